@@ -61,6 +61,7 @@
 #define CARDREADER_DB2COM 1
 #define CARDREADER_STINGER 1
 #define CARDREADER_DRECAS 1
+//#define CARDREADER_VIRTUAL 1
 
 #ifdef WITH_PCSC
 #define CARDREADER_PCSC 1
@@ -87,7 +88,7 @@
 #endif
 
 #ifdef WITH_STAPI5
-#define CARDREADER_STAPI5 1
+//#define CARDREADER_STAPI5 1
 #endif
 
 #ifdef READER_DRE
@@ -3,7 +3,7 @@
 addons="WEBIF WEBIF_LIVELOG WEBIF_JQUERY TOUCH WITH_SSL HAVE_DVBAPI READ_SDT_CHARSETS IRDETO_GUESSING CS_ANTICASC WITH_DEBUG MODULE_MONITOR WITH_LB CS_CACHEEX CW_CYCLE_CHECK LCDSUPPORT LEDSUPPORT CLOCKFIX IPV6SUPPORT"
 protocols="MODULE_CAMD33 MODULE_CAMD35 MODULE_CAMD35_TCP MODULE_NEWCAMD MODULE_CCCAM MODULE_CCCSHARE MODULE_GBOX MODULE_RADEGAST MODULE_SCAM MODULE_SERIAL MODULE_CONSTCW MODULE_PANDORA MODULE_GHTTP"
 readers="READER_NAGRA READER_IRDETO READER_CONAX READER_CRYPTOWORKS READER_SECA READER_VIACCESS READER_VIDEOGUARD READER_DRE READER_TONGFANG READER_BULCRYPT READER_GRIFFIN READER_DGCRYPT"
-card_readers="CARDREADER_PHOENIX CARDREADER_INTERNAL CARDREADER_SC8IN1 CARDREADER_MP35 CARDREADER_SMARGO CARDREADER_DB2COM CARDREADER_STAPI CARDREADER_STAPI5 CARDREADER_STINGER CARDREADER_DRECAS"
+card_readers="CARDREADER_PHOENIX CARDREADER_INTERNAL CARDREADER_SC8IN1 CARDREADER_MP35 CARDREADER_SMARGO CARDREADER_DB2COM CARDREADER_STAPI CARDREADER_STAPI5 CARDREADER_STINGER CARDREADER_DRECAS CARDREADER_VIRTUAL"
 
 defconfig="
 CONFIG_WEBIF=y
@@ -60,6 +60,7 @@ CARDREADER_DB2COM=y
 CARDREADER_STAPI=y
 # CARDREADER_STAPI5=n
 CARDREADER_STINGER=y
+# CARDREADER_VIRTUAL=n
 "
 
 usage() {
@@ -525,6 +526,7 @@ menu_card_readers() {
 		CARDREADER_STAPI5	"STAPI5"						$(check_test "CARDREADER_STAPI5") \
 		CARDREADER_STINGER	"STINGER"						$(check_test "CARDREADER_STINGER") \
 		CARDREADER_DRECAS	"DRECAS"						$(check_test "CARDREADER_DRECAS") \
+		CARDREADER_VIRTUAL	"Virtual card (benchmarking)"	$(check_test "CARDREADER_VIRTUAL") \
 	2> ${tempfile}
 
 	opt=${?}
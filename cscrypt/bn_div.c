@@ -282,7 +282,10 @@ int BN_div(BIGNUM *dv, BIGNUM *rm, const BIGNUM *num, const BIGNUM *divisor,
 				t2 -= d1;
 			}
 #else /* !BN_LLONG */
-			BN_ULONG t2l, t2h, ql, qh;
+			BN_ULONG t2l, t2h;
+#ifndef BN_UMULT_HIGH
+			BN_ULONG ql, qh;
+#endif
 
 			q = bn_div_words(n0, n1, d0);
 #ifndef REMAINDER_IS_ALREADY_CALCULATED
@@ -156,7 +156,11 @@ int BN_mod_exp(BIGNUM *r, BIGNUM *a, const BIGNUM *p, const BIGNUM *m,
 	bn_check_top(p);
 	bn_check_top(m);
 
-	ret = BN_mod_exp_simple(r, a, p, m, ctx);
+	/* Montgomery needs an odd modulus, which every RSA modulus is */
+	if(BN_is_odd(m))
+		{ ret = BN_mod_exp_mont(r, a, p, m, ctx, NULL); }
+	else
+		{ ret = BN_mod_exp_simple(r, a, p, m, ctx); }
 
 	return (ret);
 }
@@ -216,6 +216,9 @@ extern "C" {
              : "r"(a), "r"(b));     \
         ret;            })
 #  endif    /* compiler */
+# elif defined(__GNUC__) && defined(__SIZEOF_INT128__) && (defined(SIXTY_FOUR_BIT_LONG) || defined(SIXTY_FOUR_BIT))
+	/* any 64 bit target where gcc/clang provide a 128 bit type (x86_64, aarch64, ...) */
+#  define BN_UMULT_HIGH(a,b)    (BN_ULONG)(((unsigned __int128)(a) * (b)) >> 64)
 # endif     /* cpu */
 #endif      /* NO_ASM */
 
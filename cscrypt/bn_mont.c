@@ -0,0 +1,331 @@
+#include "bn.h"
+
+#ifndef WITH_LIBCRYPTO
+/* Montgomery multiplication and exponentiation with the OpenSSL BN_MONT_CTX API.
+ *
+ * Values in Montgomery form are kept as plain arrays of N.top words, so the
+ * exponentiation loop runs without BIGNUM/BN_CTX bookkeeping and without any
+ * long division. Moduli up to BN_MONT_FIXED_BITS use stack buffers, larger
+ * ones a single heap block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bn_lcl.h"
+#include "openssl_mods.h"
+
+#define TABLE_SIZE          32
+#define BN_MONT_FIXED_BITS  1024
+#define BN_MONT_FIXED_WORDS (BN_MONT_FIXED_BITS / BN_BITS2)
+
+/* r = a * b * R^-1 mod n, a, b < n. t needs nl + 2 words, r may be a or b */
+static void bn_mont_mul_words(BN_ULONG *r, BN_ULONG *a, BN_ULONG *b, BN_ULONG *n, BN_ULONG n0, int nl, BN_ULONG *t)
+{
+	BN_ULONG c, m;
+	int i;
+
+	memset(t, 0, (nl + 2) * sizeof(BN_ULONG));
+	for(i = 0; i < nl; i++)
+	{
+		c = bn_mul_add_words(t, a, nl, b[i]);
+		t[nl] = (t[nl] + c) & BN_MASK2;
+		t[nl + 1] += (t[nl] < c);
+
+		m = (t[0] * n0) & BN_MASK2;
+		c = bn_mul_add_words(t, n, nl, m);
+		t[nl] = (t[nl] + c) & BN_MASK2;
+		t[nl + 1] += (t[nl] < c);
+
+		/* t[0] is zero now, divide by the word base */
+		memmove(t, t + 1, (nl + 1) * sizeof(BN_ULONG));
+		t[nl + 1] = 0;
+	}
+
+	/* t < 2n, so one conditional subtraction is enough */
+	if(bn_sub_words(r, t, n, nl) && !t[nl])
+		{ memcpy(r, t, nl * sizeof(BN_ULONG)); }
+}
+
+static void bn_mont_load(BN_ULONG *w, const BIGNUM *a, int nl)
+{
+	memcpy(w, a->d, a->top * sizeof(BN_ULONG));
+	memset(w + a->top, 0, (nl - a->top) * sizeof(BN_ULONG));
+}
+
+static int bn_mont_store(BIGNUM *r, const BN_ULONG *w, int nl)
+{
+	if(bn_wexpand(r, nl) == NULL) { return (0); }
+	memcpy(r->d, w, nl * sizeof(BN_ULONG));
+	r->top = nl;
+	r->neg = 0;
+	bn_fix_top(r);
+	return (1);
+}
+
+void BN_MONT_CTX_init(BN_MONT_CTX *ctx)
+{
+	ctx->ri = 0;
+	BN_init(&(ctx->RR));
+	BN_init(&(ctx->N));
+	BN_init(&(ctx->Ni));
+	ctx->n0 = 0;
+	ctx->flags = 0;
+}
+
+BN_MONT_CTX *BN_MONT_CTX_new(void)
+{
+	BN_MONT_CTX *ret;
+
+	if((ret = (BN_MONT_CTX *)OPENSSL_malloc(sizeof(BN_MONT_CTX))) == NULL)
+		{ return (NULL); }
+
+	BN_MONT_CTX_init(ret);
+	ret->flags = BN_FLG_MALLOCED;
+	return (ret);
+}
+
+void BN_MONT_CTX_free(BN_MONT_CTX *mont)
+{
+	if(mont == NULL)
+		{ return; }
+
+	BN_free(&(mont->RR));
+	BN_free(&(mont->N));
+	BN_free(&(mont->Ni));
+	if(mont->flags & BN_FLG_MALLOCED)
+		{ OPENSSL_free(mont); }
+}
+
+int BN_MONT_CTX_set(BN_MONT_CTX *mont, const BIGNUM *mod, BN_CTX *ctx)
+{
+	BN_ULONG x, w;
+	int i;
+
+	/* Montgomery reduction needs an odd modulus */
+	if(BN_is_zero(mod) || !BN_is_odd(mod))
+		{ return (0); }
+
+	if(!BN_copy(&(mont->N), mod)) { return (0); }
+	mont->N.neg = 0;
+	mont->ri = mont->N.top * BN_BITS2;
+
+	/* n0 = -N^-1 mod 2^BN_BITS2, every newton step doubles the correct low bits */
+	w = mod->d[0];
+	x = 1;
+	for(i = 1; i < BN_BITS2; i <<= 1)
+		{ x = (x * (2 - w * x)) & BN_MASK2; }
+	mont->n0 = (0 - x) & BN_MASK2;
+
+	/* RR = R^2 mod N, converts values into Montgomery form */
+	BN_zero(&(mont->RR));
+	if(!BN_set_bit(&(mont->RR), mont->ri * 2)) { return (0); }
+	if(!BN_mod(&(mont->RR), &(mont->RR), &(mont->N), ctx)) { return (0); }
+
+	return (1);
+}
+
+BN_MONT_CTX *BN_MONT_CTX_copy(BN_MONT_CTX *to, BN_MONT_CTX *from)
+{
+	if(to == from) { return (to); }
+
+	if(!BN_copy(&(to->RR), &(from->RR))) { return (NULL); }
+	if(!BN_copy(&(to->N), &(from->N))) { return (NULL); }
+	if(!BN_copy(&(to->Ni), &(from->Ni))) { return (NULL); }
+	to->ri = from->ri;
+	to->n0 = from->n0;
+	return (to);
+}
+
+/* r = a * R^-1 mod N for 0 <= a < N * R */
+int BN_from_montgomery(BIGNUM *ret, BIGNUM *a, BN_MONT_CTX *mont, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	BN_ULONG *tp, c, m;
+	int i, j, nl, r = 0;
+
+	nl = mont->N.top;
+	if(a->neg || a->top > 2 * nl)
+		{ return (0); }
+
+	BN_CTX_start(ctx);
+	if((t = BN_CTX_get(ctx)) == NULL) { goto err; }
+	if(!BN_copy(t, a)) { goto err; }
+	if(bn_wexpand(t, 2 * nl + 1) == NULL) { goto err; }
+	tp = t->d;
+	for(i = t->top; i <= 2 * nl; i++)
+		{ tp[i] = 0; }
+
+	for(i = 0; i < nl; i++)
+	{
+		m = (tp[i] * mont->n0) & BN_MASK2;
+		c = bn_mul_add_words(tp + i, mont->N.d, nl, m);
+		for(j = i + nl; c && j <= 2 * nl; j++)
+		{
+			tp[j] = (tp[j] + c) & BN_MASK2;
+			c = (tp[j] < c);
+		}
+	}
+
+	if(!bn_mont_store(ret, tp + nl, nl + 1)) { goto err; }
+	if(BN_ucmp(ret, &(mont->N)) >= 0)
+	{
+		if(!BN_usub(ret, ret, &(mont->N))) { goto err; }
+	}
+	r = 1;
+err:
+	BN_CTX_end(ctx);
+	return (r);
+}
+
+/* r = a * b * R^-1 mod N for a, b < N */
+int BN_mod_mul_montgomery(BIGNUM *r, BIGNUM *a, BIGNUM *b, BN_MONT_CTX *mont, BN_CTX *ctx)
+{
+	BN_ULONG fixed[3 * BN_MONT_FIXED_WORDS + 2], *buf = fixed;
+	int nl = mont->N.top, ret;
+
+	(void)ctx;
+	if(a->top > nl || b->top > nl)
+		{ return (0); }
+	if(nl > BN_MONT_FIXED_WORDS && (buf = (BN_ULONG *)OPENSSL_malloc((3 * nl + 2) * sizeof(BN_ULONG))) == NULL)
+		{ return (0); }
+
+	bn_mont_load(buf, a, nl);
+	bn_mont_load(buf + nl, b, nl);
+	bn_mont_mul_words(buf, buf, buf + nl, mont->N.d, mont->n0, nl, buf + 2 * nl);
+	ret = bn_mont_store(r, buf, nl);
+
+	if(buf != fixed)
+		{ OPENSSL_free(buf); }
+	return (ret);
+}
+
+/* Sliding window exponentiation like BN_mod_exp_simple(), but every step is a
+ * Montgomery multiplication on plain word arrays. */
+int BN_mod_exp_mont(BIGNUM *rr, BIGNUM *a, const BIGNUM *p, const BIGNUM *m, BN_CTX *ctx, BN_MONT_CTX *in_mont)
+{
+	BN_ULONG fixed[(TABLE_SIZE + 4) * BN_MONT_FIXED_WORDS + 2], *buf = fixed;
+	BN_ULONG *val, *r, *d, *one, *t, *n;
+	BN_MONT_CTX *mont = NULL;
+	BIGNUM *aa;
+	int i, j, nl, bits, ret = 0, wstart, wend, window, wvalue, ts;
+	int start = 1;
+
+	bn_check_top(a);
+	bn_check_top(p);
+	bn_check_top(m);
+
+	if(!BN_is_odd(m))
+		{ return (0); }
+
+	bits = BN_num_bits(p);
+	if(bits == 0)
+		{ return (BN_one(rr)); }
+
+	BN_CTX_start(ctx);
+	if((aa = BN_CTX_get(ctx)) == NULL) { goto err; }
+
+	if(in_mont != NULL)
+		{ mont = in_mont; }
+	else
+	{
+		if((mont = BN_MONT_CTX_new()) == NULL) { goto err; }
+		if(!BN_MONT_CTX_set(mont, m, ctx)) { goto err; }
+	}
+
+	if(a->neg || BN_ucmp(a, m) >= 0)
+	{
+		if(!BN_mod(aa, a, m, ctx)) { goto err; }
+		if(aa->neg && !BN_add(aa, aa, m)) { goto err; }
+	}
+	else if(!BN_copy(aa, a)) { goto err; }
+
+	if(BN_is_zero(aa))
+	{
+		ret = BN_zero(rr);
+		goto err;
+	}
+
+	window = BN_window_bits_for_exponent_size(bits);
+	ts = 1 << (window - 1);
+
+	nl = mont->N.top;
+	if(nl > BN_MONT_FIXED_WORDS && (buf = (BN_ULONG *)OPENSSL_malloc(((ts + 4) * nl + 2) * sizeof(BN_ULONG))) == NULL)
+		{ goto err; }
+	val = buf;
+	r = val + ts * nl;
+	d = r + nl;
+	one = d + nl;
+	t = one + nl;
+	n = mont->N.d;
+
+	/* val[i] = a^(2i+1) in Montgomery form */
+	bn_mont_load(d, &(mont->RR), nl);
+	bn_mont_load(val, aa, nl);
+	bn_mont_mul_words(val, val, d, n, mont->n0, nl, t);                   /* 1 */
+	if(window > 1)
+	{
+		bn_mont_mul_words(d, val, val, n, mont->n0, nl, t);               /* 2 */
+		for(i = 1; i < ts; i++)
+			{ bn_mont_mul_words(val + i * nl, val + (i - 1) * nl, d, n, mont->n0, nl, t); }
+	}
+
+	wvalue = 0;
+	wstart = bits - 1;
+	wend = 0;
+
+	for(;;)
+	{
+		if(BN_is_bit_set(p, wstart) == 0)
+		{
+			if(!start)
+				{ bn_mont_mul_words(r, r, r, n, mont->n0, nl, t); }
+			if(wstart == 0) { break; }
+			wstart--;
+			continue;
+		}
+
+		wvalue = 1;
+		wend = 0;
+		for(i = 1; i < window; i++)
+		{
+			if(wstart - i < 0) { break; }
+			if(BN_is_bit_set(p, wstart - i))
+			{
+				wvalue <<= (i - wend);
+				wvalue |= 1;
+				wend = i;
+			}
+		}
+
+		j = wend + 1;
+		if(start)
+			{ memcpy(r, val + (wvalue >> 1) * nl, nl * sizeof(BN_ULONG)); }
+		else
+		{
+			for(i = 0; i < j; i++)
+				{ bn_mont_mul_words(r, r, r, n, mont->n0, nl, t); }
+			bn_mont_mul_words(r, r, val + (wvalue >> 1) * nl, n, mont->n0, nl, t);
+		}
+
+		wstart -= wend + 1;
+		start = 0;
+		if(wstart < 0) { break; }
+	}
+
+	/* back from Montgomery form */
+	memset(one, 0, nl * sizeof(BN_ULONG));
+	one[0] = 1;
+	bn_mont_mul_words(r, r, one, n, mont->n0, nl, t);
+	ret = bn_mont_store(rr, r, nl);
+
+err:
+	if(in_mont == NULL && mont != NULL)
+		{ BN_MONT_CTX_free(mont); }
+	if(buf != fixed)
+		{ OPENSSL_free(buf); }
+	BN_CTX_end(ctx);
+	return (ret);
+}
+
+#endif
@@ -14,5 +14,6 @@ extern const struct s_cardreader cardreader_smartreader;
 extern const struct s_cardreader cardreader_stapi;
 extern const struct s_cardreader cardreader_stinger;
 extern const struct s_cardreader cardreader_drecas;
+extern const struct s_cardreader cardreader_virtual;
 
 #endif
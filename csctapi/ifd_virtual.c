@@ -0,0 +1,534 @@
+/*
+        ifd_virtual.c
+        This module provides an emulated card for benchmarking the local card
+        path (reader, cardsystem, icc_async and the T0/T1 protocol layer)
+        without hardware.
+
+        The device is a script file:
+
+            # card answer to reset
+            atr      = 3B 24 00 30 42 30 30
+            # line speed in bps, 0 = no line delay, default is the negotiated speed
+            baudrate = 115200
+            # ms the card works on every command
+            latency  = 20
+            # apdu = <command prefix> : <answer data and status word> [: <latency ms>]
+            apdu     = DD 26 : 98 0C
+            apdu     = DD CA 00 00 0C : 20 01 40 28 02 0B 00 ... 90 00
+            apdu     = *  : 6D 00
+
+        Every command is answered by the entry with the longest matching prefix,
+        "*" matches everything. Commands without an entry get 6D 00.
+
+        T0: a header answered with data is sent back as outgoing command, the
+        data is cut or zero padded to P3. Any other command with P3 > 0 is
+        incoming, its data is read before it is matched. An incoming command
+        answered with data gets 61 xx and the data is fetched by GET RESPONSE.
+        T1: chained I-blocks, R-blocks and S(IFS, RESYNCH) requests are handled,
+        answers larger than the IFSD are chained.
+*/
+
+#include "../globals.h"
+
+#ifdef CARDREADER_VIRTUAL
+#include "../oscam-string.h"
+#include "../oscam-time.h"
+#include "atr.h"
+#include "icc_async.h"
+
+#define OK 0
+#define ERROR 1
+
+#define VIRTUAL_MAX_APDU    512     // bytes of a command or an answer
+#define VIRTUAL_MAX_LINE    2048    // chars of a script line
+#define VIRTUAL_IFSD        254     // bytes per T1 block sent by the card
+#define VIRTUAL_BYTE_ETU    12      // start, 8 data, parity and 2 guard bits
+
+#define VIRTUAL_T0_IDLE     0
+#define VIRTUAL_T0_DATA     1       // incoming command, waiting for the data
+
+struct s_virtual_entry
+{
+	struct s_virtual_entry  *next;
+	uint8_t                 *cmd;
+	uint8_t                 *rsp;
+	uint16_t                cmd_len;    // 0 matches every command
+	uint16_t                rsp_len;
+	int32_t                 latency;    // ms, -1 = script default
+};
+
+struct virtual_data
+{
+	struct s_virtual_entry  *entries;
+	uint8_t                 atr[ATR_MAX_SIZE];
+	uint32_t                atr_len;
+	int32_t                 baudrate;       // -1 = negotiated
+	uint32_t                cur_baudrate;   // set by InitCard
+	uint32_t                latency;        // ms
+	uint64_t                line_us;        // time the line is busy until
+	// bytes sent by the card
+	uint8_t                 out[VIRTUAL_MAX_APDU + 8];
+	uint32_t                out_len;
+	uint32_t                out_pos;
+	// command being received
+	uint8_t                 cmd[VIRTUAL_MAX_APDU];
+	uint32_t                cmd_len;
+	uint32_t                cmd_need;
+	int8_t                  t0_state;
+	// T0 GET RESPONSE data, T1 answer being chained
+	uint8_t                 rsp[VIRTUAL_MAX_APDU];
+	uint32_t                rsp_len;
+	uint32_t                rsp_pos;
+	uint8_t                 ns;             // T1 send sequence of the card
+	int8_t                  pps;            // nothing sent since the reset, a PPS request may come
+	uint32_t                commands;
+	uint32_t                unknown;
+};
+
+static uint64_t virtual_now(void)
+{
+	struct timeb tb;
+	cs_ftimeus(&tb);
+	return (uint64_t)tb.time * 1000000 + tb.millitm;
+}
+
+// Moves the line clock by the time size bytes need on the wire plus extra_us
+static void virtual_line(struct virtual_data *vd, uint32_t size, uint32_t extra_us)
+{
+	uint32_t baudrate = vd->baudrate >= 0 ? (uint32_t)vd->baudrate : vd->cur_baudrate;
+	uint64_t now = virtual_now();
+
+	if(vd->line_us < now)
+		{ vd->line_us = now; }
+	vd->line_us += extra_us;
+	if(baudrate)
+		{ vd->line_us += (uint64_t)size * VIRTUAL_BYTE_ETU * 1000000 / baudrate; }
+}
+
+static int32_t virtual_hex(const char *s, uint8_t *buf, uint32_t max)
+{
+	uint32_t len = 0;
+	int32_t hi, lo;
+
+	while(*s)
+	{
+		if(isspace((uint8_t)*s))
+		{
+			s++;
+			continue;
+		}
+		if((hi = gethexval(s[0])) < 0 || (lo = gethexval(s[1])) < 0 || len >= max)
+			{ return -1; }
+		buf[len++] = (hi << 4) | lo;
+		s += 2;
+	}
+	return len;
+}
+
+static void virtual_free_entries(struct virtual_data *vd)
+{
+	struct s_virtual_entry *e;
+
+	while((e = vd->entries))
+	{
+		vd->entries = e->next;
+		NULLFREE(e);
+	}
+}
+
+static int32_t virtual_add_entry(struct virtual_data *vd, struct s_virtual_entry **last, char *value)
+{
+	uint8_t cmd[VIRTUAL_MAX_APDU], rsp[VIRTUAL_MAX_APDU];
+	struct s_virtual_entry *e;
+	char *saveptr = NULL, *c, *r, *l;
+	int32_t cmd_len, rsp_len;
+
+	c = strtok_r(value, ":", &saveptr);
+	r = strtok_r(NULL, ":", &saveptr);
+	l = strtok_r(NULL, ":", &saveptr);
+	if(!c || !r)
+		{ return ERROR; }
+	c = trim(c);
+	cmd_len = streq(c, "*") ? 0 : virtual_hex(c, cmd, sizeof(cmd));
+	rsp_len = virtual_hex(r, rsp, sizeof(rsp));
+	if(cmd_len < 0 || rsp_len < 2)
+		{ return ERROR; }
+
+	if(!cs_malloc(&e, sizeof(struct s_virtual_entry) + cmd_len + rsp_len))
+		{ return ERROR; }
+	e->cmd = (uint8_t *)(e + 1);
+	e->rsp = e->cmd + cmd_len;
+	memcpy(e->cmd, cmd, cmd_len);
+	memcpy(e->rsp, rsp, rsp_len);
+	e->cmd_len = cmd_len;
+	e->rsp_len = rsp_len;
+	e->latency = l ? strtol(l, NULL, 10) : -1;
+	if(*last)
+		{ (*last)->next = e; }
+	else
+		{ vd->entries = e; }
+	*last = e;
+	return OK;
+}
+
+static int32_t virtual_load(struct s_reader *reader, struct virtual_data *vd)
+{
+	struct s_virtual_entry *last = NULL;
+	char line[VIRTUAL_MAX_LINE], *key, *value, *p;
+	int32_t lineno = 0, count = 0, len;
+	FILE *fp;
+
+	if(!(fp = fopen(reader->device, "r")))
+	{
+		rdr_log(reader, "ERROR: Cannot open card script %s (errno=%d %s)", reader->device, errno, strerror(errno));
+		return ERROR;
+	}
+	vd->baudrate = -1;
+	while(fgets(line, sizeof(line), fp))
+	{
+		lineno++;
+		if((p = strchr(line, '#')))
+			{ *p = '\0'; }
+		if(!(value = strchr(line, '=')))
+			{ continue; }
+		*value++ = '\0';
+		key = trim(line);
+		value = trim(value);
+		if(streq(key, "atr"))
+		{
+			len = virtual_hex(value, vd->atr, sizeof(vd->atr));
+			vd->atr_len = len > 0 ? len : 0;
+		}
+		else if(streq(key, "baudrate"))
+			{ vd->baudrate = strtol(value, NULL, 10); }
+		else if(streq(key, "latency"))
+			{ vd->latency = strtoul(value, NULL, 10); }
+		else if(streq(key, "apdu") && virtual_add_entry(vd, &last, value) == OK)
+			{ count++; }
+		else
+			{ rdr_log(reader, "WARNING: Ignoring line %d of card script %s", lineno, reader->device); }
+	}
+	fclose(fp);
+
+	if(!vd->atr_len)
+	{
+		rdr_log(reader, "ERROR: Card script %s has no atr", reader->device);
+		return ERROR;
+	}
+	rdr_log_dbg(reader, D_IFD, "Card script %s: %d apdus, baudrate %d, latency %u ms", reader->device, count, vd->baudrate, vd->latency);
+	return OK;
+}
+
+static struct s_virtual_entry *virtual_find(struct virtual_data *vd, const uint8_t *cmd, uint32_t cmd_len)
+{
+	struct s_virtual_entry *e, *found = NULL;
+
+	for(e = vd->entries; e; e = e->next)
+	{
+		if(e->cmd_len <= cmd_len && (!found || e->cmd_len > found->cmd_len) && !memcmp(e->cmd, cmd, e->cmd_len))
+			{ found = e; }
+	}
+	return found;
+}
+
+// Looks up the answer of a complete command and lets the card work on it
+static struct s_virtual_entry *virtual_answer(struct virtual_data *vd, const uint8_t *cmd, uint32_t cmd_len)
+{
+	struct s_virtual_entry *e = virtual_find(vd, cmd, cmd_len);
+
+	vd->commands++;
+	if(!e)
+		{ vd->unknown++; }
+	virtual_line(vd, 0, (e && e->latency >= 0 ? (uint32_t)e->latency : vd->latency) * 1000);
+	return e;
+}
+
+static void virtual_send(struct virtual_data *vd, const uint8_t *data, uint32_t len)
+{
+	if(vd->out_pos == vd->out_len)
+		{ vd->out_pos = vd->out_len = 0; }
+	len = MIN(len, sizeof(vd->out) - vd->out_len);
+	memcpy(vd->out + vd->out_len, data, len);
+	vd->out_len += len;
+}
+
+static void virtual_send_sw(struct virtual_data *vd, struct s_virtual_entry *e)
+{
+	static const uint8_t sw_unknown[] = { 0x6D, 0x00 };
+	virtual_send(vd, e ? e->rsp + e->rsp_len - 2 : sw_unknown, 2);
+}
+
+// Outgoing T0 command: procedure byte, le bytes of data and the status word
+static void virtual_t0_outgoing(struct virtual_data *vd, const uint8_t *data, uint32_t len, const uint8_t *sw)
+{
+	uint8_t buf[256];
+	uint32_t le = vd->cmd[4] ? vd->cmd[4] : 256;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, data, MIN(len, le));
+	virtual_send(vd, &vd->cmd[1], 1);
+	virtual_send(vd, buf, le);
+	virtual_send(vd, sw, 2);
+}
+
+static void virtual_t0_command(struct virtual_data *vd)
+{
+	static const uint8_t sw_ok[] = { 0x90, 0x00 };
+	struct s_virtual_entry *e;
+	uint8_t sw[2];
+
+	if(vd->t0_state == VIRTUAL_T0_IDLE)
+	{
+		// GET RESPONSE of a previous incoming command
+		if(vd->cmd[1] == 0xC0 && vd->rsp_len)
+		{
+			virtual_answer(vd, vd->cmd, 5);
+			virtual_t0_outgoing(vd, vd->rsp, vd->rsp_len, sw_ok);
+			vd->rsp_len = 0;
+			return;
+		}
+		vd->rsp_len = 0;
+		e = virtual_find(vd, vd->cmd, 5);
+		if(e && e->cmd_len <= 5 && e->rsp_len > 2)
+		{
+			e = virtual_answer(vd, vd->cmd, 5);
+			virtual_t0_outgoing(vd, e->rsp, e->rsp_len - 2, e->rsp + e->rsp_len - 2);
+			return;
+		}
+		if(vd->cmd[4])
+		{
+			vd->t0_state = VIRTUAL_T0_DATA;
+			vd->cmd_need = 5 + vd->cmd[4];
+			virtual_send(vd, &vd->cmd[1], 1);
+			return;
+		}
+	}
+
+	vd->t0_state = VIRTUAL_T0_IDLE;
+	e = virtual_answer(vd, vd->cmd, vd->cmd_len);
+	if(e && e->rsp_len > 2)
+	{
+		vd->rsp_len = e->rsp_len - 2;
+		memcpy(vd->rsp, e->rsp, vd->rsp_len);
+		sw[0] = 0x61;
+		sw[1] = vd->rsp_len & 0xFF;
+		virtual_send(vd, sw, 2);
+	}
+	else
+		{ virtual_send_sw(vd, e); }
+}
+
+static void virtual_t0_transmit(struct virtual_data *vd, const uint8_t *buf, uint32_t size)
+{
+	uint32_t i;
+
+	for(i = 0; i < size; i++)
+	{
+		if(vd->t0_state == VIRTUAL_T0_IDLE && vd->cmd_len >= 5)
+			{ vd->cmd_len = 0; }
+		if(vd->cmd_len < sizeof(vd->cmd))
+			{ vd->cmd[vd->cmd_len++] = buf[i]; }
+		if((vd->t0_state == VIRTUAL_T0_IDLE && vd->cmd_len == 5)
+				|| (vd->t0_state == VIRTUAL_T0_DATA && vd->cmd_len == vd->cmd_need))
+			{ virtual_t0_command(vd); }
+	}
+}
+
+static void virtual_t1_block(struct virtual_data *vd, uint8_t pcb, const uint8_t *inf, uint32_t len)
+{
+	uint8_t block[VIRTUAL_IFSD + 4];
+	uint32_t i;
+
+	block[0] = 0x00;
+	block[1] = pcb;
+	block[2] = len;
+	memcpy(block + 3, inf, len);
+	block[len + 3] = 0;
+	for(i = 0; i < len + 3; i++)
+		{ block[len + 3] ^= block[i]; }
+	virtual_send(vd, block, len + 4);
+}
+
+// Sends the next I-block of the answer
+static void virtual_t1_answer(struct virtual_data *vd)
+{
+	uint32_t len = MIN(vd->rsp_len - vd->rsp_pos, VIRTUAL_IFSD);
+	int8_t more = vd->rsp_pos + len < vd->rsp_len;
+
+	virtual_t1_block(vd, (vd->ns << 6) | (more ? 0x20 : 0), vd->rsp + vd->rsp_pos, len);
+	vd->ns ^= 1;
+	vd->rsp_pos += len;
+}
+
+static void virtual_t1_transmit(struct virtual_data *vd, const uint8_t *buf, uint32_t size)
+{
+	struct s_virtual_entry *e;
+	uint8_t pcb, lrc = 0;
+	uint32_t i, len;
+
+	if(size < 4 || size != (uint32_t)buf[2] + 4)
+		{ return; }
+	for(i = 0; i < size; i++)
+		{ lrc ^= buf[i]; }
+	pcb = buf[1];
+	len = buf[2];
+	if(lrc)
+	{
+		virtual_t1_block(vd, 0x81, NULL, 0);
+		return;
+	}
+
+	if(!(pcb & 0x80)) // I-block
+	{
+		len = MIN(len, sizeof(vd->cmd) - vd->cmd_len);
+		memcpy(vd->cmd + vd->cmd_len, buf + 3, len);
+		vd->cmd_len += len;
+		if(pcb & 0x20)
+		{
+			virtual_t1_block(vd, 0x80 | ((pcb & 0x40) ? 0 : 0x10), NULL, 0);
+			return;
+		}
+		e = virtual_answer(vd, vd->cmd, vd->cmd_len);
+		vd->cmd_len = 0;
+		if(e)
+		{
+			memcpy(vd->rsp, e->rsp, e->rsp_len);
+			vd->rsp_len = e->rsp_len;
+		}
+		else
+		{
+			vd->rsp[0] = 0x6D;
+			vd->rsp[1] = 0x00;
+			vd->rsp_len = 2;
+		}
+		vd->rsp_pos = 0;
+		virtual_t1_answer(vd);
+	}
+	else if(!(pcb & 0x40)) // R-block, next part of a chained answer
+	{
+		if(vd->rsp_pos < vd->rsp_len)
+			{ virtual_t1_answer(vd); }
+	}
+	else // S-block request, answered with the same information field
+	{
+		if((pcb & 0x1F) == 0x00)
+		{
+			vd->ns = 0;
+			vd->cmd_len = 0;
+		}
+		virtual_t1_block(vd, pcb | 0x20, buf + 3, len);
+	}
+}
+
+static int32_t Virtual_Init(struct s_reader *reader)
+{
+	struct virtual_data *vd;
+
+	if(!cs_malloc(&reader->crdr_data, sizeof(struct virtual_data)))
+		{ return ERROR; }
+	vd = reader->crdr_data;
+	vd->cur_baudrate = DEFAULT_BAUDRATE;
+	if(virtual_load(reader, vd) != OK)
+	{
+		virtual_free_entries(vd);
+		return ERROR;
+	}
+	return OK;
+}
+
+static int32_t Virtual_GetStatus(struct s_reader *UNUSED(reader), int32_t *status)
+{
+	*status = 1;
+	return OK;
+}
+
+static int32_t Virtual_Activate(struct s_reader *reader, ATR *atr)
+{
+	struct virtual_data *vd = reader->crdr_data;
+
+	rdr_log_dbg(reader, D_IFD, "Resetting virtual card");
+	vd->cur_baudrate = DEFAULT_BAUDRATE;
+	vd->out_len = vd->out_pos = 0;
+	vd->cmd_len = vd->rsp_len = vd->rsp_pos = 0;
+	vd->t0_state = VIRTUAL_T0_IDLE;
+	vd->ns = 0;
+	vd->pps = 1;
+	virtual_line(vd, vd->atr_len, 0);
+	return ATR_InitFromArray(atr, vd->atr, vd->atr_len) == ATR_OK ? OK : ERROR;
+}
+
+static int32_t Virtual_Transmit(struct s_reader *reader, unsigned char *buffer, uint32_t size, uint32_t UNUSED(expectedlen), uint32_t UNUSED(delay), uint32_t UNUSED(timeout))
+{
+	struct virtual_data *vd = reader->crdr_data;
+
+	virtual_line(vd, size, 0);
+	if(vd->pps && buffer[0] == 0xFF && size >= 3)
+	{
+		virtual_send(vd, buffer, size); // PPS request, confirmed unchanged
+		return OK;
+	}
+	vd->pps = 0;
+	if(reader->protocol_type == ATR_PROTOCOL_TYPE_T1)
+		{ virtual_t1_transmit(vd, buffer, size); }
+	else if(reader->protocol_type == ATR_PROTOCOL_TYPE_T0)
+		{ virtual_t0_transmit(vd, buffer, size); }
+	else
+	{
+		rdr_log(reader, "ERROR: Virtual card does not support T%d", reader->protocol_type);
+		return ERROR;
+	}
+	return OK;
+}
+
+static int32_t Virtual_Receive(struct s_reader *reader, unsigned char *buffer, uint32_t size, uint32_t UNUSED(delay), uint32_t UNUSED(timeout))
+{
+	struct virtual_data *vd = reader->crdr_data;
+	uint64_t now;
+
+	if(vd->out_len - vd->out_pos < size)
+	{
+		rdr_log_dbg(reader, D_IFD, "Virtual card sent %u of %u bytes", vd->out_len - vd->out_pos, size);
+		vd->out_pos = vd->out_len;
+		return ERROR;
+	}
+	memcpy(buffer, vd->out + vd->out_pos, size);
+	vd->out_pos += size;
+
+	virtual_line(vd, size, 0);
+	if((now = virtual_now()) < vd->line_us)
+		{ cs_sleepus(vd->line_us - now); }
+	return OK;
+}
+
+static int32_t Virtual_SetBaudrate(struct s_reader *reader, uint32_t baudrate)
+{
+	struct virtual_data *vd = reader->crdr_data;
+	vd->cur_baudrate = baudrate;
+	return OK;
+}
+
+static int32_t Virtual_Close(struct s_reader *reader)
+{
+	struct virtual_data *vd = reader->crdr_data;
+
+	if(!vd)
+		{ return OK; }
+	rdr_log_dbg(reader, D_IFD, "Virtual card answered %u commands, %u unknown", vd->commands, vd->unknown);
+	virtual_free_entries(vd);
+	return OK;
+}
+
+const struct s_cardreader cardreader_virtual =
+{
+	.desc          = "virtual",
+	.typ           = R_VIRTUAL,
+	.reader_init   = Virtual_Init,
+	.get_status    = Virtual_GetStatus,
+	.activate      = Virtual_Activate,
+	.transmit      = Virtual_Transmit,
+	.receive       = Virtual_Receive,
+	.close         = Virtual_Close,
+	.set_baudrate  = Virtual_SetBaudrate,
+};
+
+#endif
@@ -399,6 +399,11 @@ typedef unsigned char uchar;
 #define MAX_EMM_SIZE 512
 #endif
 
+// ECM payloads are trimmed to MAX(ecmlen, ECM_PAYLOAD_MIN) + ECM_PAYLOAD_SLACK,
+// the slack covers the 10 byte header added by betatunnel conversion
+#define ECM_PAYLOAD_MIN   32
+#define ECM_PAYLOAD_SLACK 16
+
 #define CS_EMMCACHESIZE  512 //nr of EMMs that each reader will cache
 #define MSGLOGSIZE 64   //size of string buffer for a ecm to return messages
 
@@ -431,6 +436,7 @@ typedef unsigned char uchar;
 #define R_SMART     0x7 // Smartreader+
 #define R_PCSC      0x8 // PCSC
 #define R_DRECAS    0x9 // Reader DRECAS
+#define R_VIRTUAL   0xA // Emulated card from a script, for benchmarking
 /////////////////// proxy readers after R_CS378X
 #define R_CAMD35    0x20  // Reader cascading camd 3.5x
 #define R_CAMD33    0x21  // Reader cascading camd 3.3x
@@ -977,7 +983,6 @@ struct s_cardsystem
 	int32_t (*card_info)(struct s_reader *);
 	void	(*poll_status)(struct s_reader *);
 	int32_t (*do_ecm)(struct s_reader *, const struct ecm_request_t *, struct s_ecm_answer *);
-	int32_t (*do_emm_reassembly)(struct s_reader *, struct s_client *, struct emm_packet_t *);     // Returns 1/true if the EMM is ready to be written in the card
 	int32_t (*do_emm)(struct s_reader *, struct emm_packet_t *);
 	void (*post_process)(struct s_reader *);
 	int32_t (*get_emm_type)(struct emm_packet_t *, struct s_reader *);
@@ -1001,47 +1006,74 @@ typedef struct cw_extendted_t
 } EXTENDED_CW;
 #endif
 
+// ECM trace stages of a request, offsets in us from trace_start (0 = not reached)
+#define ECM_TRACE_CACHE     0   // check_cache() done
+#define ECM_TRACE_REQUEST   1   // first request_cw_from_readers()
+#define ECM_TRACE_ANSWER    2   // first chk_dcw()
+#define ECM_TRACE_SEND      3   // send_dcw()
+#define ECM_TRACE_STAGES    4
+// ECM trace stages of a reader answer
+#define EA_TRACE_QUEUED     0   // job added to the reader
+#define EA_TRACE_DEQUEUED   1   // job picked up by the reader thread
+#define EA_TRACE_SENT       2   // forwarded to the card or the proxy
+#define EA_TRACE_ANSWERED   3   // write_ecm_answer()
+#define EA_TRACE_STAGES     4
+
 typedef struct ecm_request_t
 {
-	uchar           ecm[MAX_ECM_SIZE];
-	uchar           cw[16];
-	EXTENDED_CW     cw_ex;
+	// hot part, read by the ecmcwcache and pending table scans, keep it in front
+	struct ecm_request_t    *next;
+	struct s_client *client;            //contains pointer to 'c' client while running in 'r' client
 	uchar           ecmd5[CS_ECMSTORESIZE];
-	int16_t         ecmlen;
+	uint32_t        csp_hash; 					// csp has its own hash
 	uint16_t        caid;
 	uint16_t        ocaid;              //original caid, used for betatunneling
 	uint16_t        srvid;
+	uint16_t        chid;
+	uint32_t        prid;
+	int16_t         ecmlen;
+	int8_t          rc;
+	uint8_t         rcEx;
+	uint8_t         stage;              // processing stage in server module
+	int8_t          readers_timeout_check;  // set to 1 after ctimeout occurs and readers not answered are checked
+	uint8_t         from_csp;                   // =1 if er from csp cache
+	uint8_t         from_cacheex;               // =1 if er from cacheex client pushing cache
+	uint64_t        grp;
+	struct timeb    tps;                // incoming time stamp
+	uchar           *ecm;               // counted payload, see ecm_payload_alloc()
+	struct s_ecm_answer *matching_rdr;      //list of matching readers
+#ifdef CS_CACHEEX
+	uint32_t        cacheex_wait_time;          // cacheex wait time in ms
+	uint16_t        cacheex_mode1_delay;        // cacheex mode 1 delay
+	uint8_t         cacheex_wait_time_expired;  // =1 if cacheex wait_time expires
+#endif
+	uint16_t            cacheex_reader_count;       // count of selected cacheex mode-1 readers
+
+	// cold part
+	uchar           cw[16];
+	EXTENDED_CW     cw_ex;
 	uint16_t        onid;
 	uint16_t        tsid;
 	uint16_t        pmtpid;
 	uint32_t        ens;                // enigma namespace
 	uint32_t        vpid;               // videopid
-	uint16_t        chid;
 	uint16_t        pid;
 	uint16_t        idx;
-	uint32_t        prid;
 	struct s_reader *selected_reader;
-	struct s_ecm_answer *matching_rdr;      //list of matching readers
 	const struct s_reader   *fallback;      //fallback is the first fallback reader in the list matching_rdr
-	struct s_client *client;            //contains pointer to 'c' client while running in 'r' client
-	uint64_t        grp;
 	int32_t         msgid;              // client pending table index
-	uint8_t         stage;              // processing stage in server module
-	int8_t          rc;
-	uint8_t         rcEx;
-	struct timeb    tps;                // incoming time stamp
+	struct timespec trace_start;        // zero if ecmtrace is disabled
+	uint32_t        trace[ECM_TRACE_STAGES];
 	int8_t          btun;               // mark er as betatunneled
 	uint16_t            reader_avail;               // count of available readers for ecm
 	uint16_t            readers;                    // count of available used readers for ecm
 	uint16_t            reader_requested;           // count of real requested readers
 	uint16_t            localreader_count;          // count of selected local readers
-	uint16_t            cacheex_reader_count;       // count of selected cacheex mode-1 readers
 	uint16_t            fallback_reader_count;      // count of selected fb readers
 	uint16_t            reader_count;               // count of selected not fb readers
 	int8_t          preferlocalcards;
 	int8_t          checked;                //for doublecheck
 	uchar           cw_checked[16];     //for doublecheck
-	int8_t          readers_timeout_check;  // set to 1 after ctimeout occurs and readers not answered are checked
 	struct s_reader     *origin_reader;
 
 #if defined MODULE_CCCAM
@@ -1056,22 +1088,16 @@ typedef struct ecm_request_t
 #endif
 
 	void            *src_data;
-	uint32_t        csp_hash; 					// csp has its own hash
 
 	struct s_client *cacheex_src;               // Cacheex origin
 #ifdef CS_CACHEEX
 	int8_t          cacheex_pushed;             // to avoid duplicate pushs
 	uint8_t         csp_answered;               // =1 if er get answer by csp
 	LLIST           *csp_lastnodes;             // last 10 Cacheex nodes atm cc-proto-only
-	uint32_t        cacheex_wait_time;          // cacheex wait time in ms
-	uint8_t         cacheex_wait_time_expired;  // =1 if cacheex wait_time expires
-	uint16_t        cacheex_mode1_delay;        // cacheex mode 1 delay
 	uint8_t         cacheex_hitcache;           // =1 if wait_time due hitcache
 	void            *cw_cache;					//pointer to cw stored in cache
 #endif
 	uint32_t        cw_count;
-	uint8_t         from_csp;                   // =1 if er from csp cache
-	uint8_t         from_cacheex;               // =1 if er from cacheex client pushing cache
 	uint8_t         from_cacheex1_client;       // =1 if er from cacheex-1 client
 	char            msglog[MSGLOGSIZE];
 	uint8_t			cwc_cycletime;
@@ -1083,7 +1109,6 @@ typedef struct ecm_request_t
 	char			dev_name[20];
 #endif
 	struct ecm_request_t    *parent;
-	struct ecm_request_t    *next;
 #ifdef HAVE_DVBAPI
 	uint8_t		adapter_index;
 #endif
@@ -1102,6 +1127,7 @@ struct s_ecm_answer
 	char            msglog[MSGLOGSIZE];
 	struct timeb    time_request_sent;  //using for evaluate ecm_time
 	int32_t         ecm_time;
+	uint32_t        trace[EA_TRACE_STAGES];
 	uint16_t        tier; //only filled by local videoguard reader atm
 #ifdef WITH_LB
 	int32_t     value;
@@ -1124,6 +1150,9 @@ struct s_acasc
 {
 	uint16_t        stat[10];
 	uchar           idx;            // current active index in stat[]
+	uchar           exceeds;        // samples in stat[] above limit, kept up to date by ac_set_sample()
+	uchar           samples;        // cfg.ac_samples exceeds was counted for
+	uint16_t        limit;          // ac_limit exceeds was counted for
 };
 
 struct s_cwresponse
@@ -1148,6 +1177,9 @@ typedef struct sidtabs
 	SIDTABBITS      no;         // negative services
 } SIDTABS;
 
+#define ZAPLIST_SIZE    15
+#define ZAPLIST_BUCKETS 16
+
 struct s_zap_list
 {
 	uint16_t	caid;
@@ -1156,14 +1188,28 @@ struct s_zap_list
 	uint16_t	sid;
 	int8_t		request_stage;
 	time_t		lasttime;
+	int8_t		hash_next;		// slot + 1 of the next entry in the same bucket, 0 ends the chain
+	int8_t		newer;			// slot + 1 of the neighbours in the recency list
+	int8_t		older;
 };
 
-// EMM reassemply
-struct emm_rass
+struct s_zaplist
 {
-	int16_t         emmlen;
-	int32_t			provid;
-	uint8_t         emm[MAX_EMM_SIZE];
+	struct s_zap_list	entry[ZAPLIST_SIZE];
+	int8_t		bucket[ZAPLIST_BUCKETS];	// slot + 1 of the newest entry hashed there
+	int8_t		newest;			// slot + 1, ends of the recency list
+	int8_t		oldest;
+	int8_t		used;			// slots taken so far, the others were never used
+	time_t		clock_back;		// newest time seen before the clock went back
+};
+
+// Scheduling classes of the reader jobs, see job_get_class() in oscam-work.c
+enum job_class
+{
+	JOB_CLASS_ECM = 0,                              // ecm requests, reader control and all client jobs
+	JOB_CLASS_EMM,
+	JOB_CLASS_HOUSEKEEPING,
+	JOB_CLASSES
 };
 
 struct s_client
@@ -1175,6 +1221,9 @@ struct s_client
 	int8_t          kill;
 	int8_t          kill_started;
 	LLIST           *joblist;
+	int32_t         job_queued[JOB_CLASSES];    // jobs waiting in joblist, protected by thread_lock
+	struct timeb    job_emm_next;       // deferred emms may not run before
+	struct timeb    job_ecm_last;       // last ecm job, the emm budget applies only while ecms come in
 	IN_ADDR_T       ip;
 	in_port_t       port;
 	time_t          login;      // connection
@@ -1195,8 +1244,6 @@ struct s_client
 	int8_t          dup;
 	LLIST           *aureader_list;
 	int8_t          autoau;
-	LLIST           *ra_buf;         // EMM reassembly buffer for viaccess
-	struct emm_rass *cw_rass;          // EMM reassembly buffer for cryptoworks
 	int8_t          monlvl;
 	CAIDTAB         ctab;
 	TUNTAB          ttab;
@@ -1247,7 +1294,7 @@ struct s_client
 	uint8_t         cacheex_needfilter; // flag for cachex mode 3 used with camd35
 #endif
 #ifdef CS_ANTICASC
-	struct s_zap_list	client_zap_list[15]; //15 last zappings from client used for ACoSC
+	struct s_zaplist	client_zaplist; // last zappings from client used for ACoSC
 #endif
 #ifdef WEBIF
 	struct s_cwresponse cwlastresptimes[CS_ECM_RINGBUFFER_MAX]; //ringbuffer for last 20 times
@@ -1294,6 +1341,7 @@ struct s_client
 	struct s_reader *reader;                        // points to s_reader when cl->typ='r'
 
 	ECM_REQUEST *ecmtask;
+	struct s_ecmtask_index *ecmtask_index;       // lookups into ecmtask, see casc_ecmtask_alloc()
 
 	pthread_t       thread;
 
@@ -1385,7 +1433,7 @@ struct ecmrl
 	int32_t         ratelimittime;
 	int32_t         srvidholdtime;
 };
-#define MAXECMRATELIMIT 20
+#define MAXECMRATELIMIT 20 // at most 32, the slots in use are kept in a bitmap
 
 #ifdef MODULE_SERIAL
 struct ecmtw
@@ -1455,6 +1503,15 @@ struct s_emmlen_range
 	int16_t max;
 };
 
+#define METRICS_BUCKETS 13                          // fixed latency buckets in ms, see oscam-metrics.c
+
+struct s_metrics_hist
+{
+	uint64_t        bucket[METRICS_BUCKETS];        // not cumulative, the last one is +Inf
+	uint64_t        sum;                            // ms
+	uint64_t        count;
+};
+
 struct s_reader                                     //contains device info, reader info and card info
 {
 	uint8_t         keepalive;
@@ -1508,6 +1565,7 @@ struct s_reader                                     //contains device info, read
 	uint8_t         boxkey_length;
 	uint8_t         rsa_mod[120];                   // rsa modulus for nagra cards.
 	uint8_t         rsa_mod_length;
+	struct s_rsa_mont *rsa_mont;                    // cached montgomery contexts of the card rsa keys
 	uint8_t         des_key[128];                   // 3des key for Viaccess 16 bytes, des key for Dre 128 bytes
 	uint8_t         des_key_length;
 	uchar           atr[64];
@@ -1659,6 +1717,9 @@ struct s_reader                                     //contains device info, read
 	 	                   	       // (everything below 60 ms is converted to ms by applying *1000)
 	struct timeb    lastdvbapirateoverride;
 	uint32_t        ecmsok;
+	struct s_metrics_hist ecm_hist;                 // ecm time histogram, only written by the reader thread
+	struct s_metrics_hist trace_hist[EA_TRACE_STAGES - 1]; // ecm stage histograms in us, only written by the reader thread
+	struct s_metrics_hist job_wait_hist[JOB_CLASSES]; // job queue wait per class, only written by the reader thread
 	uint32_t        webif_ecmsok;
 	uint32_t        ecmsnok;
 	uint32_t        webif_ecmsnok;
@@ -1676,6 +1737,9 @@ struct s_reader                                     //contains device info, read
 	int8_t          cooldownstate;
 	struct timeb    cooldowntime;
 	struct ecmrl    rlecmh[MAXECMRATELIMIT];
+	uint32_t        rlecm_used;         // bitmap of the rlecmh slots in use (last.time != -1)
+	struct timeb    rlecm_expire;       // no slot in use can be released before this time
+	struct timeb    rlecm_newest;       // latest request time of the slots in use
 	int8_t          fix_07;
 	int8_t          fix_9993;
 	int8_t          readtiers; // method to get videoguard tiers
@@ -1845,10 +1909,25 @@ struct s_srvid
 	struct s_srvid       *next;
 };
 
+// (srvid, caid, provid), (caid, provid) or (tierid, caid) key to the entry a name lookup returns
+struct s_name_index_slot
+{
+	uint64_t key;           // 0 = free
+	void *entry;
+};
+
+struct s_name_index
+{
+	uint32_t mask;
+	uint32_t count;
+	struct s_name_index_slot *slot;
+};
+
 struct s_rlimit
 {
 	struct ecmrl    rl;
 	struct s_rlimit *next;
+	struct s_rlimit *next_same;     // next rule for the same caid, provid and srvid, see ratelimit_index_create()
 };
 
 struct s_cw
@@ -1972,6 +2051,9 @@ struct s_config
 	struct s_srvid  *srvid[16];
 	struct s_tierid *tierid;
 	struct s_provid *provid;
+	struct s_name_index *srvid_index;   // rebuilt and swapped together with the lists above
+	struct s_name_index *tierid_index;
+	struct s_name_index *provid_index;
 	struct s_sidtab *sidtab;
 #ifdef MODULE_MONITOR
 	int32_t         mon_port;
@@ -2115,6 +2197,7 @@ struct s_config
 	int32_t         waitforcards_extra_delay;
 	int8_t          preferlocalcards;
 	int32_t         reader_restart_seconds;         // schlocke: reader restart auf x seconds, disable = 0
+	int32_t         reader_init_parallel;           // readers doing their init at the same time, 0 = no limit
 	int8_t          dropdups;                       // drop duplicate logins
 
 
@@ -2155,6 +2238,7 @@ struct s_config
 	int8_t      dvbapi_pmtmode;
 	int8_t      dvbapi_requestmode;
 	int32_t     dvbapi_listenport;                  // TCP port to listen instead of camd.socket (network mode, default=0 -> disabled)
+	int32_t     dvbapi_demuxers;                    // demuxers network clients may use (network mode, default=0 -> MAX_DEMUX)
 	SIDTABS     dvbapi_sidtabs;
 	int32_t     dvbapi_delayer;                     // delayer ms, minimum time to write cw
 	int8_t      dvbapi_ecminfo_type;
@@ -2255,9 +2339,11 @@ struct s_config
 	char        *pidfile;
 
 	int32_t     max_pending;
+	int32_t     ecmtrace;                       // number of slowest ecm traces kept, 0 = tracing disabled
 
 	//Ratelimit list
 	struct s_rlimit *ratelimit_list;
+	struct s_name_index *ratelimit_index;   // swapped together with ratelimit_list
 	
 	// fake cws
 	struct s_fakecws fakecws[0x100];
@@ -2370,6 +2456,11 @@ char *get_provider(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen);
 char *get_providername(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen);
 char *get_providername_or_null(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen);
 void add_provider(uint16_t caid, uint32_t provid, const char *name, const char *sat, const char *lang);
+struct s_name_index *srvid_index_create(struct s_srvid **srvid);
+struct s_name_index *provid_index_create(struct s_provid *provid);
+struct s_name_index *tierid_index_create(struct s_tierid *tierid);
+struct s_name_index *ratelimit_index_create(struct s_rlimit *rlimit);
+struct s_rlimit *ratelimit_index_get(struct s_name_index *idx, uint16_t caid, uint32_t provid, uint16_t srvid);
 const char *get_cl_lastprovidername(struct s_client *cl);
 bool boxtype_is(const char *boxtype);
 bool boxname_is(const char *boxname);
@@ -74,9 +74,40 @@ void ac_init_stat(void)
 	ac_init_log();
 }
 
+/* ac_stat->exceeds counts the samples above the limit, so a stat interval only
+   looks at the sample it replaces. It is recounted when the limit or the
+   number of samples changed since it was counted. */
+static void ac_set_sample(struct s_acasc *ac_stat, int32_t idx, uint16_t value, uint16_t limit)
+{
+	int32_t j;
+
+	if(ac_stat->limit != limit || ac_stat->samples != cfg.ac_samples)
+	{
+		ac_stat->limit = limit;
+		ac_stat->samples = cfg.ac_samples;
+		for(j = ac_stat->exceeds = 0; j < cfg.ac_samples; j++)
+			{ ac_stat->exceeds += (ac_stat->stat[j] > limit); }
+	}
+	if(idx < cfg.ac_samples)
+		{ ac_stat->exceeds += (value > limit) - (ac_stat->stat[idx] > limit); }
+	ac_stat->stat[idx] = value;
+}
+
+static int32_t ac_max_sample(struct s_acasc *ac_stat)
+{
+	int32_t j, maxval;
+
+	for(j = maxval = 0; j < cfg.ac_samples; j++)
+	{
+		if(ac_stat->stat[j] > maxval)
+			{ maxval = ac_stat->stat[j]; }
+	}
+	return maxval;
+}
+
 void ac_do_stat(void)
 {
-	int32_t j, idx, exceeds, maxval, prev_deny = 0;
+	int32_t idx, prev_deny = 0;
 
 	struct s_client *client;
 	for(client = first_client; client; client = client->next)
@@ -87,7 +118,7 @@ void ac_do_stat(void)
 		struct s_acasc_shm *acasc = &client->acasc;
 
 		idx = ac_stat->idx;
-		ac_stat->stat[idx] = acasc->ac_count;
+		ac_set_sample(ac_stat, idx, acasc->ac_count, client->ac_limit);
 		acasc->ac_count = 0;
 
 		if(ac_stat->stat[idx])
@@ -99,17 +130,11 @@ void ac_do_stat(void)
 			}
 			else
 			{
-				for(j = exceeds = maxval = 0; j < cfg.ac_samples; j++)
-				{
-					if(ac_stat->stat[j] > maxval)
-						{ maxval = ac_stat->stat[j]; }
-					exceeds += (ac_stat->stat[j] > client->ac_limit);
-				}
 				prev_deny = acasc->ac_deny;
-				acasc->ac_deny = (exceeds >= cfg.ac_denysamples);
+				acasc->ac_deny = (ac_stat->exceeds >= cfg.ac_denysamples);
 
 				cs_log_dbg(D_CLIENT, "acasc: %s limit=%d, max=%d, samples=%d, dsamples=%d, [idx=%d]:",
-							  client->account->usr, client->ac_limit, maxval,
+							  client->account->usr, client->ac_limit, ac_max_sample(ac_stat),
 							  cfg.ac_samples, cfg.ac_denysamples, idx);
 				cs_log_dbg(D_CLIENT, "acasc: %d %d %d %d %d %d %d %d %d %d ", ac_stat->stat[0],
 							  ac_stat->stat[1], ac_stat->stat[2], ac_stat->stat[3],
@@ -118,7 +143,7 @@ void ac_do_stat(void)
 				if(acasc->ac_deny)
 				{
 					cs_log("acasc: user '%s' exceeds limit", client->account->usr);
-					ac_stat->stat[idx] = 0;
+					ac_set_sample(ac_stat, idx, 0, client->ac_limit);
 				}
 				else if(prev_deny)
 					{ cs_log("acasc: user '%s' restored access", client->account->usr); }
@@ -420,70 +445,200 @@ int8_t get_caid_weight(ECM_REQUEST *er)
 	}
 }
 
-void insert_zaplist(ECM_REQUEST *er, struct s_client *client)
+/* The zap list keeps the last ACoSC zappings of a client. Entries are found
+   through a small hash on caid/provid/chid/sid and kept in a recency list, so
+   the checks below only walk the entries young enough to matter. A new zapping
+   takes the lowest slot unused for 30 seconds, like the plain slot scan did,
+   as the slot it overwrites decides which zappings are still counted.
+   The walks stop at the first entry too old, which only holds while the
+   recency list is sorted by time. After the clock went back, the plain slot
+   scans are used until the entries from before are out of every window. */
+#define ZAP_SLOT(zl, n) (&(zl)->entry[(n) - 1])
+#define ZAP_WINDOW      60      // s, the longest time an entry is looked at
+
+static int8_t zaplist_in_order(struct s_zaplist *zl, time_t zaptime)
+{
+	if(zl->newest && zaptime < ZAP_SLOT(zl, zl->newest)->lasttime)
+		{ return 0; }
+	return !zl->clock_back || zaptime - ZAP_WINDOW > zl->clock_back;
+}
+
+static int32_t zaplist_bucket(uint16_t caid, uint32_t provid, uint16_t chid, uint16_t sid)
 {
-	bool new_zaplist_entry = false;
-	int8_t zap_caid_weight;
-	zap_caid_weight = get_caid_weight(er);
-	int8_t k = 0;
-	bool found = false;
-	time_t zaptime = time(NULL);
-
-	for(k=0; k<15 ; k++)
+	uint32_t h = caid * 31 + provid;
+	h = h * 31 + chid;
+	h = h * 31 + sid;
+	return (h ^ (h >> 8)) % ZAPLIST_BUCKETS;
+}
+
+static void zaplist_unhash(struct s_zaplist *zl, int8_t n)
+{
+	struct s_zap_list *e = ZAP_SLOT(zl, n);
+	int8_t *prev = &zl->bucket[zaplist_bucket(e->caid, e->provid, e->chid, e->sid)];
+
+	while(*prev && *prev != n)
+		{ prev = &ZAP_SLOT(zl, *prev)->hash_next; }
+	if(*prev)
+		{ *prev = e->hash_next; }
+	e->hash_next = 0;
+}
+
+static void zaplist_unlink(struct s_zaplist *zl, int8_t n)
+{
+	struct s_zap_list *e = ZAP_SLOT(zl, n);
+
+	if(e->newer)
+		{ ZAP_SLOT(zl, e->newer)->older = e->older; }
+	else
+		{ zl->newest = e->older; }
+	if(e->older)
+		{ ZAP_SLOT(zl, e->older)->newer = e->newer; }
+	else
+		{ zl->oldest = e->newer; }
+	e->newer = e->older = 0;
+}
+
+static void zaplist_push(struct s_zaplist *zl, int8_t n)
+{
+	struct s_zap_list *e = ZAP_SLOT(zl, n);
+	time_t newest = zl->newest ? ZAP_SLOT(zl, zl->newest)->lasttime : 0;
+
+	if(e->lasttime < newest && newest > zl->clock_back)
+		{ zl->clock_back = newest; }
+	e->older = zl->newest;
+	e->newer = 0;
+	if(zl->newest)
+		{ ZAP_SLOT(zl, zl->newest)->newer = n; }
+	else
+		{ zl->oldest = n; }
+	zl->newest = n;
+}
+
+// Lowest slot (+ 1) not used for 30 seconds, 0 if all were used more recently
+static int8_t zaplist_free_slot(struct s_zaplist *zl, time_t zaptime)
+{
+	int8_t n, slot = zl->used < ZAPLIST_SIZE ? zl->used + 1 : 0;
+
+	if(!zaplist_in_order(zl, zaptime))
 	{
-		if(er->caid == client->client_zap_list[k].caid && er->prid == client->client_zap_list[k].provid && er->chid == client->client_zap_list[k].chid && er->srvid == client->client_zap_list[k].sid) //found
+		for(n = 1; n <= zl->used; n++)
 		{
-			if(zaptime-zap_caid_weight*2 < client->client_zap_list[k].lasttime)
-			{
-				cs_log_dbg(D_TRACE, "[zaplist] update Entry [%i] for Client: %s  %04X@%06X/%04X/%04X TIME: %ld Diff: %ld zcw: %i(%i)", k, username(client), er->caid, er->prid, er->chid, er->srvid, zaptime, zaptime-client->client_zap_list[k].lasttime, zap_caid_weight, zap_caid_weight*2);
-				client->client_zap_list[k].lasttime = zaptime;
-				if(client->client_zap_list[k].request_stage < 10)
-				{
-					client->client_zap_list[k].request_stage ++;
-				}
-				found = true;
-				break;
-			}
+			if(zaptime-30 > ZAP_SLOT(zl, n)->lasttime)
+				{ return n; }
 		}
+		return slot;
 	}
+	for(n = zl->oldest; n && zaptime-30 > ZAP_SLOT(zl, n)->lasttime; n = ZAP_SLOT(zl, n)->newer)
+	{
+		if(!slot || n < slot)
+			{ slot = n; }
+	}
+	return slot;
+}
 
-	if(!found)
+void zaplist_insert(struct s_client *client, ECM_REQUEST *er, time_t zaptime)
+{
+	struct s_zaplist *zl = &client->client_zaplist;
+	struct s_zap_list *e = NULL;
+	int8_t zap_caid_weight = get_caid_weight(er);
+	int8_t n, bucket = zaplist_bucket(er->caid, er->prid, er->chid, er->srvid);
+	int8_t in_order = zaplist_in_order(zl, zaptime);
+
+	// the newest entry for a service is the only one which can still be followed,
+	// after the clock went back an older one can be in time again
+	for(n = in_order ? zl->bucket[bucket] : 1; n && n <= zl->used; n = in_order ? e->hash_next : n + 1)
 	{
-		for(k=0; k<15 ; k++)
+		e = ZAP_SLOT(zl, n);
+		if(er->caid == e->caid && er->prid == e->provid && er->chid == e->chid && er->srvid == e->sid
+				&& (in_order || zaptime-zap_caid_weight*2 < e->lasttime))
+			{ break; }
+	}
+	if(n > zl->used)
+		{ n = 0; }
+
+	if(n && zaptime-zap_caid_weight*2 < e->lasttime) //found
+	{
+		cs_log_dbg(D_TRACE, "[zaplist] update Entry [%i] for Client: %s  %04X@%06X/%04X/%04X TIME: %ld Diff: %ld zcw: %i(%i)", n - 1, username(client), er->caid, er->prid, er->chid, er->srvid, zaptime, zaptime-e->lasttime, zap_caid_weight, zap_caid_weight*2);
+		e->lasttime = zaptime;
+		if(e->request_stage < 10)
 		{
-			if(zaptime-30 > client->client_zap_list[k].lasttime) //make a new Entry and use a memoryplace of a old entry
-			{
-				client->client_zap_list[k].caid = er->caid;
-				client->client_zap_list[k].provid = er->prid;
-				client->client_zap_list[k].chid = er->chid;
-				client->client_zap_list[k].sid = er->srvid;
-				client->client_zap_list[k].request_stage = 1; //need for ACoSC
-				client->client_zap_list[k].lasttime = zaptime;
-				cs_log_dbg(D_TRACE, "[zaplist] new Entry [%i] for Client: %s  %04X@%06X/%04X/%04X TIME: %ld", k, username(client), er->caid, er->prid, er->chid, er->srvid, zaptime);
-				new_zaplist_entry = true;
-				break;
-			}
+			e->request_stage ++;
 		}
-		if(!new_zaplist_entry)
-			{ cs_log_dbg(D_TRACE, "[zaplist] no free slot for client: %s", username(client)); }
+		zaplist_unlink(zl, n);
+		zaplist_push(zl, n);
+		return;
+	}
 
-		if(client->account->acosc_user_zap_count_start_time+60 > zaptime)
-			{ client->account->acosc_user_zap_count ++; }
+	if((n = zaplist_free_slot(zl, zaptime))) //make a new Entry and use a memoryplace of a old entry
+	{
+		e = ZAP_SLOT(zl, n);
+		if(n > zl->used)
+			{ zl->used = n; }
 		else
 		{
-			client->account->acosc_user_zap_count_start_time = zaptime;
-			client->account->acosc_user_zap_count = 0;
-			cs_log_dbg(D_TRACE, "[zaplist] Client: %s reset acosc_user_zap_count_start_time", username(client));
-			for(k=0; k<15 ; k++)
-			{
-				if(client->client_zap_list[k].lasttime > zaptime-60)
-				{
-					client->account->acosc_user_zap_count ++;
-				}
-			}
-			cs_log_dbg(D_TRACE, "[zaplist] Client: %s zap_count: %i", username(client), client->account->acosc_user_zap_count);
+			zaplist_unhash(zl, n);
+			zaplist_unlink(zl, n);
+		}
+		e->caid = er->caid;
+		e->provid = er->prid;
+		e->chid = er->chid;
+		e->sid = er->srvid;
+		e->request_stage = 1; //need for ACoSC
+		e->lasttime = zaptime;
+		e->hash_next = zl->bucket[bucket];
+		zl->bucket[bucket] = n;
+		zaplist_push(zl, n);
+		cs_log_dbg(D_TRACE, "[zaplist] new Entry [%i] for Client: %s  %04X@%06X/%04X/%04X TIME: %ld", n - 1, username(client), er->caid, er->prid, er->chid, er->srvid, zaptime);
+	}
+	else
+		{ cs_log_dbg(D_TRACE, "[zaplist] no free slot for client: %s", username(client)); }
+
+	if(client->account->acosc_user_zap_count_start_time+60 > zaptime)
+		{ client->account->acosc_user_zap_count ++; }
+	else
+	{
+		client->account->acosc_user_zap_count_start_time = zaptime;
+		client->account->acosc_user_zap_count = 0;
+		cs_log_dbg(D_TRACE, "[zaplist] Client: %s reset acosc_user_zap_count_start_time", username(client));
+		in_order = zaplist_in_order(zl, zaptime);
+		for(n = in_order ? zl->newest : 1; n && n <= zl->used; n = in_order ? ZAP_SLOT(zl, n)->older : n + 1)
+		{
+			if(ZAP_SLOT(zl, n)->lasttime > zaptime-60)
+				{ client->account->acosc_user_zap_count ++; }
+			else if(in_order)
+				{ break; }
+		}
+		cs_log_dbg(D_TRACE, "[zaplist] Client: %s zap_count: %i", username(client), client->account->acosc_user_zap_count);
+	}
+}
+
+void insert_zaplist(ECM_REQUEST *er, struct s_client *client)
+{
+	zaplist_insert(client, er, time(NULL));
+}
+
+// Services the client followed for more than 10 ECMs within the last 30 seconds
+int8_t zaplist_active_sids(struct s_client *client, time_t zaptime)
+{
+	struct s_zaplist *zl = &client->client_zaplist;
+	struct s_zap_list *e;
+	int8_t n, in_order = zaplist_in_order(zl, zaptime), active_sid_count = 0;
+
+	for(n = in_order ? zl->newest : 1; n && n <= zl->used; n = in_order ? e->older : n + 1)
+	{
+		if(zaptime-30 >= (e = ZAP_SLOT(zl, n))->lasttime)
+		{
+			if(in_order)
+				{ break; }
+			continue;
+		}
+		if(e->request_stage == 10)
+		{
+			cs_log_dbg(D_TRACE, "[zaplist] ACoSC for Client: %s  more then 10 ECM's for %04X@%06X/%04X/%04X", username(client), e->caid, e->provid, e->chid, e->sid);
+			active_sid_count ++;
 		}
 	}
+	return active_sid_count;
 }
 
 #endif
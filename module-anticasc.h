@@ -10,6 +10,9 @@ extern void ac_copy_vars(struct s_auth *src, struct s_auth *dst);
 extern void ac_init_client(struct s_client *cl, struct s_auth *account);
 extern void ac_chk(struct s_client *cl, ECM_REQUEST *er, int32_t level);
 extern void insert_zaplist(ECM_REQUEST *er, struct s_client *client);
+extern int8_t get_caid_weight(ECM_REQUEST *er);
+extern void zaplist_insert(struct s_client *client, ECM_REQUEST *er, time_t zaptime);
+extern int8_t zaplist_active_sids(struct s_client *client, time_t zaptime);
 static inline bool acosc_enabled(void) { return cfg.acosc_enabled; }
 extern bool anticasc_logging(char *txt);
 #else
@@ -21,6 +24,8 @@ static inline void ac_copy_vars(struct s_auth *UNUSED(src), struct s_auth *UNUSE
 static inline void ac_init_client(struct s_client *UNUSED(cl), struct s_auth *UNUSED(account)) { }
 static inline void ac_chk(struct s_client *UNUSED(cl), ECM_REQUEST *UNUSED(er), int32_t UNUSED(level)) { }
 static inline void insert_zaplist(ECM_REQUEST *UNUSED(er), struct s_client *UNUSED(client)) { }
+static inline void zaplist_insert(struct s_client *UNUSED(client), ECM_REQUEST *UNUSED(er), time_t UNUSED(zaptime)) { }
+static inline int8_t zaplist_active_sids(struct s_client *UNUSED(client), time_t UNUSED(zaptime)) { return 0; }
 static inline bool acosc_enabled(void) { return 0; }
 static inline bool anticasc_logging(char *UNUSED(txt)) { return 0; }
 #endif
@@ -14,6 +14,7 @@
 #include "oscam-ecm.h"
 #include "oscam-hashtable.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-net.h"
 #include "oscam-string.h"
 #include "oscam-time.h"
@@ -572,7 +573,7 @@ uint8_t check_cacheex_filter(struct s_client *cl, ECM_REQUEST *er)
 	  )
 		{ return 1; }
 
-	NULLFREE(er);
+	free_ecmtask(er);
 	return 0;
 }
 
@@ -739,6 +740,7 @@ static int32_t cacheex_add_to_cache_int(struct s_client *cl, ECM_REQUEST *er, in
 		first_client->cwcacheexgot++;
 	}
 
+	ecm_payload_trim(er);  //only ecm[0] is pushed on, before add_cache() hands er to other threads
 	cacheex_add_hitcache(cl, er);  //we have to call it before add_cache, because in chk_process we could remove it!
 	add_cache(er);
 	cacheex_add_stats(cl, er->caid, er->srvid, er->prid, 1);
@@ -1037,6 +1039,7 @@ void cacheex_push_out(struct s_client *cl, ECM_REQUEST *er) {
 	if(cl->account)
 		{ cl->account->cwcacheexpush++; }
 	first_client->cwcacheexpush++;
+	metrics_inc(MC_CACHEEX_PUSH);
 }
 
 bool cacheex_check_queue_length(struct s_client *cl)
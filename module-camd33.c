@@ -136,7 +136,7 @@ static void camd33_process_ecm(uchar *buf, int32_t l)
 	memcpy(&er->msgid, buf + 3, 4); // save pin
 	er->ecmlen = l - 7;
 	if(er->ecmlen < 0 || er->ecmlen > MAX_ECM_SIZE)
-		{ NULLFREE(er); return; }
+		{ free_ecmtask(er); return; }
 	er->caid = b2i(2, buf + 1);
 	memcpy(er->ecm , buf + 7, er->ecmlen);
 	get_cw(cur_client(), er);
@@ -388,7 +388,7 @@ static void camd35_cacheex_push_in(struct s_client *cl, uchar *buf)
 		if(count > cacheex_maxhop(cl))
 		{
 			cs_log_dbg(D_CACHEEX, "cacheex: received %d nodes (max=%d), ignored! %s", (int32_t)count, cacheex_maxhop(cl), username(cl));
-			NULLFREE(er);
+			free_ecmtask(er);
 			return;
 		}
 		cs_log_dbg(D_CACHEEX, "cacheex: received %d nodes %s", (int32_t)count, username(cl));
@@ -439,20 +439,12 @@ void camd35_cacheex_recv_ce1_cwc_info(struct s_client *cl, uchar *buf, int32_t i
 	if(!(buf[0] == 0x01 && buf[18] < 0xFF && buf[18] > 0x00)) // cwc info ; normal camd3 ecms send 0xFF but we need no cycletime of 255 ;)
 		return;
 
-	ECM_REQUEST *er = NULL;
-	int32_t i;
-
-	for(i = 0; i < cfg.max_pending; i++)
-	{
-		if (cl->ecmtask[i].idx == idx)
-		{
-			er = &cl->ecmtask[i];
-			break;
-		}
-	}
+	ECM_REQUEST *er;
+	int32_t i = casc_get_ecmtask(cl, idx);
 
-	if(!er)
+	if(i < 0)
 	{ return; }
+	er = &cl->ecmtask[i];
 
 	int8_t rc = buf[3];
 	if(rc != E_FOUND)
@@ -498,7 +498,7 @@ static void camd35_process_ecm(uchar *buf, int buflen)
 	er->ecmlen = ecmlen;
 	
 	if(!cs_malloc(&er->src_data, 0x34 + 20 + er->ecmlen))
-		{ NULLFREE(er); return; }
+		{ free_ecmtask(er); return; }
 		
 	memcpy(er->src_data, buf, 0x34 + 20 + er->ecmlen);  // save request
 	er->srvid = b2i(2, buf + 8);
@@ -401,7 +401,7 @@ void cc_cacheex_push_in(struct s_client *cl, uchar *buf)
 	if(count > cacheex_maxhop(cl))
 	{
 			cs_log_dbg(D_CACHEEX, "cacheex: received %d nodes (max=%d), ignored! %s", (int32_t)count, cacheex_maxhop(cl), username(cl));
-		NULLFREE(er);
+		free_ecmtask(er);
 		return;
 	}
 	cs_log_dbg(D_CACHEEX, "cacheex: received %d nodes %s", (int32_t)count, username(cl));
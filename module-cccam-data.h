@@ -92,6 +92,32 @@ struct cc_provider
 	uint8_t sa[4]; //shared address
 };
 
+// hash lookup over a goodsids/badsids list, rebuilt when the list version or count changed
+struct cc_sid_hash
+{
+	void **slot; // struct cc_srvid or struct cc_srvid_block, both start with sid/chid/ecmlen
+	uint32_t version;
+	int32_t count;
+	int32_t size; // power of two
+};
+
+struct cc_sid_index
+{
+	struct cc_sid_hash good;
+	struct cc_sid_hash bad;
+};
+
+#define CC_CARD_INDEX_SIZE 64
+#define CC_CARD_INDEX_ANY 0xFFFFFFFF // every card of the caid
+#define CC_CARD_INDEX_NOPROV 0xFFFFFFFE // cards without providers
+
+struct cc_card_bucket
+{
+	uint16_t caid;
+	uint32_t prov; // provider, CC_CARD_INDEX_ANY or CC_CARD_INDEX_NOPROV
+	LLIST *cards; // struct cc_card, in cc->cards order
+};
+
 typedef enum
 {
 	CT_LOCALCARD = 1,
@@ -115,6 +141,7 @@ struct cc_card
 	LLIST *badsids; // sids that have failed to decode (struct cc_srvid_block)
 	LLIST *goodsids; //sids that could decoded (struct cc_srvid)
 	LLIST *remote_nodes; //remote note id, 8 bytes
+	struct cc_sid_index *sid_index; //lookup index for goodsids/badsids, built on first use
 	struct s_reader  *origin_reader;
 	uint32_t origin_id;
 	cc_card_type card_type;
@@ -125,6 +152,7 @@ struct cc_card
 	time_t timeout;
 	uint8_t is_ext;
 	int8_t rating;
+	uint32_t seq; // position in cc->cards, increases on every append
 };
 
 typedef enum
@@ -191,6 +219,8 @@ struct cc_data
 	uint8_t send_buffer[CC_MAXMSGSIZE];
 
 	LLIST *cards; // cards list
+	LLIST *card_index[CC_CARD_INDEX_SIZE]; // struct cc_card_bucket, cards by caid and provider
+	uint32_t card_seq;
 
 	int32_t max_ecms;
 	int32_t ecm_counter;
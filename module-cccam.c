@@ -311,17 +311,110 @@ int32_t sid_eq_bb(struct cc_srvid_block *srvid1, struct cc_srvid_block *srvid2)
 				&& (srvid1->blocked_till == srvid2->blocked_till || !srvid1->blocked_till || !srvid2->blocked_till));
 }
 
-struct cc_srvid_block *is_sid_blocked(struct cc_card *card, struct cc_srvid *srvid_blocked)
+static pthread_mutex_t sid_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int32_t sid_hash_pos(uint16_t sid, int32_t size)
 {
-	LL_ITER it = ll_iter_create(card->badsids);
-	struct cc_srvid_block *srvid;
-	while((srvid = ll_iter_next(&it)))
+	return ((sid * 0x9E3779B1) >> 16) & (size - 1);
+}
+
+static void sid_hash_insert(struct cc_sid_hash *hash, struct cc_srvid *srvid)
+{
+	int32_t pos = sid_hash_pos(srvid->sid, hash->size);
+	while(hash->slot[pos])
+		{ pos = (pos + 1) & (hash->size - 1); }
+	hash->slot[pos] = srvid;
+	hash->count++;
+}
+
+/* Entries with the same sid end up in list order along the probe sequence, so
+ * a lookup returns the same entry as a list walk would. Removals only bump the
+ * list version and are handled by a rebuild. */
+static int32_t sid_hash_sync(struct cc_sid_hash *hash, LLIST *list)
+{
+	int32_t count = ll_count(list), size;
+
+	if(hash->size && hash->version == list->version && hash->count == count)
+		{ return 1; }
+
+	for(size = 16; size < count * 2; size <<= 1) { ; }
+	if(size != hash->size)
 	{
-		if(sid_eq_nb(srvid_blocked, srvid))
-		{
-			break;
-		}
+		NULLFREE(hash->slot);
+		hash->size = 0;
+		if(!cs_malloc(&hash->slot, size * sizeof(void *)))
+			{ return 0; }
+		hash->size = size;
+	}
+	else
+		{ memset(hash->slot, 0, size * sizeof(void *)); }
+
+	hash->version = list->version;
+	hash->count = 0;
+	LL_ITER it = ll_iter_create(list);
+	struct cc_srvid *srvid;
+	while(hash->count < count && (srvid = ll_iter_next(&it)))
+		{ sid_hash_insert(hash, srvid); }
+	return 1;
+}
+
+static void *sid_hash_find(struct cc_sid_hash *hash, LLIST *list, struct cc_srvid *srvid_find)
+{
+	struct cc_srvid *srvid = NULL;
+	int32_t pos;
+
+	if(!sid_hash_sync(hash, list))
+	{
+		LL_ITER it = ll_iter_create(list);
+		while((srvid = ll_iter_next(&it)) && !sid_eq(srvid, srvid_find)) { ; }
+		return srvid;
 	}
+
+	for(pos = sid_hash_pos(srvid_find->sid, hash->size); (srvid = hash->slot[pos]); pos = (pos + 1) & (hash->size - 1))
+	{
+		if(sid_eq(srvid, srvid_find))
+			{ break; }
+	}
+	return srvid;
+}
+
+// keeps the hash in sync after our own append instead of rebuilding it on the next lookup
+static void sid_hash_append(struct cc_sid_hash *hash, LLIST *list, struct cc_srvid *srvid)
+{
+	if(hash->size && hash->version == list->version && hash->count + 1 == ll_count(list) && (hash->count + 1) * 2 <= hash->size)
+		{ sid_hash_insert(hash, srvid); }
+}
+
+static struct cc_sid_index *get_sid_index(struct cc_card *card)
+{
+	if(!card->sid_index && !cs_malloc(&card->sid_index, sizeof(struct cc_sid_index)))
+		{ return NULL; }
+	return card->sid_index;
+}
+
+static void cc_free_sid_index(struct cc_card *card)
+{
+	if(!card->sid_index)
+		{ return; }
+	SAFE_MUTEX_LOCK(&sid_index_lock);
+	NULLFREE(card->sid_index->good.slot);
+	NULLFREE(card->sid_index->bad.slot);
+	NULLFREE(card->sid_index);
+	SAFE_MUTEX_UNLOCK(&sid_index_lock);
+}
+
+struct cc_srvid_block *is_sid_blocked(struct cc_card *card, struct cc_srvid *srvid_blocked)
+{
+	struct cc_sid_index *idx;
+	struct cc_srvid_block *srvid = NULL;
+
+	if(!ll_count(card->badsids))
+		{ return NULL; }
+
+	SAFE_MUTEX_LOCK(&sid_index_lock);
+	if((idx = get_sid_index(card)))
+		{ srvid = sid_hash_find(&idx->bad, card->badsids, srvid_blocked); }
+	SAFE_MUTEX_UNLOCK(&sid_index_lock);
 	return srvid;
 }
 
@@ -341,15 +434,16 @@ uint32_t has_perm_blocked_sid(struct cc_card *card)
 
 struct cc_srvid *is_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 {
-	LL_ITER it = ll_iter_create(card->goodsids);
-	struct cc_srvid *srvid;
-	while((srvid = ll_iter_next(&it)))
-	{
-		if(sid_eq(srvid, srvid_good))
-		{
-			break;
-		}
-	}
+	struct cc_sid_index *idx;
+	struct cc_srvid *srvid = NULL;
+
+	if(!ll_count(card->goodsids))
+		{ return NULL; }
+
+	SAFE_MUTEX_LOCK(&sid_index_lock);
+	if((idx = get_sid_index(card)))
+		{ srvid = sid_hash_find(&idx->good, card->goodsids, srvid_good); }
+	SAFE_MUTEX_UNLOCK(&sid_index_lock);
 	return srvid;
 }
 
@@ -369,6 +463,12 @@ void add_sid_block(struct cc_card *card, struct cc_srvid *srvid_blocked, bool te
 		{ srvid->blocked_till = time(NULL) + BLOCKING_SECONDS; }
 	
 	ll_append(card->badsids, srvid);
+	if(card->sid_index)
+	{
+		SAFE_MUTEX_LOCK(&sid_index_lock);
+		sid_hash_append(&card->sid_index->bad, card->badsids, (struct cc_srvid *)srvid);
+		SAFE_MUTEX_UNLOCK(&sid_index_lock);
+	}
 	cs_log_dbg(D_READER, "added sid block %04X(CHID %04X, length %d) for card %08x",
 				  srvid_blocked->sid, srvid_blocked->chid, srvid_blocked->ecmlen, card->id);
 }
@@ -396,6 +496,12 @@ void add_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 		{ return; }
 	memcpy(srvid, srvid_good, sizeof(struct cc_srvid));
 	ll_append(card->goodsids, srvid);
+	if(card->sid_index)
+	{
+		SAFE_MUTEX_LOCK(&sid_index_lock);
+		sid_hash_append(&card->sid_index->good, card->goodsids, srvid);
+		SAFE_MUTEX_UNLOCK(&sid_index_lock);
+	}
 	cs_log_dbg(D_READER, "added good sid %04X(%d) for card %08x", srvid_good->sid, srvid_good->ecmlen, card->id);
 }
 
@@ -514,12 +620,9 @@ struct cc_extended_ecm_idx *get_extended_ecm_idx_by_idx(struct s_client *cl,
 
 void cc_reset_pending(struct s_client *cl, int32_t ecm_idx)
 {
-	int32_t i = 0;
-	for(i = 0; i < cfg.max_pending; i++)
-	{
-		if(cl->ecmtask[i].idx == ecm_idx && cl->ecmtask[i].rc == E_ALREADY_SENT)
-			{ cl->ecmtask[i].rc = E_UNHANDLED; } //Mark unused
-	}
+	int32_t i = casc_get_ecmtask(cl, ecm_idx);
+	if(i >= 0 && cl->ecmtask[i].rc == E_ALREADY_SENT)
+		{ cl->ecmtask[i].rc = E_UNHANDLED; } //Mark unused
 }
 
 void free_extended_ecm_idx_by_card(struct s_client *cl, struct cc_card *card, int8_t null_only)
@@ -1273,19 +1376,203 @@ int32_t same_card(struct cc_card *card1, struct cc_card *card2)
 			same_first_node(card1, card2));
 }
 
-struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8_t chk_only)
+static inline uint32_t cc_card_index_pos(uint16_t caid, uint32_t prov)
 {
-	struct cc_data *cc = cl->cc;
-	struct s_reader *rdr = cl->reader;
-	if(cl->kill || !rdr || !cc)
+	return ((caid * 0x9E3779B1) ^ (prov * 0x85EBCA6B)) >> 26 & (CC_CARD_INDEX_SIZE - 1);
+}
+
+static LLIST *cc_card_index_get(struct cc_data *cc, uint16_t caid, uint32_t prov, int8_t create)
+{
+	uint32_t pos = cc_card_index_pos(caid, prov);
+	struct cc_card_bucket *bucket;
+
+	LL_ITER it = ll_iter_create(cc->card_index[pos]);
+	while((bucket = ll_iter_next(&it)))
+	{
+		if(bucket->caid == caid && bucket->prov == prov)
+			{ return bucket->cards; }
+	}
+	if(!create || !cs_malloc(&bucket, sizeof(struct cc_card_bucket)))
 		{ return NULL; }
+	bucket->caid = caid;
+	bucket->prov = prov;
+	bucket->cards = ll_create("card_bucket");
+	if(!cc->card_index[pos])
+		{ cc->card_index[pos] = ll_create("card_index"); }
+	ll_append(cc->card_index[pos], bucket);
+	return bucket->cards;
+}
 
-	struct cc_srvid cur_srvid;
-	cur_srvid.sid = cur_er->srvid;
-	cur_srvid.chid = cur_er->chid;
-	cur_srvid.ecmlen = cur_er->ecmlen;
+static int32_t cc_card_has_prov_before(struct cc_card *card, struct cc_provider *prov_end)
+{
+	LL_ITER it = ll_iter_create(card->providers);
+	struct cc_provider *provider;
+	while((provider = ll_iter_next(&it)) && provider != prov_end)
+	{
+		if(provider->prov == prov_end->prov)
+			{ return 1; }
+	}
+	return 0;
+}
+
+/* Every card is kept in its (caid, any) bucket and in one bucket per provider,
+ * or in (caid, noprov) without providers. Call with cards_busy writelocked, or
+ * readlocked for a card that is already indexed (move_card_to_end). */
+static void cc_card_index_add(struct cc_data *cc, struct cc_card *card)
+{
+	LLIST *cards;
+	card->seq = ++cc->card_seq;
+
+	if((cards = cc_card_index_get(cc, card->caid, CC_CARD_INDEX_ANY, 1)))
+		{ ll_append(cards, card); }
+
+	if(!ll_count(card->providers))
+	{
+		if((cards = cc_card_index_get(cc, card->caid, CC_CARD_INDEX_NOPROV, 1)))
+			{ ll_append(cards, card); }
+		return;
+	}
+
+	LL_ITER it = ll_iter_create(card->providers);
+	struct cc_provider *provider;
+	while((provider = ll_iter_next(&it)))
+	{
+		if(!cc_card_has_prov_before(card, provider) && (cards = cc_card_index_get(cc, card->caid, provider->prov, 1)))
+			{ ll_append(cards, card); }
+	}
+}
 
-	int32_t best_rating = MIN_RATING - 1, rating;
+static void cc_card_index_remove(struct cc_data *cc, struct cc_card *card)
+{
+	LLIST *cards;
+
+	if((cards = cc_card_index_get(cc, card->caid, CC_CARD_INDEX_ANY, 0)))
+		{ ll_remove(cards, card); }
+
+	if(!ll_count(card->providers))
+	{
+		if((cards = cc_card_index_get(cc, card->caid, CC_CARD_INDEX_NOPROV, 0)))
+			{ ll_remove(cards, card); }
+		return;
+	}
+
+	LL_ITER it = ll_iter_create(card->providers);
+	struct cc_provider *provider;
+	while((provider = ll_iter_next(&it)))
+	{
+		if((cards = cc_card_index_get(cc, card->caid, provider->prov, 0)))
+			{ ll_remove(cards, card); }
+	}
+}
+
+// empties the buckets but keeps them, get_matching_card() may run without cards_busy
+static void cc_card_index_clear(struct cc_data *cc, int32_t destroy)
+{
+	int32_t i;
+	struct cc_card_bucket *bucket;
+
+	for(i = 0; i < CC_CARD_INDEX_SIZE; i++)
+	{
+		LL_ITER it = ll_iter_create(cc->card_index[i]);
+		while((bucket = ll_iter_next(&it)))
+		{
+			if(destroy)
+				{ ll_destroy(&bucket->cards); }
+			else
+				{ ll_clear(bucket->cards); }
+		}
+		if(destroy)
+			{ ll_destroy_data(&cc->card_index[i]); }
+	}
+}
+
+static int32_t cc_card_sid_allowed(struct cc_card *card, struct cc_srvid *cur_srvid, int8_t chk_only)
+{
+	int32_t goodSidCount = ll_count(card->goodsids);
+	int32_t badSidCount = ll_count(card->badsids);
+	struct cc_srvid_block *blocked_sid;
+
+	// only good sids -> check if sid is good
+	if(goodSidCount && !badSidCount)
+		{ return is_good_sid(card, cur_srvid) != NULL; }
+
+	// only bad sids -> check if sid is bad
+	// bad and good sids -> check not blocked and good
+	if(badSidCount)
+	{
+		blocked_sid = is_sid_blocked(card, cur_srvid);
+		if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
+			{ return 0; }
+		if(goodSidCount && !is_good_sid(card, cur_srvid))
+			{ return 0; }
+	}
+	return 1;
+}
+
+static void cc_rate_card(struct cc_card *ncard, struct cc_srvid *cur_srvid, int8_t chk_only, uint32_t prid,
+						 struct cc_card **card, int32_t *best_rating)
+{
+	int32_t rating;
+
+	if(!cc_card_sid_allowed(ncard, cur_srvid, chk_only))
+		{ return; }
+
+	rating = ncard->rating - ncard->hop * HOP_RATING;
+	if(rating < MIN_RATING)
+		{ rating = MIN_RATING; }
+	else if(rating > MAX_RATING)
+		{ rating = MAX_RATING; }
+
+	// buckets are visited one after another, the lower seq wins a tie like in a cc->cards walk
+	if(rating < *best_rating || (rating == *best_rating && ncard->seq > (*card)->seq))
+		{ return; }
+
+	if(!ll_count(ncard->providers) || !prid)
+	{
+		*card = ncard;
+		*best_rating = rating;
+		return;
+	}
+
+	LL_ITER it = ll_iter_create(ncard->providers);
+	struct cc_provider *provider;
+	while((provider = ll_iter_next(&it)))
+	{
+		if(provider->prov == prid)    // provid matches
+		{
+			*card = ncard;
+			*best_rating = rating;
+			return;
+		}
+	}
+}
+
+static void cc_rate_bucket(LLIST *cards, struct cc_srvid *cur_srvid, int8_t chk_only, uint32_t prid,
+						   struct cc_card **card, int32_t *best_rating)
+{
+	struct cc_card *ncard;
+	LL_ITER it = ll_iter_create(cards);
+	while((ncard = ll_iter_next(&it)))
+		{ cc_rate_card(ncard, cur_srvid, chk_only, prid, card, best_rating); }
+}
+
+static void cc_rate_caid(struct cc_data *cc, uint16_t caid, struct cc_srvid *cur_srvid, int8_t chk_only, uint32_t prid,
+						 struct cc_card **card, int32_t *best_rating)
+{
+	if(!prid)
+	{
+		cc_rate_bucket(cc_card_index_get(cc, caid, CC_CARD_INDEX_ANY, 0), cur_srvid, chk_only, prid, card, best_rating);
+		return;
+	}
+	cc_rate_bucket(cc_card_index_get(cc, caid, prid, 0), cur_srvid, chk_only, prid, card, best_rating);
+	cc_rate_bucket(cc_card_index_get(cc, caid, CC_CARD_INDEX_NOPROV, 0), cur_srvid, chk_only, prid, card, best_rating);
+}
+
+static struct cc_card *get_matching_card_scan(struct s_client *cl, ECM_REQUEST *cur_er, int8_t chk_only, struct cc_srvid *cur_srvid)
+{
+	struct cc_data *cc = cl->cc;
+	struct s_reader *rdr = cl->reader;
+	int32_t best_rating = MIN_RATING - 1;
 
 	LL_ITER it = ll_iter_create(cc->cards);
 	struct cc_card *card = NULL, *ncard, *xcard = NULL;
@@ -1307,75 +1594,14 @@ struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8
 				// needed for wantemu
 				|| lb_match
 		  )
-		{		
-			int32_t goodSidCount = ll_count(ncard->goodsids);
-			int32_t badSidCount = ll_count(ncard->badsids);
-			struct cc_srvid *good_sid;
-			struct cc_srvid_block *blocked_sid;
-			
-			// only good sids -> check if sid is good
-			if(goodSidCount && !badSidCount)
-			{			
-				good_sid = is_good_sid(ncard, &cur_srvid);
-				if(!good_sid)
-					{ continue; }
-			}
-			// only bad sids -> check if sid is bad
-			else if(!goodSidCount && badSidCount)
-			{
-				blocked_sid = is_sid_blocked(ncard, &cur_srvid);
-				if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
-					{ continue; }
-			}			
-			// bad and good sids -> check not blocked and good
-			else if (goodSidCount && badSidCount)
-			{
-				blocked_sid = is_sid_blocked(ncard, &cur_srvid);				
-				good_sid = is_good_sid(ncard, &cur_srvid);
-				
-				if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
-					{ continue; }
-				if(!good_sid)
-					{ continue; }
-			}
-
+		{
+			if(!cc_card_sid_allowed(ncard, cur_srvid, chk_only))
+				{ continue; }
 
 			if(!(rdr->cc_want_emu) && caid_is_nagra(ncard->caid) && (!xcard || ncard->hop < xcard->hop))
 				{ xcard = ncard; } //remember card (D+ / 1810 fix) if request has no provider, but card has
 
-			rating = ncard->rating - ncard->hop * HOP_RATING;
-			if(rating < MIN_RATING)
-				{ rating = MIN_RATING; }
-			else if(rating > MAX_RATING)
-				{ rating = MAX_RATING; }
-
-			if(!ll_count(ncard->providers))    //card has no providers:
-			{
-				if(rating > best_rating)
-				{
-					// ncard is closer
-					card = ncard;
-					best_rating = rating; // ncard has been matched
-				}
-
-			}
-			else   //card has providers
-			{
-				LL_ITER it2 = ll_iter_create(ncard->providers);
-				struct cc_provider *provider;
-				while((provider = ll_iter_next(&it2)))
-				{
-					if(!cur_er->prid || (provider->prov == cur_er->prid))    // provid matches
-					{
-						if(rating  > best_rating)
-						{
-							// ncard is closer
-							card = ncard;
-							best_rating = rating; // ncard has been matched
-						}
-					}
-				}
-			}
+			cc_rate_card(ncard, cur_srvid, chk_only, cur_er->prid, &card, &best_rating);
 		}
 	}
 	if(!card)
@@ -1384,6 +1610,46 @@ struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8
 	return card;
 }
 
+struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8_t chk_only)
+{
+	struct cc_data *cc = cl->cc;
+	struct s_reader *rdr = cl->reader;
+	if(cl->kill || !rdr || !cc)
+		{ return NULL; }
+
+	struct cc_srvid cur_srvid;
+	cur_srvid.sid = cur_er->srvid;
+	cur_srvid.chid = cur_er->chid;
+	cur_srvid.ecmlen = cur_er->ecmlen;
+
+	// beta tunnel matches cards of other caids, keep the full walk for it
+	if(config_enabled(WITH_LB) && chk_only && cfg.lb_mode && cfg.lb_auto_betatunnel
+			&& (caid_is_nagra(cur_er->caid) || caid_is_betacrypt(cur_er->caid)))
+		{ return get_matching_card_scan(cl, cur_er, chk_only, &cur_srvid); }
+
+	int32_t best_rating = MIN_RATING - 1;
+	struct cc_card *card = NULL, *ncard, *xcard = NULL;
+
+	cc_rate_caid(cc, cur_er->caid, &cur_srvid, chk_only, cur_er->prid, &card, &best_rating);
+	// or system matches if caid ends with 00, needed for wantemu
+	if(rdr->cc_want_emu && (cur_er->caid & 0xFF00) != cur_er->caid)
+		{ cc_rate_caid(cc, cur_er->caid & 0xFF00, &cur_srvid, chk_only, cur_er->prid, &card, &best_rating); }
+
+	//18xx: if request has no provider and we have no card, we try the nearest card (D+ / 1810 fix)
+	if(!card && !rdr->cc_want_emu && caid_is_nagra(cur_er->caid))
+	{
+		LL_ITER it = ll_iter_create(cc_card_index_get(cc, cur_er->caid, CC_CARD_INDEX_ANY, 0));
+		while((ncard = ll_iter_next(&it)))
+		{
+			if((!xcard || ncard->hop < xcard->hop) && cc_card_sid_allowed(ncard, &cur_srvid, chk_only))
+				{ xcard = ncard; }
+		}
+		card = xcard;
+	}
+
+	return card;
+}
+
 //reopen all blocked sids for this srvid:
 static void reopen_sids(struct cc_data *cc, int8_t ignore_time, ECM_REQUEST *cur_er, struct cc_srvid *cur_srvid)
 {
@@ -1884,6 +2150,7 @@ void cc_free_card(struct cc_card *card)
 	ll_destroy_data(&card->badsids);
 	ll_destroy_data(&card->goodsids);
 	ll_destroy_data(&card->remote_nodes);
+	cc_free_sid_index(card);
 
 	add_garbage(card);
 }
@@ -1932,6 +2199,7 @@ void cc_free(struct s_client *cl)
 	cs_writelock(__func__, &cc->lockcmd);
 
 	cs_log_dbg(D_TRACE, "exit cccam1/3");
+	cc_card_index_clear(cc, 1);
 	cc_free_cardlist(cc->cards, 1);
 	ll_destroy_data(&cc->pending_emms);
 	free_extended_ecm_idx(cc);
@@ -2209,6 +2477,7 @@ void cc_card_removed(struct s_client *cl, uint32_t shareid)
 			//cs_log_dbg(D_CLIENT, "cccam: card %08x removed, caid %04X, count %d",
 			//      card->id, card->caid, ll_count(cc->cards));
 			ll_iter_remove(&it);
+			cc_card_index_remove(cc, card);
 			if(cc->last_emm_card == card)
 			{
 				cc->last_emm_card = NULL;
@@ -2254,7 +2523,9 @@ void move_card_to_end(struct s_client *cl, struct cc_card *card_to_move)
 	{
 		cs_log_dbg(D_READER, "%s Moving card %08X to the end...", getprefix(), card_to_move->id);
 		free_extended_ecm_idx_by_card(cl, card, 0);
+		cc_card_index_remove(cc, card_to_move);
 		ll_append(cc->cards, card_to_move);
+		cc_card_index_add(cc, card_to_move);
 	}
 }
 
@@ -2345,6 +2616,7 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 		if(l == 0x48)    //72 bytes: normal server data
 		{
 			cs_writelock(__func__, &cc->cards_busy);
+			cc_card_index_clear(cc, 0);
 			cc_free_cardlist(cc->cards, 0);
 			free_extended_ecm_idx(cc);
 			cc->last_emm_card = NULL;
@@ -2545,6 +2817,7 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 			{
 				card->card_type = CT_REMOTECARD;
 				ll_append(cc->cards, card);
+				cc_card_index_add(cc, card);
 				set_au_data(cl, rdr, card, NULL);
 				cc->card_added_count++;
 				card->hop++;
@@ -2702,16 +2975,13 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 				if(buf[1] == MSG_CW_NOK1)   //MSG_CW_NOK1: share no more available
 				{
 					cs_log_dbg(D_TRACE, "NOK1: share temporarily not available %d %04X ecm %d %d!", card->id, card->caid, eei->send_idx, eei->ecm_idx);
-					int j;
-					for(j = 0; j < cfg.max_pending; j++)
+					int j = casc_get_ecmtask(cl, ecm_idx);
+					if(j >= 0 && cl->ecmtask[j].rc == E_ALREADY_SENT)
 					{
-						if(cl->ecmtask[j].idx == ecm_idx && cl->ecmtask[j].rc == E_ALREADY_SENT) {
-							ECM_REQUEST *er = &cl->ecmtask[j];
-							cl->pending--;
+						ECM_REQUEST *er = &cl->ecmtask[j];
+						cl->pending--;
 
-							write_ecm_answer(rdr, er, E_NOTFOUND, 0, NULL, NULL, 0, NULL);
-							break;
-						}
+						write_ecm_answer(rdr, er, E_NOTFOUND, 0, NULL, NULL, 0, NULL);
 					}
 				}
 				//else MSG_CW_NOK2: can't decode
@@ -2793,19 +3063,15 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 			}
 			else
 			{
-				int32_t i = 0;
-				for(i = 0; i < cfg.max_pending; i++)
+				int32_t i = casc_get_ecmtask(cl, ecm_idx);
+				if(i >= 0 && cl->ecmtask[i].rc == E_ALREADY_SENT)
 				{
-					if(cl->ecmtask[i].idx == ecm_idx && cl->ecmtask[i].rc == E_ALREADY_SENT)
-					{
-						cs_log_dbg(D_TRACE,
-									  "%s ext NOK %s", getprefix(), (buf[1] == MSG_CW_NOK1) ? "NOK1" : "NOK2");
-						ECM_REQUEST *er = &cl->ecmtask[i];
-						cl->pending--;
+					cs_log_dbg(D_TRACE,
+								  "%s ext NOK %s", getprefix(), (buf[1] == MSG_CW_NOK1) ? "NOK1" : "NOK2");
+					ECM_REQUEST *er = &cl->ecmtask[i];
+					cl->pending--;
 
-						write_ecm_answer(rdr, er, E_NOTFOUND, 0, NULL, NULL, 0, NULL);
-						break;
-					}
+					write_ecm_answer(rdr, er, E_NOTFOUND, 0, NULL, NULL, 0, NULL);
 				}
 			}
 		}
@@ -3850,6 +4116,7 @@ int32_t cc_cli_connect(struct s_client *cl)
 	}
 	else
 	{
+		cc_card_index_clear(cc, 0);
 		cc_free_cardlist(cc->cards, 0);
 		free_extended_ecm_idx(cc);
 	}
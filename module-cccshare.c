@@ -29,6 +29,141 @@ static bool share_updater_refresh;
 
 int32_t card_valid_for_client(struct s_client *cl, struct cc_card *card);
 
+/* Keyed lookup over the cards of one share refresh. Entries are chained per
+ * bucket in insertion order, so the first match is the card a walk over the
+ * cardlist would have found. Indexes are 1-based, 0 ends a chain. */
+#define CARD_KEY_SAME2 0     // caid, card type, sidtab, hexserial (same_card2)
+#define CARD_KEY_PROVIDERS 1 // CARD_KEY_SAME2 and the provider set
+#define CARD_KEY_SAME 2      // CARD_KEY_SAME2, group, remote id and first node (same_card)
+
+struct cc_card_map_entry
+{
+	struct cc_card *card;
+	uint32_t hash;
+	int32_t next;
+	int8_t claimed;
+};
+
+struct cc_card_map
+{
+	struct cc_card_map_entry *entry;
+	int32_t *bucket;
+	int32_t count;
+	int32_t size;
+	int32_t buckets;
+};
+
+static uint32_t card_map_hash(struct cc_card *card, int8_t key)
+{
+	uint32_t hash = crc32(0, (uint8_t *)&card->caid, sizeof(card->caid));
+	hash = crc32(hash, (uint8_t *)&card->card_type, sizeof(card->card_type));
+	hash = crc32(hash, (uint8_t *)&card->sidtab, sizeof(card->sidtab));
+	hash = crc32(hash, card->hexserial, sizeof(card->hexserial));
+
+	if(key == CARD_KEY_PROVIDERS)
+	{
+		// order independent like equal_providers()
+		LL_ITER it = ll_iter_create(card->providers);
+		struct cc_provider *prov;
+		while((prov = ll_iter_next(&it)))
+			{ hash += crc32(0, (uint8_t *)&prov->prov, sizeof(prov->prov)); }
+	}
+	else if(key == CARD_KEY_SAME)
+	{
+		uint8_t *node = ll_has_elements(card->remote_nodes);
+		hash = crc32(hash, (uint8_t *)&card->remote_id, sizeof(card->remote_id));
+		hash = crc32(hash, (uint8_t *)&card->grp, sizeof(card->grp));
+		if(node)
+			{ hash = crc32(hash, node, 8); }
+	}
+	return hash;
+}
+
+static void card_map_link(struct cc_card_map *map, int32_t idx)
+{
+	int32_t *pos = &map->bucket[map->entry[idx - 1].hash & (map->buckets - 1)];
+	while(*pos)
+		{ pos = &map->entry[*pos - 1].next; }
+	*pos = idx;
+	map->entry[idx - 1].next = 0;
+}
+
+static int32_t card_map_init(struct cc_card_map *map, int32_t size)
+{
+	memset(map, 0, sizeof(struct cc_card_map));
+	for(map->buckets = 256; map->buckets < size; map->buckets <<= 1) { ; }
+	map->size = map->buckets;
+	if(!cs_malloc(&map->bucket, map->buckets * sizeof(int32_t)) || !cs_malloc(&map->entry, map->size * sizeof(struct cc_card_map_entry)))
+	{
+		NULLFREE(map->bucket);
+		map->buckets = map->size = 0;
+		return 0;
+	}
+	return 1;
+}
+
+static void card_map_free(struct cc_card_map *map)
+{
+	NULLFREE(map->bucket);
+	NULLFREE(map->entry);
+	map->count = map->size = map->buckets = 0;
+}
+
+static void card_map_add(struct cc_card_map *map, struct cc_card *card, uint32_t hash)
+{
+	int32_t i;
+
+	if(!map->buckets)
+		{ return; }
+
+	if(map->count == map->size)
+	{
+		if(!cs_realloc(&map->entry, map->size * 2 * sizeof(struct cc_card_map_entry)))
+		{
+			NULLFREE(map->bucket);
+			map->count = map->size = map->buckets = 0;
+			return;
+		}
+		map->size *= 2;
+	}
+
+	map->entry[map->count].card = card;
+	map->entry[map->count].hash = hash;
+	map->entry[map->count].claimed = 0;
+	map->count++;
+
+	if(map->count > map->buckets * 2)
+	{
+		if(!cs_realloc(&map->bucket, map->buckets * 2 * sizeof(int32_t)))
+		{
+			NULLFREE(map->entry);
+			map->count = map->size = map->buckets = 0;
+			return;
+		}
+		map->buckets *= 2;
+		memset(map->bucket, 0, map->buckets * sizeof(int32_t));
+		for(i = 1; i < map->count; i++)
+			{ card_map_link(map, i); }
+	}
+	card_map_link(map, map->count);
+}
+
+static struct cc_card_map_entry *card_map_next(struct cc_card_map *map, struct cc_card_map_entry *e, uint32_t hash)
+{
+	int32_t idx;
+
+	if(!map->buckets)
+		{ return NULL; }
+
+	idx = e ? e->next : map->bucket[hash & (map->buckets - 1)];
+	for(; idx; idx = map->entry[idx - 1].next)
+	{
+		if(map->entry[idx - 1].hash == hash)
+			{ return &map->entry[idx - 1]; }
+	}
+	return NULL;
+}
+
 LLIST *get_cardlist(uint16_t caid, LLIST **list)
 {
 	caid = (caid >> 8) % CAID_KEY;
@@ -730,7 +865,10 @@ struct cc_card *create_card(struct cc_card *card)
 	if(!cs_malloc(&card2, sizeof(struct cc_card)))
 		{ return NULL; }
 	if(card)
-		{ memcpy(card2, card, sizeof(struct cc_card)); }
+	{
+		memcpy(card2, card, sizeof(struct cc_card));
+		card2->sid_index = NULL;
+	}
 	else
 		{ memset(card2, 0, sizeof(struct cc_card)); }
 	card2->providers = ll_create("providers");
@@ -893,55 +1031,85 @@ void merge_sids(struct cc_card *carddst, struct cc_card *cardsrc)
 	
 }
 
+/**
+ * returns the card to insert into the serverlist: the card itself if we own it, or a copy
+ */
+static struct cc_card *serverlist_card(struct cc_card *card, int8_t free_card, int8_t clear_hop)
+{
+	struct cc_card *card2;
+
+	if(free_card)
+		{ return card; }
+
+	card2 = create_card(card); //Copy card
+	if(!card2)
+		{ return NULL; }
+	if(clear_hop)
+		{ card2->hop = 0; }
+	add_card_providers(card2, card, 1); //copy providers to new card. Copy remote nodes to new card
+	return card2;
+}
+
+/**
+ * replaces card2 by card in place, so the cardlist and the card map keep their entry
+ */
+static void serverlist_replace(struct cc_card *card2, struct cc_card *card)
+{
+	struct cc_card tmp;
+
+	memcpy(&tmp, card2, sizeof(struct cc_card));
+	memcpy(card2, card, sizeof(struct cc_card));
+	memcpy(card, &tmp, sizeof(struct cc_card));
+	cc_free_card(card);
+}
+
 /**
  * Adds a new card to a cardlist.
+ * map indexes the cards of all cardlists of this refresh.
  */
-int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t free_card)
+int32_t add_card_to_serverlist(struct cc_card_map *map, LLIST *cardlist, struct cc_card *card, int8_t free_card)
 {
 
 	int32_t modified = 0;
 	if(!card)
 		{ return modified; }
 
-	LL_ITER it = ll_iter_create(cardlist);
-	struct cc_card *card2;
+	struct cc_card *card2 = NULL;
+	struct cc_card_map_entry *e;
+	uint32_t hash;
 
 	//Minimize all, transmit just CAID, merge providers:
 	if(cfg.cc_minimize_cards == MINIMIZE_CAID && !cfg.cc_forward_origin_card)
 	{
-		while((card2 = ll_iter_next(&it)))
+		hash = card_map_hash(card, CARD_KEY_SAME2);
+		for(e = card_map_next(map, NULL, hash); e; e = card_map_next(map, e, hash))
 		{
 			//compare caid, hexserial, cardtype and sidtab (if any):
-			if(same_card2(card, card2, 0))
+			if(same_card2(card, e->card, 0))
 			{
 				//Merge cards only if resulting providercount is smaller than CS_MAXPROV
 				int32_t nsame, ndiff, nnew;
 
-				nsame = num_same_providers(card, card2); //count same cards
+				nsame = num_same_providers(card, e->card); //count same cards
 				ndiff = ll_count(card->providers) - nsame; //cound different cards, this cound will be added
-				nnew = ndiff + ll_count(card2->providers); //new card count after add. because its limited to CS_MAXPROV, dont add it
+				nnew = ndiff + ll_count(e->card->providers); //new card count after add. because its limited to CS_MAXPROV, dont add it
 
 				if(nnew <= CS_MAXPROV)
-					{ break; }
+				{
+					card2 = e->card;
+					break;
+				}
 			}
 		}
 
 		if(!card2)    //Not found->add it:
 		{
-			if(free_card)    //Use this card
-			{
-				free_card = 0;
-				ll_iter_insert(&it, card);
-			}
-			else
-			{
-				card2 = create_card(card); //Copy card
-				if(!card2)
-					{ return modified; }
-				card2->hop = 0;
-				ll_iter_insert(&it, card2);
-				add_card_providers(card2, card, 1); //copy providers to new card. Copy remote nodes to new card
-			}
+			card2 = serverlist_card(card, free_card, 1);
+			if(!card2)
+				{ return modified; }
+			free_card = 0;
+			ll_append(cardlist, card2);
+			card_map_add(map, card2, hash);
 			modified = 1;
 
 		}
@@ -958,38 +1126,35 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 	//Removed duplicate cards, keeping card with lower hop:
 	else if(cfg.cc_minimize_cards == MINIMIZE_HOPS && !cfg.cc_forward_origin_card)
 	{
-		while((card2 = ll_iter_next(&it)))
+		hash = card_map_hash(card, CARD_KEY_PROVIDERS);
+		for(e = card_map_next(map, NULL, hash); e; e = card_map_next(map, e, hash))
 		{
 			//compare caid, hexserial, cardtype, sidtab (if any), providers:
-			if(same_card2(card, card2, 0) && equal_providers(card, card2))
+			if(same_card2(card, e->card, 0) && equal_providers(card, e->card))
 			{
+				card2 = e->card;
 				break;
 			}
 		}
 
 		if(card2 && card2->hop > card->hop)    //hop is smaller, drop old card
 		{
-			ll_iter_remove(&it);
-			cc_free_card(card2);
-			card2 = NULL;
+			struct cc_card *card3 = serverlist_card(card, free_card, 0);
+			if(!card3)
+				{ return modified; }
+			free_card = 0;
+			serverlist_replace(card2, card3);
 			card_dup_count++;
+			modified = 1;
 		}
-
-		if(!card2)    //Not found->add it:
+		else if(!card2)    //Not found->add it:
 		{
-			if(free_card)    //use this card
-			{
-				free_card = 0;
-				ll_iter_insert(&it, card);
-			}
-			else
-			{
-				card2 = create_card(card); //copy card
-				if(!card2)
-					{ return modified; }
-				ll_iter_insert(&it, card2);
-				add_card_providers(card2, card, 1); //copy providers to new card. Copy remote nodes to new card
-			}
+			card2 = serverlist_card(card, free_card, 0);
+			if(!card2)
+				{ return modified; }
+			free_card = 0;
+			ll_append(cardlist, card2);
+			card_map_add(map, card2, hash);
 			modified = 1;
 		}
 		else     //found, merge cards (providers are same!)
@@ -1004,35 +1169,35 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 	//like cccam:
 	else   //just remove duplicate cards (same ids)
 	{
-		while((card2 = ll_iter_next(&it)))
+		hash = card_map_hash(card, CARD_KEY_SAME);
+		for(e = card_map_next(map, NULL, hash); e; e = card_map_next(map, e, hash))
 		{
 			//compare remote_id, first_node, caid, hexserial, cardtype, sidtab (if any), providers:
-			if(same_card(card, card2))
-				{ break; }
+			if(same_card(card, e->card))
+			{
+				card2 = e->card;
+				break;
+			}
 		}
 
 		if(card2 && card2->hop > card->hop)    //same card, if hop greater drop card
 		{
-			ll_iter_remove(&it);
-			cc_free_card(card2);
-			card2 = NULL;
+			struct cc_card *card3 = serverlist_card(card, free_card, 0);
+			if(!card3)
+				{ return modified; }
+			free_card = 0;
+			serverlist_replace(card2, card3);
 			card_dup_count++;
+			modified = 1;
 		}
-		if(!card2)    //Not found, add it:
+		else if(!card2)    //Not found, add it:
 		{
-			if(free_card)
-			{
-				free_card = 0;
-				ll_iter_insert(&it, card);
-			}
-			else
-			{
-				card2 = create_card(card);
-				if(!card2)
-					{ return modified; }
-				ll_iter_insert(&it, card2);
-				add_card_providers(card2, card, 1);
-			}
+			card2 = serverlist_card(card, free_card, 0);
+			if(!card2)
+				{ return modified; }
+			free_card = 0;
+			ll_append(cardlist, card2);
+			card_map_add(map, card2, hash);
 			modified = 1;
 		}
 		else     //Found, everything is same (including providers)
@@ -1067,24 +1232,48 @@ int32_t card_timed_out(struct cc_card *card)
  * if the card1 is already reported, we throw it away, because we build a new sharelist
  * so after finding all reported cards, we have a list of reported cards, which aren't used anymore
  **/
-int32_t find_reported_card(struct cc_card *card1)
+int32_t find_reported_card(struct cc_card_map *reported, struct cc_card *card1)
 {
-	LL_ITER it = ll_iter_create(get_cardlist(card1->caid, reported_carddatas_list));
-	struct cc_card *card2;
-	while((card2 = ll_iter_next(&it)))
+	uint32_t hash = card_map_hash(card1, CARD_KEY_SAME);
+	struct cc_card_map_entry *e;
+	for(e = card_map_next(reported, NULL, hash); e; e = card_map_next(reported, e, hash))
 	{
-		if(same_card(card1, card2) && !card_timed_out(card2))
+		if(!e->claimed && same_card(card1, e->card) && !card_timed_out(e->card))
 		{
-			card1->id = card2->id; //Set old id !!
-			card1->timeout = card2->timeout;
-			cc_free_card(card2);
-			ll_iter_remove(&it);
+			card1->id = e->card->id; //Set old id !!
+			card1->timeout = e->card->timeout;
+			cc_free_card(e->card);
+			e->claimed = 1;
 			return 1; //Old card and new card are equal!
 		}
 	}
 	return 0; //Card not found
 }
 
+/**
+ * sends a remove for every reported card which is not in the new sharelist and frees it.
+ * returns the number of removed cards
+ **/
+static int32_t remove_unreported_cards(struct cc_card_map *reported)
+{
+	int32_t i, count = 0;
+	struct cc_card *card;
+
+	for(i = 0; i < reported->count; i++)
+	{
+		if(reported->entry[i].claimed)
+			{ continue; }
+		card = reported->entry[i].card;
+		cs_log_dbg(D_TRACE, "s-card removed: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
+					  card->id, card->remote_id, card->caid, card->hop, card->reshare, card->origin_id, card->card_type);
+
+		send_remove_card_to_clients(card);
+		cc_free_card(card);
+		count++;
+	}
+	return count;
+}
+
 /**
 * Server:
 * Adds a cccam-carddata buffer to the list of reported carddatas
@@ -1100,9 +1289,9 @@ void cc_add_reported_carddata(LLIST *reported_carddatas, struct cc_card *card)
  * if this card is already reported, find_reported_card throws the "origin" card away
  * so the "old" sharelist is reduced
  **/
-void report_card(struct cc_card *card, LLIST *new_reported_carddatas, LLIST *new_cards)
+void report_card(struct cc_card_map *reported, struct cc_card *card, LLIST *new_reported_carddatas, LLIST *new_cards)
 {
-	if(!find_reported_card(card))    //Add new card:
+	if(!find_reported_card(reported, card))    //Add new card:
 	{
 
 		cs_log_dbg(D_TRACE, "s-card added: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
@@ -1135,10 +1324,17 @@ void update_card_list(void)
 
 	LL_ITER it, it2;
 	struct cc_card *card;
+	struct cc_card_map server_map, reported_map;
 
 	memset(server_cards, 0, sizeof(server_cards));
 	memset(new_reported_carddatas, 0, sizeof(new_reported_carddatas));
 
+	// the last sharelist size is a good guess for this one
+	for(i = 0; i < CAID_KEY; i++)
+		{ card_count += ll_count(reported_carddatas_list[i]); }
+	card_map_init(&server_map, card_count);
+	card_count = 0;
+
 	card_added_count = 0;
 	card_removed_count = 0;
 	card_dup_count = 0;
@@ -1165,7 +1361,7 @@ void update_card_list(void)
 					ll_append(card->providers, prov);
 				}
 
-				add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 1);
+				add_card_to_serverlist(&server_map, get_cardlist(card->caid, server_cards), card, 1);
 			}
 			flt = 1;
 		}
@@ -1228,7 +1424,7 @@ void update_card_list(void)
 								if(!rdr->audisabled)
 									{ cc_UA_oscam2cccam(rdr->hexserial, card->hexserial, card->caid); }
 
-								add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 1);
+								add_card_to_serverlist(&server_map, get_cardlist(card->caid, server_cards), card, 1);
 								flt = 1;
 							}
 							else
@@ -1277,7 +1473,7 @@ void update_card_list(void)
 						}
 
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+						add_card_to_serverlist(&server_map, get_cardlist(caid, server_cards), card, 1);
 						flt = 1;
 					}
 				}
@@ -1304,7 +1500,7 @@ void update_card_list(void)
 							{ cc_UA_oscam2cccam(rdr->hexserial, card->hexserial, lcaid); }
 
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(lcaid, server_cards), card, 1);
+						add_card_to_serverlist(&server_map, get_cardlist(lcaid, server_cards), card, 1);
 						flt = 1;
 					}
 				}
@@ -1346,7 +1542,7 @@ void update_card_list(void)
 							//cs_log("Main CCcam card report provider: %02X%02X%02X%02X", buf[21+(j*7)], buf[22+(j*7)], buf[23+(j*7)], buf[24+(j*7)]);
 						}
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+						add_card_to_serverlist(&server_map, get_cardlist(caid, server_cards), card, 1);
 						flt = 1;
 					}
 				}
@@ -1383,7 +1579,7 @@ void update_card_list(void)
 						//cs_log("Main CCcam card report provider: %02X%02X%02X%02X", buf[21+(j*7)], buf[22+(j*7)], buf[23+(j*7)], buf[24+(j*7)]);
 					}
 					add_good_bad_sids_by_rdr(rdr, card);
-					add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+					add_card_to_serverlist(&server_map, get_cardlist(caid, server_cards), card, 1);
 				}
 			}
 
@@ -1422,7 +1618,7 @@ void update_card_list(void)
 
 							if(dont_ignore)    //Filtered by service
 							{
-								add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 0);
+								add_card_to_serverlist(&server_map, get_cardlist(card->caid, server_cards), card, 0);
 								count++;
 							}
 						}
@@ -1441,6 +1637,19 @@ void update_card_list(void)
 
 	cs_writelock(__func__, &cc_shares_lock);
 
+	//index the last sharelist, reported cards keep their id. The map is sized for
+	//all of them, so adding never reallocates and a claimed card is never lost:
+	for(i = 0; i < CAID_KEY; i++)
+		{ card_count += ll_count(reported_carddatas_list[i]); }
+	card_map_init(&reported_map, card_count);
+	card_count = 0;
+	for(i = 0; i < CAID_KEY; i++)
+	{
+		it = ll_iter_create(reported_carddatas_list[i]);
+		while((card = ll_iter_next(&it)))
+			{ card_map_add(&reported_map, card, card_map_hash(card, CARD_KEY_SAME)); }
+	}
+
 	//report reshare cards:
 	//cs_log_dbg(D_TRACE, "%s reporting %d cards", getprefix(), ll_count(server_cards));
 	for(i = 0; i < CAID_KEY; i++)
@@ -1456,18 +1665,28 @@ void update_card_list(void)
 
 				if(!new_reported_carddatas[i])
 					{ new_reported_carddatas[i] = ll_create("new_cardlist"); }
-				report_card(card, new_reported_carddatas[i], new_cards);
+				report_card(&reported_map, card, new_reported_carddatas[i], new_cards);
 				ll_iter_remove(&it);
 			}
 			cc_free_cardlist(server_cards[i], 1);
 		}
+	}
+	card_map_free(&server_map);
 
-		//remove unsed, remaining cards:
-		card_removed_count += cc_free_reported_carddata(reported_carddatas_list[i], new_reported_carddatas[i], 1);
+	//remove unsed, remaining cards:
+	if(reported_map.buckets)
+		{ card_removed_count += remove_unreported_cards(&reported_map); }
+	for(i = 0; i < CAID_KEY; i++)
+	{
+		if(reported_map.buckets)
+			{ ll_destroy(&reported_carddatas_list[i]); }
+		else
+			{ card_removed_count += cc_free_reported_carddata(reported_carddatas_list[i], NULL, 1); }
 		reported_carddatas_list[i] = new_reported_carddatas[i];
 		card_count += ll_count(reported_carddatas_list[i]);
 		//cs_log_dbg(D_TRACE, "CARDS FOR INDEX %d=%d", i, ll_count(reported_carddatas[i]));
 	}
+	card_map_free(&reported_map);
 
 	//now send new cards. Always remove first, then add new:
 	it = ll_iter_create(new_cards);
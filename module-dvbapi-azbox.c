@@ -17,7 +17,7 @@
 
 // These variables are declared in module-dvbapi.c
 extern void *dvbapi_client;
-extern DEMUXTYPE demux[MAX_DEMUX];
+extern DEMUXTYPE *demux;
 
 // These are used in module-dvbapi.c
 int32_t openxcas_provid;
@@ -127,6 +127,9 @@ static void *azbox_main_thread(void *cli)
 	}
 	cs_auth_client(client, ok ? account : (struct s_auth *)(-1), "dvbapi");
 
+	if(!dvbapi_alloc_demux())
+		{ return NULL; }
+
 	dvbapi_read_priority();
 
 	openxcas_msg_t msg;
@@ -204,7 +207,7 @@ static void *azbox_main_thread(void *cli)
 				openxcas_remove_filter(msg.stream_id, OPENXCAS_FILTER_ECM);
 				openxcas_stop_filter_ex(msg.stream_id, msg.sequence, openxcas_filter_idx);
 				openxcas_destory_cipher_ex(msg.stream_id, msg.sequence);
-				memset(&demux, 0, sizeof(demux));
+				dvbapi_clear_demux();
 				break;
 			case OPENXCAS_ECM_CALLBACK:
 				cs_log_dbg(D_DVBAPI, "OPENXCAS_ECM_CALLBACK");
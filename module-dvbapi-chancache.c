@@ -6,64 +6,295 @@
 
 #include "oscam-config.h"
 #include "oscam-ecm.h"
+#include "oscam-garbage.h"
 #include "oscam-string.h"
 #include "module-dvbapi.h"
 #include "module-dvbapi-chancache.h"
 
-extern DEMUXTYPE demux[MAX_DEMUX];
+extern DEMUXTYPE *demux;
 
-static LLIST *channel_cache;
+/* The channel cache is kept in the order entries were added, which is the order
+ * lookups prefer and the order it is saved in. It is indexed by srvid/caid/pid,
+ * the provid is compared inside the bucket since an ecmpid without provid
+ * matches any, and by caid/provid for the caid_and_prid_only lookups.
+ * On exit it is saved as a binary snapshot which is mapped and read in one go
+ * on the next start. The text file of older versions is only read when there
+ * is no usable snapshot. */
+
+#define CHANCACHE_BUCKETS_MIN   256
+#define CHANCACHE_PROV_BUCKETS  64
+#define CHANCACHE_MAGIC         0x4343534F  // "OSCC" in host byte order
+#define CHANCACHE_VERSION       1
+
+struct s_chancache_prov
+{
+	uint16_t                caid;
+	uint32_t                prid;
+	uint32_t                count;
+	struct s_channel_cache  *first;
+	struct s_chancache_prov *next;
+};
+
+struct s_chancache_header
+{
+	uint32_t    magic;
+	uint16_t    version;
+	uint16_t    record_size;
+	uint32_t    count;
+	uint32_t    reserved;
+};
+
+struct s_chancache_record
+{
+	uint16_t    caid;
+	uint16_t    srvid;
+	uint16_t    pid;
+	uint16_t    reserved;
+	uint32_t    prid;
+	uint32_t    chid;
+};
+
+static struct s_channel_cache *chancache_first, *chancache_last;
+static struct s_channel_cache **chancache_hash;
+static uint32_t chancache_buckets, chancache_count;
+static struct s_chancache_prov *chancache_prov[CHANCACHE_PROV_BUCKETS];
+static pthread_mutex_t chancache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t chancache_bucket(uint16_t srvid, uint16_t caid, uint16_t pid)
+{
+	uint32_t h = ((uint32_t)srvid << 16 | caid) * 0x9E3779B1 ^ pid * 0x85EBCA6B;
+	return (h ^ (h >> 15)) & (chancache_buckets - 1);
+}
+
+// Doubles the srvid/caid/pid index, bucket chains keep the cache order
+static int32_t chancache_resize(void)
+{
+	struct s_channel_cache **hash, *c;
+	uint32_t buckets = chancache_buckets ? chancache_buckets * 2 : CHANCACHE_BUCKETS_MIN;
+
+	if(!cs_malloc(&hash, buckets * sizeof(struct s_channel_cache *)))
+		{ return 0; }
+	NULLFREE(chancache_hash);
+	chancache_hash = hash;
+	chancache_buckets = buckets;
+	for(c = chancache_last; c; c = c->prev)
+	{
+		uint32_t b = chancache_bucket(c->srvid, c->caid, c->pid);
+		c->hash_next = chancache_hash[b];
+		chancache_hash[b] = c;
+	}
+	return 1;
+}
+
+static struct s_chancache_prov *chancache_get_prov(uint16_t caid, uint32_t prid, int8_t create)
+{
+	struct s_chancache_prov *prov;
+	uint32_t b = caid % CHANCACHE_PROV_BUCKETS;
+
+	for(prov = chancache_prov[b]; prov; prov = prov->next)
+	{
+		if(prov->caid == caid && prov->prid == prid)
+			{ return prov; }
+	}
+	if(!create || !cs_malloc(&prov, sizeof(struct s_chancache_prov)))
+		{ return NULL; }
+	prov->caid = caid;
+	prov->prid = prid;
+	prov->next = chancache_prov[b];
+	chancache_prov[b] = prov;
+	return prov;
+}
+
+static void chancache_add(struct s_channel_cache *c)
+{
+	struct s_channel_cache **prev;
+
+	c->next = NULL;
+	c->prev = chancache_last;
+	if(chancache_last)
+		{ chancache_last->next = c; }
+	else
+		{ chancache_first = c; }
+	chancache_last = c;
+	chancache_count++;
+
+	c->hash_next = NULL;
+	if((chancache_count <= chancache_buckets * 2 || !chancache_resize()) && chancache_hash) // a new index already holds c
+	{
+		for(prev = &chancache_hash[chancache_bucket(c->srvid, c->caid, c->pid)]; *prev; prev = &(*prev)->hash_next) { ; }
+		*prev = c;
+	}
+
+	c->prov_prev = NULL;
+	if((c->prov = chancache_get_prov(c->caid, c->prid, 1)))
+	{
+		if((c->prov_next = c->prov->first))
+			{ c->prov_next->prov_prev = c; }
+		c->prov->first = c;
+		c->prov->count++;
+	}
+}
+
+static void chancache_remove(struct s_channel_cache *c)
+{
+	struct s_channel_cache **prev;
+
+	if(c->next)
+		{ c->next->prev = c->prev; }
+	else
+		{ chancache_last = c->prev; }
+	if(c->prev)
+		{ c->prev->next = c->next; }
+	else
+		{ chancache_first = c->next; }
+	chancache_count--;
+
+	if(chancache_hash)
+	{
+		for(prev = &chancache_hash[chancache_bucket(c->srvid, c->caid, c->pid)]; *prev && *prev != c; prev = &(*prev)->hash_next) { ; }
+		if(*prev)
+			{ *prev = c->hash_next; }
+	}
+
+	if(c->prov)
+	{
+		if(c->prov_next)
+			{ c->prov_next->prov_prev = c->prov_prev; }
+		if(c->prov_prev)
+			{ c->prov_prev->prov_next = c->prov_next; }
+		else
+			{ c->prov->first = c->prov_next; }
+		c->prov->count--;
+	}
+	add_garbage(c); // lookups hand out entries without holding the lock
+}
+
+static struct s_channel_cache *chancache_new(uint16_t caid, uint32_t prid, uint16_t srvid, uint16_t pid, uint32_t chid)
+{
+	struct s_channel_cache *c;
+
+	if(!cs_malloc(&c, sizeof(struct s_channel_cache)))
+		{ return NULL; }
+	c->caid = caid;
+	c->prid = prid;
+	c->srvid = srvid;
+	c->pid = pid;
+	c->chid = chid;
+	return c;
+}
 
 void dvbapi_save_channel_cache(void)
 {
 	if(boxtype_is("dbox2")) return; // dont save channelcache on these boxes, they lack resources and will crash!
-	
+
 	if (USE_OPENXCAS) // Why?
 		return;
 
-	char fname[256];
-	int32_t result = 0;
-	get_config_filename(fname, sizeof(fname), "oscam.ccache");
-	FILE *file = fopen(fname, "w");
+	char fname[256], tmpname[260];
+	struct s_chancache_header header;
+	struct s_chancache_record rec;
+	struct s_channel_cache *c;
+	int32_t ok;
+
+	get_config_filename(fname, sizeof(fname), "oscam.ccache.bin");
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+	FILE *file = fopen(tmpname, "w");
 
 	if(!file)
 	{
-		cs_log("dvbapi channelcache can't write to file %s", fname);
+		cs_log("dvbapi channelcache can't write to file %s", tmpname);
 		return;
 	}
 
-	LL_ITER it = ll_iter_create(channel_cache);
-	struct s_channel_cache *c;
-	while((c = ll_iter_next(&it)))
+	SAFE_MUTEX_LOCK(&chancache_lock);
+	memset(&header, 0, sizeof(header));
+	header.magic = CHANCACHE_MAGIC;
+	header.version = CHANCACHE_VERSION;
+	header.record_size = sizeof(struct s_chancache_record);
+	header.count = chancache_count;
+	ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	memset(&rec, 0, sizeof(rec));
+	for(c = chancache_first; c && ok; c = c->next)
+	{
+		rec.caid = c->caid;
+		rec.srvid = c->srvid;
+		rec.pid = c->pid;
+		rec.prid = c->prid;
+		rec.chid = c->chid;
+		ok = fwrite(&rec, sizeof(rec), 1, file) == 1;
+	}
+	SAFE_MUTEX_UNLOCK(&chancache_lock);
+
+	if(fclose(file) || !ok || rename(tmpname, fname))
 	{
-		result = fprintf(file, "%04X,%06X,%04X,%04X,%06X\n", c->caid, c->prid, c->srvid, c->pid, c->chid);
-		if(result < 0)
+		if(!remove(tmpname))
 		{
-			fclose(file);
-			result = remove(fname);
-			if(!result)
-			{
-				cs_log("error writing cache -> cache file removed!");
-			}
-			else
-			{
-				cs_log("error writing cache -> cache file could not be removed either!");
-			}
-			return;
+			cs_log("error writing cache -> cache file removed!");
+		}
+		else
+		{
+			cs_log("error writing cache -> cache file could not be removed either!");
 		}
+		return;
 	}
-
-	fclose(file);
 	cs_log("dvbapi channelcache saved to %s", fname);
 }
 
+// Reads the snapshot written by dvbapi_save_channel_cache(), returns 0 if there is none or it is unusable
+static int32_t dvbapi_load_channel_cache_snapshot(void)
+{
+	char fname[256];
+	struct stat st;
+	struct s_chancache_header *header;
+	struct s_chancache_record *rec;
+	struct s_channel_cache *c;
+	uint32_t i;
+	void *map;
+	int32_t fd;
+
+	get_config_filename(fname, sizeof(fname), "oscam.ccache.bin");
+	if((fd = open(fname, O_RDONLY)) < 0)
+		{ return 0; }
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(struct s_chancache_header)
+			|| (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	header = map;
+	if(header->magic != CHANCACHE_MAGIC || header->version != CHANCACHE_VERSION || header->record_size != sizeof(struct s_chancache_record)
+			|| (uint64_t)st.st_size != sizeof(struct s_chancache_header) + (uint64_t)header->count * sizeof(struct s_chancache_record))
+	{
+		cs_log("dvbapi channelcache %s has an unknown format, ignored", fname);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	rec = (struct s_chancache_record *)(header + 1);
+	SAFE_MUTEX_LOCK(&chancache_lock);
+	for(i = 0; i < header->count; i++, rec++)
+	{
+		if(rec->caid && (c = chancache_new(rec->caid, rec->prid, rec->srvid, rec->pid, rec->chid)))
+			{ chancache_add(c); }
+	}
+	SAFE_MUTEX_UNLOCK(&chancache_lock);
+	cs_log("dvbapi channelcache loaded from %s (%u entries)", fname, header->count);
+	munmap(map, st.st_size);
+	return 1;
+}
+
 void dvbapi_load_channel_cache(void)
 {
 	if(boxtype_is("dbox2")) return; // dont load channelcache on these boxes, they lack resources and will crash!
-	
+
 	if (USE_OPENXCAS) // Why?
 		return;
 
+	if(dvbapi_load_channel_cache_snapshot())
+		{ return; }
+
 	char fname[256];
 	char line[1024];
 	FILE *file;
@@ -76,13 +307,14 @@ void dvbapi_load_channel_cache(void)
 		cs_log_dbg(D_TRACE, "dvbapi channelcache can't read from file %s", fname);
 		return;
 	}
-	
+
 	int32_t i = 1;
 	int32_t valid = 0;
 	char *ptr, *saveptr1 = NULL;
 	char *split[6];
 
 	memset(line, 0, sizeof(line));
+	SAFE_MUTEX_LOCK(&chancache_lock);
 	while(fgets(line, sizeof(line), file))
 	{
 		if(!line[0] || line[0] == '#' || line[0] == ';')
@@ -94,117 +326,106 @@ void dvbapi_load_channel_cache(void)
 		}
 
 		valid = (i == 5);
-		if(valid)
+		if(valid && a2i(split[0], 4) != 0)
 		{
-			if(!cs_malloc(&c, sizeof(struct s_channel_cache)))
-			{ continue; }
-			c->caid = a2i(split[0], 4);
-			c->prid = a2i(split[1], 6);
-			c->srvid = a2i(split[2], 4);
-			c->pid = a2i(split[3], 4);
-			c->chid = a2i(split[4], 6);
-
-			if(valid && c->caid != 0)
-			{
-				if(!channel_cache)
-				{
-					channel_cache = ll_create("channel cache");
-				}
-
-				ll_append(channel_cache, c);
-			}
-			else
-			{
-				NULLFREE(c);
-			}
+			if((c = chancache_new(a2i(split[0], 4), a2i(split[1], 6), a2i(split[2], 4), a2i(split[3], 4), a2i(split[4], 6))))
+				{ chancache_add(c); }
 		}
 	}
+	SAFE_MUTEX_UNLOCK(&chancache_lock);
 	fclose(file);
 	cs_log("dvbapi channelcache loaded from %s", fname);
 }
 
-struct s_channel_cache *dvbapi_find_channel_cache(int32_t demux_id, int32_t pidindex, int8_t caid_and_prid_only)
+// First entry in cache order for the ecmpid, a provid of 0 matches every provid
+static struct s_channel_cache *chancache_find(uint16_t srvid, struct s_ecmpids *p)
 {
-	struct s_ecmpids *p = &demux[demux_id].ECMpids[pidindex];
 	struct s_channel_cache *c;
-	LL_ITER it;
 
-	if(!channel_cache)
-		{ channel_cache = ll_create("channel cache"); }
-
-	it = ll_iter_create(channel_cache);
-	while((c = ll_iter_next(&it)))
+	if(!chancache_hash)
+		{ return NULL; }
+	for(c = chancache_hash[chancache_bucket(srvid, p->CAID, p->ECM_PID)]; c; c = c->hash_next)
 	{
+		if(srvid == c->srvid
+				&& p->CAID == c->caid
+				&& p->ECM_PID == c->pid
+				&& (p->PROVID == c->prid || p->PROVID == 0)) // PROVID ==0 some provider no provid in PMT table
+			{ return c; }
+	}
+	return NULL;
+}
 
-		if(caid_and_prid_only)
-		{
-			if(p->CAID == c->caid && (p->PROVID == c->prid || p->PROVID == 0))  // PROVID ==0 some provider no provid in PMT table
-				{ return c; }
-		}
-		else
+struct s_channel_cache *dvbapi_find_channel_cache(int32_t demux_id, int32_t pidindex, int8_t caid_and_prid_only)
+{
+	struct s_ecmpids *p = &demux[demux_id].ECMpids[pidindex];
+	struct s_channel_cache *c = NULL;
+	struct s_chancache_prov *prov;
+
+	SAFE_MUTEX_LOCK(&chancache_lock);
+	if(caid_and_prid_only)
+	{
+		if(p->PROVID == 0) // PROVID ==0 some provider no provid in PMT table
 		{
-			if(demux[demux_id].program_number == c->srvid
-					&& p->CAID == c->caid
-					&& p->ECM_PID == c->pid
-					&& (p->PROVID == c->prid || p->PROVID == 0)) // PROVID ==0 some provider no provid in PMT table
+			for(prov = chancache_prov[p->CAID % CHANCACHE_PROV_BUCKETS]; prov && !c; prov = prov->next)
 			{
-
-#ifdef WITH_DEBUG
-				char buf[ECM_FMT_LEN];
-				ecmfmt(buf, ECM_FMT_LEN, c->caid, 0, c->prid, c->chid, c->pid, c->srvid, 0, 0, 0, 0, 0, 0, NULL, NULL);
-				cs_log_dbg(D_DVBAPI, "Demuxer %d found in channel cache: %s", demux_id, buf);
-#endif
-				return c;
+				if(prov->caid == p->CAID)
+					{ c = prov->first; }
 			}
 		}
+		else if((prov = chancache_get_prov(p->CAID, p->PROVID, 0)))
+			{ c = prov->first; }
 	}
-	return NULL;
+	else
+		{ c = chancache_find(demux[demux_id].program_number, p); }
+	SAFE_MUTEX_UNLOCK(&chancache_lock);
+
+#ifdef WITH_DEBUG
+	if(c && !caid_and_prid_only)
+	{
+		char buf[ECM_FMT_LEN];
+		ecmfmt(buf, ECM_FMT_LEN, c->caid, 0, c->prid, c->chid, c->pid, c->srvid, 0, 0, 0, 0, 0, 0, NULL, NULL);
+		cs_log_dbg(D_DVBAPI, "Demuxer %d found in channel cache: %s", demux_id, buf);
+	}
+#endif
+	return c;
 }
 
 int32_t dvbapi_edit_channel_cache(int32_t demux_id, int32_t pidindex, uint8_t add)
 {
 	struct s_ecmpids *p = &demux[demux_id].ECMpids[pidindex];
 	struct s_channel_cache *c;
-	LL_ITER it;
+	uint16_t srvid = demux[demux_id].program_number;
 	int32_t count = 0;
 
-	if(!channel_cache)
-		{ channel_cache = ll_create("channel cache"); }
-
-	it = ll_iter_create(channel_cache);
-	while((c = ll_iter_next(&it)))
+	SAFE_MUTEX_LOCK(&chancache_lock);
+	while((c = chancache_find(srvid, p)))
 	{
-		if(demux[demux_id].program_number == c->srvid
-				&& p->CAID == c->caid
-				&& p->ECM_PID == c->pid
-				&& (p->PROVID == c->prid || p->PROVID == 0))
+		if(add && p->CHID == c->chid)
 		{
-			if(add && p->CHID == c->chid)
-			{
-				return 0; //already added
-			}
-			ll_iter_remove_data(&it);
-			count++;
+			SAFE_MUTEX_UNLOCK(&chancache_lock);
+			return 0; //already added
 		}
+		chancache_remove(c);
+		count++;
 	}
 
 	if(add)
 	{
-		if(!cs_malloc(&c, sizeof(struct s_channel_cache)))
-			{ return count; }
-		c->srvid = demux[demux_id].program_number;
-		c->caid = p->CAID;
-		c->pid = p->ECM_PID;
-		c->prid = p->PROVID;
-		c->chid = p->CHID;
-		ll_append(channel_cache, c);
+		if(!(c = chancache_new(p->CAID, p->PROVID, srvid, p->ECM_PID, p->CHID)))
+		{
+			SAFE_MUTEX_UNLOCK(&chancache_lock);
+			return count;
+		}
+		chancache_add(c);
+		SAFE_MUTEX_UNLOCK(&chancache_lock);
 #ifdef WITH_DEBUG
 		char buf[ECM_FMT_LEN];
 		ecmfmt(buf, ECM_FMT_LEN, c->caid, 0, c->prid, c->chid, c->pid, c->srvid, 0, 0, 0, 0, 0, 0, NULL, NULL);
 		cs_log_dbg(D_DVBAPI, "Demuxer %d added to channel cache: %s", demux_id, buf);
 #endif
-		count++;
+		return count + 1;
 	}
+	SAFE_MUTEX_UNLOCK(&chancache_lock);
 
 	return count;
 }
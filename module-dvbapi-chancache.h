@@ -3,6 +3,8 @@
 
 #ifdef HAVE_DVBAPI
 
+struct s_chancache_prov;
+
 struct s_channel_cache
 {
 	uint16_t    caid;
@@ -10,6 +12,10 @@ struct s_channel_cache
 	uint16_t    srvid;
 	uint16_t    pid;
 	uint32_t    chid;
+	struct s_channel_cache  *next, *prev;           // cache order
+	struct s_channel_cache  *hash_next;             // next entry in the same srvid/caid/pid bucket
+	struct s_channel_cache  *prov_next, *prov_prev; // entries with the same caid/provid
+	struct s_chancache_prov *prov;
 };
 
 void dvbapi_save_channel_cache(void);
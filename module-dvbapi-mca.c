@@ -46,7 +46,7 @@ int8_t dummy(void)
 
 // These variables are declared in module-dvbapi.c
 extern void *dvbapi_client;
-extern DEMUXTYPE demux[MAX_DEMUX];
+extern DEMUXTYPE *demux;
 
 // These are used in module-dvbapi.c
 int32_t openxcas_provid;
@@ -410,6 +410,9 @@ static void *mca_main_thread(void *cli)
 	}
 	cs_auth_client(client, ok ? account : (struct s_auth *)(-1), "dvbapi");
 
+	if(!dvbapi_alloc_demux())
+		{ return NULL; }
+
 	dvbapi_read_priority();
 
 	openxcas_msg_t msg;
@@ -442,7 +445,7 @@ static void *mca_main_thread(void *cli)
 			case OPENXCAS_START_PMT_ECM:
 				//FIXME: Apparently this is what the original MCA-oscam does
 				cs_log_dbg(D_DVBAPI, "OPENXCAS_STOP_PMT_ECM");
-				memset(&demux, 0, sizeof(demux));
+				dvbapi_clear_demux();
 				memset(&found, 0, sizeof(found));
 
 				cs_log_dbg(D_DVBAPI, "OPENXCAS_START_PMT_ECM");
@@ -493,7 +496,7 @@ static void *mca_main_thread(void *cli)
 				openxcas_remove_filter(msg.stream_id, OPENXCAS_FILTER_ECM);
 				openxcas_stop_filter_ex(msg.stream_id, msg.sequence, openxcas_filter_idx);
 				openxcas_destory_cipher_ex(msg.stream_id, msg.sequence);
-				memset(&demux, 0, sizeof(demux));
+				dvbapi_clear_demux();
 				memset(&found, 0, sizeof(found));
 				break;
 			case OPENXCAS_ECM_CALLBACK:
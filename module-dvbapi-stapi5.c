@@ -73,7 +73,7 @@ static int32_t stapi_do_remove_filter(int32_t demux_id, FILTERTYPE *filter, int3
 // These variables are declared in module-dvbapi.c
 extern int32_t disable_pmt_files;
 extern struct s_dvbapi_priority *dvbapi_priority;
-extern DEMUXTYPE demux[MAX_DEMUX];
+extern DEMUXTYPE *demux;
 
 static int32_t stapi_on;
 static pthread_mutex_t filter_lock;
@@ -23,8 +23,12 @@
 #include "oscam-string.h"
 #include "oscam-time.h"
 #include "oscam-work.h"
+#include "oscam-writer.h"
 #include "reader-irdeto.h"
 #include "cscrypt/md5.h"
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 
 extern int32_t exit_oscam;
 
@@ -257,7 +261,8 @@ int32_t pausecam = 0, disable_pmt_files = 0, pmt_stopmarking = 1;
 int32_t pausecam = 0, disable_pmt_files = 0, pmt_stopmarking = 0;
 #endif
 
-DEMUXTYPE demux[MAX_DEMUX];
+DEMUXTYPE *demux;      // allocated once and never moved, ecm answers read it from other threads
+int32_t demux_max;     // entries in demux, MAX_DEMUX unless raised for network clients
 struct s_dvbapi_priority *dvbapi_priority;
 struct s_client *dvbapi_client;
 
@@ -294,7 +299,92 @@ static char* last_client_name = NULL;
 static int32_t ca_fd[MAX_DEMUX]; // holds fd handle of each ca device 0 = not in use
 static LLIST * ll_activestreampids; // list of all enabled streampids on ca devices
 
-static int32_t unassoc_fd[MAX_DEMUX];
+// state of pmt and network client sockets, indexed by fd and only used by the dvbapi thread
+struct s_dvbapi_conn
+{
+	uchar *buf;             // incomplete message read so far
+	uint16_t buf_len, buf_used;
+	uint16_t proto_version;
+	int8_t unassoc;         // poll it even if no demuxer uses this socket
+	uint32_t poll_round;    // last poll round it was added in
+	int8_t ep_added;        // registered in the epoll set
+	uint32_t ep_round;      // last poll round it was part of the epoll set
+	int32_t ep_slot;        // index in the poll set of that round
+};
+
+static struct s_dvbapi_conn *dvbapi_conn;
+static int32_t dvbapi_conn_count;
+static volatile uint32_t dvbapi_filter_opens; // bumped for every demux device opened, a closed fd may come back with the same number
+
+// fds polled by the dvbapi thread, grown as clients and filters are added
+struct s_dvbapi_pollset
+{
+	struct pollfd *pfd;
+	int32_t *ids, *fdn;
+	int8_t *type;           // 1 = socket, 0 = demux filter
+	int32_t count, size;
+};
+
+// network clients may use more demuxers than a local box has, the platform modules index their own tables by demux id
+static int32_t dvbapi_demux_count(void)
+{
+#if !defined(CARDREADER_STAPI) && !defined(CARDREADER_STAPI5) && !defined(WITH_AZBOX) && !defined(WITH_MCA)
+	if(cfg.dvbapi_listenport && cfg.dvbapi_demuxers > MAX_DEMUX)
+		{ return MIN(cfg.dvbapi_demuxers, MAX_NET_DEMUX); }
+#endif
+	return MAX_DEMUX;
+}
+
+// sets up an unused entry, its answerlock must not be initialized yet
+static void dvbapi_init_demux(int32_t demux_id)
+{
+	int32_t i, j;
+
+	memset(&demux[demux_id], 0 , sizeof(DEMUXTYPE));
+	SAFE_MUTEX_INIT(&demux[demux_id].answerlock, NULL);
+
+	for(i = 0; i < ECM_PIDS; i++)
+	{
+		for(j = 0; j < MAX_STREAM_INDICES; j++)
+		{
+			demux[demux_id].ECMpids[i].index[j] = INDEX_INVALID;
+		}
+	}
+
+	demux[demux_id].pidindex = -1;
+	demux[demux_id].curindex = -1;
+}
+
+bool dvbapi_alloc_demux(void)
+{
+	int32_t i, count;
+
+	if(demux) { return true; }
+
+	count = dvbapi_demux_count();
+	if(!cs_malloc(&demux, sizeof(DEMUXTYPE) * count))
+		{ return false; }
+
+	for(i = 0; i < count; i++)
+		{ dvbapi_init_demux(i); }
+	demux_max = count;
+
+	if(count > MAX_DEMUX)
+		{ cs_log("dvbapi: %d demuxers for network clients", count); }
+	return true;
+}
+
+// forgets all demuxers without touching the devices, used by platforms that manage them on their own
+void dvbapi_clear_demux(void)
+{
+	int32_t i;
+
+	for(i = 0; i < demux_max; i++)
+	{
+		pthread_mutex_destroy(&demux[i].answerlock);
+		dvbapi_init_demux(i);
+	}
+}
 
 bool is_dvbapi_usr(char *usr) {
 	return streq(cfg.dvbapi_usr, usr);
@@ -1089,6 +1179,8 @@ int32_t dvbapi_open_device(int32_t type, int32_t num, int32_t adapter)
 
 	cs_log_dbg(D_DVBAPI, "Open device %s (fd %d)", device_path, dmx_fd);
 
+	if(type == 0)
+		{ dvbapi_filter_opens++; }
 	return dmx_fd;
 }
 
@@ -1289,7 +1381,7 @@ int32_t dvbapi_stop_filternum(int32_t demux_index, int32_t num)
 							int32_t j, k, otherdemuxpid;
 							ca_index_t otherdemuxidx;
 
-							for(j = 0; j < MAX_DEMUX; j++) // check other demuxers for same streampid with same index
+							for(j = 0; j < demux_max; j++) // check other demuxers for same streampid with same index
 							{
 								if(demux[j].program_number == 0) { continue; }  					// skip empty demuxers
 								if(demux_index == j) { continue; } 									// skip same demuxer
@@ -1781,7 +1873,7 @@ ca_index_t dvbapi_get_descindex(int32_t demux_index, int32_t pid, int32_t stream
 	while(fail && idx <= INDEX_MAX)
 	{
 		fail = 0;
-		for(i = 0; i < MAX_DEMUX && !fail && idx <= INDEX_MAX; i++)
+		for(i = 0; i < demux_max && !fail && idx <= INDEX_MAX; i++)
 		{
 			if(demux[i].program_number == 0) { continue; }  // skip empty demuxers
 
@@ -1937,7 +2029,7 @@ void dvbapi_set_pid(int32_t demux_id, int32_t num, ca_index_t idx, bool enable,
 void dvbapi_stop_all_descrambling(void)
 {
 	int32_t j;
-	for(j = 0; j < MAX_DEMUX; j++)
+	for(j = 0; j < demux_max; j++)
 	{
 		if(demux[j].program_number == 0) { continue; }
 		dvbapi_stop_descrambling(j);
@@ -1947,7 +2039,7 @@ void dvbapi_stop_all_descrambling(void)
 void dvbapi_stop_all_emm_sdt_filtering(void)
 {
 	int32_t j;
-	for(j = 0; j < MAX_DEMUX; j++)
+	for(j = 0; j < demux_max; j++)
 	{
 		if(demux[j].program_number == 0) { continue; }
 		dvbapi_stop_filter(j, TYPE_EMM);
@@ -1990,21 +2082,9 @@ void dvbapi_stop_descrambling(int32_t demux_id)
 	dvbapi_stop_filter(demux_id, TYPE_ECM);
 
 	pthread_mutex_destroy(&demux[demux_id].answerlock);
-	memset(&demux[demux_id], 0 , sizeof(DEMUXTYPE));
-	SAFE_MUTEX_INIT(&demux[demux_id].answerlock, NULL);
-
-	for(i = 0; i < ECM_PIDS; i++)
-	{
-		for(j = 0; j < MAX_STREAM_INDICES; j++)
-		{
-			demux[demux_id].ECMpids[i].index[j] = INDEX_INVALID;
-		}
-	}
-
-	demux[demux_id].pidindex = -1;
-	demux[demux_id].curindex = -1;
+	dvbapi_init_demux(demux_id);
 	if (!cfg.dvbapi_listenport && cfg.dvbapi_boxtype != BOXTYPE_PC_NODMX)
-		unlink(ECMINFO_FILE);
+		writer_remove(ECMINFO_FILE);
 	return;
 }
 
@@ -2163,7 +2243,7 @@ int32_t dvbapi_start_descrambling(int32_t demux_id, int32_t pid, int8_t checked)
 		demux[demux_id].ECMpids[pid].status = -1; // flag this pid as unusable
 		dvbapi_edit_channel_cache(demux_id, pid, 0); // remove this pid from channelcache
 	}
-	if(!fake_ecm) { NULLFREE(er); }
+	if(!fake_ecm) { free_ecmtask(er); }
 	return started;
 }
 
@@ -2546,6 +2626,11 @@ void dvbapi_resort_ecmpids(int32_t demux_index)
 	ECM_REQUEST *er;
 	if(!cs_malloc(&er, sizeof(ECM_REQUEST)))
 		{ return; }
+	if(!(er->ecm = ecm_payload_alloc(0))) // reader matching peeks into the (empty) ecm
+	{
+		NULLFREE(er);
+		return;
+	}
 
 	for(prio = dvbapi_priority; prio != NULL; prio = prio->next)
 	{
@@ -2589,7 +2674,7 @@ void dvbapi_resort_ecmpids(int32_t demux_index)
 					cs_log_dbg(D_DVBAPI, "Demuxer %d prio forced%s ecmpid %d %04X@%06X:%04X:%04X (file)", demux_index,
 						((prio->caid == er->caid && prio->caid != er->ocaid) ? " betatunneled" : ""), n, demux[demux_index].ECMpids[n].CAID,
 						demux[demux_index].ECMpids[n].PROVID, demux[demux_index].ECMpids[n].ECM_PID, (uint16_t) prio->chid);
-					NULLFREE(er);
+					free_ecmtask(er);
 					return; // go start descrambling since its forced by user!
 				}
 				else
@@ -2878,7 +2963,7 @@ void dvbapi_resort_ecmpids(int32_t demux_index)
 		cs_log("Demuxer %d found channel in cache and matching prio -> start descrambling ecmpid %d ", demux_index, found);
 	}
 
-	NULLFREE(er);
+	free_ecmtask(er);
 
 	cs_ftime(&end);
 	int64_t gone = comp_timeb(&end, &start);
@@ -3023,7 +3108,7 @@ void request_cw(struct s_client *client, ECM_REQUEST *er, int32_t demux_id, uint
 	if(filternum < 0)
 	{
 		cs_log_dbg(D_DVBAPI, "Demuxer %d not requesting cw -> ecm filter was killed!", demux_id);
-		NULLFREE(er);
+		free_ecmtask(er);
 		return;
 	}
 
@@ -3040,7 +3125,7 @@ void request_cw(struct s_client *client, ECM_REQUEST *er, int32_t demux_id, uint
 			if(demux[demux_id].demux_fd[filternum].prevresult < E_NOTFOUND)
 			{
 				cs_log_dbg(D_DVBAPI, "Demuxer %d not requesting same ecm again! -> SKIP!", demux_id);
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 			else
@@ -3053,7 +3138,7 @@ void request_cw(struct s_client *client, ECM_REQUEST *er, int32_t demux_id, uint
 			if(demux[demux_id].demux_fd[filternum].lastresult < E_NOTFOUND)
 			{
 				cs_log_dbg(D_DVBAPI, "Demuxer %d not requesting same ecm again! -> SKIP!", demux_id);
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 			else
@@ -3207,13 +3292,13 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 
 		if(!pmt_stopmarking && (ca_pmt_list_management == LIST_FIRST || ca_pmt_list_management == LIST_ONLY))
 		{
-			for(i = 0; i < MAX_DEMUX; i++)
+			for(i = 0; i < (uint32_t)demux_max; i++)
 			{
 				if(demux[i].program_number == 0) { continue; }  // skip empty demuxers
 				if(demux[i].socket_fd != connfd) { continue; }  // skip demuxers belonging to other ca pmt connection
 				if((demux[i].socket_fd == -1) && (pmtfile && strcmp(demux[i].pmt_file, pmtfile) != 0)) { continue; } // skip demuxers handled by other pmt files
 				demux[i].stopdescramble = 1; // Mark for deletion if not used again by following pmt objects.
-				cs_log_dbg(D_DVBAPI, "Marked demuxer %d/%d (srvid = %04X fd = %d) to stop decoding", i, MAX_DEMUX, demux[i].program_number, connfd);
+				cs_log_dbg(D_DVBAPI, "Marked demuxer %d/%d (srvid = %04X fd = %d) to stop decoding", i, demux_max, demux[i].program_number, connfd);
 			}
 			pmt_stopmarking = 1; // only stop demuxing for first pmt record
 		}
@@ -3222,7 +3307,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 		cs_log_dbg(D_DVBAPI,"Receiver wants to demux srvid %04X on adapter %04X camask %04X index %04X pmtpid %04X",
 			program_number, adapter_index, ca_mask, demux_index, pmtpid);
 
-		for(i = 0; i < MAX_DEMUX; i++)    // search current demuxers for running the same program as the one we received in this PMT object
+		for(i = 0; i < (uint32_t)demux_max; i++)    // search current demuxers for running the same program as the one we received in this PMT object
 		{
 			if(demux[i].program_number == 0) { continue; }
 			if(cfg.dvbapi_boxtype == BOXTYPE_IPBOX_PMT) demux_index = i; // fixup for ipbox
@@ -3261,7 +3346,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 		// start using the new list
 		if(ca_pmt_list_management != LIST_FIRST && ca_pmt_list_management != LIST_MORE)
 		{
-			for(j = 0; j < MAX_DEMUX; j++)
+			for(j = 0; j < demux_max; j++)
 			{
 				if(demux[j].program_number == 0) { continue; }
 				if(demux[j].stopdescramble == 1) { dvbapi_stop_descrambling(j); }// Stop descrambling and remove all demuxer entries not in new PMT.
@@ -3272,7 +3357,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 
 		if(demux_id == -1)
 		{
-			for(demux_id = 0; demux_id < MAX_DEMUX; demux_id++)
+			for(demux_id = 0; demux_id < demux_max; demux_id++)
 			{
 				if(demux[demux_id].program_number == 0)
 				{
@@ -3305,9 +3390,9 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 			}
 		}
 
-		if(demux_id >= MAX_DEMUX)
+		if(demux_id >= demux_max)
 		{
-			cs_log("ERROR: No free id (MAX_DEMUX)");
+			cs_log("ERROR: No free id (all %d demuxers in use)", demux_max);
 			return -1;
 		}
 
@@ -3437,10 +3522,9 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 	cs_log_dbg(D_DVBAPI,"Demuxer %d serving srvid %04X (%s) on adapter %04X camask %04X index %04X pmtpid %04X", demux_id, demux[demux_id].program_number, channame, adapter_index, ca_mask, demux_index, pmtpid);
 	demux[demux_id].stopdescramble = 0; // remove deletion mark!
 
-	// remove from unassoc_fd when necessary
-	for (j = 0; j < MAX_DEMUX; j++)
-			if (unassoc_fd[j] == connfd)
-					unassoc_fd[j] = 0;
+	// the demuxer polls this socket from now on
+	if(connfd > 0 && connfd < dvbapi_conn_count)
+		{ dvbapi_conn[connfd].unassoc = 0; }
 
 	dvbapi_capmt_notify(&demux[demux_id]);
 
@@ -3461,10 +3545,10 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 
 			cs_log("Mapping ecmpid %04X@%06X:%04X:%04X to xtra demuxer/ca-devices", xtraentry->caid, xtraentry->provid, xtraentry->ecmpid, xtraentry->srvid);
 
-			for(xtra_demux_id = 0; xtra_demux_id < MAX_DEMUX && demux[xtra_demux_id].program_number > 0; xtra_demux_id++)
+			for(xtra_demux_id = 0; xtra_demux_id < demux_max && demux[xtra_demux_id].program_number > 0; xtra_demux_id++)
 				{ ; }
 
-			if(xtra_demux_id >= MAX_DEMUX)
+			if(xtra_demux_id >= demux_max)
 			{
 				cs_log("Found no free demux device for xtra streams.");
 				continue;
@@ -3548,7 +3632,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 
 	if(start_descrambling)
 	{
-		for(j = 0; j < MAX_DEMUX; j++)
+		for(j = 0; j < demux_max; j++)
 		{
 			if(demux[j].program_number == 0) { continue; }
 			if(demux[j].socket_fd != connfd) { continue; }  // skip demuxers belonging to other ca pmt connection
@@ -3559,7 +3643,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 			if(demux[j].running == 0 && demux[j].ECMpidcount != 0 )   // only start demuxer if it wasnt running
 			{
 				dvbapi_stop_all_emm_sdt_filtering(); // remove all unimportant filtering (there are images with limited amount of filters available!)
-				cs_log_dbg(D_DVBAPI, "Demuxer %d/%d lets start descrambling (srvid = %04X fd = %d ecmpids = %d)", j, MAX_DEMUX,
+				cs_log_dbg(D_DVBAPI, "Demuxer %d/%d lets start descrambling (srvid = %04X fd = %d ecmpids = %d)", j, demux_max,
 					demux[j].program_number, connfd, demux[j].ECMpidcount);
 				demux[j].running = 1;  // mark channel as running
 				openxcas_set_sid(demux[j].program_number);
@@ -3570,7 +3654,7 @@ int32_t dvbapi_parse_capmt(unsigned char *buffer, uint32_t length, int32_t connf
 			}
 			else if(demux[j].ECMpidcount == 0) //fta do logging and part of ecmhandler since there will be no ecms asked!
 			{
-				cs_log_dbg(D_DVBAPI, "Demuxer %d/%d no descrambling needed (srvid = %04X fd = %d ecmpids = %d)", j, MAX_DEMUX,
+				cs_log_dbg(D_DVBAPI, "Demuxer %d/%d no descrambling needed (srvid = %04X fd = %d ecmpids = %d)", j, demux_max,
 					demux[j].program_number, connfd, demux[j].ECMpidcount);
 				demux[j].running = 0; // reset running flag
 				demux[demux_id].pidindex = -1; // reset ecmpid used for descrambling
@@ -4107,7 +4191,7 @@ void event_handler(int32_t UNUSED(signal))
 		return;
 	}
 
-	for(i = 0; i < MAX_DEMUX; i++)
+	for(i = 0; i < demux_max; i++)
 	{
 		if(demux[i].pmt_file[0] != 0)
 		{
@@ -4188,7 +4272,7 @@ void event_handler(int32_t UNUSED(signal))
 		}
 
 		int32_t found = 0;
-		for(i = 0; i < MAX_DEMUX; i++)
+		for(i = 0; i < demux_max; i++)
 		{
 			if(strcmp(demux[i].pmt_file, dp->d_name) == 0)
 			{
@@ -4316,7 +4400,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 		return;
 	}
 
-	if(demux_id < 0 || demux_id >= MAX_DEMUX)
+	if(demux_id < 0 || demux_id >= demux_max)
 	{
 		cs_log("dvbapi_process_input(): error -  received invalid demux_id (%d)", demux_id);
 		return;
@@ -4415,7 +4499,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 				chid = get_subid(er); // fetch chid or fake chid
 				er->chid = chid;
 				dvbapi_set_section_filter(demux_id, er, filter_num);
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 
@@ -4475,7 +4559,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 		{
 			curpid->table = 0;
 			dvbapi_set_section_filter(demux_id, er, filter_num);
-			NULLFREE(er);
+			free_ecmtask(er);
 			return;
 		}
 
@@ -4492,14 +4576,14 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 				{
 					if(curpid->table != buffer[0]) curpid->table = 0; // fix for receivers not supporting section filtering
 					dvbapi_set_section_filter(demux_id, er, filter_num); // set ecm filter to odd + even since this ecm doesnt match with current irdeto index
-					NULLFREE(er);
+					free_ecmtask(er);
 					return;
 				}
 			}
 			else //fix for receivers not supporting section filtering
 			{
 				if(curpid->table == buffer[0]){
-					NULLFREE(er);
+					free_ecmtask(er);
 					return;
 				}
 			}
@@ -4529,7 +4613,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 							curpid->CHID = 0x10000;
 						}
 						dvbapi_stop_filternum(demux_id, filter_num); // stop this ecm filter!
-						NULLFREE(er);
+						free_ecmtask(er);
 						return;
 					}
 				}
@@ -4540,7 +4624,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 
 				curpid->table = 0;
 				dvbapi_set_section_filter(demux_id, er, filter_num); // set ecm filter to odd + even since this ecm doesnt match with current irdeto index
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 			else  // all nonirdeto cas systems
@@ -4550,7 +4634,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 				dvbapi_set_section_filter(demux_id, er, filter_num); // set ecm filter to odd + even since this ecm doesnt match with current irdeto index
 				if(forceentry && forceentry->force)
 				{
-					NULLFREE(er);
+					free_ecmtask(er);
 					return; // forced pid? keep trying the forced ecmpid!
 				}
 				if(curpid->checked == 2) { curpid->checked = 4; }
@@ -4560,7 +4644,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 					curpid->CHID = 0x10000;
 				}
 				dvbapi_stop_filternum(demux_id, filter_num); // stop this ecm filter!
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 		}
@@ -4579,7 +4663,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 			if((uint)p->delay == sctlen && p->force < 6)
 			{
 				p->force++;
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 			if(p->force >= 6)
@@ -4595,7 +4679,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 			{
 				curpid->table = 0;
 				dvbapi_set_section_filter(demux_id, er, filter_num); // set ecm filter to odd + even since this ecm doesnt match with current irdeto index
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 		}
@@ -4633,7 +4717,7 @@ void dvbapi_process_input(int32_t demux_id, int32_t filter_num, uchar *buffer, i
 					}
 					dvbapi_stop_filternum(demux_id, filter_num); // stop this ecm filter!
 				}
-				NULLFREE(er);
+				free_ecmtask(er);
 				return;
 			}
 		}
@@ -4913,7 +4997,7 @@ static void dvbapi_handlesockmsg(uchar* mbuf, uint16_t chunksize, uint16_t data_
 				if(cfg.dvbapi_boxtype == BOXTYPE_IPBOX || cfg.dvbapi_boxtype == BOXTYPE_PC_NODMX || cfg.dvbapi_listenport)
 				{
 					int32_t demux_index = mbuf[7];
-					for(i = 0; i < MAX_DEMUX; i++)
+					for(i = 0; i < demux_max; i++)
 					{
 						// 0xff demux_index is a wildcard => close all related demuxers
 						if(demux_index == 0xff)
@@ -4933,7 +5017,7 @@ static void dvbapi_handlesockmsg(uchar* mbuf, uint16_t chunksize, uint16_t data_
 					{
 						// check do we have any demux running on this fd
 						int16_t execlose = 1;
-						for(i = 0; i < MAX_DEMUX; i++)
+						for(i = 0; i < demux_max; i++)
 						{
 							if(demux[i].socket_fd == connfd)
 							{
@@ -4987,7 +5071,7 @@ static void dvbapi_handlesockmsg(uchar* mbuf, uint16_t chunksize, uint16_t data_
 			int32_t demux_id = mbuf[4];
 			int32_t filter_num = mbuf[5];
 
-			if(demux_id < 0 || demux_id >= MAX_DEMUX)
+			if(demux_id < 0 || demux_id >= demux_max)
 			{
 				cs_log("dvbapi_handlesockmsg(): error -  received invalid demux_id (%d)", demux_id);
 				break;
@@ -4999,6 +5083,13 @@ static void dvbapi_handlesockmsg(uchar* mbuf, uint16_t chunksize, uint16_t data_
 				break;
 			}
 
+			// with many network clients a box may only feed its own demuxers
+			if(cfg.dvbapi_listenport && demux[demux_id].socket_fd != connfd)
+			{
+				cs_log_dbg(D_DVBAPI, "dvbapi_handlesockmsg(): demux_id %d does not belong to socket %d", demux_id, connfd);
+				break;
+			}
+
 			dvbapi_process_input(demux_id, filter_num, mbuf + 6, data_len + 3);
 			break;
 		}
@@ -5115,17 +5206,207 @@ static bool dvbapi_handlesockdata(int32_t connfd, uchar* mbuf, uint16_t mbuf_siz
 	return true;
 }
 
+static struct s_dvbapi_conn *dvbapi_get_conn(int32_t fd)
+{
+	struct s_dvbapi_conn *conn;
+	int32_t count;
+
+	if(fd < 0)
+		{ return NULL; }
+	if(fd >= dvbapi_conn_count)
+	{
+		count = (fd + 64) & ~63;
+		if(!cs_malloc(&conn, count * sizeof(struct s_dvbapi_conn)))
+			{ return NULL; }
+		if(dvbapi_conn)
+			{ memcpy(conn, dvbapi_conn, dvbapi_conn_count * sizeof(struct s_dvbapi_conn)); }
+		NULLFREE(dvbapi_conn);
+		dvbapi_conn = conn;
+		dvbapi_conn_count = count;
+	}
+	return &dvbapi_conn[fd];
+}
+
+// forget everything about a socket which was closed or is reused by a new connection
+static void dvbapi_reset_conn(int32_t fd)
+{
+	if(fd < 0 || fd >= dvbapi_conn_count)
+		{ return; }
+	NULLFREE(dvbapi_conn[fd].buf);
+	memset(&dvbapi_conn[fd], 0, sizeof(struct s_dvbapi_conn));
+}
+
+static void dvbapi_free_conns(void)
+{
+	int32_t i;
+
+	for(i = 0; i < dvbapi_conn_count; i++)
+		{ NULLFREE(dvbapi_conn[i].buf); }
+	NULLFREE(dvbapi_conn);
+	dvbapi_conn_count = 0;
+}
+
+static int32_t dvbapi_poll_grow(struct s_dvbapi_pollset *ps, int32_t size)
+{
+	struct pollfd *pfd;
+	int32_t *ids, *fdn;
+	int8_t *type;
+
+	if(!cs_malloc(&pfd, size * sizeof(struct pollfd)))
+		{ return 0; }
+	if(!cs_malloc(&ids, size * sizeof(int32_t) * 2))
+	{
+		NULLFREE(pfd);
+		return 0;
+	}
+	if(!cs_malloc(&type, size * sizeof(int8_t)))
+	{
+		NULLFREE(pfd);
+		NULLFREE(ids);
+		return 0;
+	}
+	fdn = ids + size;
+
+	if(ps->count)
+	{
+		memcpy(pfd, ps->pfd, ps->count * sizeof(struct pollfd));
+		memcpy(ids, ps->ids, ps->count * sizeof(int32_t));
+		memcpy(fdn, ps->fdn, ps->count * sizeof(int32_t));
+		memcpy(type, ps->type, ps->count * sizeof(int8_t));
+	}
+	NULLFREE(ps->pfd);
+	NULLFREE(ps->ids);
+	NULLFREE(ps->type);
+	ps->pfd = pfd;
+	ps->ids = ids;
+	ps->fdn = fdn;
+	ps->type = type;
+	ps->size = size;
+	return 1;
+}
+
+static void dvbapi_poll_free(struct s_dvbapi_pollset *ps)
+{
+	NULLFREE(ps->pfd);
+	NULLFREE(ps->ids);
+	NULLFREE(ps->type);
+	ps->count = ps->size = 0;
+}
+
+static void dvbapi_poll_add(struct s_dvbapi_pollset *ps, int32_t fd, int8_t type, int32_t demux_id, int32_t filter_num)
+{
+	if(ps->count >= ps->size && !dvbapi_poll_grow(ps, ps->size * 2))
+	{
+		cs_log("ERROR: no memory to poll fd %d", fd);
+		return;
+	}
+	ps->pfd[ps->count].fd = fd;
+	ps->pfd[ps->count].events = (POLLIN | POLLPRI);
+	ps->pfd[ps->count].revents = 0;
+	ps->ids[ps->count] = demux_id;
+	ps->fdn[ps->count] = filter_num;
+	ps->type[ps->count] = type;
+	ps->count++;
+}
+
+// adds a client socket once per poll round
+static void dvbapi_poll_add_socket(struct s_dvbapi_pollset *ps, int32_t fd, int32_t demux_id, uint32_t poll_round)
+{
+	struct s_dvbapi_conn *conn = dvbapi_get_conn(fd);
+
+	if(conn)
+	{
+		if(conn->poll_round == poll_round)
+			{ return; }
+		conn->poll_round = poll_round;
+	}
+	dvbapi_poll_add(ps, fd, 1, demux_id, 0);
+}
+
+#if defined(__linux__)
+#define DVBAPI_EPOLL_EVENTS 64
+
+// brings the epoll set in line with the poll set of this round, unchanged fds cost no syscall
+// returns the number of already closed fds flagged with POLLNVAL, -1 if epoll can't be used
+static int32_t dvbapi_epoll_sync(int32_t epfd, struct s_dvbapi_pollset *ps, uint32_t poll_round, int8_t readd_filters)
+{
+	struct s_dvbapi_conn *conn;
+	struct epoll_event ev;
+	int32_t i, fd, closed = 0;
+
+	memset(&ev, 0, sizeof(ev));
+	for(i = 0; i < ps->count; i++)
+	{
+		fd = ps->pfd[i].fd;
+		if(!(conn = dvbapi_get_conn(fd)))
+			{ return -1; }
+		conn->ep_round = poll_round;
+		conn->ep_slot = i;
+		if(conn->ep_added && !(readd_filters && ps->type[i] == 0))
+			{ continue; }
+
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.fd = fd;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+		{
+			if(errno == EBADF) // closed while handling its last message, let the caller clean up as poll would
+			{
+				ps->pfd[i].revents = POLLNVAL;
+				closed++;
+				continue;
+			}
+			cs_log("ERROR: Could not add fd %d to epoll (errno=%d %s)", fd, errno, strerror(errno));
+			return -1;
+		}
+		conn->ep_added = 1;
+	}
+
+	// closed fds already left the set, the kernel drops them on close
+	for(i = 0; i < dvbapi_conn_count; i++)
+	{
+		if(dvbapi_conn[i].ep_added && dvbapi_conn[i].ep_round != poll_round)
+		{
+			epoll_ctl(epfd, EPOLL_CTL_DEL, i, &ev);
+			dvbapi_conn[i].ep_added = 0;
+		}
+	}
+	return closed;
+}
+
+// hands the epoll results to the poll set, returns the number of fds with events
+static int32_t dvbapi_epoll_revents(struct s_dvbapi_pollset *ps, struct epoll_event *events, int32_t count, uint32_t poll_round)
+{
+	struct pollfd *pfd;
+	int32_t i, fd, rc = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		fd = events[i].data.fd;
+		if(fd < 0 || fd >= dvbapi_conn_count || dvbapi_conn[fd].ep_round != poll_round)
+			{ continue; }
+		pfd = &ps->pfd[dvbapi_conn[fd].ep_slot];
+		if(events[i].events & EPOLLIN) { pfd->revents |= POLLIN; }
+		if(events[i].events & EPOLLPRI) { pfd->revents |= POLLPRI; }
+		if(events[i].events & EPOLLERR) { pfd->revents |= POLLERR; }
+		if(events[i].events & EPOLLHUP) { pfd->revents |= POLLHUP; }
+		rc++;
+	}
+	return rc;
+}
+#endif
+
 static void *dvbapi_main_local(void *cli)
 {
-	int32_t i, j, l;
+	int32_t i, j;
 	struct s_client *client = (struct s_client *) cli;
 	client->thread = pthread_self();
 	SAFE_SETSPECIFIC(getclient, cli);
 
 	dvbapi_client = cli;
 
-	int32_t maxpfdsize = (MAX_DEMUX * maxfilter) + MAX_DEMUX + 2;
-	struct pollfd pfd2[maxpfdsize];
+	struct s_dvbapi_pollset ps;
+	struct s_dvbapi_conn *conn;
+	uint32_t poll_round = 0;
 	struct timeb start, end;  // start time poll, end time poll
 #define PMT_SERVER_SOCKET "/tmp/.listen.camd.socket"
 	struct sockaddr_un saddr;
@@ -5133,30 +5414,24 @@ static void *dvbapi_main_local(void *cli)
 	strncpy(saddr.sun_path, PMT_SERVER_SOCKET, 107);
 	saddr.sun_path[107] = '\0';
 
-	int32_t rc, pfdcount, g, connfd, clilen;
-	int32_t ids[maxpfdsize], fdn[maxpfdsize], type[maxpfdsize];
+	int32_t rc, g, connfd, clilen;
 	struct SOCKADDR servaddr;
 	ssize_t len = 0;
 	static const uint16_t mbuf_size = 2048;
 	uchar *mbuf;
-	uint16_t unhandled_buf_len[maxpfdsize], unhandled_buf_used[maxpfdsize];
-	uchar *unhandled_buf[maxpfdsize];
 	struct s_auth *account;
 	int32_t ok = 0;
-	uint16_t client_proto_version[maxpfdsize];
 
 	if(!cs_malloc(&mbuf, sizeof(uchar)*mbuf_size))
 	{
 		return NULL;
 	}
 
-	for(i = 0; i < maxpfdsize; i++)
+	memset(&ps, 0, sizeof(ps));
+	if(!dvbapi_alloc_demux() || !dvbapi_poll_grow(&ps, demux_max + 2))
 	{
-		unhandled_buf[i] = NULL;
-		unhandled_buf_len[i] = 0;
-		unhandled_buf_used[i] = 0;
-
-		client_proto_version[i] = 0;
+		free(mbuf);
+		return NULL;
 	}
 
 	for(account = cfg.account; account != NULL; account = account->next)
@@ -5166,23 +5441,7 @@ static void *dvbapi_main_local(void *cli)
 	}
 	cs_auth_client(client, ok ? account : (struct s_auth *)(-1), "dvbapi");
 
-	memset(demux, 0, sizeof(struct demux_s) * MAX_DEMUX);
-	for(i = 0; i < MAX_DEMUX; i++)
-	{
-		SAFE_MUTEX_INIT(&demux[i].answerlock, NULL);
-		for(j = 0; j < ECM_PIDS; j++)
-		{
-			for(l = 0; l < MAX_STREAM_INDICES; l++)
-			{
-				demux[i].ECMpids[j].index[l] = INDEX_INVALID;
-			}
-		}
-		demux[i].pidindex = -1;
-		demux[i].curindex = -1;
-	}
-
 	memset(ca_fd, 0, sizeof(ca_fd));
-	memset(unassoc_fd, 0, sizeof(unassoc_fd));
 
 	dvbapi_read_priority();
 	dvbapi_load_channel_cache();
@@ -5191,6 +5450,7 @@ static void *dvbapi_main_local(void *cli)
 	if(selected_box == -1 || selected_api == -1)
 	{
 		cs_log("ERROR: Could not detect DVBAPI version.");
+		dvbapi_poll_free(&ps);
 		free(mbuf);
 		return NULL;
 	}
@@ -5208,12 +5468,13 @@ static void *dvbapi_main_local(void *cli)
 		if(listenfd < 1)
 		{
 			cs_log("ERROR: Could not init socket: (errno=%d: %s)", errno, strerror(errno));
+			dvbapi_poll_free(&ps);
 			free(mbuf);
 			return NULL;
 		}
 	}
 
-	for(i = 0; i < MAX_DEMUX; i++)  // init all demuxers!
+	for(i = 0; i < demux_max; i++)  // init all demuxers!
 	{
 		demux[i].pidindex = -1;
 		demux[i].curindex = -1;
@@ -5240,20 +5501,23 @@ static void *dvbapi_main_local(void *cli)
 		int32_t ret = start_thread("dvbapi event", dvbapi_event_thread, (void *) dvbapi_client, NULL, 1, 0);
 		if(ret)
 		{
+			dvbapi_poll_free(&ps);
 			free(mbuf);
 			return NULL;
 		}
 	}
 
-	if(listenfd != -1)
-	{
-		pfd2[0].fd = listenfd;
-		pfd2[0].events = (POLLIN | POLLPRI);
-		type[0] = 1;
-	}
-
 #if defined WITH_COOLAPI || defined WITH_COOLAPI2
 	system("pzapit -rz");
+#endif
+#if defined(__linux__)
+	// with many network clients most fds stay idle, epoll only reports the ready ones
+	struct epoll_event events[DVBAPI_EPOLL_EVENTS];
+	uint32_t filter_opens = dvbapi_filter_opens;
+	int32_t ep_closed = 0;
+	int32_t epfd = epoll_create(DVBAPI_EPOLL_EVENTS);
+	if(epfd < 0)
+		{ cs_log("WARNING: epoll not available, falling back to poll (errno=%d %s)", errno, strerror(errno)); }
 #endif
 	cs_ftime(&start); // register start time
 	while(!exit_oscam)
@@ -5281,9 +5545,7 @@ static void *dvbapi_main_local(void *cli)
 				}
 				else
 				{
-					pfd2[0].fd = listenfd;
-					pfd2[0].events = (POLLIN | POLLPRI);
-					type[0] = 1;
+					dvbapi_reset_conn(listenfd);
 					cs_log("PMT6 CA PMT Server connected on fd %d!", listenfd);
 				}
 			}
@@ -5294,20 +5556,25 @@ static void *dvbapi_main_local(void *cli)
 			}
 
 		}
-		pfdcount = (listenfd > -1) ? 1 : 0;
+		ps.count = 0;
+		poll_round++;
+		if(listenfd > -1)
+			{ dvbapi_poll_add_socket(&ps, listenfd, 0, poll_round); }
 
-		for(i = 0; i < MAX_DEMUX; i++)
+		// add client fd's which are not yet associated with the demux but needs to be polled for data
+		for(i = 0; i < dvbapi_conn_count; i++)
 		{
-			// add client fd's which are not yet associated with the demux but needs to be polled for data
-			if (unassoc_fd[i]) {
-				pfd2[pfdcount].fd = unassoc_fd[i];
-				pfd2[pfdcount].events = (POLLIN | POLLPRI);
-				client_proto_version[pfdcount] = last_client_proto_version;
-				type[pfdcount++] = 1;
-			}
+			if(dvbapi_conn[i].unassoc)
+				{ dvbapi_poll_add_socket(&ps, i, 0, poll_round); }
+		}
 
+		for(i = 0; i < demux_max; i++)
+		{
 			if(demux[i].program_number == 0) { continue; }  // only evalutate demuxers that have channels assigned
 
+			if(demux[i].socket_fd > 0 && cfg.dvbapi_pmtmode != 6)
+				{ dvbapi_poll_add_socket(&ps, demux[i].socket_fd, i, poll_round); }
+
 			uint32_t ecmcounter = 0, emmcounter = 0;
 			for(g = 0; g < maxfilter; g++)
 			{
@@ -5315,11 +5582,7 @@ static void *dvbapi_main_local(void *cli)
 
 				if(!cfg.dvbapi_listenport && cfg.dvbapi_boxtype != BOXTYPE_PC_NODMX && selected_api != STAPI && selected_api != COOLAPI)
 				{
-					pfd2[pfdcount].fd = demux[i].demux_fd[g].fd;
-					pfd2[pfdcount].events = (POLLIN | POLLPRI);
-					ids[pfdcount] = i;
-					fdn[pfdcount] = g;
-					type[pfdcount++] = 0;
+					dvbapi_poll_add(&ps, demux[i].demux_fd[g].fd, 0, i, g);
 				}
 				if(demux[i].demux_fd[g].type == TYPE_ECM) { ecmcounter++; }  // count ecm filters to see if demuxing is possible anyway
 				if(demux[i].demux_fd[g].type == TYPE_EMM) { emmcounter++; }  // count emm filters also
@@ -5460,38 +5723,43 @@ static void *dvbapi_main_local(void *cli)
 					}
 				}
 			}
+		}
 
-			if(demux[i].socket_fd > 0 && cfg.dvbapi_pmtmode != 6)
+#if defined(__linux__)
+		if(epfd > -1)
+		{
+			int8_t readd_filters = filter_opens != dvbapi_filter_opens;
+			filter_opens = dvbapi_filter_opens;
+			if((ep_closed = dvbapi_epoll_sync(epfd, &ps, poll_round, readd_filters)) < 0)
 			{
-				rc = 0;
-				for(j = 0; j < pfdcount; j++)
-				{
-					if(pfd2[j].fd == demux[i].socket_fd)
-					{
-						rc = 1;
-						break;
-					}
-				}
-				if(rc == 1) { continue; }
-
-				pfd2[pfdcount].fd = demux[i].socket_fd;
-				pfd2[pfdcount].events = (POLLIN | POLLPRI);
-				ids[pfdcount] = i;
-				type[pfdcount++] = 1;
+				cs_log("WARNING: falling back to poll");
+				close(epfd);
+				epfd = -1;
+				ep_closed = 0;
 			}
 		}
+#endif
 
 		rc = 0;
 		while(!(listenfd == -1 && cfg.dvbapi_pmtmode == 6))
 		{
-			rc = poll(pfd2, pfdcount, 500);
+#if defined(__linux__)
+			if(epfd > -1)
+			{
+				rc = epoll_wait(epfd, events, DVBAPI_EPOLL_EVENTS, ep_closed ? 0 : 500);
+				if(rc >= 0)
+					{ rc = dvbapi_epoll_revents(&ps, events, rc, poll_round) + ep_closed; }
+			}
+			else
+#endif
+			rc = poll(ps.pfd, ps.count, 500);
 			if(rc < 0) // error occured while polling for fd's with fresh data
 			{
 				if(errno == EINTR || errno == EAGAIN) // try again in case of interrupt
 				{
 					continue;
 				}
-				cs_log("ERROR: error on poll of %d fd's (errno=%d %s)", pfdcount, errno, strerror(errno));
+				cs_log("ERROR: error on poll of %d fd's (errno=%d %s)", ps.count, errno, strerror(errno));
 				break;
 			}
 			else
@@ -5507,46 +5775,43 @@ static void *dvbapi_main_local(void *cli)
 			if (timeout < 0) {
 				cs_log("*** WARNING: BAD TIME AFFECTING WHOLE OSCAM ECM HANDLING ****");
 			}
-			cs_log_dbg(D_TRACE, "New events occurred on %d of %d handlers after %"PRId64" ms inactivity", rc, pfdcount, timeout);
+			cs_log_dbg(D_TRACE, "New events occurred on %d of %d handlers after %"PRId64" ms inactivity", rc, ps.count, timeout);
 			cs_ftime(&start); // register new start time for next poll
 		}
 
-		for(i = 0; i < pfdcount && rc > 0; i++)
+		for(i = 0; i < ps.count && rc > 0; i++)
 		{
-			if(pfd2[i].revents == 0) { continue; }  // skip sockets with no changes
+			struct pollfd *pfd = &ps.pfd[i];
+
+			if(pfd->revents == 0) { continue; }  // skip sockets with no changes
 			rc--; //event handled!
-			cs_log_dbg(D_TRACE, "Now handling fd %d that reported event %d", pfd2[i].fd, pfd2[i].revents);
+			cs_log_dbg(D_TRACE, "Now handling fd %d that reported event %d", pfd->fd, pfd->revents);
 
-			if(pfd2[i].revents & (POLLHUP | POLLNVAL | POLLERR))
+			if(pfd->revents & (POLLHUP | POLLNVAL | POLLERR))
 			{
-				if(type[i] == 1)
+				if(ps.type[i] == 1)
 				{
-					for(j = 0; j < MAX_DEMUX; j++)
+					for(j = 0; j < demux_max; j++)
 					{
-						if(demux[j].socket_fd == pfd2[i].fd)  // if listenfd closes stop all assigned decoding!
+						if(demux[j].socket_fd == pfd->fd)  // if listenfd closes stop all assigned decoding!
 						{
 							dvbapi_stop_descrambling(j);
 						}
-
-						// remove from unassoc_fd when necessary
-						if (unassoc_fd[j] == pfd2[i].fd)
-						{
-							unassoc_fd[j] = 0;
-						}
 					}
-					int32_t ret = close(pfd2[i].fd);
+					dvbapi_reset_conn(pfd->fd);
+					int32_t ret = close(pfd->fd);
 					if(ret < 0 && errno != 9) { cs_log("ERROR: Could not close demuxer socket fd (errno=%d %s)", errno, strerror(errno)); }
-					if(pfd2[i].fd == listenfd && cfg.dvbapi_pmtmode == 6)
+					if(pfd->fd == listenfd && cfg.dvbapi_pmtmode == 6)
 					{
 						listenfd = -1;
 					}
 
-					cs_log_dbg(D_DVBAPI, "Socket %d reported hard connection close", pfd2[i].fd);
+					cs_log_dbg(D_DVBAPI, "Socket %d reported hard connection close", pfd->fd);
 				}
 				else   // type = 0
 				{
-					int32_t demux_index = ids[i];
-					int32_t n = fdn[i];
+					int32_t demux_index = ps.ids[i];
+					int32_t n = ps.fdn[i];
 
 					if(cfg.dvbapi_boxtype != BOXTYPE_SAMYGO)
 					{
@@ -5590,14 +5855,14 @@ static void *dvbapi_main_local(void *cli)
 				continue; // continue with other events
 			}
 
-			if(pfd2[i].revents & (POLLIN | POLLPRI))
+			if(pfd->revents & (POLLIN | POLLPRI))
 			{
-				if(type[i] == 1)
+				if(ps.type[i] == 1)
 				{
 					connfd = -1;         // initially no socket to read from
 					uint8_t add_to_poll = 0; // we may need to additionally poll this socket when no PMT data comes in
 
-					if (pfd2[i].fd == listenfd)
+					if (pfd->fd == listenfd)
 					{
 						if (cfg.dvbapi_pmtmode == 6) {
 							connfd = listenfd;
@@ -5613,36 +5878,37 @@ static void *dvbapi_main_local(void *cli)
 								client->port = ntohs(SIN_GET_PORT(servaddr));
 							}
 							add_to_poll = 1;
+							dvbapi_reset_conn(connfd); // fd may be reused from a closed connection
 
 							if(cfg.dvbapi_pmtmode == 3 || cfg.dvbapi_pmtmode == 0) { disable_pmt_files = 1; }
 
 							if(connfd <= 0)
-								cs_log_dbg(D_DVBAPI, "accept() returns error on fd event %d (errno=%d %s)", pfd2[i].revents, errno, strerror(errno));
+								cs_log_dbg(D_DVBAPI, "accept() returns error on fd event %d (errno=%d %s)", pfd->revents, errno, strerror(errno));
 						}
 					}
 					else
 					{
-						connfd = pfd2[i].fd;
+						connfd = pfd->fd;
 					}
 
 					//reading and completing data from socket
-					if (connfd > 0) {
+					if (connfd > 0 && (conn = dvbapi_get_conn(connfd))) {
 
-						if(unhandled_buf_used[i])
+						if(conn->buf_used)
 						{
-							memcpy(mbuf, unhandled_buf[i], unhandled_buf_used[i]);
+							memcpy(mbuf, conn->buf, conn->buf_used);
 						}
 
-						if(!dvbapi_handlesockdata(connfd, mbuf, mbuf_size, unhandled_buf_used[i], &add_to_poll, &unhandled_buf_used[i], &client_proto_version[i]))
+						if(!dvbapi_handlesockdata(connfd, mbuf, mbuf_size, conn->buf_used, &add_to_poll, &conn->buf_used, &conn->proto_version))
 						{
-							unhandled_buf_used[i] = 0;
+							dvbapi_reset_conn(connfd);
 
 							//client disconnects, stop all assigned decoding
 							cs_log_dbg(D_DVBAPI, "Socket %d reported connection close", connfd);
 							int active_conn = 0; //other active connections counter
 							add_to_poll = 0;
 
-							for (j = 0; j < MAX_DEMUX; j++)
+							for (j = 0; j < demux_max; j++)
 							{
 								if (demux[j].socket_fd == connfd)
 								{
@@ -5652,12 +5918,6 @@ static void *dvbapi_main_local(void *cli)
 								{
 									active_conn++;
 								}
-
-								// remove from unassoc_fd when necessary
-								if (unassoc_fd[j] == connfd)
-								{
-									unassoc_fd[j] = 0;
-								}
 							}
 
 							close(connfd);
@@ -5676,46 +5936,41 @@ static void *dvbapi_main_local(void *cli)
 							continue;
 						}
 
-						if(unhandled_buf_used[i])
+						if(conn->buf_used)
 						{
-							if(unhandled_buf_used[i] > unhandled_buf_len[i])
+							if(conn->buf_used > conn->buf_len)
 							{
-								NULLFREE(unhandled_buf[i]);
+								NULLFREE(conn->buf);
 
-								unhandled_buf_len[i] = unhandled_buf_used[i] < 128 ? 128 : unhandled_buf_used[i];
+								conn->buf_len = conn->buf_used < 128 ? 128 : conn->buf_used;
 
-								if(!cs_malloc(&unhandled_buf[i], sizeof(uchar)*unhandled_buf_len[i]))
+								if(!cs_malloc(&conn->buf, sizeof(uchar)*conn->buf_len))
 								{
-									unhandled_buf_len[i] = 0;
-									unhandled_buf_used[i] = 0;
+									conn->buf_len = 0;
+									conn->buf_used = 0;
 									continue;
 								}
 							}
 
-							memcpy(unhandled_buf[i], mbuf, unhandled_buf_used[i]);
+							memcpy(conn->buf, mbuf, conn->buf_used);
 						}
 
 						// if the connection is new and we read no PMT data, then add it to the poll,
 						// otherwise this socket will not be checked with poll when data arives
 						// because fd it is not yet assigned with the demux
 						if (add_to_poll) {
-							for (j = 0; j < MAX_DEMUX; j++) {
-								if (!unassoc_fd[j]) {
-									unassoc_fd[j] = connfd;
-									break;
-								}
-							}
+							conn->unassoc = 1;
 						}
 					}
 				}
 				else     // type==0
 				{
-					int32_t demux_index = ids[i];
-					int32_t n = fdn[i];
+					int32_t demux_index = ps.ids[i];
+					int32_t n = ps.fdn[i];
 
-					if((int)demux[demux_index].demux_fd[n].fd != pfd2[i].fd) { continue; } // filter already killed, no need to process this data!
+					if((int)demux[demux_index].demux_fd[n].fd != pfd->fd) { continue; } // filter already killed, no need to process this data!
 
-					len = dvbapi_read_device(pfd2[i].fd, mbuf, mbuf_size);
+					len = dvbapi_read_device(pfd->fd, mbuf, mbuf_size);
 					if(len < 0) // serious filterdata read error
 					{
 						dvbapi_stop_filternum(demux_index, n); // stop filter since its giving errors and wont return anything good.
@@ -5734,10 +5989,12 @@ static void *dvbapi_main_local(void *cli)
 		}
 	}
 
-	for(j = 0; j < maxpfdsize; j++)
-	{
-		NULLFREE(unhandled_buf[j]);
-	}
+#if defined(__linux__)
+	if(epfd > -1)
+		{ close(epfd); }
+#endif
+	dvbapi_free_conns();
+	dvbapi_poll_free(&ps);
 	free(mbuf);
 	return NULL;
 }
@@ -5889,7 +6146,7 @@ void dvbapi_send_dcw(struct s_client *client, ECM_REQUEST *er)
 {
 	int32_t i, j, k, handled = 0;
 
-	for(i = 0; i < MAX_DEMUX; i++)
+	for(i = 0; i < demux_max; i++)
 	{
 		uint32_t nocw_write = 0; // 0 = write cw, 1 = dont write cw to hardware demuxer
 		if(demux[i].program_number == 0) { continue; }  // ignore empty demuxers
@@ -6289,8 +6546,10 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 #define ECMINFO_TYPE_CCCAM		4
 #define ECMINFO_TYPE_CAMD3		5
 
-	FILE *ecmtxt = fopen(ECMINFO_FILE, "w");
-	if(ecmtxt != NULL && er->rc < E_NOTFOUND)
+	// the file is rewritten by the file writer thread, an unanswered ecm leaves it empty
+	struct s_writer_buf ecmtxt;
+	ecmtxt.len = 0;
+	if(er->rc < E_NOTFOUND)
 	{
 		char tmp[25];
 		const char *reader_name = NULL, *from_name = NULL, *proto_name = NULL;
@@ -6306,25 +6565,25 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 		{
 			if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_WICARDD)
 			{
-				fprintf(ecmtxt, "system: %s\n", system_name);
+				writer_buf_printf(&ecmtxt, "system: %s\n", system_name);
 			}
 
-			fprintf(ecmtxt, "caid: 0x%04X\npid: 0x%04X\n", er->caid, er->pid);
+			writer_buf_printf(&ecmtxt, "caid: 0x%04X\npid: 0x%04X\n", er->caid, er->pid);
 
 			if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_WICARDD)
 			{
-				fprintf(ecmtxt, "prov: %06X\n", (uint) er->prid);
+				writer_buf_printf(&ecmtxt, "prov: %06X\n", (uint) er->prid);
 			}
 			else
 			{
-				fprintf(ecmtxt, "prov: 0x%06X\n", (uint) er->prid);
+				writer_buf_printf(&ecmtxt, "prov: 0x%06X\n", (uint) er->prid);
 			}
 
-			fprintf(ecmtxt, "chid: 0x%04X\n", er->chid);
+			writer_buf_printf(&ecmtxt, "chid: 0x%04X\n", er->chid);
 		}
 		else if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_MGCAMD)
 		{
-			fprintf(ecmtxt, "===== %s ECM on CaID  0x%04X, pid 0x%04X =====\nprov: %06X\n", system_name, er->caid, er->pid, (uint) er->prid);
+			writer_buf_printf(&ecmtxt, "===== %s ECM on CaID  0x%04X, pid 0x%04X =====\nprov: %06X\n", system_name, er->caid, er->pid, (uint) er->prid);
 		}
 		else if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_CCCAM)
 		{
@@ -6332,17 +6591,17 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 			get_providername(er->prid, er->caid, provider_name, sizeof(provider_name));
 			if(provider_name[0])
 			{
-				fprintf(ecmtxt, "system: %s\ncaid: 0x%04X\nprovider: %s\nprovid: 0x%06X\npid: 0x%04X\n",
+				writer_buf_printf(&ecmtxt, "system: %s\ncaid: 0x%04X\nprovider: %s\nprovid: 0x%06X\npid: 0x%04X\n",
 							system_name, er->caid, provider_name, (uint) er->prid, er->pid);
 			}
 			else
 			{
-				fprintf(ecmtxt, "system: %s\ncaid: 0x%04X\nprovid: 0x%06X\npid: 0x%04X\n", system_name, er->caid, (uint) er->prid, er->pid);
+				writer_buf_printf(&ecmtxt, "system: %s\ncaid: 0x%04X\nprovid: 0x%06X\npid: 0x%04X\n", system_name, er->caid, (uint) er->prid, er->pid);
 			}
 		}
 		else if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_CAMD3)
 		{
-			fprintf(ecmtxt, "CAID 0x%04X, PID 0x%04X, PROVIDER 0x%06X\n", er->caid, er->pid, (uint) er->prid);
+			writer_buf_printf(&ecmtxt, "CAID 0x%04X, PID 0x%04X, PROVIDER 0x%06X\n", er->caid, er->pid, (uint) er->prid);
 		}
 
 		switch(er->rc)
@@ -6394,33 +6653,33 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 			case E_FOUND:
 				if(er->selected_reader)
 				{
-					fprintf(ecmtxt, "reader: %s\nfrom: %s\nprotocol: %s\nhops: %d\n", reader_name, from_name, proto_name, hops);
+					writer_buf_printf(&ecmtxt, "reader: %s\nfrom: %s\nprotocol: %s\nhops: %d\n", reader_name, from_name, proto_name, hops);
 				}
 				break;
 
 			case E_CACHE1:
 			case E_CACHE2:
 			case E_CACHEEX:
-				fprintf(ecmtxt, "reader: %s\nfrom: %s\nprotocol: %s\n", reader_name, from_name, proto_name);
+				writer_buf_printf(&ecmtxt, "reader: %s\nfrom: %s\nprotocol: %s\n", reader_name, from_name, proto_name);
 				break;
 			}
 
 			if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_OSCAM)
-				{ fprintf(ecmtxt, "ecm time: %.3f\n", (float) client->cwlastresptime / 1000); }
+				{ writer_buf_printf(&ecmtxt, "ecm time: %.3f\n", (float) client->cwlastresptime / 1000); }
 			else
-				{ fprintf(ecmtxt, "ecm time: %d\n", client->cwlastresptime); }
+				{ writer_buf_printf(&ecmtxt, "ecm time: %d\n", client->cwlastresptime); }
 		}
 
 		if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_CAMD3)
 		{
-			fprintf(ecmtxt, "FROM: %s\n", reader_name);
-			fprintf(ecmtxt, "CW0: %s\n", cs_hexdump(1, lastcw0, 8, tmp, sizeof(tmp)));
-			fprintf(ecmtxt, "CW1: %s\n", cs_hexdump(1, lastcw1, 8, tmp, sizeof(tmp)));
+			writer_buf_printf(&ecmtxt, "FROM: %s\n", reader_name);
+			writer_buf_printf(&ecmtxt, "CW0: %s\n", cs_hexdump(1, lastcw0, 8, tmp, sizeof(tmp)));
+			writer_buf_printf(&ecmtxt, "CW1: %s\n", cs_hexdump(1, lastcw1, 8, tmp, sizeof(tmp)));
 		}
 		else
 		{
-			fprintf(ecmtxt, "cw0: %s\n", cs_hexdump(1, lastcw0, 8, tmp, sizeof(tmp)));
-			fprintf(ecmtxt, "cw1: %s\n", cs_hexdump(1, lastcw1, 8, tmp, sizeof(tmp)));
+			writer_buf_printf(&ecmtxt, "cw0: %s\n", cs_hexdump(1, lastcw0, 8, tmp, sizeof(tmp)));
+			writer_buf_printf(&ecmtxt, "cw1: %s\n", cs_hexdump(1, lastcw1, 8, tmp, sizeof(tmp)));
 		}
 
 		if(cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_WICARDD || cfg.dvbapi_ecminfo_type == ECMINFO_TYPE_MGCAMD)
@@ -6429,11 +6688,11 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 			struct tm lt;
 			char timebuf[32];
 
-			fprintf(ecmtxt, "Signature %s\n", (isValidCW(lastcw0) || isValidCW(lastcw1)) ? "OK" : "NOK");
+			writer_buf_printf(&ecmtxt, "Signature %s\n", (isValidCW(lastcw0) || isValidCW(lastcw1)) ? "OK" : "NOK");
 
 			if(reader_name != NULL)
 			{
-				fprintf(ecmtxt, "source: %s (%s at %s:%d)\n", reader_name, proto_name, from_name, from_port);
+				writer_buf_printf(&ecmtxt, "source: %s (%s at %s:%d)\n", reader_name, proto_name, from_name, from_port);
 			}
 
 			walltime = cs_time();
@@ -6441,7 +6700,7 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 
 			if(strftime(timebuf, 32, "%a %b %d %H:%M:%S %Y", &lt) != 0)
 			{
-				fprintf(ecmtxt, "%d msec -- %s\n", client->cwlastresptime, timebuf);
+				writer_buf_printf(&ecmtxt, "%d msec -- %s\n", client->cwlastresptime, timebuf);
 			}
 		}
 
@@ -6449,19 +6708,14 @@ void dvbapi_write_ecminfo_file(struct s_client *client, ECM_REQUEST *er, uint8_t
 		{
 			if(reader_name != NULL)
 			{
-				fprintf(ecmtxt, "using: %s\naddress: %s:%d\nhops: %d\n", proto_name, from_name, from_port, hops);
+				writer_buf_printf(&ecmtxt, "using: %s\naddress: %s:%d\nhops: %d\n", proto_name, from_name, from_port, hops);
 			}
 
-			fprintf(ecmtxt, "ecm time: %d\n", client->cwlastresptime);
+			writer_buf_printf(&ecmtxt, "ecm time: %d\n", client->cwlastresptime);
 		}
 	}
 
-	if(ecmtxt)
-	{
-		int32_t ret = fclose(ecmtxt);
-		if(ret < 0) { cs_log("ERROR: Could not close ecmtxt fd (errno=%d %s)", errno, strerror(errno)); }
-		ecmtxt = NULL;
-	}
+	writer_replace(ECMINFO_FILE, ecmtxt.data, ecmtxt.len);
 }
 
 
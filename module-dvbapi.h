@@ -26,7 +26,8 @@
 #define ECMINFO_FILE    "/tmp/ecm.info"
 #endif
 
-#define MAX_DEMUX 16
+#define MAX_DEMUX 16        // demuxers of a local box, also the number of ca devices
+#define MAX_NET_DEMUX 255   // network clients address demuxers with one byte, 0xff is the wildcard
 #define MAX_CAID 50
 #define ECM_PIDS 30
 #define MAX_FILTER 32
@@ -393,6 +394,8 @@ static inline void openxcas_set_provid(uint32_t UNUSED(_provid)) { }
 #endif
 
 bool is_dvbapi_usr(char *usr);
+bool dvbapi_alloc_demux(void);
+void dvbapi_clear_demux(void);
 static inline bool module_dvbapi_enabled(void) { return cfg.dvbapi_enabled; }
 #else
 static inline void dvbapi_stop_all_descrambling(void) { }
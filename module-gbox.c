@@ -20,6 +20,7 @@
 #include "oscam-reader.h"
 #include "oscam-garbage.h"
 #include "oscam-files.h"
+#include "oscam-writer.h"
 
 #define RECEIVE_BUFFER_SIZE	1024
 #define MIN_GBOX_MESSAGE_LENGTH	10 //CMD + pw + pw. TODO: Check if is really min
@@ -119,23 +120,20 @@ static void write_attack_file (struct s_client *cli, uint8_t txt_id, uint16_t rc
 	cs_ctime_r(&walltime, tsbuf);
 	char *fext= FILE_ATTACK_INFO; 
 	char *fname = get_gbox_tmp_fname(fext); 
-	FILE *fhandle = fopen(fname, "a");
-	if(!fhandle)
-	{
-		cs_log("Couldn't open %s: %s", fname, strerror(errno));
-		return;
-	}
+	struct s_writer_buf line; // an attacking peer must not keep us busy with file writes
+	line.len = 0;
 	if(txt_id == GBOX_ATTACK_LOCAL_PW)
-	{fprintf(fhandle, "ATTACK ALERT FROM %04X  %s - peer sends wrong local password - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
+	{writer_buf_printf(&line, "ATTACK ALERT FROM %04X  %s - peer sends wrong local password - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
 	if(txt_id == GBOX_ATTACK_PEER_IGNORE)
-	{fprintf(fhandle, "ATTACK ALERT FROM %04X  %s - peer is ignored - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
+	{writer_buf_printf(&line, "ATTACK ALERT FROM %04X  %s - peer is ignored - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
 	if(txt_id == GBOX_ATTACK_PEER_PW)
-	{fprintf(fhandle, "ATTACK ALERT FROM %04X  %s - peer sends unknown peer password - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
+	{writer_buf_printf(&line, "ATTACK ALERT FROM %04X  %s - peer sends unknown peer password - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
 	if(txt_id == GBOX_ATTACK_AUTH_FAIL)
-	{fprintf(fhandle, "ATTACK ALERT FROM %04X  %s - authentification failed - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
+	{writer_buf_printf(&line, "ATTACK ALERT FROM %04X  %s - authentification failed - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
 	if(txt_id == GBOX_ATTACK_ECM_BLOCKED)
-	{fprintf(fhandle, "ATTACK ALERT FROM %04X  %s - ECM is blocked - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
-	fclose(fhandle);
+	{writer_buf_printf(&line, "ATTACK ALERT FROM %04X  %s - ECM is blocked - %s", rcvd_id, cs_inet_ntoa(cli->ip), tsbuf);}
+	if(line.len)
+		{ writer_append(fname, line.data, line.len, FILE_ATTACK_INFO_MAX); }
 	return;
 }
 
@@ -862,7 +860,7 @@ static int8_t gbox_incoming_ecm(struct s_client *cli, uchar *data, int32_t n)
 	struct gbox_ecm_request_ext *ere;
 	if(!cs_malloc(&ere, sizeof(struct gbox_ecm_request_ext)))
 	{
-		NULLFREE(er);
+		free_ecmtask(er);
 		return -1;
 	}
 
@@ -879,7 +877,7 @@ static int8_t gbox_incoming_ecm(struct s_client *cli, uchar *data, int32_t n)
 	er->ecmlen = SCT_LEN(ecm);
 
 	if(er->ecmlen < 3 || er->ecmlen > MAX_ECM_SIZE || er->ecmlen+18 > n)
-		{ NULLFREE(ere); NULLFREE(er); return -1; }
+		{ NULLFREE(ere); free_ecmtask(er); return -1; }
 
 	er->pid = b2i(2, data + 10);
 	er->srvid = b2i(2, data + 12);
@@ -1000,14 +998,11 @@ static int8_t gbox_cw_received(struct s_client *cli, uchar *data, int32_t n)
 	if(idx < 0) { return -1; }  // no dcw received
 	if(!idx) { idx = cli->last_idx; }
 	cli->reader->last_g = time((time_t *)0); // for reconnect timeout
-	for(i = 0; i < cfg.max_pending; i++)
+	if((i = casc_get_ecmtask(cli, idx)) >= 0)
 	{
-		if(cli->ecmtask[i].idx == idx)
-		{
-			cli->pending--;
-			casc_check_dcw(cli->reader, i, rc, dcw);
-			return 0;
-		}
+		cli->pending--;
+		casc_check_dcw(cli->reader, i, rc, dcw);
+		return 0;
 	}
 	return -1;
 }
@@ -44,6 +44,7 @@
 #define FILE_SHARED_CARDS_INFO  "share.info"
 #define FILE_BACKUP_CARDS_INFO  "expired.info"
 #define FILE_ATTACK_INFO        "attack.txt"
+#define FILE_ATTACK_INFO_MAX    1024    // kB before attack.txt is rotated to attack.txt-prev
 #define FILE_GBOX_PEER_ONL      "share.onl"
 #define FILE_STATS              "stats.info"
 #define FILE_MSG_INFO           "msg.info"
@@ -8,12 +8,31 @@
 #include "oscam-reader.h"
 #include "oscam-work.h"
 #include "module-dvbapi.h"
+#include "module-ghttp.h"
 #ifdef WITH_SSL
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #endif
 
+/* Requests are pipelined on one keep-alive connection. The server answers them
+ * in the order they were sent, so every request leaves an entry in the inflight
+ * ring telling which ecms wait for its answer. An ecm whose hash is already on
+ * the way joins that request instead of sending another one. Responses are
+ * collected in a receive buffer until they are complete. */
+
+#define GHTTP_MAX_INFLIGHT  32      // requests sent and not answered yet
+#define GHTTP_MAX_WAITING   4       // ecms waiting for the answer of one request
+#define GHTTP_RBUF_SIZE     2048    // initial size of the receive buffer
+
+typedef struct
+{
+	uint32_t hash;                      // ecm hash as used in the cache get
+	int8_t   odd;
+	int8_t   count;                     // waiting ecms, 0 for capmt notifies
+	int32_t  idx[GHTTP_MAX_WAITING];    // ecmtask idx of the waiting ecms
+} s_ghttp_req;
+
 typedef struct
 {
 	uchar *session_id;
@@ -21,7 +40,13 @@ typedef struct
 	uchar *fallback_id;
 	pthread_mutex_t conn_mutex;
 	LLIST *post_contexts;
-	LLIST *ecm_q;
+	s_ghttp_req inflight[GHTTP_MAX_INFLIGHT];
+	int32_t inflight_first;
+	int32_t inflight_count;
+	uchar *rbuf;                        // only the reader thread touches the receive buffer
+	int32_t rlen;
+	int32_t rsize;
+	int8_t rbuf_stale;                  // connection reset, the buffered responses are void
 #ifdef WITH_SSL
 	SSL *ssl_handle;
 #endif
@@ -40,7 +65,36 @@ static LLIST *ghttp_ignored_contexts;
 static SSL_CTX *ghttp_ssl_context;
 #endif
 
-static int32_t _ghttp_post_ecmdata(struct s_client *client, ECM_REQUEST *er);
+static int32_t _ghttp_post_ecmdata(struct s_client *client, ECM_REQUEST *er, s_ghttp_req *req);
+
+// Forgets the requests sent on the connection, called with conn_mutex held.
+// The unread responses are emptied by the reader thread, see _ghttp_drop_stale().
+static void _ghttp_reset(s_ghttp *context)
+{
+	context->inflight_first = 0;
+	context->inflight_count = 0;
+	context->rbuf_stale = 1;
+}
+
+// Empties the receive buffer after a reset from any thread, called with conn_mutex held
+static bool _ghttp_drop_stale_locked(s_ghttp *context)
+{
+	if(!context->rbuf_stale)
+		{ return false; }
+	context->rbuf_stale = 0;
+	context->rlen = 0;
+	return true;
+}
+
+static bool _ghttp_drop_stale(s_ghttp *context)
+{
+	bool stale;
+
+	SAFE_MUTEX_LOCK(&context->conn_mutex);
+	stale = _ghttp_drop_stale_locked(context);
+	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
+	return stale;
+}
 
 #ifdef WITH_SSL
 static bool _ssl_connect(struct s_client *client, int32_t fd)
@@ -58,10 +112,10 @@ static bool _ssl_connect(struct s_client *client, int32_t fd)
 	context->ssl_handle = SSL_new(ghttp_ssl_context);
 	if(context->ssl_handle == NULL)
 	{
-		ERR_print_errors_fp(stderr);
+		ERR_print_errors_fp(stderr);
 #if OPENSSL_VERSION_NUMBER < 0x1010005fL
 		ERR_remove_state(0);
-#endif
+#endif
 		return false;
 	}
 	if(!SSL_set_fd(context->ssl_handle, fd))
@@ -69,7 +123,7 @@ static bool _ssl_connect(struct s_client *client, int32_t fd)
 		ERR_print_errors_fp(stderr);
 #if OPENSSL_VERSION_NUMBER < 0x1010005fL
 		ERR_remove_state(0);
-#endif
+#endif
 		return false;
 	}
 	if(SSL_connect(context->ssl_handle) != 1)
@@ -77,7 +131,7 @@ static bool _ssl_connect(struct s_client *client, int32_t fd)
 		ERR_print_errors_fp(stderr);
 #if OPENSSL_VERSION_NUMBER < 0x1010005fL
 		ERR_remove_state(0);
-#endif
+#endif
 	}
 
 	if(context->ssl_handle)
@@ -92,7 +146,7 @@ static bool _ssl_connect(struct s_client *client, int32_t fd)
 
 int32_t ghttp_client_init(struct s_client *cl)
 {
-	int32_t handle;
+	int32_t handle, no_delay = 1;
 	char *str = NULL;
 
 	ghttp_ignored_contexts = ll_create("ignored contexts");
@@ -103,7 +157,7 @@ int32_t ghttp_client_init(struct s_client *cl)
 		ERR_print_errors_fp(stderr);
 #if OPENSSL_VERSION_NUMBER < 0x1010005fL
 		ERR_remove_state(0);
-#endif
+#endif
 	}
 #endif
 
@@ -124,6 +178,8 @@ int32_t ghttp_client_init(struct s_client *cl)
 
 	handle = network_tcp_connection_open(cl->reader);
 	if(handle < 0) { return -1; }
+	// pipelined requests must not wait for the ack of the previous one
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (void *)&no_delay, sizeof(no_delay));
 
 	cl->reader->tcp_connected = 2;
 	cl->reader->card_status = CARD_INSERTED;
@@ -136,11 +192,10 @@ int32_t ghttp_client_init(struct s_client *cl)
 		if(!cs_malloc(&(cl->ghttp), sizeof(s_ghttp))) { return -1; }
 		memset(cl->ghttp, 0, sizeof(s_ghttp));
 		((s_ghttp *)cl->ghttp)->post_contexts = ll_create("post contexts");
-		((s_ghttp *)cl->ghttp)->ecm_q = ll_create("ecm queue");
 	}
 	else
 	{
-		ll_clear(((s_ghttp *)cl->ghttp)->ecm_q);
+		_ghttp_reset((s_ghttp *)cl->ghttp);
 	}
 
 	if(cl->reader->ghttp_use_ssl)
@@ -195,59 +250,145 @@ static int32_t ghttp_send_int(struct s_client *client, uchar *buf, int32_t l)
 	return send(client->pfd, buf, l, 0);
 }
 
-static int32_t ghttp_send(struct s_client *client, uchar *buf, int32_t l)
+// Sends a request and queues the ecms waiting for its answer in the same order
+static int32_t ghttp_send(struct s_client *client, uchar *buf, int32_t l, s_ghttp_req *req)
 {
 	s_ghttp *context = (s_ghttp *)client->ghttp;
+	int32_t ret = -1;
+
 	SAFE_MUTEX_LOCK(&context->conn_mutex);
-	int32_t ret = ghttp_send_int(client, buf, l);
+	if(context->inflight_count < GHTTP_MAX_INFLIGHT)
+	{
+		ret = ghttp_send_int(client, buf, l);
+		if(ret == l)
+		{
+			context->inflight[(context->inflight_first + context->inflight_count) % GHTTP_MAX_INFLIGHT] = *req;
+			context->inflight_count++;
+		}
+		else
+		{
+			// a partly sent request breaks the order of the answers
+			network_tcp_connection_close(client->reader, "send error");
+			_ghttp_reset(context);
+			ret = -1;
+		}
+	}
 	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
 	return ret;
 }
 
-static int32_t ghttp_recv_int(struct s_client *client, uchar *buf, int32_t l)
+// Attaches an ecm to a request for the same hash which is on the way already
+static bool _ghttp_join_inflight(s_ghttp *context, uint32_t hash, int8_t odd, int32_t idx)
 {
-	int32_t n = -1;
-	s_ghttp *context = (s_ghttp *)client->ghttp;
+	s_ghttp_req *req;
+	int32_t i;
+	bool joined = false;
 
-	if(!client->pfd)
+	SAFE_MUTEX_LOCK(&context->conn_mutex);
+	for(i = 0; i < context->inflight_count; i++)
 	{
-		ll_clear(context->ecm_q);
-		return -1;
+		req = &context->inflight[(context->inflight_first + i) % GHTTP_MAX_INFLIGHT];
+		if(req->count && req->count < GHTTP_MAX_WAITING && req->hash == hash && req->odd == odd)
+		{
+			req->idx[req->count++] = idx;
+			joined = true;
+			break;
+		}
 	}
+	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
+	return joined;
+}
 
-	if(client->reader->ghttp_use_ssl)
+static bool _ghttp_pop_inflight(s_ghttp *context, s_ghttp_req *req)
+{
+	bool found = false;
+
+	SAFE_MUTEX_LOCK(&context->conn_mutex);
+	if(context->inflight_count)
 	{
-#ifdef WITH_SSL
-		n = SSL_read(context->ssl_handle, buf, l);
-#endif
+		*req = context->inflight[context->inflight_first];
+		context->inflight_first = (context->inflight_first + 1) % GHTTP_MAX_INFLIGHT;
+		context->inflight_count--;
+		found = true;
 	}
-	else { n = cs_recv(client->pfd, buf, l, 0); }
+	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
+	return found;
+}
 
-	if(n > 0)
-	{
-		cs_log_dbg(D_CLIENT, "%s: received %d bytes from %s", client->reader->label, n, remote_txt());
-		client->last = time((time_t *)0);
+static void _ghttp_close(struct s_client *client, char *reason)
+{
+	s_ghttp *context = (s_ghttp *)client->ghttp;
+
+	SAFE_MUTEX_LOCK(&context->conn_mutex);
+	network_tcp_connection_close(client->reader, reason);
+	_ghttp_reset(context);
+	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
+}
 
-		if(n > 400)
+static int32_t _ghttp_read(struct s_client *client, s_ghttp *context)
+{
+	int32_t size;
+
+	if(context->rlen == context->rsize)
+	{
+		if(context->rsize >= GHTTP_RBUF_MAX)
 		{
-			buf[n] = '\0';
-			cs_log_dbg(D_CLIENT, "%s: unexpected reply size %d - %s", client->reader->label, n, buf);
-			return -1; // assumes google error, disconnects
+			cs_log_dbg(D_CLIENT, "%s: response exceeds %d bytes", client->reader->label, GHTTP_RBUF_MAX);
+			return -1;
 		}
+		size = context->rsize ? MIN(context->rsize * 2, GHTTP_RBUF_MAX) : GHTTP_RBUF_SIZE;
+		if(!cs_realloc(&context->rbuf, size))
+			{ return -1; }
+		context->rsize = size;
+	}
+#ifdef WITH_SSL
+	if(client->reader->ghttp_use_ssl)
+		{ return SSL_read(context->ssl_handle, context->rbuf + context->rlen, context->rsize - context->rlen); }
+#endif
+	return cs_recv(client->pfd, context->rbuf + context->rlen, context->rsize - context->rlen, 0);
+}
+
+// Appends what the connection has to the receive buffer, ghttp_recv_chk() takes the complete responses
+static int32_t ghttp_recv_int(struct s_client *client)
+{
+	int32_t n, total = 0;
+	s_ghttp *context = (s_ghttp *)client->ghttp;
+
+	if(!client->pfd)
+	{
+		_ghttp_reset(context);
+		return -1;
 	}
-	if(n < 5)
+	_ghttp_drop_stale_locked(context);
+
+	for(;;)
 	{
-		cs_log_dbg(D_CLIENT, "%s: read %d bytes, disconnecting", client->reader->label, n);
-		n = -1;
+		n = _ghttp_read(client, context);
+		if(n <= 0)
+		{
+			cs_log_dbg(D_CLIENT, "%s: read %d bytes, disconnecting", client->reader->label, n);
+			return -1;
+		}
+		context->rlen += n;
+		total += n;
+#ifdef WITH_SSL
+		// data openssl has decrypted already is not signalled on the socket again
+		if(client->reader->ghttp_use_ssl && SSL_pending(context->ssl_handle) > 0)
+			{ continue; }
+#endif
+		break;
 	}
-	return n;
+
+	cs_log_dbg(D_CLIENT, "%s: received %d bytes from %s", client->reader->label, total, remote_txt());
+	client->last = time((time_t *)0);
+	return total;
 }
 
-static int32_t ghttp_recv(struct s_client *client, uchar *buf, int32_t l)
+static int32_t ghttp_recv(struct s_client *client, uchar *UNUSED(buf), int32_t UNUSED(l))
 {
 	s_ghttp *context = (s_ghttp *)client->ghttp;
 	SAFE_MUTEX_LOCK(&context->conn_mutex);
-	int32_t ret = ghttp_recv_int(client, buf, l);
+	int32_t ret = ghttp_recv_int(client);
 	SAFE_MUTEX_UNLOCK(&context->conn_mutex);
 	return ret;
 }
@@ -318,7 +459,6 @@ static bool _swap_hosts(s_ghttp *context)
 	context->host_id = context->fallback_id;
 	context->fallback_id = tmp;
 	NULLFREE(context->session_id);
-	ll_clear(context->ecm_q);
 	ll_clear_data(ghttp_ignored_contexts);
 	return true;
 }
@@ -328,7 +468,9 @@ static char *_get_header_substr(uchar *buf, const char *start, const char *end)
 	char *data = strstr((char *)buf, start);
 	if(!data) { return NULL; }
 	data += strlen(start);
-	int len = strstr(data, end) - data;
+	char *stop = strstr(data, end);
+	if(!stop) { return NULL; }
+	int len = stop - data;
 	if(len <= 0) { return NULL; }
 	char tmp = data[len];
 	data[len] = '\0';
@@ -337,48 +479,207 @@ static char *_get_header_substr(uchar *buf, const char *start, const char *end)
 	return value;
 }
 
-static int _get_int_header(uchar *buf, const char *start)
+static char *_get_header(uchar *buf, const char *start)
 {
-	char *data = strstr((char *)buf, start);
-	if(!data) { return -1; }
-	data += strlen(start);
-	return atoi(data);
+	return _get_header_substr(buf, start, "\r\n");
 }
 
-static char *_get_header(uchar *buf, const char *start)
+// Value of a header line if its name matches, NULL otherwise
+static char *_header_value(char *line, const char *name)
 {
-	return _get_header_substr(buf, start, "\r\n");
+	int32_t len = strlen(name);
+
+	if(strncasecmp(line, name, len) || line[len] != ':')
+		{ return NULL; }
+	line += len + 1;
+	while(*line == ' ' || *line == '\t')
+		{ line++; }
+	return line;
 }
 
-static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc, uchar *buf, int32_t n)
+// Start of the \r\n which ends the line at p, NULL if there is none before end
+static char *_ghttp_eol(char *p, char *end)
 {
-	char *data;
-	char *hdrstr;
-	uchar *content;
-	int rcode, len, clen = 0;
-	s_ghttp *context = (s_ghttp *)client->ghttp;
-	ECM_REQUEST *er = NULL;
+	for(; p + 1 < end; p++)
+	{
+		if(p[0] == '\r' && p[1] == '\n')
+			{ return p; }
+	}
+	return NULL;
+}
 
-	if(n < 5) { return -1; }
+/* Walks the chunks of a body starting at pos. Returns the end of the body, 0
+ * when it is not complete yet and -1 on bad framing. With decode set the chunk
+ * data is moved together in place, which only works on a complete body. */
+static int32_t _ghttp_chunks(uchar *buf, int32_t len, int32_t pos, int32_t *body_len, int8_t decode)
+{
+	int32_t size, start = pos, out = pos, i;
+	char *end;
 
-	data = strstr((char *)buf, "HTTP/1.1 ");
-	if(!data || ll_count(context->ecm_q) > 6)
+	for(;;)
 	{
-		cs_log_dbg(D_CLIENT, "%s: non http or otherwise corrupt response: %s", client->reader->label, buf);
-		cs_log_dump_dbg(D_CLIENT, buf, n, "%s: ", client->reader->label);
-		network_tcp_connection_close(client->reader, "receive error");
-		NULLFREE(context->session_id);
-		ll_clear(context->ecm_q);
-		return -1;
+		for(i = pos; i + 1 < len && (buf[i] != '\r' || buf[i + 1] != '\n'); i++) { ; }
+		if(i + 1 >= len)
+			{ return 0; }
+		size = strtol((char *)buf + pos, &end, 16);
+		if(end == (char *)buf + pos || size < 0 || size > GHTTP_RBUF_MAX || (*end != ';' && *end != ' ' && *end != '\r'))
+			{ return -1; }
+		pos = i + 2;
+		if(!size)
+			{ break; }
+		if(pos + size + 2 > len)
+			{ return 0; }
+		if(buf[pos + size] != '\r' || buf[pos + size + 1] != '\n')
+			{ return -1; }
+		if(decode)
+			{ memmove(buf + out, buf + pos, size); }
+		out += size;
+		pos += size + 2;
 	}
 
-	LL_ITER itr = ll_iter_create(context->ecm_q);
-	er = (ECM_REQUEST *)ll_iter_next(&itr);
+	// trailer lines up to the empty line
+	for(;;)
+	{
+		for(i = pos; i + 1 < len && (buf[i] != '\r' || buf[i + 1] != '\n'); i++) { ; }
+		if(i + 1 >= len)
+			{ return 0; }
+		if(i == pos)
+			{ break; }
+		pos = i + 2;
+	}
+	*body_len = out - start;
+	return pos + 2;
+}
 
-	rcode = _get_int_header(buf, "HTTP/1.1 ");
-	clen = _get_int_header(buf, "Content-Length: ");
+/* Parses the response at the start of buf. Returns 1 when it is complete, 0 when
+ * more data is needed and -1 on a broken response. The body starts at
+ * buf + hdr_len, a chunked body is decoded in place. The header block of a
+ * complete response is terminated by a '\0' so the header lookups stay inside
+ * this response. */
+int32_t ghttp_parse_response(uchar *buf, int32_t len, struct s_ghttp_resp *resp)
+{
+	char *line, *next, *value, *hdr_end;
+	int32_t i, hdr_len, end, clen = -1;
+	int8_t chunked = 0, bad = 0;
+
+	memset(resp, 0, sizeof(struct s_ghttp_resp));
+	for(i = 0; i + 3 < len && memcmp(buf + i, "\r\n\r\n", 4); i++) { ; }
+	if(i + 3 >= len)
+		{ return (len > GHTTP_MAX_HEADER) ? -1 : 0; }
+	hdr_len = i + 4;
+	if(hdr_len < 16 || memcmp(buf, "HTTP/1.", 7) || buf[8] != ' ')
+		{ return -1; }
+	for(i = 9; i < 12; i++)
+	{
+		if(buf[i] < '0' || buf[i] > '9')
+			{ return -1; }
+		resp->status = resp->status * 10 + buf[i] - '0';
+	}
+	resp->close = buf[7] == '0';    // http/1.0 closes unless asked otherwise
+
+	// the lines are walked within hdr_len and cut one at a time, a NUL byte
+	// in them would end a line early and is no http anyway
+	if(memchr(buf, '\0', hdr_len))
+		{ return -1; }
+	hdr_end = (char *)buf + hdr_len - 2;    // the empty line
+	for(line = _ghttp_eol((char *)buf, hdr_end) + 2; line < hdr_end; line = next + 2)
+	{
+		if(!(next = _ghttp_eol(line, hdr_end)))
+			{ return -1; }
+		*next = '\0';
+		if((value = _header_value(line, "Content-Length")))
+		{
+			clen = strtol(value, NULL, 10);
+			bad |= clen < 0 || clen > GHTTP_RBUF_MAX;
+		}
+		else if((value = _header_value(line, "Transfer-Encoding")))
+			{ chunked = strlen(value) >= 7 && !strncasecmp(value + strlen(value) - 7, "chunked", 7); }
+		else if((value = _header_value(line, "Connection")))
+		{
+			if(!strncasecmp(value, "close", 5))
+				{ resp->close = 1; }
+			else if(!strncasecmp(value, "keep-alive", 10))
+				{ resp->close = 0; }
+		}
+		*next = '\r';
+	}
+	if(bad)
+		{ return -1; }
 
-	content = (uchar *)(strstr(data, "\r\n\r\n") + 4);
+	if(resp->status < 200 || resp->status == 204 || resp->status == 304)
+		{ end = hdr_len; }
+	else if(chunked)
+	{
+		if((end = _ghttp_chunks(buf, len, hdr_len, &resp->body_len, 0)) <= 0)
+			{ return end; }
+		_ghttp_chunks(buf, len, hdr_len, &resp->body_len, 1);
+	}
+	else if(clen >= 0)
+	{
+		if(hdr_len + clen > len)
+			{ return 0; }
+		resp->body_len = clen;
+		end = hdr_len + clen;
+	}
+	else
+	{
+		// a body delimited by closing the connection is not expected from the cache
+		end = hdr_len;
+		resp->close = 1;
+	}
+
+	buf[hdr_len - 2] = '\0';
+	resp->hdr_len = hdr_len;
+	resp->consumed = end;
+	return 1;
+}
+
+// First ecm of a request which still waits for an answer
+static ECM_REQUEST *_ghttp_waiting_ecm(struct s_client *client, s_ghttp_req *req)
+{
+	int32_t i, slot;
+
+	for(i = 0; i < req->count; i++)
+	{
+		if((slot = casc_get_ecmtask(client, req->idx[i])) >= 0)
+			{ return &client->ecmtask[slot]; }
+	}
+	return NULL;
+}
+
+// Answers the ecms of a request, dcw NULL means not found
+static void _ghttp_answer(struct s_client *client, s_ghttp_req *req, uchar *dcw)
+{
+	int32_t i, slot;
+
+	for(i = 0; i < req->count; i++)
+	{
+		if((slot = casc_get_ecmtask(client, req->idx[i])) < 0)
+			{ continue; }   // timed out or answered with an ecm of the same md5
+		if(dcw)
+			{ cs_log_dump_dbg(D_TRACE, dcw, 16, "%s: cw recv chk for idx %d", client->reader->label, req->idx[i]); }
+		client->pending--;
+		casc_check_dcw(client->reader, slot, dcw ? 1 : 0, dcw);
+	}
+	if(dcw)
+		{ client->reader->last_g = time((time_t *)0); }
+}
+
+// Sends the ecm of a request again as post, the waiting ecms move to the new request
+static void _ghttp_repost(struct s_client *client, s_ghttp_req *req, ECM_REQUEST *er)
+{
+	if(_ghttp_post_ecmdata(client, er, req) < 0)
+		{ _ghttp_answer(client, req, NULL); }
+}
+
+static void _ghttp_process_response(struct s_client *client, s_ghttp_req *req, uchar *buf, struct s_ghttp_resp *resp)
+{
+	char *data;
+	char *hdrstr;
+	uchar *content = buf + resp->hdr_len;
+	int rcode = resp->status, len, clen = resp->body_len;
+	s_ghttp *context = (s_ghttp *)client->ghttp;
+	ECM_REQUEST *er = _ghttp_waiting_ecm(client, req);
 
 	hdrstr = _get_header_substr(buf, "ETag: \"", "\"\r\n");
 	if(hdrstr)
@@ -396,8 +697,8 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 			cs_log_dbg(D_CLIENT, "%s: redirected...", client->reader->label);
 			NULLFREE(context->session_id);
 			ll_clear_data(ghttp_ignored_contexts);
-			ll_clear(context->ecm_q);
-			return -1;
+			_ghttp_answer(client, req, NULL);
+			return;
 		}
 	}
 
@@ -422,21 +723,12 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 		cs_log_dbg(D_CLIENT, "%s: set session_id to: %s", client->reader->label, context->session_id);
 	}
 
-	// buf[n] = '\0';
-	// cs_log_dump_dbg(D_TRACE, content, clen, "%s: reply\n%s", client->reader->label, buf);
-
 	if(rcode < 200 || rcode > 204)
 	{
 		cs_log_dbg(D_CLIENT, "%s: http error code %d", client->reader->label, rcode);
 		data = strstr((char *)buf, "Content-Type: application/octet-stream"); // if not octet-stream, google error. need reconnect?
-		if(data)    // we have error info string in the post content
-		{
-			if(clen > 0)
-			{
-				content[clen] = '\0';
-				cs_log_dbg(D_CLIENT, "%s: http error message: %s", client->reader->label, content);
-			}
-		}
+		if(data && clen > 0)    // we have error info string in the post content
+			{ cs_log_dbg(D_CLIENT, "%s: http error message: %.*s", client->reader->label, clen, content); }
 		if(rcode == 503)
 		{
 			if(er && _is_post_context(context->post_contexts, er, false))
@@ -448,19 +740,17 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 				else
 				{
 					cs_log_dbg(D_CLIENT, "%s: recv_chk got 503 despite post, trying reconnect", client->reader->label);
-					network_tcp_connection_close(client->reader, "reconnect");
-					ll_clear(context->ecm_q);
+					_ghttp_close(client, "reconnect");
+					return;
 				}
 			}
-			else
+			else if(er)
 			{
 				// on 503 cache timeout, retry with POST immediately (and switch to POST for subsequent)
-				if(er)
-				{
-					_set_pid_status(context->post_contexts, er->onid, er->tsid, er->srvid, 0);
-					cs_log_dbg(D_CLIENT, "%s: recv_chk got 503, trying direct post", client->reader->label);
-					_ghttp_post_ecmdata(client, er);
-				}
+				_set_pid_status(context->post_contexts, er->onid, er->tsid, er->srvid, 0);
+				cs_log_dbg(D_CLIENT, "%s: recv_chk got 503, trying direct post", client->reader->label);
+				_ghttp_repost(client, req, er);
+				return;
 			}
 		}
 		else if(rcode == 401)
@@ -469,22 +759,19 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 			if(er)
 			{
 				cs_log_dbg(D_CLIENT, "%s: session expired, trying direct post", client->reader->label);
-				_ghttp_post_ecmdata(client, er);
+				_ghttp_repost(client, req, er);
+				return;
 			}
 		}
 		else if(rcode == 403)
 		{
 			client->reader->enable = 0;
-			network_tcp_connection_close(client->reader, "login failure");
-			ll_clear(context->ecm_q);
+			_ghttp_close(client, "login failure");
 			cs_log("%s: invalid username/password, disabling reader.", client->reader->label);
+			return;
 		}
-
-		// not sure if this is needed on failure, copied from newcamd
-		*rc = 0;
-		memset(dcw, 0, 16);
-
-		return -1;
+		_ghttp_answer(client, req, NULL);
+		return;
 	}
 
 	// successful http reply (200 ok or 204 no content)
@@ -499,7 +786,8 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 			if(sscanf(hdrstr, "%4x-%4x-%4x", &onid, &tsid, &sid) == 3)
 				{ _set_pids_status(ghttp_ignored_contexts, onid, tsid, sid, content, clen); }
 			NULLFREE(hdrstr);
-			return -1;
+			_ghttp_answer(client, req, NULL);
+			return;
 		}
 		NULLFREE(hdrstr);
 	}
@@ -524,16 +812,61 @@ static int32_t ghttp_recv_chk(struct s_client *client, uchar *dcw, int32_t *rc,
 
 	if(clen == 16)    // cw in content
 	{
-		memcpy(dcw, content, 16);
-		*rc = 1;
-		er = ll_remove_first(context->ecm_q);
-		if(!er) { return -1; }
-		cs_log_dump_dbg(D_TRACE, dcw, 16, "%s: cw recv chk for idx %d", client->reader->label, er->idx);
-		return er->idx;
+		_ghttp_answer(client, req, content);
+		return;
 	}
-	else
+	if(clen != 0) { cs_log_dump_dbg(D_CLIENT, content, clen, "%s: recv_chk fail, clen = %d", client->reader->label, clen); }
+	_ghttp_answer(client, req, NULL);
+}
+
+/* Handles every complete response in the receive buffer, the cws are handed over
+ * directly. The buffer is only touched here and in ghttp_recv_int(), both run in
+ * the reader thread. A send from the dvbapi thread which resets the connection
+ * only marks the buffer stale, the rest of it is dropped as soon as that is seen. */
+static int32_t ghttp_recv_chk(struct s_client *client, uchar *UNUSED(dcw), int32_t *UNUSED(rc), uchar *UNUSED(buf), int32_t UNUSED(n))
+{
+	struct s_ghttp_resp resp;
+	s_ghttp_req req;
+	int32_t pos = 0, start, ret;
+	s_ghttp *context = (s_ghttp *)client->ghttp;
+
+	if(_ghttp_drop_stale(context))
+		{ return -1; }
+	while(pos < context->rlen)
 	{
-		if(clen != 0) { cs_log_dump_dbg(D_CLIENT, content, clen, "%s: recv_chk fail, clen = %d", client->reader->label, clen); }
+		start = pos;
+		ret = ghttp_parse_response(context->rbuf + start, context->rlen - start, &resp);
+		if(!ret)
+			{ break; }
+		if(ret < 0)
+		{
+			cs_log_dump_dbg(D_CLIENT, context->rbuf + start, MIN(context->rlen - start, 256), "%s: non http or otherwise corrupt response:", client->reader->label);
+			NULLFREE(context->session_id);
+			_ghttp_close(client, "receive error");
+			return -1;
+		}
+		pos += resp.consumed;
+		if(resp.status < 200)
+			{ continue; }   // interim response, the real one follows
+
+		if(!_ghttp_pop_inflight(context, &req))
+			{ cs_log_dbg(D_CLIENT, "%s: response %d without request", client->reader->label, resp.status); }
+		else
+			{ _ghttp_process_response(client, &req, context->rbuf + start, &resp); }
+
+		if(!client->pfd || _ghttp_drop_stale(context))
+			{ return -1; }  // closed or reset while handling the response
+		if(resp.close)
+		{
+			_ghttp_close(client, "closed by server");
+			return -1;
+		}
+	}
+
+	if(pos)
+	{
+		memmove(context->rbuf, context->rbuf + pos, context->rlen - pos);
+		context->rlen -= pos;
 	}
 	return -1;
 }
@@ -554,7 +887,7 @@ static char *_ghttp_basic_auth(struct s_client *client)
 	return encauth;
 }
 
-static int32_t _ghttp_http_get(struct s_client *client, uint32_t hash, int odd)
+static int32_t _ghttp_http_get(struct s_client *client, s_ghttp_req *request)
 {
 	uchar req[128];
 	char *encauth = NULL;
@@ -565,27 +898,27 @@ static int32_t _ghttp_http_get(struct s_client *client, uint32_t hash, int odd)
 
 	if(encauth)    // basic auth login
 	{
-		ret = snprintf((char *)req, sizeof(req), "GET /api/c/%d/%x HTTP/1.1\r\nHost: %s\r\nAuthorization: Basic %s\r\n\r\n", odd ? 81 : 80, hash, context->host_id, encauth);
+		ret = snprintf((char *)req, sizeof(req), "GET /api/c/%d/%x HTTP/1.1\r\nHost: %s\r\nAuthorization: Basic %s\r\n\r\n", request->odd ? 81 : 80, request->hash, context->host_id, encauth);
 		NULLFREE(encauth);
 	}
 	else
 	{
 		if(context->session_id)    // session exists
 		{
-			ret = snprintf((char *)req, sizeof(req), "GET /api/c/%s/%d/%x HTTP/1.1\r\nHost: %s\r\n\r\n", context->session_id, odd ? 81 : 80, hash, context->host_id);
+			ret = snprintf((char *)req, sizeof(req), "GET /api/c/%s/%d/%x HTTP/1.1\r\nHost: %s\r\n\r\n", context->session_id, request->odd ? 81 : 80, request->hash, context->host_id);
 		}
 		else     // no credentials configured, assume no session required
 		{
-			ret = snprintf((char *)req, sizeof(req), "GET /api/c/%d/%x HTTP/1.1\r\nHost: %s\r\n\r\n", odd ? 81 : 80, hash, context->host_id);
+			ret = snprintf((char *)req, sizeof(req), "GET /api/c/%d/%x HTTP/1.1\r\nHost: %s\r\n\r\n", request->odd ? 81 : 80, request->hash, context->host_id);
 		}
 	}
 
-	ret = ghttp_send(client, req, ret);
+	ret = ghttp_send(client, req, ret, request);
 
 	return ret;
 }
 
-static int32_t _ghttp_post_ecmdata(struct s_client *client, ECM_REQUEST *er)
+static int32_t _ghttp_post_ecmdata(struct s_client *client, ECM_REQUEST *er, s_ghttp_req *request)
 {
 	uchar req[640];
 	uchar *end;
@@ -616,7 +949,7 @@ static int32_t _ghttp_post_ecmdata(struct s_client *client, ECM_REQUEST *er)
 
 	cs_log_dbg(D_CLIENT, "%s: sending full ecm - /api/e/%x/%x/%x/%x/%x/%x", client->reader->label, er->onid, er->tsid, er->pid, er->srvid, er->caid, er->prid);
 
-	ret = ghttp_send(client, req, ret + er->ecmlen);
+	ret = ghttp_send(client, req, ret + er->ecmlen, request);
 
 	return ret;
 }
@@ -642,7 +975,8 @@ static bool _is_pid_ignored(ECM_REQUEST *er)
 
 static int32_t ghttp_send_ecm(struct s_client *client, ECM_REQUEST *er)
 {
-	uint32_t hash;
+	s_ghttp_req req;
+	int32_t ret;
 	s_ghttp *context = (s_ghttp *)client->ghttp;
 
 	if(_is_pid_ignored(er))
@@ -653,18 +987,29 @@ static int32_t ghttp_send_ecm(struct s_client *client, ECM_REQUEST *er)
 
 	if(!context->host_id) { context->host_id = (uchar *)cs_strdup(client->reader->device); }
 
-	ll_append(context->ecm_q, er);
-	if(ll_count(context->ecm_q) > 1)
-		{ cs_log_dbg(D_CLIENT, "%s: %d simultaneous ecms...", client->reader->label, ll_count(context->ecm_q)); }
+	memset(&req, 0, sizeof(req));
+	req.hash = javastring_hashcode(er->ecm + 3, er->ecmlen - 3);
+	req.odd = er->ecm[0] == 0x81;
+	if(_ghttp_join_inflight(context, req.hash, req.odd, er->idx))
+	{
+		cs_log_dbg(D_CLIENT, "%s: ecm idx %d joins the pending request for %x", client->reader->label, er->idx, req.hash);
+		return 0;
+	}
+	req.count = 1;
+	req.idx[0] = er->idx;
 
 	if(_is_post_context(context->post_contexts, er, false))
 	{
-		_ghttp_post_ecmdata(client, er);
+		ret = _ghttp_post_ecmdata(client, er, &req);
 	}
 	else
 	{
-		hash = javastring_hashcode(er->ecm + 3, er->ecmlen - 3);
-		_ghttp_http_get(client, hash, er->ecm[0] == 0x81);
+		ret = _ghttp_http_get(client, &req);
+	}
+	if(ret < 0)
+	{
+		cs_log_dbg(D_CLIENT, "%s: ecm idx %d not sent, %d requests pending", client->reader->label, er->idx, context->inflight_count);
+		return -1;
 	}
 
 	return 0;
@@ -681,7 +1026,7 @@ static void ghttp_cleanup(struct s_client *client)
 		NULLFREE(context->session_id);
 		NULLFREE(context->host_id);
 		NULLFREE(context->fallback_id);
-		ll_destroy(&context->ecm_q);
+		NULLFREE(context->rbuf);
 		ll_destroy_data(&context->post_contexts);
 #ifdef WITH_SSL
 		if(context->ssl_handle)
@@ -704,9 +1049,11 @@ static int32_t ghttp_capmt_notify(struct s_client *client, struct demux_s *demux
 	char *encauth = NULL;
 	int32_t ret;
 	int8_t i, pids_len = 0, offs = 0;
+	s_ghttp_req notify;
 	s_ghttp *context = (s_ghttp *)client->ghttp;
 
 	if(!context) { return -1; }
+	memset(&notify, 0, sizeof(notify));    // answers to notifies carry no cw
 
 	cs_log_dbg(D_CLIENT, "%s: capmt %x-%x-%x %d pids on adapter %d mask %x dmx index %d", client->reader->label, demux->onid, demux->tsid, demux->program_number, demux->ECMpidcount, demux->adapter_index, demux->ca_mask, demux->demux_index);
 
@@ -756,7 +1103,7 @@ static int32_t ghttp_capmt_notify(struct s_client *client, struct demux_s *demux
 	}
 	cs_log_dump_dbg(D_CLIENT, pids, pids_len, "%s: sending capmt ecm pids - %s /api/p/%x/%x/%x/%x/%x", client->reader->label, (pids_len > 0) ? "POST" : "GET", demux->onid, demux->tsid, demux->program_number, demux->ECMpidcount, demux->enigma_namespace);
 
-	ret = ghttp_send(client, req, ret + pids_len);
+	ret = ghttp_send(client, req, ret + pids_len, &notify);
 
 	if(pids_len > 0) { NULLFREE(pids); }
 
@@ -0,0 +1,22 @@
+#ifndef MODULE_GHTTP_H_
+#define MODULE_GHTTP_H_
+
+#ifdef MODULE_GHTTP
+
+#define GHTTP_MAX_HEADER    8192            // bytes of status line and headers
+#define GHTTP_RBUF_MAX      (64 * 1024)     // largest response kept in the receive buffer
+
+struct s_ghttp_resp
+{
+	int32_t status;     // http status code
+	int32_t hdr_len;    // status line and headers, the body starts behind them
+	int32_t body_len;   // body length, after removing the chunk framing
+	int32_t consumed;   // bytes of the response in the receive buffer
+	int8_t  close;      // server closes the connection after this response
+};
+
+int32_t ghttp_parse_response(uchar *buf, int32_t len, struct s_ghttp_resp *resp);
+
+#endif
+
+#endif
@@ -190,7 +190,8 @@ static int32_t radegast_send_ecm(struct s_client *client, ECM_REQUEST *er)
 	uchar *ecmbuf;
 	
 	uint8_t *SubECMp; 
-	uint8_t *via_ecm_mod;
+	uint8_t *via_ecm_mod = NULL;
+	uchar *ecm = er->ecm;  // payload is shared with the parent request, never modify it
 	uint32_t n, k, Len, pos = 0;
 
 	if(!radegast_connect())
@@ -249,10 +250,9 @@ static int32_t radegast_send_ecm(struct s_client *client, ECM_REQUEST *er)
 				}
 				Len = via_ecm_mod[2]+3;
 				er->ecmlen = Len;
-				memcpy(er->ecm, via_ecm_mod, Len);
-				cs_log_dump_dbg(D_ATR, er->ecm, er->ecmlen, "%s: ecm dump AFTER suppressing SubECMs with CWsSwap set to 01", __func__);
+				ecm = via_ecm_mod;
+				cs_log_dump_dbg(D_ATR, ecm, er->ecmlen, "%s: ecm dump AFTER suppressing SubECMs with CWsSwap set to 01", __func__);
 			}
-			NULLFREE(via_ecm_mod);
 		}
 		
 	}	
@@ -278,7 +278,8 @@ static int32_t radegast_send_ecm(struct s_client *client, ECM_REQUEST *er)
 	ecmbuf[5 + sizeof(header)] = er->caid & 0xff;
 	ecmbuf[6 + sizeof(header)] = 3;
 	ecmbuf[7 + sizeof(header)] = er->ecmlen & 0xff;
-	memcpy(ecmbuf + 8 + sizeof(header), er->ecm, er->ecmlen);
+	memcpy(ecmbuf + 8 + sizeof(header), ecm, er->ecmlen);
+	NULLFREE(via_ecm_mod);
 	ecmbuf[4] = er->caid >> 8;
 
 	client->reader->msg_idx = er->idx;
@@ -793,7 +793,7 @@ static void scam_server_recv_ecm(struct s_client *cl, uchar *buf, int32_t len)
 		get_cw(cl, er);
 	}
 	else {
-		NULLFREE(er);
+		free_ecmtask(er);
 		cs_log("WARNING: ECM-request corrupt");	
 	}
 }
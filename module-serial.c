@@ -1031,7 +1031,7 @@ static void oscam_ser_process_ecm(uchar *buf, int32_t l)
 	case 3:
 	case 2:
 		//er->rc = E_CORRUPT;
-		NULLFREE(er);
+		free_ecmtask(er);
 		return; // error without log
 	case 1:
 		er->rc = E_CORRUPT;           // error with log
@@ -872,6 +872,14 @@ static uint16_t __lb_get_betatunnel_caid_to(uint16_t caid)
 	return 0;
 }
 
+/* caid lb_check_auto_betatunnel() will try for caid, 0 if none */
+uint16_t lb_get_auto_betatunnel_caid(uint16_t caid)
+{
+	if(!cfg.lb_auto_betatunnel)
+		return 0;
+	return __lb_get_betatunnel_caid_to(caid);
+}
+
 uint16_t lb_get_betatunnel_caid_to(ECM_REQUEST *er)
 {
 	if(!cfg.lb_auto_betatunnel)
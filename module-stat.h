@@ -24,6 +24,7 @@ bool lb_check_auto_betatunnel(ECM_REQUEST *er, struct s_reader *rdr);
 void lb_set_best_reader(ECM_REQUEST *er);
 void lb_update_last(struct s_ecm_answer *ea_er, struct s_reader *reader);
 uint16_t lb_get_betatunnel_caid_to(ECM_REQUEST *er);
+uint16_t lb_get_auto_betatunnel_caid(uint16_t caid);
 void readerinfofix_get_stat_query(ECM_REQUEST *er, STAT_QUERY *q);
 void readerinfofix_inc_fail(READER_STAT *s);
 READER_STAT *readerinfofix_get_add_stat(struct s_reader *rdr, STAT_QUERY *q);
@@ -41,6 +42,7 @@ static inline bool lb_check_auto_betatunnel(ECM_REQUEST *UNUSED(er), struct s_re
 static inline void lb_set_best_reader(ECM_REQUEST *UNUSED(er)) { }
 static inline void lb_update_last(struct s_ecm_answer *UNUSED(ea_er), struct s_reader *UNUSED(reader)) { }
 static inline uint16_t lb_get_betatunnel_caid_to(ECM_REQUEST *UNUSED(er)) { return 0; }
+static inline uint16_t lb_get_auto_betatunnel_caid(uint16_t UNUSED(caid)) { return 0; }
 #endif
 
 #endif
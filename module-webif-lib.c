@@ -330,7 +330,7 @@ int32_t webif_read(char *buf, int32_t num, FILE *f)
 		return read(fileno(f), buf, num);
 }
 
-void send_headers(FILE *f, int32_t status, char *title, char *extra, char *mime, int32_t cache, int32_t length, char *content, int8_t forcePlain)
+static void send_headers_int(FILE *f, int32_t status, char *title, char *extra, char *mime, int32_t cache, int32_t length, uint32_t etag, int8_t forcePlain)
 {
 	time_t now;
 	char timebuf[32];
@@ -365,11 +365,8 @@ void send_headers(FILE *f, int32_t status, char *title, char *extra, char *mime,
 		}
 		pos += snprintf(pos, sizeof(buf) - (pos - buf), "Content-Length: %d\r\n", length);
 		pos += snprintf(pos, sizeof(buf) - (pos - buf), "Last-Modified: %s\r\n", timebuf);
-		if(content)
-		{
-			uint32_t checksum = (uint32_t)crc32(0L, (uchar *)content, length);
-			pos += snprintf(pos, sizeof(buf) - (pos - buf), "ETag: \"%u\"\r\n", checksum == 0 ? 1 : checksum);
-		}
+		if(etag)
+			{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "ETag: \"%u\"\r\n", etag); }
 	}
 	if(*(int8_t *)pthread_getspecific(getkeepalive))
 		{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "Connection: Keep-Alive\r\n"); }
@@ -380,6 +377,68 @@ void send_headers(FILE *f, int32_t status, char *title, char *extra, char *mime,
 	else { webif_write(buf, f); }
 }
 
+void send_headers(FILE *f, int32_t status, char *title, char *extra, char *mime, int32_t cache, int32_t length, char *content, int8_t forcePlain)
+{
+	uint32_t checksum = 0;
+	if(content)
+	{
+		checksum = (uint32_t)crc32(0L, (uchar *)content, length);
+		if(checksum == 0) { checksum = 1; }
+	}
+	send_headers_int(f, status, title, extra, mime, cache, length, checksum, forcePlain);
+}
+
+/* Sends the headers for a response whose length isn't known in advance. The body has to be written
+   with webif_write_chunk() and finished with webif_write_chunk_end(). */
+void send_headers_chunked(FILE *f, int32_t status, char *title, char *extra, char *mime)
+{
+	time_t now;
+	char timebuf[32];
+	char buf[sizeof(PROTOCOL_CHUNKED) + sizeof(SERVER) + strlen(title) + (extra == NULL ? 0 : strlen(extra) + 2) + (mime == NULL ? 0 : strlen(mime) + 2) + 300];
+	char *pos = buf;
+	struct tm timeinfo;
+
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "%s %d %s\r\n", PROTOCOL_CHUNKED, status, title);
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "Server: %s\r\n", SERVER);
+
+	now = time(NULL);
+	cs_gmtime_r(&now, &timeinfo);
+	strftime(timebuf, sizeof(timebuf), RFC1123FMT, &timeinfo);
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "Date: %s\r\n", timebuf);
+
+	if(extra)
+		{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "%s\r\n", extra); }
+
+	if(mime)
+		{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "Content-Type: %s\r\n", mime); }
+
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "Cache-Control: no-store, no-cache, must-revalidate\r\n");
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "Expires: Sat, 10 Jan 2000 05:00:00 GMT\r\n");
+	pos += snprintf(pos, sizeof(buf) - (pos - buf), "Transfer-Encoding: chunked\r\n");
+	if(*(int8_t *)pthread_getspecific(getkeepalive))
+		{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "Connection: Keep-Alive\r\n"); }
+	else
+		{ pos += snprintf(pos, sizeof(buf) - (pos - buf), "Connection: close\r\n"); }
+	snprintf(pos, sizeof(buf) - (pos - buf), "\r\n");
+	webif_write(buf, f);
+}
+
+/* Writes one chunk of a chunked response. Empty chunks are skipped as they would end the response. */
+int32_t webif_write_chunk(char *buf, FILE *f, int32_t len)
+{
+	char size[16];
+	if(len <= 0) { return 0; }
+	snprintf(size, sizeof(size), "%X\r\n", len);
+	if(webif_write(size, f) <= 0 || webif_write_raw(buf, f, len) != len || webif_write_raw("\r\n", f, 2) != 2)
+		{ return -1; }
+	return len;
+}
+
+int32_t webif_write_chunk_end(FILE *f)
+{
+	return webif_write_raw("0\r\n\r\n", f, 5);
+}
+
 void send_error(FILE *f, int32_t status, char *title, char *extra, char *text, int8_t forcePlain)
 {
 	char buf[(2 * strlen(title)) + strlen(text) + 128];
@@ -499,6 +558,29 @@ void send_file(FILE *f, char *filename, char *subdir, time_t modifiedheader, uin
 	}
 	else
 	{
+		// Internal files are sent straight from memory with their precomputed length and ETag
+		const char *tplname = filen == 1 ? "CSS" : filen == 2 ? "JSCRIPT" : "JQUERY";
+#ifdef TOUCH
+		if(subdir && !strcmp(subdir, TOUCH_SUBDIR) && filen != 3)
+			{ tplname = filen == 1 ? "TOUCH_CSS" : "TOUCH_JSCRIPT"; }
+#endif
+		uint32_t tpllen = 0, tplcrc = 0;
+		const char *tpldata = tpl_getStaticTpl(tplname, &tpllen, &tplcrc);
+		if(tpldata && tpllen > 0)
+		{
+			if(tplcrc == 0) { tplcrc = 1; }
+			if((etagheader == 0 && first_client->login < modifiedheader) || (etagheader > 0 && tplcrc == etagheader))
+			{
+				send_header304(f, extraheader);
+			}
+			else
+			{
+				send_headers_int(f, 200, "OK", NULL, mimetype, 1, tpllen, tplcrc, 0);
+				webif_write_raw((char *)tpldata, f, tpllen);
+			}
+			return;
+		}
+
 		CSS = tpl_getUnparsedTpl("CSS", 1, "");
 		JSCRIPT = tpl_getUnparsedTpl("JSCRIPT", 1, "");
 		JQUERY = tpl_getUnparsedTpl("JQUERY", 1, "");
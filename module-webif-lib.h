@@ -13,6 +13,8 @@
 #define SERVER "webserver/1.0"
 /* The protocol that gets output. Currently only 1.0 is possible as 1.1 requires many features we don't have. */
 #define PROTOCOL "HTTP/1.0"
+/* The protocol used for chunked (streamed) responses. Only sent to clients which requested with HTTP/1.1. */
+#define PROTOCOL_CHUNKED "HTTP/1.1"
 /* The RFC1123 time format which is used in http headers. */
 #define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
 /* The realm for http digest authentication. Gets displayed to browser. */
@@ -27,6 +29,18 @@
 #define MAXGETPARAMS 100
 /* The refresh delay (in seconds) when stopping OSCam via http. */
 #define SHUTDOWNREFRESH 30
+/* The amount of threads serving http requests. */
+#define HTTP_WORKERS 4
+/* More threads are started while all are busy, so a slow page doesn't hold up the others. */
+#define HTTP_MAXWORKERS 64
+/* How long (in seconds) such an extra thread waits for requests before it ends. */
+#define HTTP_WORKER_IDLE 30
+/* The maximum amount of open connections (including idle keep-alive connections). */
+#define HTTP_MAXCONNECTIONS 64
+/* How long (in seconds) an idle keep-alive connection is kept open. */
+#define HTTP_KEEPALIVE_TIMEOUT 15
+/* How long (in ms) we wait for the rest of a request before giving up. */
+#define HTTP_READTIMEOUT 5000
 
 #define TOUCH_SUBDIR "touch/"
 
@@ -38,6 +52,13 @@ struct s_connection
 #ifdef WITH_SSL
 	SSL *ssl;
 #endif
+	FILE *f;
+	char *pending;       // pipelined data received behind the current request
+	int32_t pending_len;
+	time_t last;         // last activity, used to expire idle keep-alive connections
+	int8_t keepalive;
+	int8_t busy;         // a worker is serving this connection
+	int8_t closed;
 };
 
 struct uriparams
@@ -94,6 +115,9 @@ extern int32_t webif_write_raw(char *buf, FILE *f, int32_t len);
 extern int32_t webif_write(char *buf, FILE *f);
 extern int32_t webif_read(char *buf, int32_t num, FILE *f);
 extern void send_headers(FILE *f, int32_t status, char *title, char *extra, char *mime, int32_t cache, int32_t length, char *content, int8_t forcePlain);
+extern void send_headers_chunked(FILE *f, int32_t status, char *title, char *extra, char *mime);
+extern int32_t webif_write_chunk(char *buf, FILE *f, int32_t len);
+extern int32_t webif_write_chunk_end(FILE *f);
 extern void send_error(FILE *f, int32_t status, char *title, char *extra, char *text, int8_t forcePlain);
 extern void send_error500(FILE *f);
 extern void send_header304(FILE *f, char *extraheader);
@@ -5,6 +5,7 @@
 #ifdef WEBIF
 #include "webif/pages.h"
 #include "module-webif-tpl.h"
+#include "module-webif-lib.h"
 #include "oscam-files.h"
 #include "oscam-string.h"
 #ifdef COMPRESSED_TEMPLATES
@@ -25,6 +26,7 @@ struct tpl
 	const char *tpl_deps;
 	char *extra_data;
 	uint32_t tpl_data_len;
+	uint32_t tpl_data_crc;
 	uint8_t tpl_type;
 };
 
@@ -94,6 +96,7 @@ void webif_tpls_prepare(void)
 		tpls[i].tpl_type      = templates[i].tpl_type;
 		tpls[i].tpl_name_hash = jhash(tpls[i].tpl_name, strlen(tpls[i].tpl_name));
 		tpl_init_base64(&tpls[i]);
+		tpls[i].tpl_data_crc  = crc32(0L, (uchar *)tpls[i].tpl_data, tpls[i].tpl_data_len);
 	}
 #else
 	for(i = 0; i < tpls_count; ++i)
@@ -105,6 +108,7 @@ void webif_tpls_prepare(void)
 		tpls[i].tpl_data_len  = templates[i].tpl_data_len;
 		tpls[i].tpl_type      = templates[i].tpl_type;
 		tpl_init_base64(&tpls[i]);
+		tpls[i].tpl_data_crc  = crc32(0L, (uchar *)tpls[i].tpl_data, tpls[i].tpl_data_len);
 	}
 #endif
 }
@@ -124,6 +128,18 @@ void webif_tpls_free(void)
 	NULLFREE(tpls);
 }
 
+/* Makes sure that value i can hold at least needed bytes. Buffers grow geometrically so that
+   repeated TPLAPPEND calls while building large lists don't copy the whole value every time. */
+static int8_t tpl_reserveVar(struct templatevars *vars, int32_t i, uint32_t needed)
+{
+	if((*vars).valueallocs[i] >= needed) { return 1; }
+	uint32_t allocated = (*vars).valueallocs[i] < 64 ? 64 : (*vars).valueallocs[i];
+	while(allocated < needed) { allocated *= 2; }
+	if(!cs_realloc(&((*vars).values[i]), allocated)) { return 0; }
+	(*vars).valueallocs[i] = allocated;
+	return 1;
+}
+
 /* Adds a name->value-mapping or appends to it. You will get a reference back which you may freely
    use (but you should not call free/realloc on this!)*/
 void tpl_addVar(struct templatevars *vars, uint8_t addmode, const char *name, const char *value)
@@ -147,6 +163,8 @@ void tpl_addVar(struct templatevars *vars, uint8_t addmode, const char *name, co
 			if(!cs_realloc(&(*vars).names, (*vars).varsalloc * 2 * sizeof(char **))) { return; }
 			if(!cs_realloc(&(*vars).values, (*vars).varsalloc * 2 * sizeof(char **))) { return; }
 			if(!cs_realloc(&(*vars).vartypes, (*vars).varsalloc * 2 * sizeof(uint8_t *))) { return; }
+			if(!cs_realloc(&(*vars).valuelens, (*vars).varsalloc * 2 * sizeof(uint32_t))) { return; }
+			if(!cs_realloc(&(*vars).valueallocs, (*vars).varsalloc * 2 * sizeof(uint32_t))) { return; }
 			(*vars).varsalloc = (*vars).varscnt * 2;
 		}
 		int32_t len = strlen(name) + 1;
@@ -161,15 +179,18 @@ void tpl_addVar(struct templatevars *vars, uint8_t addmode, const char *name, co
 		}
 		memcpy(tmp, value, len);
 		(*vars).values[(*vars).varscnt] = tmp;
+		(*vars).valuelens[(*vars).varscnt] = len - 1;
+		(*vars).valueallocs[(*vars).varscnt] = len;
 		(*vars).vartypes[(*vars).varscnt] = addmode;
 		(*vars).varscnt++;
 	}
 	else
 	{
-		int32_t oldlen = 0, newlen = strlen(value);
-		if(addmode == TPLAPPEND || addmode == TPLAPPENDONCE) { oldlen = strlen((*vars).values[i]); }
-		if(!cs_realloc(&((*vars).values[i]), oldlen + newlen + 1)) { return; }
+		uint32_t oldlen = 0, newlen = strlen(value);
+		if(addmode == TPLAPPEND || addmode == TPLAPPENDONCE) { oldlen = (*vars).valuelens[i]; }
+		if(!tpl_reserveVar(vars, i, oldlen + newlen + 1)) { return; }
 		memcpy((*vars).values[i] + oldlen, value, newlen + 1);
+		(*vars).valuelens[i] = oldlen + newlen;
 		(*vars).vartypes[i] = addmode;
 	}
 	return;
@@ -247,6 +268,7 @@ char *tpl_getVar(struct templatevars *vars, const char *name)
 		if((*vars).vartypes[i] == TPLADDONCE || (*vars).vartypes[i] == TPLAPPENDONCE)
 		{
 			// This is a one-time-use variable which gets cleaned up automatically after retrieving it
+			(*vars).valuelens[i] = 0;
 			if(!cs_malloc(&(*vars).values[i], 1))
 			{
 				(*vars).values[i] = result;
@@ -256,6 +278,7 @@ char *tpl_getVar(struct templatevars *vars, const char *name)
 			else
 			{
 				(*vars).values[i][0] = '\0';
+				(*vars).valueallocs[i] = 1;
 				return tpl_addTmp(vars, result);
 			}
 		}
@@ -291,11 +314,23 @@ struct templatevars *tpl_create(void)
 		NULLFREE(vars);
 		return NULL;
 	}
+	if(!cs_malloc(&(*vars).valuelens, (*vars).varsalloc * sizeof(uint32_t))
+			|| !cs_malloc(&(*vars).valueallocs, (*vars).varsalloc * sizeof(uint32_t)))
+	{
+		NULLFREE((*vars).names);
+		NULLFREE((*vars).values);
+		NULLFREE((*vars).vartypes);
+		NULLFREE((*vars).valuelens);
+		NULLFREE(vars);
+		return NULL;
+	}
 	if(!cs_malloc(&(*vars).tmp, (*vars).tmpalloc * sizeof(char **)))
 	{
 		NULLFREE((*vars).names);
 		NULLFREE((*vars).values);
 		NULLFREE((*vars).vartypes);
+		NULLFREE((*vars).valuelens);
+		NULLFREE((*vars).valueallocs);
 		NULLFREE(vars);
 		return NULL;
 	}
@@ -314,6 +349,8 @@ void tpl_clear(struct templatevars *vars)
 	NULLFREE((*vars).names);
 	NULLFREE((*vars).values);
 	NULLFREE((*vars).vartypes);
+	NULLFREE((*vars).valuelens);
+	NULLFREE((*vars).valueallocs);
 	for(i = (*vars).tmpcnt - 1; i >= 0; --i)
 	{
 		NULLFREE((*vars).tmp[i]);
@@ -412,6 +449,7 @@ char *tpl_getUnparsedTpl(const char *name, int8_t removeHeader, const char *subd
 											check_conf(CARDREADER_DB2COM, ptr2);
 											check_conf(CARDREADER_STAPI, ptr2);
 											check_conf(CARDREADER_STAPI5, ptr2);
+											check_conf(CARDREADER_VIRTUAL, ptr2);
 											check_conf(WEBIF_LIVELOG, ptr2);
 											check_conf(WEBIF_JQUERY, ptr2);
 											check_conf(TOUCH, ptr2);
@@ -512,23 +550,86 @@ char *tpl_getUnparsedTpl(const char *name, int8_t removeHeader, const char *subd
 	return result;
 }
 
-/* Returns the specified template with all variables/other templates replaced or an
-   empty string if the template doesn't exist. Do not free the result yourself, it
-   will get automatically cleaned up! */
-char *tpl_getTpl(struct templatevars *vars, const char *name)
+/* Returns the data of an internal template without copying it, along with its length and the
+   checksum used as ETag. Returns NULL if the template doesn't exist or is overridden on disk. */
+const char *tpl_getStaticTpl(const char *name, uint32_t *len, uint32_t *crc)
+{
+	int32_t i;
+	if(cfg.http_tpl)
+	{
+		char path[255];
+		if(strlen(tpl_getTplPath(name, cfg.http_tpl, path, 255)) > 0 && file_exists(path))
+			{ return NULL; }
+	}
+	uint32_t name_hash = jhash(name, strlen(name));
+	for(i = 0; i < tpls_count; i++)
+	{
+		if(tpls[i].tpl_name_hash == name_hash)
+		{
+			*len = tpls[i].tpl_data_len;
+			*crc = tpls[i].tpl_data_crc;
+			return tpls[i].tpl_data;
+		}
+	}
+	return NULL;
+}
+
+/* Output sink for tpl_render(): either a growing buffer (tpl_getTpl) or the client
+   connection set with tpl_setStream() (tpl_sendTpl). */
+struct tpl_out
+{
+	char *buf;
+	uint32_t len;
+	uint32_t allocated;
+	FILE *f;
+};
+
+#define TPL_CHUNKSIZE 8192
+
+static int8_t tpl_flush(struct tpl_out *out)
+{
+	if(out->f && out->len > 0)
+	{
+		if(webif_write_chunk(out->buf, out->f, out->len) < 0) { return 0; }
+		out->len = 0;
+	}
+	return 1;
+}
+
+static int8_t tpl_out_write(struct tpl_out *out, const char *data, uint32_t len)
+{
+	if(out->f)
+	{
+		if(out->len + len > out->allocated)
+		{
+			if(!tpl_flush(out)) { return 0; }
+			// Big values (e.g. list rows) go out directly instead of being copied into the chunk buffer
+			if(len > out->allocated) { return webif_write_chunk((char *)data, out->f, len) >= 0; }
+		}
+	}
+	else if(out->len + len + 1 > out->allocated)
+	{
+		uint32_t allocated = out->allocated;
+		while(allocated < out->len + len + 1) { allocated *= 2; }
+		if(!cs_realloc(&out->buf, allocated)) { return 0; }
+		out->allocated = allocated;
+	}
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+	return 1;
+}
+
+/* Replaces all variables/other templates of the specified template and writes the result to out. */
+static int8_t tpl_render(struct templatevars *vars, const char *name, struct tpl_out *out)
 {
 	char *tplorg = tpl_getUnparsedTpl(name, 1, tpl_getVar(vars, "SUBDIR"));
-	if(!tplorg) { return ""; }
+	if(!tplorg) { return 0; }
 	char *tplend = tplorg + strlen(tplorg);
-	char *pch, *pch2, *tpl = tplorg;
+	char *pch, *pch2, *tpl = tplorg, *text = tplorg;
 	char varname[33];
+	int8_t ok = 1;
 
-	int32_t tmp, respos = 0;
-	int32_t allocated = 2 * strlen(tpl) + 1;
-	char *result;
-	if(!cs_malloc(&result, allocated)) { return ""; }
-
-	while(tpl < tplend)
+	while(tpl < tplend && ok)
 	{
 		if(tpl[0] == '#' && tpl[1] == '#' && tpl[2] != '#')
 		{
@@ -537,6 +638,7 @@ char *tpl_getTpl(struct templatevars *vars, const char *name)
 			while(pch[0] != '\0' && (pch[0] != '#' || pch[1] != '#')) { ++pch; }
 			if(pch - pch2 < 32 && pch[0] == '#' && pch[1] == '#')
 			{
+				ok = tpl_out_write(out, text, tpl - text);
 				memcpy(varname, pch2 + 2, pch - pch2 - 2);
 				varname[pch - pch2 - 2] = '\0';
 				if(strncmp(varname, "TPL", 3) == 0)
@@ -549,33 +651,81 @@ char *tpl_getTpl(struct templatevars *vars, const char *name)
 				{
 					pch2 = tpl_getVar(vars, varname);
 				}
-				tmp = strlen(pch2);
-				if(tmp + respos + 2 >= allocated)
-				{
-					allocated = tmp + respos + 256;
-					if(!cs_realloc(&result, allocated)) { return ""; }
-				}
-				memcpy(result + respos, pch2, tmp);
-				respos += tmp;
-				tpl = pch + 2;
-			}
-		}
-		else
-		{
-			if(respos + 2 >= allocated)
-			{
-				allocated = respos + 256;
-				if(!cs_realloc(&result, allocated)) { return ""; }
+				if(ok) { ok = tpl_out_write(out, pch2, strlen(pch2)); }
+				tpl = text = pch + 2;
+				continue;
 			}
-			result[respos] = tpl[0];
-			++respos;
-			++tpl;
 		}
+		++tpl;
 	}
+	if(ok) { ok = tpl_out_write(out, text, tpl - text); }
 	NULLFREE(tplorg);
-	result[respos] = '\0';
-	tpl_addTmp(vars, result);
-	return result;
+	return ok;
+}
+
+/* Returns the specified template with all variables/other templates replaced or an
+   empty string if the template doesn't exist. Do not free the result yourself, it
+   will get automatically cleaned up! */
+char *tpl_getTpl(struct templatevars *vars, const char *name)
+{
+	struct tpl_out out;
+	memset(&out, 0, sizeof(out));
+	out.allocated = 1024;
+	if(!cs_malloc(&out.buf, out.allocated)) { return ""; }
+	if(!tpl_render(vars, name, &out))
+	{
+		NULLFREE(out.buf);
+		return "";
+	}
+	out.buf[out.len] = '\0';
+	tpl_addTmp(vars, out.buf);
+	return out.buf;
+}
+
+/* Enables streaming output for this request: pages returning tpl_sendTpl() will then be written straight to f
+   using chunked transfer encoding instead of building it in memory. mime and extraheader are
+   used for the response headers. */
+void tpl_setStream(struct templatevars *vars, FILE *f, const char *mime, char *extraheader)
+{
+	(*vars).stream = f;
+	(*vars).stream_mime = mime;
+	(*vars).stream_extraheader = extraheader;
+}
+
+/* Marks the specified template to be sent to the stream set with tpl_setStream() and returns "1" to
+   signal that the response will be sent by tpl_flushStream(). If no stream is set this behaves like
+   tpl_getTpl(). */
+char *tpl_sendTpl(struct templatevars *vars, const char *name)
+{
+	if(!(*vars).stream) { return tpl_getTpl(vars, name); }
+	(*vars).stream_tpl = name;
+	return "1";
+}
+
+/* Renders the template selected with tpl_sendTpl() straight to the connection using chunked transfer
+   encoding. Only the chunk buffer is kept in memory, big variables (like the rows of a list) are passed
+   through without copying them into a result string first. As the rendering only uses the template
+   variables this can be called after the http lock has been released. Returns 1 if a response was sent. */
+int8_t tpl_flushStream(struct templatevars *vars)
+{
+	if(!(*vars).stream || !(*vars).stream_tpl) { return 0; }
+
+	struct tpl_out out;
+	memset(&out, 0, sizeof(out));
+	out.allocated = TPL_CHUNKSIZE;
+	if(!cs_malloc(&out.buf, out.allocated))
+	{
+		send_error500((*vars).stream);
+		return 1;
+	}
+	out.f = (*vars).stream;
+
+	send_headers_chunked(out.f, 200, "OK", (*vars).stream_extraheader, (char *)(*vars).stream_mime);
+	if(tpl_render(vars, (*vars).stream_tpl, &out) && tpl_flush(&out))
+		{ webif_write_chunk_end(out.f); }
+	NULLFREE(out.buf);
+	(*vars).stream_tpl = NULL;
+	return 1;
 }
 
 /* Saves all templates to the specified paths. Existing files will be overwritten! */
@@ -24,8 +24,14 @@ struct templatevars
 	char **names;
 	char **values;
 	uint8_t *vartypes;
+	uint32_t *valuelens;
+	uint32_t *valueallocs;
 	char **tmp;
 	uint8_t messages;
+	FILE *stream;
+	const char *stream_mime;
+	char *stream_extraheader;
+	const char *stream_tpl;
 };
 
 void    webif_tpls_prepare(void);
@@ -42,7 +48,11 @@ char    *tpl_getVar(struct templatevars *vars, const char *name);
 char    *tpl_getFilePathInSubdir(const char *path, const char *subdir, const char *name, const char *ext, char *result, uint32_t resultsize);
 char    *tpl_getTplPath(const char *name, const char *path, char *result, uint32_t resultsize);
 char    *tpl_getTpl(struct templatevars *vars, const char *name);
+void    tpl_setStream(struct templatevars *vars, FILE *f, const char *mime, char *extraheader);
+char    *tpl_sendTpl(struct templatevars *vars, const char *name);
+int8_t  tpl_flushStream(struct templatevars *vars);
 char    *tpl_getUnparsedTpl(const char *name, int8_t removeHeader, const char *subdir);
+const char *tpl_getStaticTpl(const char *name, uint32_t *len, uint32_t *crc);
 
 int32_t tpl_saveIncludedTpls(const char *path);
 
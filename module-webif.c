@@ -24,7 +24,9 @@
 #include "oscam-garbage.h"
 #include "oscam-cache.h"
 #include "oscam-client.h"
+#include "oscam-emm.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-net.h"
 #include "oscam-reader.h"
 #include "oscam-string.h"
@@ -2687,6 +2689,7 @@ static char *send_oscam_reader_config(struct templatevars *vars, struct uriparam
 	case R_INTERNAL:
 	case R_SERIAL :
 	case R_PCSC :
+	case R_VIRTUAL :
 		tpl_addVar(vars, TPLAPPEND, "READERDEPENDINGCONFIG", tpl_getTpl(vars, "READERCONFIGSTDHWREADERBIT"));
 		break;
 	case R_CAMD35 :
@@ -3045,9 +3048,9 @@ static char *send_oscam_reader_stats(struct templatevars *vars, struct uriparams
 	tpl_printf(vars, TPLADD, "TOTALECM", "%'" PRIu64, ecmcount);
 
 	if(!apicall)
-		{ return tpl_getTpl(vars, "READERSTATS"); }
+		{ return tpl_sendTpl(vars, "READERSTATS"); }
 	else
-		{ return tpl_getTpl(vars, "APIREADERSTATS"); }
+		{ return tpl_sendTpl(vars, "APIREADERSTATS"); }
 }
 
 static char *send_oscam_user_config_edit(struct templatevars *vars, struct uriparams *params, int32_t apicall)
@@ -4099,12 +4102,12 @@ static char *send_oscam_user_config(struct templatevars *vars, struct uriparams
 	set_ecm_info(vars);
 
 	if(!apicall)
-		{ return tpl_getTpl(vars, "USERCONFIGLIST"); }
+		{ return tpl_sendTpl(vars, "USERCONFIGLIST"); }
 	else
 	{
 		if(!filter || clientcount > 0)
 		{
-			return tpl_getTpl(vars, (apicall==1)?"APIUSERCONFIGLIST":"JSONUSER");
+			return tpl_sendTpl(vars, (apicall==1)?"APIUSERCONFIGLIST":"JSONUSER");
 		}
 		else
 		{
@@ -5753,7 +5756,7 @@ static char *send_oscam_status(struct templatevars * vars, struct uriparams * pa
 	if(apicall)
 	{
 		if(apicall == 1)
-		{ return tpl_getTpl(vars, "APISTATUS"); }
+		{ return tpl_sendTpl(vars, "APISTATUS"); }
 		if(apicall == 2)
 		{
 			tpl_printf(vars, TPLADD, "UCS", "%d", user_count_shown);
@@ -5775,14 +5778,14 @@ static char *send_oscam_status(struct templatevars * vars, struct uriparams * pa
 			tpl_printf(vars, TPLADD, "PCA", "%d", proxy_count_all);
 			tpl_printf(vars, TPLADD, "PICONENABLED", "%d", cfg.http_showpicons?1:0);
 			tpl_printf(vars, TPLADD, "SRVIDFILE", "%s", use_srvid2 ? "oscam.srvid2" : "oscam.srvid");
-			return tpl_getTpl(vars, "JSONSTATUS");
+			return tpl_sendTpl(vars, "JSONSTATUS");
 		}
 	}
 
 	if(is_touch)
-		{ return tpl_getTpl(vars, "TOUCH_STATUS"); }
+		{ return tpl_sendTpl(vars, "TOUCH_STATUS"); }
 	else
-		{ return tpl_getTpl(vars, "STATUS"); }
+		{ return tpl_sendTpl(vars, "STATUS"); }
 }
 
 static char *send_oscam_services_edit(struct templatevars * vars, struct uriparams * params)
@@ -6627,31 +6630,30 @@ static bool send_EMM(struct s_reader * rdr, uint16_t caid, const struct s_cardsy
 
 	if(NULL != rdr && NULL != emmhex && 0 != len)
 	{
-		EMM_PACKET *emm_pack = NULL;
+		EMM_PACKET emm_pack, *shared;
+		struct s_client *webif_client = cur_client();
+		webif_client->grp = 0xFF; /* to access to all readers */
 
-		if(cs_malloc(&emm_pack, sizeof(EMM_PACKET)))
-		{
-			struct s_client *webif_client = cur_client();
-			webif_client->grp = 0xFF; /* to access to all readers */
-
-			memset(emm_pack, '\0', sizeof(EMM_PACKET));
-			emm_pack->client = webif_client;
-			emm_pack->emmlen = len;
-			memcpy(emm_pack->emm, emmhex, len);
+		memset(&emm_pack, '\0', sizeof(EMM_PACKET));
+		emm_pack.client = webif_client;
+		emm_pack.emmlen = len;
+		memcpy(emm_pack.emm, emmhex, len);
 
-			emm_pack->caid[0] = (caid >> 8) & 0xFF;
-			emm_pack->caid[1] = caid & 0xFF;
+		emm_pack.caid[0] = (caid >> 8) & 0xFF;
+		emm_pack.caid[1] = caid & 0xFF;
 
-			if(csystem && csystem->get_emm_type)
+		if(csystem && csystem->get_emm_type)
+		{
+			if(!csystem->get_emm_type(&emm_pack, rdr))
 			{
-				if(!csystem->get_emm_type(emm_pack, rdr))
-				{
-					rdr_log_dbg(rdr, D_EMM, "get_emm_type() returns error");
-				}
+				rdr_log_dbg(rdr, D_EMM, "get_emm_type() returns error");
 			}
+		}
 
+		if((shared = emm_packet_new(&emm_pack)))
+		{
 			cs_log_dbg(D_EMM, "emm is being sent to reader %s.", rdr->label);
-			add_job(rdr->client, ACTION_READER_EMM, emm_pack, sizeof(EMM_PACKET));
+			add_job(rdr->client, ACTION_READER_EMM, shared, sizeof(EMM_PACKET));
 			return true;
 		}
 	}
@@ -7207,6 +7209,103 @@ static char *send_oscam_cacheex(struct templatevars * vars, struct uriparams * p
 }
 #endif
 
+static char *send_oscam_ecmtrace(struct templatevars * vars, struct uriparams * params)
+{
+	static const char *names[] = { "TRACECACHE", "TRACEREQUEST", "TRACECHKDCW", "TRACESEND" };
+	static const char *reader_names[] = { "TRACEQUEUED", "TRACEDEQUEUED", "TRACESENT", "TRACEANSWERED" };
+	struct s_ecm_trace *traces;
+	int32_t i, j, count;
+	char tbuffer[30];
+	struct tm st;
+
+	if(strcmp(getParam(params, "action"), "reset") == 0)
+	{
+		if(cfg.http_readonly)
+		{
+			tpl_addVar(vars, TPLADD, "APIERRORMESSAGE", "webif readonly mode");
+			return tpl_getTpl(vars, "APIERROR");
+		}
+		ecm_trace_reset();
+	}
+
+	tpl_printf(vars, TPLADD, "TRACEMAX", "%d", cfg.ecmtrace);
+	if(cfg.ecmtrace <= 0 || !cs_malloc(&traces, cfg.ecmtrace * sizeof(struct s_ecm_trace)))
+	{
+		tpl_addVar(vars, TPLADD, "TRACECOUNT", "0");
+		return tpl_getTpl(vars, "APIECMTRACE");
+	}
+	count = ecm_trace_get(traces, cfg.ecmtrace);
+	tpl_printf(vars, TPLADD, "TRACECOUNT", "%d", count);
+	for(i = 0; i < count; i++)
+	{
+		localtime_r(&traces[i].time, &st);
+		strftime(tbuffer, 30, "%Y-%m-%dT%H:%M:%S%z", &st);
+		tpl_addVar(vars, TPLADD, "TRACEDATE", tbuffer);
+		tpl_addVar(vars, TPLADD, "TRACECLIENT", xml_encode(vars, traces[i].client));
+		tpl_addVar(vars, TPLADD, "TRACEREADER", xml_encode(vars, traces[i].reader));
+		tpl_printf(vars, TPLADD, "TRACECAID", "%04X", traces[i].caid);
+		tpl_printf(vars, TPLADD, "TRACEPROVID", "%06X", traces[i].prid);
+		tpl_printf(vars, TPLADD, "TRACESRVID", "%04X", traces[i].srvid);
+		tpl_printf(vars, TPLADD, "TRACERC", "%d", traces[i].rc);
+		tpl_printf(vars, TPLADD, "TRACETOTAL", "%u", traces[i].trace[ECM_TRACE_SEND]);
+		// stage offsets in us from the start of the request, empty if the stage wasn't reached
+		for(j = 0; j < ECM_TRACE_STAGES; j++)
+		{
+			if(traces[i].trace[j]) { tpl_printf(vars, TPLADD, names[j], "%u", traces[i].trace[j]); }
+			else { tpl_addVar(vars, TPLADD, names[j], ""); }
+		}
+		for(j = 0; j < EA_TRACE_STAGES; j++)
+		{
+			if(traces[i].reader_trace[j]) { tpl_printf(vars, TPLADD, reader_names[j], "%u", traces[i].reader_trace[j]); }
+			else { tpl_addVar(vars, TPLADD, reader_names[j], ""); }
+		}
+		tpl_addVar(vars, TPLAPPEND, "APIECMTRACEROW", tpl_getTpl(vars, "APIECMTRACEBIT"));
+	}
+	NULLFREE(traces);
+	return tpl_getTpl(vars, "APIECMTRACE");
+}
+
+#ifdef WITH_LOCKPROFILE
+static char *send_oscam_lockprofile(struct templatevars * vars, struct uriparams * params)
+{
+	struct s_lock_profile profile[64];
+	int32_t i, count;
+
+	if(strcmp(getParam(params, "action"), "reset") == 0)
+	{
+		if(cfg.http_readonly)
+		{
+			tpl_addVar(vars, TPLADD, "APIERRORMESSAGE", "webif readonly mode");
+			return tpl_getTpl(vars, "APIERROR");
+		}
+		cs_lock_profile_reset();
+	}
+
+	memset(profile, 0, sizeof(profile));
+	count = cs_lock_profile_get(profile, 64);
+	tpl_printf(vars, TPLADD, "LOCKCOUNT", "%d", count);
+	// times in us
+	for(i = 0; i < count; i++)
+	{
+		tpl_addVar(vars, TPLADD, "LOCKNAME", xml_encode(vars, profile[i].name));
+		tpl_printf(vars, TPLADD, "LOCKACQUIRED", "%" PRIu64, profile[i].count);
+		tpl_printf(vars, TPLADD, "LOCKCONTENDED", "%" PRIu64, profile[i].contended);
+		tpl_printf(vars, TPLADD, "LOCKWAIT", "%" PRIu64, profile[i].wait_ns / 1000);
+		tpl_printf(vars, TPLADD, "LOCKWAITMAX", "%" PRIu64, profile[i].wait_max_ns / 1000);
+		tpl_printf(vars, TPLADD, "LOCKHOLD", "%" PRIu64, profile[i].hold_ns / 1000);
+		tpl_printf(vars, TPLADD, "LOCKHOLDMAX", "%" PRIu64, profile[i].hold_max_ns / 1000);
+		tpl_addVar(vars, TPLAPPEND, "APILOCKPROFILEROW", tpl_getTpl(vars, "APILOCKPROFILEBIT"));
+	}
+	return tpl_getTpl(vars, "APILOCKPROFILE");
+}
+#else
+static char *send_oscam_lockprofile(struct templatevars * vars, struct uriparams *UNUSED(params))
+{
+	tpl_addVar(vars, TPLADD, "APIERRORMESSAGE", "lock profiling not compiled in");
+	return tpl_getTpl(vars, "APIERROR");
+}
+#endif
+
 static char *send_oscam_api(struct templatevars * vars, FILE * f, struct uriparams * params, int8_t *keepalive, int8_t apicall, char *extraheader)
 {
 	if(strcmp(getParam(params, "part"), "status") == 0)
@@ -7383,6 +7482,14 @@ static char *send_oscam_api(struct templatevars * vars, FILE * f, struct uripara
 			return tpl_getTpl(vars, "APIERROR");
 		}
 	}
+	else if(strcmp(getParam(params, "part"), "ecmtrace") == 0)
+	{
+		return send_oscam_ecmtrace(vars, params);
+	}
+	else if(strcmp(getParam(params, "part"), "lockprofile") == 0)
+	{
+		return send_oscam_lockprofile(vars, params);
+	}
 	else if(strcmp(getParam(params, "part"), "shutdown") == 0)
 	{
 		if((strcmp(strtolower(getParam(params, "action")), "restart") == 0) ||
@@ -7488,6 +7595,21 @@ static char *send_oscam_robots_txt(FILE * f)
 	return "1";
 }
 
+/* Prometheus scrape target. Doesn't need http_lock, the counters are summed up from the metrics shards. */
+static void send_oscam_metrics(FILE *f, char *extraheader)
+{
+	int32_t len;
+	char *content = metrics_render(&len);
+	if(!content)
+	{
+		send_error500(f);
+		return;
+	}
+	send_headers(f, 200, "OK", extraheader, "text/plain; version=0.0.4", 0, len, NULL, 0);
+	webif_write_raw(content, f, len);
+	NULLFREE(content);
+}
+
 static char *send_oscam_graph(struct templatevars * vars)
 {
 	return tpl_getTpl(vars, "GRAPH");
@@ -7730,45 +7852,82 @@ static int8_t check_valid_origin(IN_ADDR_T addr)
 	return 0;
 }
 
-static int8_t check_request(char *result, int32_t readen)
+/* Returns the length of the first complete request in result or 0 if it isn't complete yet. */
+static int32_t check_request(char *result, int32_t readen)
 {
-	if(readen < 50) { return 0; }
 	result[readen] = '\0';
 	int8_t method;
 	if(strncmp(result, "POST", 4) == 0) { method = 1; }
 	else { method = 0; }
 	char *headerEnd = strstr(result, "\r\n\r\n");
 	if(headerEnd == NULL) { return 0; }
-	else if(method == 0) { return 1; }
+	int32_t headerlen = headerEnd + 4 - result;
+	if(method == 0) { return headerlen; }
 	else
 	{
 		char *ptr = strstr(result, "Content-Length: ");
-		if(ptr != NULL)
+		if(ptr != NULL && ptr < headerEnd)
 		{
-			ptr += 16;
-			if(ptr < result + readen)
-			{
-				uint32_t length = atoi(ptr);
-				if(strlen(headerEnd + 4) >= length) { return 1; }
-			}
+			uint32_t length = atoi(ptr + 16);
+			if((uint32_t)(readen - headerlen) >= length) { return headerlen + length; }
 		}
 	}
 	return 0;
 }
 
-static int32_t readRequest(FILE * f, IN_ADDR_T in, char **result, int8_t forcePlain)
+/* Checks if there is already data for another request on this connection which poll() won't report. */
+static int8_t data_pending(struct s_connection *conn)
+{
+	if(conn->pending_len > 0) { return 1; }
+#ifdef WITH_SSL
+	if(ssl_active && conn->ssl && SSL_pending(conn->ssl) > 0) { return 1; }
+#endif
+	return 0;
+}
+
+static int32_t readRequest(FILE * f, IN_ADDR_T in, char **result, int8_t forcePlain, struct s_connection *conn)
 {
-	int32_t n, bufsize = 0, errcount = 0;
+	int32_t n, bufsize = 0, errcount = 0, reqlen = 0;
 	char buf2[1024];
-	struct pollfd pfd2[1];
 #ifdef WITH_SSL
 	int8_t is_ssl = 0;
 	if(ssl_active && !forcePlain)
 		{ is_ssl = 1; }
 #endif
 
-	while(1)
+	// Pipelined requests which have been received together with the previous one
+	if(conn && conn->pending_len > 0)
+	{
+		*result = conn->pending;
+		bufsize = conn->pending_len;
+		conn->pending = NULL;
+		conn->pending_len = 0;
+		reqlen = check_request(*result, bufsize);
+	}
+
+	while(!reqlen)
 	{
+		// Don't let a client which doesn't complete its request block a worker forever
+#ifdef WITH_SSL
+		if(!is_ssl || SSL_pending((SSL *)f) <= 0)
+#endif
+		{
+			struct pollfd pfd2[1];
+#ifdef WITH_SSL
+			pfd2[0].fd = is_ssl ? SSL_get_fd((SSL *)f) : fileno(f);
+#else
+			pfd2[0].fd = fileno(f);
+#endif
+			pfd2[0].events = (POLLIN | POLLPRI);
+			int32_t rc = poll(pfd2, 1, HTTP_READTIMEOUT);
+			if(rc == 0)
+			{
+				cs_log_dbg(D_TRACE, "WebIf: timeout while reading request from %s", cs_inet_ntoa(in));
+				NULLFREE(*result);
+				return -1;
+			}
+		}
+
 		errno = 0;
 		if(forcePlain)
 			{ n = read(fileno(f), buf2, sizeof(buf2)); }
@@ -7776,6 +7935,9 @@ static int32_t readRequest(FILE * f, IN_ADDR_T in, char **result, int8_t forcePl
 			{ n = webif_read(buf2, sizeof(buf2), f); }
 		if(n <= 0)
 		{
+			// Peer closed the connection (e.g. an idle keep-alive connection)
+			if(n == 0 && (forcePlain || !ssl_active))
+				{ return -1; }
 			if((errno == 0 || errno == EINTR))
 			{
 				if(errcount++ < 10)
@@ -7822,37 +7984,32 @@ static int32_t readRequest(FILE * f, IN_ADDR_T in, char **result, int8_t forcePl
 			return -1;
 		}
 
-#ifdef WITH_SSL
-		if(ssl_active && !forcePlain)
-		{
-			int32_t len = 0;
-			len = SSL_pending((SSL *)f);
-
-			if(len > 0)
-				{ continue; }
-
-			pfd2[0].fd = SSL_get_fd((SSL *)f);
+		reqlen = check_request(*result, bufsize);
+	}
 
+	// Keep everything behind the first request for the next call
+	if(reqlen < bufsize)
+	{
+		if(conn && cs_malloc(&conn->pending, bufsize - reqlen + 1))
+		{
+			memcpy(conn->pending, *result + reqlen, bufsize - reqlen);
+			conn->pending_len = bufsize - reqlen;
 		}
-		else
-#endif
-			pfd2[0].fd = fileno(f);
-
-		pfd2[0].events = (POLLIN | POLLPRI);
-
-		int32_t rc = poll(pfd2, 1, 100);
-		if(rc > 0 || !check_request(*result, bufsize))
-			{ continue; }
-		else
-			{ break; }
+		bufsize = reqlen;
+		(*result)[bufsize] = '\0';
 	}
 	return bufsize;
 }
-static int32_t process_request(FILE * f, IN_ADDR_T in)
+
+/* Serves the next request of a connection and all pipelined requests which have already been
+   received. Returns 1 if the connection should be kept open for further requests. */
+static int32_t process_request(struct s_connection *conn)
 {
 	int32_t ok = 0;
+	FILE *f = conn->f;
 	int8_t *keepalive = (int8_t *)pthread_getspecific(getkeepalive);
-	IN_ADDR_T addr = GET_IP();
+	IN_ADDR_T in, addr = GET_IP();
+	IP_ASSIGN(in, conn->remote);
 
 	do
 	{
@@ -7914,6 +8071,7 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 			"/ghttp.html",
 			"/logpoll.html",
 			"/jquery.js",
+			"/metrics",
 		};
 
 		int32_t pagescnt = sizeof(pages) / sizeof(char *); // Calculate the amount of items in array
@@ -7923,13 +8081,14 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 		params.paramcount = 0;
 		time_t modifiedheader = 0;
 
-		bufsize = readRequest(f, in, &filebuf, 0);
+		bufsize = readRequest(f, in, &filebuf, 0, conn);
 
 		if(!filebuf || bufsize < 1)
 		{
 			if(!*keepalive) { cs_log_dbg(D_CLIENT, "WebIf: No data received from client %s. Closing connection.", cs_inet_ntoa(addr)); }
 			return -1;
 		}
+		*keepalive = 0;
 
 		buf = filebuf;
 
@@ -7956,6 +8115,10 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 		}
 		tmp = protocol + strlen(protocol) + 2;
 
+		// HTTP/1.1 connections are persistent unless the client asks to close them
+		if(strcmp(protocol, "HTTP/1.1") == 0 && strcmp(method, "POST"))
+			{ *keepalive = 1; }
+
 		pch = path;
 		/* advance pointer to beginning of query string */
 		while(pch[0] != '?' && pch[0] != '\0') { ++pch; }
@@ -8049,6 +8212,10 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 			{
 				*keepalive = 1;
 			}
+			else if(len > 12 && strncasecmp(str1, "Connection: close", 17) == 0)
+			{
+				*keepalive = 0;
+			}
 		}
 
 		if(cfg.http_user && cfg.http_pwd)
@@ -8102,6 +8269,10 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 		{
 			send_file(f, "JQ", subdir, modifiedheader, etagheader, extraheader);
 		}
+		else if(pgidx == 31)
+		{
+			send_oscam_metrics(f, extraheader);
+		}
 		else
 		{
 			time_t t;
@@ -8218,6 +8389,17 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 
 			char *result = NULL;
 
+			// Big pages are streamed with chunked transfer encoding to clients which understand it
+			if(strcmp(protocol, "HTTP/1.1") == 0)
+			{
+				if(pgidx == 18)
+					{ tpl_setStream(vars, f, "text/xml", extraheader); }
+				else if(pgidx == 24)
+					{ tpl_setStream(vars, f, "text/javascript", extraheader); }
+				else if(pgidx != 21)
+					{ tpl_setStream(vars, f, "text/html", extraheader); }
+			}
+
 			// WebIf allows modifying many things. Thus, all pages except images/css/static are expected to be non-threadsafe!
 			if(pgidx != 19 && pgidx != 20 && pgidx != 21 && pgidx != 27) { cs_writelock(__func__, &http_lock); }
 			switch(pgidx)
@@ -8322,6 +8504,7 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 			}
 			if(pgidx != 19 && pgidx != 20 && pgidx != 21 && pgidx != 27) { cs_writeunlock(__func__, &http_lock); }
 
+			tpl_flushStream(vars);
 			if(result == NULL || !strcmp(result, "0") || strlen(result) == 0) { send_error500(f); }
 			else if(strcmp(result, "1"))
 			{
@@ -8340,35 +8523,59 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 		}
 		NULLFREE(filebuf);
 	}
-	while(*keepalive == 1 && !exit_oscam);
-	return 0;
+	while(*keepalive == 1 && !exit_oscam && data_pending(conn));
+	return *keepalive == 1 && !exit_oscam;
 }
 
-static void *serve_process(void *conn)
+/* Connections of the http server. Idle ones are watched by the server thread with poll(),
+   connections with a pending request are handed to a pool of worker threads. The pool has
+   HTTP_WORKERS threads and grows up to HTTP_MAXWORKERS while all of them are busy. */
+static struct s_connection *http_conns[HTTP_MAXCONNECTIONS];
+static LLIST *http_jobs;
+static int32_t http_workers, http_workers_idle;   // protected by http_jobs_mutex
+static pthread_mutex_t http_jobs_mutex;
+static pthread_cond_t http_jobs_cond;
+static int32_t http_wakeup[2] = { -1, -1 };
+
+static void webif_close_connection(struct s_connection *conn)
 {
-	struct s_connection *myconn = (struct s_connection *)conn;
-	int32_t s = myconn->socket;
-	struct s_client *cl = myconn->cl;
-	IN_ADDR_T in;
-	IP_ASSIGN(in, myconn->remote);
-
-	set_thread_name(__func__);
-
 #ifdef WITH_SSL
-	SSL *ssl = myconn->ssl;
-	SAFE_SETSPECIFIC(getssl, ssl);
+	if(conn->ssl)
+	{
+		// a close notify is only sent on a connection that finished the handshake
+		if(SSL_is_init_finished(conn->ssl))
+			{ SSL_shutdown(conn->ssl); }
+		close(conn->socket);
+		SSL_free(conn->ssl);
+		conn->ssl = NULL;
+	}
+	else
 #endif
-	NULLFREE(myconn);
-
-	SAFE_SETSPECIFIC(getip, &in);
-	SAFE_SETSPECIFIC(getclient, cl);
+	if(conn->f)
+	{
+		fflush(conn->f);
+		shutdown(conn->socket, SHUT_WR);
+		fclose(conn->f);
+	}
+	else
+		{ close(conn->socket); }
+	conn->f = NULL;
+	NULLFREE(conn->pending);
+	conn->pending_len = 0;
+}
 
-	int8_t keepalive = 0;
-	SAFE_SETSPECIFIC(getkeepalive, &keepalive);
+/* Prepares a new connection for reading requests. For SSL this does the handshake, plain requests
+   to a SSL server get redirected. Returns 0 if the connection should be closed. */
+static int8_t webif_setup_connection(struct s_connection *conn)
+{
+	int32_t s = conn->socket;
 
 #ifdef WITH_SSL
 	if(ssl_active)
 	{
+		IN_ADDR_T in;
+		IP_ASSIGN(in, conn->remote);
+		SSL *ssl = conn->ssl;
 		if(SSL_set_fd(ssl, s))
 		{
 			int32_t ok = (SSL_accept(ssl) != -1);
@@ -8385,7 +8592,7 @@ static void *serve_process(void *conn)
 						struct pollfd pfd;
 						pfd.fd = s;
 						pfd.events = POLLIN | POLLPRI;
-						int32_t rc = poll(&pfd, 1, -1);
+						int32_t rc = poll(&pfd, 1, HTTP_READTIMEOUT);
 						if(rc < 0)
 						{
 							if(errno == EINTR || errno == EAGAIN) { continue; }
@@ -8393,12 +8600,15 @@ static void *serve_process(void *conn)
 						}
 						if(rc == 1)
 							{ ok = (SSL_accept(ssl) != -1); }
+						else
+							{ break; }
 					}
 				}
 			}
 			if(ok)
 			{
-				process_request((FILE *)ssl, in);
+				conn->f = (FILE *)ssl;
+				return 1;
 			}
 			else
 			{
@@ -8407,7 +8617,7 @@ static void *serve_process(void *conn)
 				if(f != NULL)
 				{
 					char *ptr, *filebuf = NULL, *host = NULL;
-					int32_t bufsize = readRequest(f, in, &filebuf, 1);
+					int32_t bufsize = readRequest(f, in, &filebuf, 1, NULL);
 
 					if(filebuf)
 					{
@@ -8431,6 +8641,10 @@ static void *serve_process(void *conn)
 					fflush(f);
 					fclose(f);
 					NULLFREE(filebuf);
+					SSL_free(ssl);
+					conn->ssl = NULL;
+					conn->socket = -1;
+					return 0;
 				}
 				else
 				{
@@ -8439,30 +8653,124 @@ static void *serve_process(void *conn)
 			}
 		}
 		else { cs_log("WebIf: Error calling SSL_set_fd()."); }
-		SSL_shutdown(ssl);
-		close(s);
-		SSL_free(ssl);
+		return 0;
 	}
-	else
 #endif
+	conn->f = fdopen(s, "r+");
+	if(conn->f == NULL)
 	{
-		FILE *f;
-		f = fdopen(s, "r+");
-		if(f != NULL)
+		cs_log_dbg(D_TRACE, "WebIf: fdopen(%d) failed. (errno=%d %s)", s, errno, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+/* Serves the pending request(s) of a connection and hands it back to the http server thread. */
+static void serve_connection(struct s_connection *conn)
+{
+	int8_t keep = 0;
+
+	SAFE_SETSPECIFIC(getip, &conn->remote);
+	SAFE_SETSPECIFIC(getclient, conn->cl);
+	SAFE_SETSPECIFIC(getkeepalive, &conn->keepalive);
+#ifdef WITH_SSL
+	SAFE_SETSPECIFIC(getssl, conn->ssl);
+#endif
+
+	if(conn->f || webif_setup_connection(conn))
+	{
+		keep = (process_request(conn) == 1);
+#ifdef WITH_SSL
+		if(!ssl_active)
+#endif
+			{ fflush(conn->f); }
+	}
+	if(!keep && conn->socket >= 0)
+		{ webif_close_connection(conn); }
+
+	SAFE_MUTEX_LOCK(&http_jobs_mutex);
+	conn->last = time(NULL);
+	conn->busy = 0;
+	if(!keep) { conn->closed = 1; }
+	SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+
+	// Wake up the server thread so that it watches or frees the connection
+	if(write(http_wakeup[1], "", 1) < 0 && errno != EAGAIN)
+		{ cs_log_dbg(D_TRACE, "WebIf: wakeup failed (errno=%d %s)", errno, strerror(errno)); }
+}
+
+static void *http_worker(void *UNUSED(d))
+{
+	struct s_connection *conn;
+	struct timespec ts;
+	time_t idle_since = time(NULL);
+
+	set_thread_name(__func__);
+
+	SAFE_MUTEX_LOCK(&http_jobs_mutex);
+	while(!exit_oscam)
+	{
+		if((conn = ll_remove_first(http_jobs)))
 		{
-			process_request(f, in);
-			fflush(f);
-			fclose(f);
+			SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+			serve_connection(conn);
+			SAFE_MUTEX_LOCK(&http_jobs_mutex);
+			idle_since = time(NULL);
+			continue;
 		}
-		else
+		// threads above the base pool end when they were not needed for a while
+		if(http_workers > HTTP_WORKERS && time(NULL) - idle_since >= HTTP_WORKER_IDLE)
+			{ break; }
+		http_workers_idle++;
+		add_ms_to_timespec(&ts, HTTP_WORKER_IDLE * 1000);
+		SAFE_COND_TIMEDWAIT(&http_jobs_cond, &http_jobs_mutex, &ts);
+		http_workers_idle--;
+	}
+	http_workers--;
+	SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+	return NULL;
+}
+
+/* Starts a worker for each job no idle worker is left for. Called with http_jobs_mutex held. */
+static void http_grow_workers(void)
+{
+	int32_t waiting = ll_count(http_jobs);
+
+	while(waiting > http_workers_idle && http_workers < HTTP_MAXWORKERS)
+	{
+		if(start_thread("webif workthread", http_worker, NULL, NULL, 1, 1))
+			{ break; }
+		http_workers++;
+		waiting--;
+	}
+}
+
+/* Adds a freshly accepted connection. If all slots are in use the longest idle keep-alive
+   connection is dropped, if there is none the new connection is refused. */
+static int8_t http_add_connection(struct s_connection *conn)
+{
+	int32_t i, slot = -1, oldest = -1;
+	for(i = 0; i < HTTP_MAXCONNECTIONS; i++)
+	{
+		if(http_conns[i] && http_conns[i]->closed && !http_conns[i]->busy)
+			{ NULLFREE(http_conns[i]); }
+		if(!http_conns[i])
 		{
-			cs_log_dbg(D_TRACE, "WebIf: fdopen(%d) failed. (errno=%d %s)", s, errno, strerror(errno));
+			slot = i;
+			break;
 		}
-		shutdown(s, SHUT_WR);
-		close(s);
+		if(!http_conns[i]->busy && http_conns[i]->f && (oldest < 0 || http_conns[i]->last < http_conns[oldest]->last))
+			{ oldest = i; }
 	}
-
-	return NULL;
+	if(slot < 0 && oldest >= 0)
+	{
+		webif_close_connection(http_conns[oldest]);
+		NULLFREE(http_conns[oldest]);
+		slot = oldest;
+	}
+	if(slot < 0) { return 0; }
+	http_conns[slot] = conn;
+	return 1;
 }
 
 /* Creates a random string with specified length. Note that dst must be one larger than size to hold the trailing \0*/
@@ -8595,8 +8903,101 @@ static void *http_server(void *UNUSED(d))
 	struct SOCKADDR remote;
 	memset(&remote, 0, sizeof(remote));
 
+	http_jobs = ll_create("http_jobs");
+	cs_pthread_cond_init(__func__, &http_jobs_mutex, &http_jobs_cond);
+	if(pipe(http_wakeup) < 0)
+	{
+		cs_log("HTTP Server: Creating wakeup pipe failed! (errno=%d %s)", errno, strerror(errno));
+		close(sock);
+		return NULL;
+	}
+	set_nonblock(http_wakeup[0], true);
+	set_nonblock(http_wakeup[1], true);
+
+	int32_t i;
+	SAFE_MUTEX_LOCK(&http_jobs_mutex);
+	for(i = 0; i < HTTP_WORKERS; i++)
+	{
+		if(!start_thread("webif workthread", http_worker, NULL, NULL, 1, 1))
+			{ http_workers++; }
+	}
+	SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+
+	struct pollfd pfd[HTTP_MAXCONNECTIONS + 2];
+	int32_t pfdconn[HTTP_MAXCONNECTIONS + 2];
+
 	while(!exit_oscam)
 	{
+		int32_t pfdcount = 0;
+		time_t now = time(NULL);
+
+		pfd[pfdcount].fd = sock;
+		pfd[pfdcount].events = POLLIN | POLLPRI;
+		pfdconn[pfdcount++] = -1;
+		pfd[pfdcount].fd = http_wakeup[0];
+		pfd[pfdcount].events = POLLIN | POLLPRI;
+		pfdconn[pfdcount++] = -1;
+
+		// Free closed connections, drop expired keep-alive connections and watch the idle ones
+		SAFE_MUTEX_LOCK(&http_jobs_mutex);
+		for(i = 0; i < HTTP_MAXCONNECTIONS; i++)
+		{
+			struct s_connection *c = http_conns[i];
+			if(!c || c->busy) { continue; }
+			if(!c->closed && now - c->last > HTTP_KEEPALIVE_TIMEOUT)
+			{
+				webif_close_connection(c);
+				c->closed = 1;
+			}
+			if(c->closed)
+			{
+				NULLFREE(http_conns[i]);
+				continue;
+			}
+			pfd[pfdcount].fd = c->socket;
+			pfd[pfdcount].events = POLLIN | POLLPRI;
+			pfdconn[pfdcount++] = i;
+		}
+		SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+
+		int32_t rc = poll(pfd, pfdcount, 1000);
+		if(rc < 0)
+		{
+			if(exit_oscam)
+				{ break; }
+			if(errno != EAGAIN && errno != EINTR)
+			{
+				cs_log("HTTP Server: Error calling poll() (errno=%d %s)", errno, strerror(errno));
+				cs_sleepms(100);
+			}
+			continue;
+		}
+		if(rc == 0)
+			{ continue; }
+
+		if(pfd[1].revents)
+		{
+			char tmp[64];
+			while(read(http_wakeup[0], tmp, sizeof(tmp)) > 0) { ; }
+		}
+
+		// Dispatch connections with a new request to the workers
+		SAFE_MUTEX_LOCK(&http_jobs_mutex);
+		for(i = 2; i < pfdcount; i++)
+		{
+			if(pfd[i].revents)
+			{
+				http_conns[pfdconn[i]]->busy = 1;
+				ll_append(http_jobs, http_conns[pfdconn[i]]);
+				SAFE_COND_SIGNAL(&http_jobs_cond);
+			}
+		}
+		http_grow_workers();
+		SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+
+		if(!pfd[0].revents)
+			{ continue; }
+
 		if((s = accept(sock, (struct sockaddr *) &remote, &len)) < 0)
 		{
 			if(exit_oscam)
@@ -8606,7 +9007,6 @@ static void *http_server(void *UNUSED(d))
 				cs_log("HTTP Server: Error calling accept() (errno=%d %s)", errno, strerror(errno));
 				cs_sleepms(100);
 			}
-			else { cs_sleepms(5); }
 			continue;
 		}
 		else
@@ -8620,6 +9020,7 @@ static void *http_server(void *UNUSED(d))
 			setTCPTimeouts(s);
 			cur_client()->last = time((time_t *)0); //reset last busy time
 			conn->cl = cur_client();
+			conn->last = cur_client()->last;
 #ifdef IPV6SUPPORT
 			if(do_ipv6)
 			{
@@ -8646,19 +9047,28 @@ static void *http_server(void *UNUSED(d))
 				if(conn->ssl == NULL)
 				{
 					close(s);
+					NULLFREE(conn);
 					cs_log("WebIf: Error calling SSL_new().");
 					continue;
 				}
 			}
 #endif
 
-			int32_t ret = start_thread("webif workthread", serve_process, (void *)conn, NULL, 1, 1);
-			if(ret)
+			// The connection is handed to a worker as soon as the request arrives
+			SAFE_MUTEX_LOCK(&http_jobs_mutex);
+			int8_t added = http_add_connection(conn);
+			SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
+			if(!added)
 			{
+				cs_log_dbg(D_TRACE, "WebIf: too many connections, refusing %s", cs_inet_ntoa(conn->remote));
+				webif_close_connection(conn);
 				NULLFREE(conn);
 			}
 		}
 	}
+	SAFE_MUTEX_LOCK(&http_jobs_mutex);
+	SAFE_COND_BROADCAST(&http_jobs_cond);
+	SAFE_MUTEX_UNLOCK(&http_jobs_mutex);
 	// Wait a bit so that we don't close ressources while http threads are active
 	cs_sleepms(300);
 #ifdef WITH_SSL
@@ -8671,6 +9081,16 @@ static void *http_server(void *UNUSED(d))
 	OPENSSL_free(lock_cs);
 	lock_cs = NULL;
 #endif
+	for(i = 0; i < HTTP_MAXCONNECTIONS; i++)
+	{
+		if(http_conns[i] && !http_conns[i]->busy)
+		{
+			if(!http_conns[i]->closed) { webif_close_connection(http_conns[i]); }
+			NULLFREE(http_conns[i]);
+		}
+	}
+	close(http_wakeup[0]);
+	close(http_wakeup[1]);
 	cs_log("HTTP Server stopped");
 	free_client(cl);
 	close(sock);
@@ -5,6 +5,7 @@
 #include "oscam-chk.h"
 #include "oscam-ecm.h"
 #include "oscam-client.h"
+#include "oscam-garbage.h"
 #include "oscam-lock.h"
 #include "oscam-net.h"
 #include "oscam-string.h"
@@ -147,127 +148,294 @@ int32_t chk_srvid_match(ECM_REQUEST *er, SIDTAB *sidtab)
 	return (rc == 7);
 }
 
-int32_t chk_srvid(struct s_client *cl, ECM_REQUEST *er)
+int32_t chk_srvid_match_by_caid_prov(uint16_t caid, uint32_t provid, SIDTAB *sidtab)
 {
-	int32_t nr, rc = 0;
-	SIDTAB *sidtab;
+	int32_t i, rc = 0;
 
-	if(!cl->sidtabs.ok)
-	{
-		if(!cl->sidtabs.no) { return (1); }
-		rc = 1;
-	}
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-		if(sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid)
-		{
-			if((cl->sidtabs.no & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match(er, sidtab)))
-				{ return (0); }
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match(er, sidtab)))
-				{ rc = 1; }
-		}
-	return (rc);
+	if(!sidtab->num_caid)
+		{ rc |= 1; }
+	else
+		for(i = 0; (i < sidtab->num_caid) && (!(rc & 1)); i++)
+			if(caid == sidtab->caid[i]) { rc |= 1; }
+
+	if(!sidtab->num_provid)
+		{ rc |= 2; }
+	else
+		for(i = 0; (i < sidtab->num_provid) && (!(rc & 2)); i++)
+			if(provid == sidtab->provid[i]) { rc |= 2; }
+
+	return (rc == 3);
 }
 
-int32_t has_srvid(struct s_client *cl, ECM_REQUEST *er)
+/* cfg.sidtab compiled into one lookup: for every caid, provid and srvid the
+ * mask of sidtabs listing it. A (caid, prid, srvid) check is three hash
+ * lookups and the clients sidtabs.ok/no masks are applied to the result.
+ * The index is rebuilt when cfg_sidtab_generation changes and swapped in as
+ * a whole, the old one is left to the garbage collector. */
+struct s_sidtab_map
 {
-	if(!cl->sidtabs.ok)
-		{ return 0; }
+	uint32_t        *key;
+	SIDTABBITS      *mask;      // 0 = free slot
+	uint32_t        size;       // power of two
+	int32_t         shift;
+};
 
-	int32_t nr;
-	SIDTAB *sidtab;
+struct s_sidtab_index
+{
+	uint32_t        generation;
+	SIDTABBITS      caid_any;   // sidtabs without caids
+	SIDTABBITS      provid_any;
+	SIDTABBITS      srvid_any;
+	SIDTABBITS      used;       // sidtabs with caids, provids or srvids
+	SIDTABBITS      cp_used;    // sidtabs with caids or provids
+	SIDTABBITS      has_srvid;  // sidtabs with srvids
+	struct s_sidtab_map caid;
+	struct s_sidtab_map provid;
+	struct s_sidtab_map srvid;
+};
+
+struct s_sidtab_match
+{
+	SIDTABBITS      match;      // sidtabs matching the request
+	SIDTABBITS      used;       // sidtabs which take part in the check
+	SIDTABBITS      has_srvid;
+};
 
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-		if(sidtab->num_srvid)
-		{
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match(er, sidtab)))
-				{ return 1; }
-		}
+extern uint32_t cfg_sidtab_generation;
+
+static struct s_sidtab_index *sidtab_index;
+static pthread_mutex_t sidtab_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t sidtab_map_pos(const struct s_sidtab_map *map, uint32_t key)
+{
+	return (key * 0x9E3779B1) >> map->shift;
+}
+
+static SIDTABBITS sidtab_map_get(const struct s_sidtab_map *map, uint32_t key)
+{
+	uint32_t pos;
+	for(pos = sidtab_map_pos(map, key); map->mask[pos]; pos = (pos + 1) & (map->size - 1))
+	{
+		if(map->key[pos] == key)
+			{ return map->mask[pos]; }
+	}
 	return 0;
 }
 
-int32_t has_lb_srvid(struct s_client *cl, ECM_REQUEST *er)
+static void sidtab_map_add(struct s_sidtab_map *map, uint32_t key, SIDTABBITS bit)
 {
-	if(!cl->lb_sidtabs.ok)
-		{ return 0; }
+	uint32_t pos;
+	for(pos = sidtab_map_pos(map, key); map->mask[pos] && map->key[pos] != key; pos = (pos + 1) & (map->size - 1)) { ; }
+	map->key[pos] = key;
+	map->mask[pos] |= bit;
+}
 
-	int32_t nr;
+static uint32_t sidtab_map_size(uint32_t count, int32_t *shift)
+{
+	uint32_t size;
+	for(size = 16, *shift = 28; size < count * 2; size <<= 1, (*shift)--) { ; }
+	return size;
+}
+
+// index and maps are one block, so add_garbage() can release it
+static struct s_sidtab_index *sidtab_index_build(uint32_t generation)
+{
+	struct s_sidtab_index *idx;
+	struct s_sidtab_map *map[3];
 	SIDTAB *sidtab;
+	SIDTABBITS bit;
+	uint32_t count[3] = { 0, 0, 0 }, size[3], total = 0;
+	int32_t i, nr, shift[3];
+	uint8_t *p;
 
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-		if((cl->lb_sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-				(chk_srvid_match(er, sidtab)))
-			{ return 1; }
-	return 0;
+	for(nr = 0, sidtab = cfg.sidtab; sidtab && nr < 64; sidtab = sidtab->next, nr++)
+	{
+		count[0] += sidtab->num_caid;
+		count[1] += sidtab->num_provid;
+		count[2] += sidtab->num_srvid;
+	}
+	for(i = 0; i < 3; i++)
+	{
+		size[i] = sidtab_map_size(count[i], &shift[i]);
+		total += size[i] * (sizeof(uint32_t) + sizeof(SIDTABBITS));
+	}
+
+	if(!cs_malloc(&idx, sizeof(struct s_sidtab_index) + total))
+		{ return NULL; }
+
+	idx->generation = generation;
+	map[0] = &idx->caid;
+	map[1] = &idx->provid;
+	map[2] = &idx->srvid;
+	p = (uint8_t *)(idx + 1);
+	for(i = 0; i < 3; i++)
+	{
+		map[i]->size = size[i];
+		map[i]->shift = shift[i];
+		map[i]->mask = (SIDTABBITS *)p;
+		p += size[i] * sizeof(SIDTABBITS);
+	}
+	for(i = 0; i < 3; i++)
+	{
+		map[i]->key = (uint32_t *)p;
+		p += size[i] * sizeof(uint32_t);
+	}
+
+	for(nr = 0, sidtab = cfg.sidtab; sidtab && nr < 64; sidtab = sidtab->next, nr++)
+	{
+		bit = (SIDTABBITS)1 << nr;
+		if(sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid) { idx->used |= bit; }
+		if(sidtab->num_caid | sidtab->num_provid) { idx->cp_used |= bit; }
+		if(sidtab->num_srvid) { idx->has_srvid |= bit; }
+
+		if(!sidtab->num_caid) { idx->caid_any |= bit; }
+		for(i = 0; i < sidtab->num_caid; i++)
+			{ sidtab_map_add(&idx->caid, sidtab->caid[i], bit); }
+
+		if(!sidtab->num_provid) { idx->provid_any |= bit; }
+		for(i = 0; i < sidtab->num_provid; i++)
+			{ sidtab_map_add(&idx->provid, sidtab->provid[i], bit); }
+
+		if(!sidtab->num_srvid) { idx->srvid_any |= bit; }
+		for(i = 0; i < sidtab->num_srvid; i++)
+			{ sidtab_map_add(&idx->srvid, sidtab->srvid[i], bit); }
+	}
+	return idx;
 }
 
-int32_t chk_srvid_match_by_caid_prov(uint16_t caid, uint32_t provid, SIDTAB *sidtab)
+static struct s_sidtab_index *get_sidtab_index(void)
 {
-	int32_t i, rc = 0;
+	struct s_sidtab_index *idx = sidtab_index, *old;
+	uint32_t generation = cfg_sidtab_generation;
 
-	if(!sidtab->num_caid)
-		{ rc |= 1; }
-	else
-		for(i = 0; (i < sidtab->num_caid) && (!(rc & 1)); i++)
-			if(caid == sidtab->caid[i]) { rc |= 1; }
+	if(idx && idx->generation == generation)
+		{ return idx; }
 
-	if(!sidtab->num_provid)
-		{ rc |= 2; }
-	else
-		for(i = 0; (i < sidtab->num_provid) && (!(rc & 2)); i++)
-			if(provid == sidtab->provid[i]) { rc |= 2; }
-
-	return (rc == 3);
+	SAFE_MUTEX_LOCK(&sidtab_index_lock);
+	idx = sidtab_index;
+	if(!idx || idx->generation != generation)
+	{
+		old = idx;
+		// a sidtab change during the build bumps the generation again
+		if((idx = sidtab_index_build(generation)))
+		{
+			sidtab_index = idx;
+			if(old)
+				{ add_garbage(old); }
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&sidtab_index_lock);
+	return idx;
 }
 
-int32_t chk_srvid_by_caid_prov(struct s_client *cl, uint16_t caid, uint32_t provid)
+/* Fills m for er (caid, prid and srvid like chk_srvid_match) or, without er,
+ * for caid and provid like chk_srvid_match_by_caid_prov. */
+static void sidtab_match(ECM_REQUEST *er, uint16_t caid, uint32_t provid, struct s_sidtab_match *m)
 {
-	int32_t nr, rc = 0;
+	struct s_sidtab_index *idx = get_sidtab_index();
 	SIDTAB *sidtab;
+	SIDTABBITS bit;
+	int32_t nr;
+
+	if(idx)
+	{
+		if(er)
+		{
+			m->match = (sidtab_map_get(&idx->caid, er->caid) | idx->caid_any)
+					   & (sidtab_map_get(&idx->srvid, er->srvid) | idx->srvid_any);
+			if(er->prid)
+				{ m->match &= sidtab_map_get(&idx->provid, er->prid) | idx->provid_any; }
+			m->used = idx->used;
+		}
+		else
+		{
+			m->match = (sidtab_map_get(&idx->caid, caid) | idx->caid_any)
+					   & (sidtab_map_get(&idx->provid, provid) | idx->provid_any);
+			m->used = idx->cp_used;
+		}
+		m->has_srvid = idx->has_srvid;
+		return;
+	}
+
+	memset(m, 0, sizeof(struct s_sidtab_match));
+	for(nr = 0, sidtab = cfg.sidtab; sidtab && nr < 64; sidtab = sidtab->next, nr++)
+	{
+		bit = (SIDTABBITS)1 << nr;
+		if(er ? (sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid) : (sidtab->num_caid | sidtab->num_provid))
+			{ m->used |= bit; }
+		if(sidtab->num_srvid)
+			{ m->has_srvid |= bit; }
+		if(er ? chk_srvid_match(er, sidtab) : chk_srvid_match_by_caid_prov(caid, provid, sidtab))
+			{ m->match |= bit; }
+	}
+}
+
+int32_t chk_srvid(struct s_client *cl, ECM_REQUEST *er)
+{
+	struct s_sidtab_match m;
+	int32_t rc = 0;
 
 	if(!cl->sidtabs.ok)
 	{
 		if(!cl->sidtabs.no) { return (1); }
 		rc = 1;
 	}
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-		if(sidtab->num_caid | sidtab->num_provid)
-		{
-			if((cl->sidtabs.no & ((SIDTABBITS)1 << nr)) && !sidtab->num_srvid &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ return (0); }
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ rc = 1; }
-		}
+	sidtab_match(er, 0, 0, &m);
+	if(cl->sidtabs.no & m.used & m.match)
+		{ return (0); }
+	if(cl->sidtabs.ok & m.used & m.match)
+		{ rc = 1; }
 	return (rc);
 }
 
-int32_t chk_srvid_by_caid_prov_rdr(struct s_reader *rdr, uint16_t caid, uint32_t provid)
+int32_t has_srvid(struct s_client *cl, ECM_REQUEST *er)
 {
-	int32_t nr, rc = 0;
-	SIDTAB *sidtab;
+	if(!cl->sidtabs.ok)
+		{ return 0; }
+
+	struct s_sidtab_match m;
+	sidtab_match(er, 0, 0, &m);
+	return (cl->sidtabs.ok & m.has_srvid & m.match) != 0;
+}
 
-	if(!rdr->sidtabs.ok)
+int32_t has_lb_srvid(struct s_client *cl, ECM_REQUEST *er)
+{
+	if(!cl->lb_sidtabs.ok)
+		{ return 0; }
+
+	struct s_sidtab_match m;
+	sidtab_match(er, 0, 0, &m);
+	return (cl->lb_sidtabs.ok & m.match) != 0;
+}
+
+static int32_t chk_sidtabs_by_caid_prov(SIDTABS *sidtabs, uint16_t caid, uint32_t provid)
+{
+	struct s_sidtab_match m;
+	int32_t rc = 0;
+
+	if(!sidtabs->ok)
 	{
-		if(!rdr->sidtabs.no) { return (1); }
+		if(!sidtabs->no) { return (1); }
 		rc = 1;
 	}
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-		if(sidtab->num_caid | sidtab->num_provid)
-		{
-			if((rdr->sidtabs.no & ((SIDTABBITS)1 << nr)) && !sidtab->num_srvid &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ return (0); }
-			if((rdr->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ rc = 1; }
-		}
+	sidtab_match(NULL, caid, provid, &m);
+	if(sidtabs->no & m.used & ~m.has_srvid & m.match)
+		{ return (0); }
+	if(sidtabs->ok & m.used & m.match)
+		{ rc = 1; }
 	return (rc);
 }
 
+int32_t chk_srvid_by_caid_prov(struct s_client *cl, uint16_t caid, uint32_t provid)
+{
+	return chk_sidtabs_by_caid_prov(&cl->sidtabs, caid, provid);
+}
+
+int32_t chk_srvid_by_caid_prov_rdr(struct s_reader *rdr, uint16_t caid, uint32_t provid)
+{
+	return chk_sidtabs_by_caid_prov(&rdr->sidtabs, caid, provid);
+}
+
 int32_t chk_is_betatunnel_caid(uint16_t caid)
 {
 	if(caid == 0x1702 || caid == 0x1722) { return 1; }
@@ -10,6 +10,7 @@
 #include "oscam-conf-chk.h"
 #include "oscam-client.h"
 #include "oscam-ecm.h"
+#include "oscam-emm-reassembly.h"
 #include "oscam-failban.h"
 #include "oscam-garbage.h"
 #include "oscam-lock.h"
@@ -742,11 +743,7 @@ void free_client(struct s_client *cl)
 	free_joblist(cl);
 	NULLFREE(cl->work_mbuf);
 
-	if(cl->ecmtask)
-	{
-		add_garbage(cl->ecmtask);
-		cl->ecmtask = NULL;
-	}
+	free_reader_ecmtask(cl);
 
 	ll_destroy_data(&cl->cascadeusers);
 
@@ -758,8 +755,7 @@ void free_client(struct s_client *cl)
     NULLFREE(cl->cltab.aclass);
  	NULLFREE(cl->cltab.bclass);
 
-	NULLFREE(cl->cw_rass);
-	ll_destroy_data(&cl->ra_buf);
+	emm_reassembly_client_free(cl);
 	NULLFREE(cl->aes_keys);
 
 #ifdef MODULE_CCCAM
@@ -342,10 +342,12 @@ static const struct config_list global_opts[] =
 	DEF_OPT_INT32("unlockparental"          , OFS(ulparent),            0),
 	DEF_OPT_INT32("nice"                    , OFS(nice),                99),
 	DEF_OPT_INT32("maxlogsize"              , OFS(max_log_size),        10),
+	DEF_OPT_INT32("ecmtrace"                , OFS(ecmtrace),            0),
 	DEF_OPT_INT8("waitforcards"             , OFS(waitforcards),        1),
 	DEF_OPT_INT32("waitforcards_extra_delay", OFS(waitforcards_extra_delay), 500),
 	DEF_OPT_INT8("preferlocalcards"         , OFS(preferlocalcards),    0),
 	DEF_OPT_INT32("readerrestartseconds"    , OFS(reader_restart_seconds), 5),
+	DEF_OPT_INT32("readerinitparallel"      , OFS(reader_init_parallel), 0),
 	DEF_OPT_INT8("dropdups"                 , OFS(dropdups),            0),
 	DEF_OPT_INT8("reload_useraccounts"      , OFS(reload_useraccounts), 0),
 	DEF_OPT_INT8("reload_readers"           , OFS(reload_readers),      0),
@@ -1230,6 +1232,7 @@ static const struct config_list dvbapi_opts[] =
 	DEF_OPT_INT8("pmt_mode"		, OFS(dvbapi_pmtmode),		0),
 	DEF_OPT_INT8("request_mode"	, OFS(dvbapi_requestmode),	0),
 	DEF_OPT_INT32("listen_port"	, OFS(dvbapi_listenport),	0),
+	DEF_OPT_INT32("demuxers"	, OFS(dvbapi_demuxers),		0),
 	DEF_OPT_INT32("delayer"		, OFS(dvbapi_delayer),		0),
 	DEF_OPT_INT8("ecminfo_type"		, OFS(dvbapi_ecminfo_type),	0),
 	DEF_OPT_STR("user"		, OFS(dvbapi_usr),		NULL),
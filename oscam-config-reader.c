@@ -207,6 +207,7 @@ static void reader_caid_fn(const char *token, char *value, void *setting, FILE *
 		struct s_reader *rdr = container_of(setting, struct s_reader, ctab);
 		if(rdr)
 			{ rdr->changes_since_shareupdate = 1; }
+		reader_route_invalidate();
 	}
 }
 
@@ -625,6 +626,7 @@ static void ratelimitecm_fn(const char *token, char *value, void *setting, FILE
 				rdr->rlecmh[i].srvid = -1;
 				rdr->rlecmh[i].last.time = -1;
 			}
+			rdr->rlecm_used = 0;
 		}
 		return;
 	}
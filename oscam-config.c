@@ -289,6 +289,7 @@ int32_t init_provid(void)
 		{ return 0; }
 	struct s_provid *provid_ptr = NULL;
 	struct s_provid *new_cfg_provid = NULL, *last_provid;
+	struct s_name_index *new_index, *last_index;
 
 	nr = 0;
 	while(fgets(token, MAXLINESIZE, fp))
@@ -390,14 +391,20 @@ int32_t init_provid(void)
 		}		
 	}
 	
+	new_index = provid_index_create(new_cfg_provid);
+
 	cs_writelock(__func__, &config_lock);
 	
 	//this allows reloading of provids, so cleanup of old data is needed:
 	last_provid = cfg.provid; //old data
+	last_index = cfg.provid_index;
 	cfg.provid = new_cfg_provid; //assign after loading, so everything is in memory
+	cfg.provid_index = new_index;
 
 	cs_writeunlock(__func__, &config_lock);
 
+	add_garbage(last_index);
+
 	struct s_client *cl;
 	for(cl = first_client->next; cl ; cl = cl->next)
 		{ cl->last_providptr = NULL; }
@@ -449,6 +456,7 @@ int32_t init_srvid(void)
 	if(!cs_malloc(&token, MAXLINESIZE))
 		{ return 0; }
 	struct s_srvid *srvid = NULL, *new_cfg_srvid[16], *last_srvid[16];
+	struct s_name_index *new_index, *last_index;
 	// A cache for strings within srvids. A checksum is calculated which is the start point in the array (some kind of primitive hash algo).
 	// From this point, a sequential search is done. This greatly reduces the amount of string comparisons.
 	const char **stringcache[1024];
@@ -691,13 +699,19 @@ int32_t init_srvid(void)
 		}
 	}
 
+	new_index = srvid_index_create(new_cfg_srvid);
+
 	cs_writelock(__func__, &config_lock);
 	//this allows reloading of srvids, so cleanup of old data is needed:
 	memcpy(last_srvid, cfg.srvid, sizeof(last_srvid));  //old data
 	memcpy(cfg.srvid, new_cfg_srvid, sizeof(last_srvid));   //assign after loading, so everything is in memory
+	last_index = cfg.srvid_index;
+	cfg.srvid_index = new_index;
 
 	cs_writeunlock(__func__, &config_lock);
 
+	add_garbage(last_index);
+
 	struct s_client *cl;
 	for(cl = first_client->next; cl ; cl = cl->next)
 		{ cl->last_srvidptr = NULL; }
@@ -960,15 +974,25 @@ static struct s_rlimit *ratelimit_read_int(void)
 void ratelimit_read(void)
 {
 
-	struct s_rlimit *entry, *old_list;
+	struct s_rlimit *entry, *old_list, *new_list;
+	struct s_name_index *new_index, *old_index;
+
+	new_list = ratelimit_read_int();
+	new_index = ratelimit_index_create(new_list);
 
+	cs_writelock(__func__, &config_lock);
 	old_list = cfg.ratelimit_list;
-	cfg.ratelimit_list = ratelimit_read_int();
+	old_index = cfg.ratelimit_index;
+	cfg.ratelimit_list = new_list;
+	cfg.ratelimit_index = new_index;
+	cs_writeunlock(__func__, &config_lock);
 
+	// readers may still look at the old rules
+	add_garbage(old_index);
 	while(old_list)
 	{
 		entry = old_list->next;
-		NULLFREE(old_list);
+		add_garbage(old_list);
 		old_list = entry;
 	}
 }
@@ -979,14 +1003,20 @@ struct ecmrl get_ratelimit(ECM_REQUEST *er)
 	struct ecmrl tmp;
 	memset(&tmp, 0, sizeof(tmp));
 	if(!cfg.ratelimit_list) { return tmp; }
-	struct s_rlimit *entry = cfg.ratelimit_list;
-	while(entry)
+	struct s_rlimit *entry;
+	if(cfg.ratelimit_index)
 	{
-		if(entry->rl.caid == er->caid && entry->rl.provid == er->prid && entry->rl.srvid == er->srvid && (!entry->rl.chid || entry->rl.chid == er->chid))
+		entry = ratelimit_index_get(cfg.ratelimit_index, er->caid, er->prid, er->srvid);
+		while(entry && entry->rl.chid && entry->rl.chid != er->chid)
+			{ entry = entry->next_same; }
+	}
+	else
+	{
+		for(entry = cfg.ratelimit_list; entry; entry = entry->next)
 		{
-			break;
+			if(entry->rl.caid == er->caid && entry->rl.provid == er->prid && entry->rl.srvid == er->srvid && (!entry->rl.chid || entry->rl.chid == er->chid))
+				{ break; }
 		}
-		entry = entry->next;
 	}
 
 	if(entry) { tmp = entry->rl; }
@@ -1056,18 +1086,24 @@ int32_t init_tierid(void)
 	fclose(fp);
 	if(nr > 0)
 		{ cs_log("%d tier-id's loaded", nr); }
+	struct s_name_index *new_index = tierid_index_create(new_cfg_tierid), *last_index;
 	cs_writelock(__func__, &config_lock);
 	//reload function:
 	tierid = cfg.tierid;
 	cfg.tierid = new_cfg_tierid;
+	last_index = cfg.tierid_index;
+	cfg.tierid_index = new_index;
+	cs_writeunlock(__func__, &config_lock);
+
+	// lookups may still use the old entries through the old index
+	add_garbage(last_index);
 	struct s_tierid *ptr;
 	while(tierid)
 	{
 		ptr = tierid->next;
-		NULLFREE(tierid);
+		add_garbage(tierid);
 		tierid = ptr;
 	}
-	cs_writeunlock(__func__, &config_lock);
 
 	return (0);
 }
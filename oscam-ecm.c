@@ -18,8 +18,10 @@
 #include "oscam-garbage.h"
 #include "oscam-failban.h"
 #include "oscam-net.h"
+#include "oscam-reader.h"
 #include "oscam-time.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-string.h"
 #include "oscam-work.h"
 #include "reader-common.h"
@@ -29,10 +31,21 @@ extern struct ecm_request_t *ecmcwcache;
 extern uint16_t len4caid[256];
 extern uint32_t ecmcwcache_size;
 extern int32_t exit_oscam;
+extern struct timeb startup_time;
 
 extern CS_MUTEX_LOCK ecm_pushed_deleted_lock;
 extern struct ecm_request_t	*ecm_pushed_deleted;
 
+/* ECM payloads live out of line behind a small reference count, so the copies
+   in the readers ecmtask tables share the bytes of their parent request. */
+struct s_ecm_payload
+{
+	int32_t refs;
+	int32_t size;
+};
+
+static pthread_mutex_t ecm_payload_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_mutex_t cw_process_sleep_cond_mutex;
 static pthread_cond_t cw_process_sleep_cond;
 static int cw_process_wakeups;
@@ -84,6 +97,7 @@ void increment_n_request(struct s_client *cl){
 	if(check_client(cl)){
 		cl->n_request[1]++;
 		first_client->n_request[1]++;
+		metrics_inc(MC_ECM_REQUEST);
 	}
 }
 
@@ -486,6 +500,60 @@ static void remove_ecm_from_reader(ECM_REQUEST *ecm)
 	}
 }
 
+uchar *ecm_payload_alloc(int32_t ecmlen)
+{
+	struct s_ecm_payload *p;
+	int32_t size = MAX(ecmlen, ECM_PAYLOAD_MIN) + ECM_PAYLOAD_SLACK;
+	if(!cs_malloc(&p, sizeof(struct s_ecm_payload) + size))
+		{ return NULL; }
+	p->refs = 1;
+	p->size = size;
+	return (uchar *)(p + 1);
+}
+
+uchar *ecm_payload_get(uchar *ecm)
+{
+	if(!ecm)
+		{ return NULL; }
+	struct s_ecm_payload *p = (struct s_ecm_payload *)ecm - 1;
+	SAFE_MUTEX_LOCK(&ecm_payload_lock);
+	p->refs++;
+	SAFE_MUTEX_UNLOCK(&ecm_payload_lock);
+	return ecm;
+}
+
+void ecm_payload_put(uchar **ecm)
+{
+	if(!*ecm)
+		{ return; }
+	struct s_ecm_payload *p = (struct s_ecm_payload *)*ecm - 1;
+	int32_t refs;
+	*ecm = NULL;
+	SAFE_MUTEX_LOCK(&ecm_payload_lock);
+	refs = --p->refs;
+	SAFE_MUTEX_UNLOCK(&ecm_payload_lock);
+	if(!refs)
+		{ add_garbage(p); }  // readers may still look at an answered ecmtask slot
+}
+
+/* Shrinks the MAX_ECM_SIZE buffer of get_ecmtask() once ecmlen is known.
+   Only valid while the payload is not shared yet. */
+void ecm_payload_trim(ECM_REQUEST *er)
+{
+	struct s_ecm_payload *p;
+	uchar *ecm;
+	if(!er->ecm)
+		{ return; }
+	p = (struct s_ecm_payload *)er->ecm - 1;
+	if(p->refs != 1 || p->size <= MAX(er->ecmlen, ECM_PAYLOAD_MIN) + ECM_PAYLOAD_SLACK)
+		{ return; }
+	if(!(ecm = ecm_payload_alloc(er->ecmlen)))
+		{ return; }
+	memcpy(ecm, er->ecm, MIN(MAX(er->ecmlen, 0), p->size));
+	NULLFREE(p);
+	er->ecm = ecm;
+}
+
 void free_ecm(ECM_REQUEST *ecm)
 {
 	struct s_ecm_answer *ea, *nxt;
@@ -506,6 +574,7 @@ void free_ecm(ECM_REQUEST *ecm)
 	}
 	if(ecm->src_data)
 		{ add_garbage(ecm->src_data); }
+	ecm_payload_put(&ecm->ecm);
 	add_garbage(ecm);
 }
 
@@ -516,7 +585,14 @@ void free_push_in_ecm(ECM_REQUEST *ecm)
 	gbox_free_cards_pending(ecm);
 	if(ecm->src_data)
 		{ NULLFREE(ecm->src_data); }
-	NULLFREE(ecm);
+	free_ecmtask(ecm);
+}
+
+/* frees a request of get_ecmtask() which was never passed to get_cw() */
+void free_ecmtask(ECM_REQUEST *er)
+{
+	ecm_payload_put(&er->ecm);
+	NULLFREE(er);
 }
 
 
@@ -528,6 +604,11 @@ ECM_REQUEST *get_ecmtask(void)
 		{ return NULL; }
 	if(!cs_malloc(&er, sizeof(ECM_REQUEST)))
 		{ return NULL; }
+	if(!(er->ecm = ecm_payload_alloc(MAX_ECM_SIZE)))
+	{
+		NULLFREE(er);
+		return NULL;
+	}
 	cs_ftime(&er->tps);
 	er->rc     = E_UNHANDLED;
 	er->client = cl;
@@ -536,6 +617,21 @@ ECM_REQUEST *get_ecmtask(void)
 	return er;
 }
 
+/* drops the pending table of a reader client together with its payload references */
+void free_reader_ecmtask(struct s_client *cl)
+{
+	int32_t i;
+	if(!cl->ecmtask)
+		{ return; }
+	for(i = 0; i < cfg.max_pending; i++)
+		{ ecm_payload_put(&cl->ecmtask[i].ecm); }
+	add_garbage(cl->ecmtask);
+	cl->ecmtask = NULL;
+	if(cl->ecmtask_index)
+		{ add_garbage(cl->ecmtask_index); }
+	cl->ecmtask_index = NULL;
+}
+
 void cleanup_ecmtasks(struct s_client *cl)
 {
 	if(!cl) { return; }
@@ -660,6 +756,25 @@ void distribute_ea(struct s_ecm_answer *ea)
 	}
 }
 
+static int8_t first_cw_logged;
+static pthread_mutex_t first_cw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Startup benchmark: time from process start until the first cw reached a client */
+static void log_first_cw(ECM_REQUEST *er)
+{
+	struct timeb now;
+
+	SAFE_MUTEX_LOCK(&first_cw_lock);
+	if(!first_cw_logged)
+	{
+		first_cw_logged = 1;
+		cs_ftime(&now);
+		cs_log("startup: first cw answered %"PRId64" ms after start (caid %04X srvid %04X)",
+				comp_timeb(&now, &startup_time), er->caid, er->srvid);
+	}
+	SAFE_MUTEX_UNLOCK(&first_cw_lock);
+}
+
 int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 {
 	if(!check_client(client) || client->typ != 'c')
@@ -783,6 +898,8 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 	{ 
 		er->rcEx = 0;
 		memset(er->msglog, 0, MSGLOGSIZE); // remove reader msglog from previous requests that failed, founds never give back msglog!
+		if(!first_cw_logged)
+			{ log_first_cw(er); }
 	}
 
 	if(er->rcEx)
@@ -802,6 +919,7 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 #endif
 
 	cs_ftime(&tpe);
+	ecm_trace_done(er);
 
 #ifdef CS_CACHEEX
 	int cx = 0;
@@ -842,6 +960,7 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 		client->cwfound++;
 		client->account->cwfound++;
 		first_client->cwfound++;
+		metrics_inc(MC_CW_FOUND);
 		break;
 	}
 	case E_CACHE1:
@@ -851,10 +970,13 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 		client->cwcache++;
 		client->account->cwcache++;
 		first_client->cwcache++;
+		metrics_inc(MC_CW_CACHE);
+		metrics_observe(MH_CACHE_HIT, client->cwlastresptime);
 #ifdef CS_CACHEEX
 		if(check_client(er->cacheex_src))
 		{
 			first_client->cwcacheexhit++;
+			metrics_inc(MC_CACHEEX_HIT);
 			er->cacheex_src->cwcacheexhit++;
 			if(er->cacheex_src->account)
 				{ er->cacheex_src->account->cwcacheexhit++; }
@@ -877,6 +999,7 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 			client->cwnot++;
 			client->account->cwnot++;
 			first_client->cwnot++;
+			metrics_inc(MC_CW_NOTFOUND);
 		}
 		break;
 	}
@@ -885,6 +1008,7 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 		client->cwtout++;
 		client->account->cwtout++;
 		first_client->cwtout++;
+		metrics_inc(MC_CW_TIMEOUT);
 		break;
 	}
 	default:
@@ -933,7 +1057,6 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 
 		if((er->rc < E_NOTFOUND && max_active_sids > 0) || zap_limit > 0)
 		{
-			int8_t k = 0;
 			int8_t active_sid_count = 0;
 			time_t zaptime = time(NULL);
 
@@ -945,14 +1068,7 @@ int32_t send_dcw(struct s_client *client, ECM_REQUEST *er)
 
 			if(client->account->acosc_penalty_active == 0 && max_active_sids > 0)
 			{
-				for(k=0; k<15 ; k++)
-				{
-					if(zaptime-30 < client->client_zap_list[k].lasttime && client->client_zap_list[k].request_stage == 10)
-					{
-						cs_log_dbg(D_TRACE, "[zaplist] ACoSC for Client: %s  more then 10 ECM's for %04X@%06X/%04X/%04X", username(client),  client->client_zap_list[k].caid, client->client_zap_list[k].provid, client->client_zap_list[k].chid, client->client_zap_list[k].sid);
-						active_sid_count ++;
-					}
-				}
+				active_sid_count = zaplist_active_sids(client, zaptime);
 				cs_log_dbg(D_TRACE, "[zaplist] ACoSC for Client: %s  active_sid_count= %i with more than 10 followed ECM's (mas:%i (%s))", username(client), active_sid_count, max_active_sids, info1);
 			}
 			if(client->account->acosc_penalty_active == 0 && max_active_sids > 0 && active_sid_count > max_active_sids) //max_active_sids reached
@@ -1124,6 +1240,7 @@ void request_cw_from_readers(ECM_REQUEST *er, uint8_t stop_stage)
 	int8_t sent = 0;
 
 	if(er->stage >= 4) { return; }
+	ecm_trace_stamp(er, &er->trace[ECM_TRACE_REQUEST]);
 
 	while(1)
 	{
@@ -1189,6 +1306,7 @@ void request_cw_from_readers(ECM_REQUEST *er, uint8_t stop_stage)
 
 			ea->status |= REQUEST_SENT;
 			cs_ftime(&ea->time_request_sent);
+			ecm_trace_stamp(er, &ea->trace[EA_TRACE_QUEUED]);
 
 			er->reader_requested++;
 
@@ -1222,7 +1340,7 @@ void add_cache_from_reader(ECM_REQUEST *er, struct s_reader *rdr, uint32_t csp_h
 
 		ecm->cwc_cycletime = er->cwc_cycletime;
 		ecm->cwc_next_cw_cycle = er->cwc_next_cw_cycle;
-		memcpy(ecm->ecm, er->ecm, sizeof(ecm->ecm));  // ecm[0] is pushed to cacheexclients so we need a copy from it
+		ecm->ecm = ecm_payload_get(er->ecm);  // ecm[0] is pushed to cacheexclients so we need it too
 		ecm->caid = caid;
 		ecm->prid = prid;
 		ecm->srvid = srvid;
@@ -1245,7 +1363,7 @@ void add_cache_from_reader(ECM_REQUEST *er, struct s_reader *rdr, uint32_t csp_h
 		ecm_pushed_deleted = ecm;
 		cs_writeunlock(__func__, &ecm_pushed_deleted_lock);
 #else
-		NULLFREE(ecm);
+		free_ecmtask(ecm);
 #endif
 	}
 }
@@ -1261,6 +1379,7 @@ void chk_dcw(struct s_ecm_answer *ea)
 	struct s_reader *eardr = ea->reader;
 	if(!ert)
 		{ return; }
+	ecm_trace_stamp(ert, &ert->trace[ECM_TRACE_ANSWER]);
 
 	//ecm request already answered!
 	if(ert->rc < E_99)
@@ -1660,6 +1779,13 @@ int32_t write_ecm_answer(struct s_reader *reader, ECM_REQUEST *er, int8_t rc, ui
 	ea->rc = rc;
 	ea->ecm_time = comp_timeb(&now, &ea->time_request_sent);
 	if(ea->ecm_time < 1) { ea->ecm_time = 1; }  //set ecm_time 1 if answer immediately
+	ecm_trace_stamp(er, &ea->trace[EA_TRACE_ANSWERED]);
+	if(reader && (rc == E_FOUND || rc == E_NOTFOUND) && reader->client == cur_client())
+	{
+		// only the reader thread writes the histograms
+		metrics_hist_add(&reader->ecm_hist, ea->ecm_time);
+		ecm_trace_reader(reader, ea);
+	}
 	ea->rcEx = rcEx;
 	if(cw) { memcpy(ea->cw, cw, 16); }
 	if(msglog) { memcpy(ea->msglog, msglog, MSGLOGSIZE); }
@@ -1920,6 +2046,7 @@ void write_ecm_answer_fromcache(struct s_write_from_cache *wfc)
 			if(er->client->account)
 				{ er->client->account->cwcacheexpush++; }
 			first_client->cwcacheexpush++;
+			metrics_inc(MC_CACHEEX_PUSH);
 		}
 #endif
 
@@ -1944,6 +2071,7 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 	cs_log_dump_dbg(D_ATR, er->ecm, er->ecmlen, "get cw for ecm:");
 	cs_log_dbg(D_LB, "{client %s, caid %04X, prid %06X, srvid %04X} [get_cw] NEW REQUEST!", (check_client(er->client) ? er->client->account->usr : "-"), er->caid, er->prid, er->srvid);
 	increment_n_request(client);
+	ecm_trace_start(er);
 
 	int32_t i, j, m;
 	time_t now = time((time_t *)0);
@@ -2281,6 +2409,7 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 	unsigned char md5tmp[MD5_DIGEST_LENGTH];
 	// store ECM in cache
 	memcpy(er->ecmd5, MD5(er->ecm + offset, er->ecmlen - offset, md5tmp), CS_ECMSTORESIZE);
+	ecm_payload_trim(er);
 	cacheex_update_hash(er);
 	ac_chk(client, er, 0);
 
@@ -2288,6 +2417,7 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 	//********  CHECK IF FOUND ECM IN CACHE
 	struct ecm_request_t *ecm = NULL;
 	ecm = check_cache(er, client);
+	ecm_trace_stamp(er, &er->trace[ECM_TRACE_CACHE]);
 	if(ecm)     //found in cache
 	{
 		cs_log_dbg(D_LB,"{client %s, caid %04X, prid %06X, srvid %04X} [get_cw] cw found immediately in cache! ", (check_client(er->client)?er->client->account->usr:"-"),er->caid, er->prid, er->srvid);
@@ -2327,11 +2457,14 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 
 	struct s_ecm_answer *ea, *prv = NULL;
 	struct s_reader *rdr;
+	struct s_reader_route_iter route;
 
 	cs_readlock(__func__, &readerlist_lock);
 	cs_readlock(__func__, &clientlist_lock);
 
-	for(rdr = first_active_reader; rdr; rdr = rdr->next)
+	// only readers whose caid table accepts the request can match
+	reader_route_init(&route, er, lb_get_auto_betatunnel_caid(er->caid));
+	while((rdr = reader_route_next(&route)))
 	{
 		uint8_t is_fallback = chk_is_fixed_fallback(rdr, er);
 		int8_t match = matching_reader(er, rdr);
@@ -18,12 +18,18 @@ uint32_t chk_provid(uint8_t *ecm, uint16_t caid);
 int32_t send_dcw(struct s_client *client, ECM_REQUEST *er);
 void free_ecm(ECM_REQUEST *ecm);
 void free_push_in_ecm(ECM_REQUEST *ecm);
+void free_ecmtask(ECM_REQUEST *er);
 void write_ecm_answer_fromcache(struct s_write_from_cache *wfc);
 void fallback_timeout(ECM_REQUEST *er);
 void ecm_timeout(ECM_REQUEST *er);
 void reader_get_ecm(struct s_reader *reader, ECM_REQUEST *er);
 ECM_REQUEST *get_ecmtask(void);
+uchar *ecm_payload_alloc(int32_t ecmlen);
+uchar *ecm_payload_get(uchar *ecm);
+void ecm_payload_put(uchar **ecm);
+void ecm_payload_trim(ECM_REQUEST *er);
 struct s_ecm_answer *get_ecm_answer(struct s_reader *reader, ECM_REQUEST *er);
+void free_reader_ecmtask(struct s_client *cl);
 void cleanup_ecmtasks(struct s_client *cl);
 void remove_reader_from_ecm(struct s_reader *rdr);
 
@@ -0,0 +1,401 @@
+#define MODULE_LOG_PREFIX "emm"
+
+#include "globals.h"
+#include "oscam-emm.h"
+#include "oscam-emm-reassembly.h"
+#include "oscam-metrics.h"
+#include "oscam-string.h"
+
+/* Shared EMMs of some systems are sent in two sections which have to be put
+ * together before a card accepts them. do_emm() runs the reassembly once per
+ * EMM ahead of the au reader fan-out, a handler per system id decides what to
+ * keep and how to combine the parts. The parts live in a fixed pool, so the
+ * reassembly never holds more than EMM_RASS_SLOTS of them. A part only combines
+ * with parts of the same client. Parts waiting longer than EMM_RASS_TIMEOUT are
+ * expired, when the pool is full the oldest part is dropped.
+ *
+ * The carousel repeats a header part long after its EMM was assembled. A used
+ * part leaves a checksum behind which makes the repeats skipped, it is kept as
+ * long as the repeats come and EMM_RASS_SEEN_TIMEOUT after the last one. */
+
+#define EMM_RASS_SLOTS          64      // parts kept at once
+#define EMM_RASS_TIMEOUT        30      // s a part waits for the rest of its EMM
+#define EMM_RASS_MAX_LEN        500     // longer sections are not reassembled
+#define EMM_RASS_SEEN_SLOTS     256     // used parts remembered at once
+#define EMM_RASS_SEEN_TIMEOUT   1800    // s a used part is remembered without a repeat
+
+struct s_emm_rass_part
+{
+	struct s_client *client;    // NULL for a free slot
+	uint16_t        caid;
+	uint32_t        provid;
+	time_t          last_seen;
+	uint32_t        seq;        // orders the parts by their last use
+	int16_t         emmlen;
+	uint8_t         emm[MAX_EMM_SIZE];
+};
+
+struct s_emm_rass_seen
+{
+	struct s_client *client;    // NULL for a free slot
+	uint16_t        caid;
+	uint32_t        provid;
+	uint32_t        crc;        // of the used part
+	int16_t         emmlen;
+	time_t          last_seen;
+	uint32_t        seq;
+};
+
+struct s_emm_rass_handler
+{
+	uint8_t     sysid;          // upper byte of the caid
+	int32_t     (*assemble)(struct s_client *client, EMM_PACKET *ep, time_t now);
+};
+
+static struct s_emm_rass_part rass_parts[EMM_RASS_SLOTS];
+static struct s_emm_rass_seen rass_seen[EMM_RASS_SEEN_SLOTS];
+static uint32_t rass_seq;
+static pthread_mutex_t rass_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void rass_expire(time_t now)
+{
+	int32_t i;
+
+	for(i = 0; i < EMM_RASS_SLOTS; i++)
+	{
+		if(rass_parts[i].client && now - rass_parts[i].last_seen > EMM_RASS_TIMEOUT)
+		{
+			rass_parts[i].client = NULL;
+			metrics_inc(MC_EMM_RASS_EXPIRED);
+		}
+	}
+	for(i = 0; i < EMM_RASS_SEEN_SLOTS; i++)
+	{
+		if(rass_seen[i].client && now - rass_seen[i].last_seen > EMM_RASS_SEEN_TIMEOUT)
+			{ rass_seen[i].client = NULL; }
+	}
+}
+
+// First part of an EMM, table 0 matches any table id
+static struct s_emm_rass_part *rass_find(struct s_client *client, uint16_t caid, uint32_t provid, uint8_t table)
+{
+	struct s_emm_rass_part *p, *found = NULL;
+	int32_t i;
+
+	for(i = 0; i < EMM_RASS_SLOTS; i++)
+	{
+		p = &rass_parts[i];
+		if(p->client != client || (p->caid >> 8) != (caid >> 8) || p->provid != provid || (table && p->emm[0] != table))
+			{ continue; }
+		if(!found || p->seq > found->seq)
+			{ found = p; }
+	}
+	return found;
+}
+
+// Used part with the checksum of the section, NULL if it went into no EMM yet
+static struct s_emm_rass_seen *rass_find_seen(struct s_client *client, uint16_t caid, uint32_t provid, EMM_PACKET *ep, uint32_t crc)
+{
+	struct s_emm_rass_seen *m;
+	int32_t i;
+
+	for(i = 0; i < EMM_RASS_SEEN_SLOTS; i++)
+	{
+		m = &rass_seen[i];
+		if(m->client == client && m->crc == crc && m->emmlen == ep->emmlen && (m->caid >> 8) == (caid >> 8) && m->provid == provid)
+			{ return m; }
+	}
+	return NULL;
+}
+
+// Frees the slot of a part which went into an EMM, its checksum is kept to skip the repeats
+static void rass_used(struct s_emm_rass_part *p, time_t now)
+{
+	struct s_emm_rass_seen *m, *slot = NULL;
+	int32_t i;
+
+	for(i = 0; i < EMM_RASS_SEEN_SLOTS; i++)
+	{
+		m = &rass_seen[i];
+		if(!m->client)
+		{
+			slot = m;
+			break;
+		}
+		if(!slot || m->seq < slot->seq)
+			{ slot = m; }
+	}
+	slot->client = p->client;
+	slot->caid = p->caid;
+	slot->provid = p->provid;
+	slot->crc = crc32(0L, p->emm, p->emmlen);
+	slot->emmlen = p->emmlen;
+	slot->last_seen = now;
+	slot->seq = ++rass_seq;
+	p->client = NULL;
+	metrics_inc(MC_EMM_RASS_COMPLETED);
+}
+
+// Keeps the first part of an EMM, a repeat of a known or used part only refreshes it
+static int32_t rass_store(struct s_client *client, EMM_PACKET *ep, uint32_t provid, time_t now)
+{
+	struct s_emm_rass_part *p, *slot = NULL, *oldest = NULL;
+	struct s_emm_rass_seen *m;
+	uint16_t caid = b2i(2, ep->caid);
+	int32_t i;
+
+	if((m = rass_find_seen(client, caid, provid, ep, crc32(0L, ep->emm, ep->emmlen))))
+	{
+		m->last_seen = now;
+		m->seq = ++rass_seq;
+		return 0;
+	}
+
+	for(i = 0; i < EMM_RASS_SLOTS; i++)
+	{
+		p = &rass_parts[i];
+		if(!p->client)
+		{
+			if(!slot)
+				{ slot = p; }
+			continue;
+		}
+		if(p->client == client && (p->caid >> 8) == (caid >> 8) && p->provid == provid && p->emm[0] == ep->emm[0])
+		{
+			if(p->emmlen == ep->emmlen && !memcmp(p->emm, ep->emm, ep->emmlen))
+			{
+				p->last_seen = now;
+				p->seq = ++rass_seq;
+				return 0;
+			}
+			metrics_inc(MC_EMM_RASS_DROPPED);   // replaced before its second part came
+			slot = p;
+			break;
+		}
+		if(!oldest || p->seq < oldest->seq)
+			{ oldest = p; }
+	}
+	if(!slot)
+	{
+		metrics_inc(MC_EMM_RASS_DROPPED);
+		slot = oldest;
+	}
+
+	slot->client = client;
+	slot->caid = caid;
+	slot->provid = provid;
+	slot->last_seen = now;
+	slot->seq = ++rass_seq;
+	slot->emmlen = ep->emmlen;
+	memcpy(slot->emm, ep->emm, ep->emmlen);
+	return 0;
+}
+
+static int32_t rass_drop(EMM_PACKET *ep, const char *reason)
+{
+	cs_log_dbg(D_EMM, "emm %02X of caid %04X dropped: %s", ep->emm[0], b2i(2, ep->caid), reason);
+	metrics_inc(MC_EMM_RASS_DROPPED);
+	return 0;
+}
+
+#ifdef READER_CRYPTOWORKS
+//   Cryptoworks EMM-S have to be assembled by the client from an EMM-SH with table
+//   id 0x84 and a corresponding EMM-SB (body) with table id 0x86. A pseudo EMM-S
+//   with table id 0x84 has to be build containing all nano commands from both the
+//   original EMM-SH and EMM-SB in ascending order.
+static int32_t rass_cryptoworks(struct s_client *client, EMM_PACKET *ep, time_t now)
+{
+	uint8_t *buffer = ep->emm, tmp[MAX_EMM_SIZE];
+	struct s_emm_rass_part *sh;
+	int32_t emm_len;
+
+	switch(buffer[0])
+	{
+	case 0x84: // emm-sh
+		if(ep->emmlen > 11 && buffer[11] == buffer[2] - 9)
+		{
+			cs_log_dbg(D_EMM, "cryptoworks: received assembled EMM-S");
+			return 1;
+		}
+		return rass_store(client, ep, 0, now);
+
+	case 0x86: // emm-sb
+		if(!(sh = rass_find(client, b2i(2, ep->caid), 0, 0x84)))
+			{ return rass_drop(ep, "EMM-SB without EMM-SH"); }
+
+		// EMM-SH[0:12] + EMM-SB[5:len_EMM-SB] + EMM-SH[12:EMM-SH_len] with the
+		// nanos sorted in ascending order and the emm length updated
+		emm_len = ep->emmlen - 5 + sh->emmlen - 12;
+		if(ep->emmlen < 5 || sh->emmlen < 12 || emm_len + 12 > MAX_EMM_SIZE)
+			{ return rass_drop(ep, "bad EMM-S length"); }
+		memcpy(tmp, buffer + 5, ep->emmlen - 5);
+		memcpy(tmp + ep->emmlen - 5, sh->emm + 12, sh->emmlen - 12);
+		memcpy(buffer, sh->emm, 12);
+		emm_sort_nanos(buffer + 12, tmp, emm_len);
+		buffer[1] = ((emm_len + 9) >> 8) | 0x70;
+		buffer[2] = (emm_len + 9) & 0xFF;
+		if(buffer[11] != emm_len)   // sanity check
+			{ return rass_drop(ep, "error assembling EMM-S"); }
+
+		ep->emmlen = emm_len + 12;
+		rass_used(sh, now);
+		cs_log_dump_dbg(D_EMM, buffer, ep->emmlen, "cryptoworks: shared emm (assembled):");
+		return 1;
+	}
+	return 1;
+}
+#endif
+
+#ifdef READER_VIACCESS
+/* The EMM-S has no provid of its own. Without one in the packet the shared
+ * address tells the provider, through the provider table of an au reader with
+ * that address which has an EMM-GH waiting. Network readers know no addresses. */
+static uint32_t rass_viaccess_provid(struct s_client *client, EMM_PACKET *ep)
+{
+	struct s_reader *rdr;
+	uint16_t caid = b2i(2, ep->caid);
+	uint32_t provid = b2i(4, ep->provid) & 0xFFFFF0;
+	int32_t i;
+
+	if(provid || !client->aureader_list)
+		{ return provid; }
+	LL_ITER itr = ll_iter_create(client->aureader_list);
+	while((rdr = ll_iter_next(&itr)))
+	{
+		if(is_network_reader(rdr))
+			{ continue; }
+		for(i = 0; i < rdr->nprov; i++)
+		{
+			provid = b2i(4, rdr->prid[i]) & 0xFFFFF0;
+			if(!memcmp(ep->emm + 3, rdr->sa[i], 3) && rass_find(client, caid, provid, 0))
+				{ return provid; }
+		}
+	}
+	return 0;
+}
+
+// Viaccess EMM-S (0x8e) carry only a part of the nanos, the rest comes with the
+// EMM-GH (0x8c/0x8d) of the provider. The last digit of the provid is a dont care.
+static int32_t rass_viaccess(struct s_client *client, EMM_PACKET *ep, time_t now)
+{
+	uint8_t *buffer = ep->emm, emmbuf[MAX_EMM_SIZE];
+	struct s_emm_rass_part *gh;
+	uint16_t caid = b2i(2, ep->caid);
+	uint32_t provid;
+	int32_t i, pos = 0;
+
+	switch(buffer[0])
+	{
+	case 0x8c:
+	case 0x8d:
+		if(ep->emmlen < 8)
+			{ return rass_drop(ep, "short EMM-GH"); }
+		return rass_store(client, ep, b2i(3, buffer + 5) & 0xFFFFF0, now);
+
+	case 0x8e:
+		if(ep->emmlen < 7 || !(provid = rass_viaccess_provid(client, ep)) || !(gh = rass_find(client, caid, provid, 0)))
+			{ return rass_drop(ep, "EMM-S without EMM-GH"); }
+
+		//extract from emm-gh
+		for(i = 3; i + 1 < gh->emmlen && pos + gh->emm[i + 1] + 2 <= (int32_t)sizeof(emmbuf); i += gh->emm[i + 1] + 2)
+		{
+			memcpy(emmbuf + pos, gh->emm + i, gh->emm[i + 1] + 2);
+			pos += gh->emm[i + 1] + 2;
+		}
+
+		if(buffer[2] == 0x2c)
+		{
+			if(ep->emmlen < 47 || pos + 44 > (int32_t)sizeof(emmbuf))
+				{ return rass_drop(ep, "short fixed EMM-S"); }
+			//add 9E 20 nano + first 32 uint8_ts of emm content
+			memcpy(emmbuf + pos, "\x9E\x20", 2);
+			memcpy(emmbuf + pos + 2, buffer + 7, 32);
+			pos += 34;
+
+			//add F0 08 nano + 8 subsequent uint8_ts of emm content
+			memcpy(emmbuf + pos, "\xF0\x08", 2);
+			memcpy(emmbuf + pos + 2, buffer + 39, 8);
+			pos += 10;
+		}
+		else
+		{
+			//extract from variable emm-s
+			for(i = 7; i + 1 < ep->emmlen && pos + buffer[i + 1] + 2 <= (int32_t)sizeof(emmbuf); i += buffer[i + 1] + 2)
+			{
+				memcpy(emmbuf + pos, buffer + i, buffer[i + 1] + 2);
+				pos += buffer[i + 1] + 2;
+			}
+		}
+		if(pos + 7 > EMM_RASS_MAX_LEN)
+			{ return rass_drop(ep, "assembled EMM-S too long"); }
+
+		emm_sort_nanos(buffer + 7, emmbuf, pos);
+		pos += 7;
+
+		//calculate emm length and set it on position 2
+		buffer[2] = pos - 3;
+		ep->emmlen = pos;
+		cs_log_dump_dbg(D_EMM, buffer, pos, "viaccess: assembled emm for provid %06X", provid);
+		rass_used(gh, now);
+		return 1;
+	}
+	return 1;
+}
+#endif
+
+static const struct s_emm_rass_handler rass_handlers[] =
+{
+#ifdef READER_VIACCESS
+	{ 0x05, rass_viaccess },
+#endif
+#ifdef READER_CRYPTOWORKS
+	{ 0x0D, rass_cryptoworks },
+#endif
+	{ 0, NULL }
+};
+
+int32_t emm_reassemble_at(struct s_client *client, EMM_PACKET *ep, time_t now)
+{
+	const struct s_emm_rass_handler *h;
+	uint8_t sysid = ep->caid[0];
+	int32_t ret;
+
+	for(h = rass_handlers; h->assemble && h->sysid != sysid; h++) { ; }
+	if(!h->assemble)
+		{ return 1; }
+	if(ep->emmlen > EMM_RASS_MAX_LEN)
+		{ return rass_drop(ep, "section too long"); }
+
+	SAFE_MUTEX_LOCK(&rass_lock);
+	rass_expire(now);
+	ret = h->assemble(client, ep, now);
+	SAFE_MUTEX_UNLOCK(&rass_lock);
+	return ret;
+}
+
+int32_t emm_reassemble(struct s_client *client, EMM_PACKET *ep)
+{
+	return emm_reassemble_at(client, ep, time(NULL));
+}
+
+// Releases the parts of a client which goes away, they can never complete
+void emm_reassembly_client_free(struct s_client *client)
+{
+	int32_t i;
+
+	SAFE_MUTEX_LOCK(&rass_lock);
+	for(i = 0; i < EMM_RASS_SLOTS; i++)
+	{
+		if(rass_parts[i].client == client)
+		{
+			rass_parts[i].client = NULL;
+			metrics_inc(MC_EMM_RASS_DROPPED);
+		}
+	}
+	for(i = 0; i < EMM_RASS_SEEN_SLOTS; i++)
+	{
+		if(rass_seen[i].client == client)
+			{ rass_seen[i].client = NULL; }
+	}
+	SAFE_MUTEX_UNLOCK(&rass_lock);
+}
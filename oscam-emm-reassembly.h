@@ -0,0 +1,8 @@
+#ifndef OSCAM_EMM_REASSEMBLY_H_
+#define OSCAM_EMM_REASSEMBLY_H_
+
+int32_t emm_reassemble(struct s_client *client, EMM_PACKET *ep); // Returns 1 if ep holds an EMM for the readers, 0 if it was kept as a part or dropped
+int32_t emm_reassemble_at(struct s_client *client, EMM_PACKET *ep, time_t now); // The same at a given time, for replaying recorded streams
+void emm_reassembly_client_free(struct s_client *client);
+
+#endif
@@ -7,16 +7,96 @@
 #include "oscam-client.h"
 #include "oscam-config.h"
 #include "oscam-emm.h"
+#include "oscam-metrics.h"
 #include "oscam-string.h"
 #include "oscam-time.h"
 #include "oscam-work.h"
+#include "oscam-writer.h"
 #include "reader-common.h"
 #include "oscam-chk.h"
 #include "oscam-emm-cache.h"
+#include "oscam-emm-reassembly.h"
 
 const char *entitlement_type[] = { "", "package", "PPV-Event", "chid", "tier", "class", "PBM", "admin" };
 
 static struct timeb last_emm_clean;
+
+/* The packets handed to the reader jobs are shared and never written after
+   they were queued. A packet is copied again only if a reader classification
+   (get_emm_type) changed the EMM in between. */
+struct s_emm_shared
+{
+	EMM_PACKET  ep;         // first member, the jobs carry &shared->ep
+	int32_t     refs;
+	int8_t      md5_done;
+	uchar       md5[MD5_DIGEST_LENGTH];
+};
+
+static pthread_mutex_t emm_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+EMM_PACKET *emm_packet_new(const EMM_PACKET *ep)
+{
+	struct s_emm_shared *shared;
+
+	if(!cs_malloc(&shared, sizeof(struct s_emm_shared)))
+		{ return NULL; }
+	memcpy(&shared->ep, ep, sizeof(EMM_PACKET));
+	shared->refs = 1;
+	metrics_inc(MC_EMM_COPIES);
+	return &shared->ep;
+}
+
+void emm_packet_retain(EMM_PACKET *ep)
+{
+	SAFE_MUTEX_LOCK(&emm_shared_lock);
+	((struct s_emm_shared *)ep)->refs++;
+	SAFE_MUTEX_UNLOCK(&emm_shared_lock);
+}
+
+void emm_packet_release(EMM_PACKET *ep)
+{
+	struct s_emm_shared *shared = (struct s_emm_shared *)ep;
+	int32_t refs;
+
+	if(!ep)
+		{ return; }
+	SAFE_MUTEX_LOCK(&emm_shared_lock);
+	refs = --shared->refs;
+	SAFE_MUTEX_UNLOCK(&emm_shared_lock);
+	if(!refs)
+		{ NULLFREE(shared); }
+}
+
+// MD5 of the EMM section, calculated once per shared packet
+static void emm_packet_md5(EMM_PACKET *ep, uchar *md5)
+{
+	struct s_emm_shared *shared = (struct s_emm_shared *)ep;
+
+	SAFE_MUTEX_LOCK(&emm_shared_lock);
+	if(!shared->md5_done)
+	{
+		MD5(ep->emm, SCT_LEN(ep->emm), shared->md5);
+		shared->md5_done = 1;
+		metrics_inc(MC_EMM_HASHES);
+	}
+	memcpy(md5, shared->md5, MD5_DIGEST_LENGTH);
+	SAFE_MUTEX_UNLOCK(&emm_shared_lock);
+}
+
+/* Returns a shared packet with the current contents of ep, reusing cur when
+   nothing changed since it was made */
+static EMM_PACKET *emm_packet_share(EMM_PACKET *cur, const EMM_PACKET *ep)
+{
+	if(cur && cur->emmlen == ep->emmlen && cur->type == ep->type && cur->client == ep->client
+			&& cur->skip_filter_check == ep->skip_filter_check
+			&& !memcmp(cur->caid, ep->caid, sizeof(ep->caid))
+			&& !memcmp(cur->provid, ep->provid, sizeof(ep->provid))
+			&& !memcmp(cur->hexserial, ep->hexserial, sizeof(ep->hexserial))
+			&& !memcmp(cur->emm, ep->emm, ep->emmlen))
+		{ return cur; }
+	emm_packet_release(cur);
+	return emm_packet_new(ep);
+}
 static int8_t cs_emmlen_is_blocked(struct s_reader *rdr, int16_t len)
 {
 	struct s_emmlen_range *blocklen;
@@ -261,11 +341,11 @@ static char *get_emmlog_filename(char *dest, size_t destlen, const char *basefil
 
 static void saveemm(struct s_reader *aureader, EMM_PACKET *ep, const char *proceded)
 {
-	FILE *fp_log;
 	char tmp[17];
 	char buf[80];
 	char token_log[256];
-	char *tmp2;
+	char line[80 + MAX_EMM_SIZE * 2 + 32];
+	const char *typename;
 	time_t rawtime;
 	uint32_t emmtype;
 	struct tm timeinfo;
@@ -279,38 +359,35 @@ static void saveemm(struct s_reader *aureader, EMM_PACKET *ep, const char *proce
 		time(&rawtime);
 		localtime_r(&rawtime, &timeinfo); // to access LOCAL date/time info
 		int32_t emm_length = SCT_LEN(ep->emm);
+		if(emm_length > MAX_EMM_SIZE)
+			{ emm_length = MAX_EMM_SIZE; }
 		strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", &timeinfo);
 		switch(ep->type)
 		{
 			case GLOBAL:
-				fp_log = fopen(get_emmlog_filename(token_log, sizeof(token_log), aureader->label, "global", "log"), "a");
+				typename = "global";
 				break;
 			case SHARED:
-				fp_log = fopen(get_emmlog_filename(token_log, sizeof(token_log), aureader->label, "shared", "log"), "a");
+				typename = "shared";
 				break;
 			case UNIQUE:
-				fp_log = fopen(get_emmlog_filename(token_log, sizeof(token_log), aureader->label, "unique", "log"), "a");
+				typename = "unique";
 				break;
 			case UNKNOWN:
 			default:
-				fp_log = fopen(get_emmlog_filename(token_log, sizeof(token_log), aureader->label, "unknown", "log"), "a");
-		}			
-		
-		if(!fp_log)
-		{
-			rdr_log(aureader, "ERROR: Cannot open file '%s' (errno=%d: %s)\n", token_log, errno, strerror(errno));
-		}
-		else
-		{
-			if(cs_malloc(&tmp2, emm_length * 2 + 1))
-			{
-				fprintf(fp_log, "%s   %s   ", buf, cs_hexdump(0, ep->hexserial, 8, tmp, sizeof(tmp)));
-				fprintf(fp_log, "%s   %s\n", cs_hexdump(0, ep->emm, emm_length, tmp2, emm_length * 2 + 1), proceded);
-				NULLFREE(tmp2);
-				rdr_log(aureader, "Successfully added EMM to %s", token_log);
-			}
-			fclose(fp_log);
+				typename = "unknown";
 		}
+		get_emmlog_filename(token_log, sizeof(token_log), aureader->label, typename, "log");
+
+		// written by the file writer thread, the client thread does not wait for it,
+		// never rotated as the webif shows and cleans this file itself (httpemm*clean),
+		// the writer reopens it after the webif moved it away
+		int32_t len = snprintf(line, sizeof(line), "%s   %s   ", buf, cs_hexdump(0, ep->hexserial, 8, tmp, sizeof(tmp)));
+		cs_hexdump(0, ep->emm, emm_length, line + len, sizeof(line) - len);
+		len += strlen(line + len);
+		len += snprintf(line + len, sizeof(line) - len, "   %s\n", proceded);
+		if(writer_append(token_log, line, MIN(len, (int32_t)sizeof(line) - 1), 0))
+			{ rdr_log(aureader, "Successfully added EMM to %s", token_log); }
 	}
 }
 
@@ -343,6 +420,7 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 		return;	
 	}
 	ep->emmlen = sct_len;
+	metrics_inc(MC_EMM_REQUEST);
 	
 	cs_log_dump_dbg(D_EMM, ep->emm, ep->emmlen, "emm:");
 
@@ -351,20 +429,25 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 	if(client->account->emm_reassembly > 1 || (client->account->emm_reassembly && cl_dvbapi))
 		{ assemble = 1; }
 
+	EMM_PACKET *shared = NULL;
+	uint16_t caid = b2i(2, ep->caid);
+	uint32_t provid = b2i(4, ep->provid);
+
+	if(caid_is_viaccess(caid)) // viaccess fixup last digit is a dont care!
+	{
+		 provid &= 0xFFFFF0;
+	}
+
+	// shared EMMs which come in parts are put together once for all readers
+	if(assemble && !emm_reassemble(client, ep))
+		{ return; }
+
 	LL_ITER itr = ll_iter_create(client->aureader_list);
 	while((aureader = ll_iter_next(&itr)))
 	{
 		if(!aureader->enable)
 			{ continue; }
 
-		uint16_t caid = b2i(2, ep->caid);
-		uint32_t provid = b2i(4, ep->provid);
-		
-		if(caid_is_viaccess(caid)) // viaccess fixup last digit is a dont care!
-		{
-			 provid &= 0xFFFFF0;
-		}
-		
 		if(aureader->audisabled)
 		{
 			rdr_log_dbg(aureader, D_EMM, "AU is disabled");
@@ -435,19 +518,6 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 			}
 		}
 
-		if(csystem && csystem->do_emm_reassembly)
-		{
-			if(assemble)
-			{
-				if(!csystem->do_emm_reassembly(aureader, client, ep))
-					{ continue; } // skip this reader
-			}
-			else
-			{
-				rdr_log_dbg(aureader, D_EMM, "processing raw emm");
-			}
-		}
-
 		rdr_log_dbg_sensitive(aureader, D_EMM, "emmtype %s. Reader serial {%s}.", typtext[ep->type],
 								 cs_hexdump(0, aureader->hexserial, 8, tmp, sizeof(tmp)));
 		rdr_log_dbg_sensitive(aureader, D_EMM, "emm UA/SA: {%s}.",
@@ -541,7 +611,9 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 		{
 			unsigned char md5tmp[MD5_DIGEST_LENGTH];
 
-			MD5(ep->emm, SCT_LEN(ep->emm), md5tmp);
+			if(!(shared = emm_packet_share(shared, ep)))
+				{ continue; }
+			emm_packet_md5(shared, md5tmp);
 		
 			struct s_emmcache *emmcache = find_emm_cache(md5tmp); // check emm cache
 			if(emmcache && !lastseendone)
@@ -567,17 +639,18 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 		
 		if(writeemm)   // only write on no cache hit or cache hit that needs further rewrite
 		{
-			EMM_PACKET *emm_pack;
-			if(cs_malloc(&emm_pack, sizeof(EMM_PACKET)))
+			if((shared = emm_packet_share(shared, ep)))
 			{
 				rdr_log_dbg(aureader, D_EMM, "emm is being sent to reader");
-				memcpy(emm_pack, ep, sizeof(EMM_PACKET));
-				add_job(aureader->client, ACTION_READER_EMM, emm_pack, sizeof(EMM_PACKET));
+				emm_packet_retain(shared);
+				if(add_job(aureader->client, ACTION_READER_EMM, shared, sizeof(EMM_PACKET)))
+					{ metrics_inc(MC_EMM_JOBS); }
 				saveemm(aureader, ep, "written");
 			}
 		}
 
 	} // done with this reader, process next reader!
+	emm_packet_release(shared);
 
 	if(emmnok > 0 && emmnok == ll_count(client->aureader_list))
 	{
@@ -599,7 +672,7 @@ int32_t reader_do_emm(struct s_reader *reader, EMM_PACKET *ep)
 	uint16_t caid = b2i(2, ep->caid);
 	if(reader->cachemm && !caid_is_irdeto(caid))
 	{
-		MD5(ep->emm, SCT_LEN(ep->emm), md5tmp);
+		emm_packet_md5(ep, md5tmp);
 		int64_t gone = comp_timeb(&tps, &last_emm_clean);
 		if(gone > (int64_t)1000*60*60*24*30 || gone < 0) // dont run every time, only on first emm oscam is started and then every 30 days
 		{
@@ -663,8 +736,11 @@ int32_t reader_do_emm(struct s_reader *reader, EMM_PACKET *ep)
 		}
 		else
 		{
+			// the cardsystems may rewrite the emm, so they get a private copy of the shared packet
+			EMM_PACKET epcopy;
+			memcpy(&epcopy, ep, sizeof(EMM_PACKET));
 			rdr_log_dbg(reader, D_READER, "local emm reader");
-			rc = cardreader_do_emm(reader, ep);
+			rc = cardreader_do_emm(reader, &epcopy);
 		}
 	}
 
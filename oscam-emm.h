@@ -4,6 +4,9 @@
 int32_t emm_reader_match(struct s_reader *reader, uint16_t caid, uint32_t provid);
 void do_emm(struct s_client *client, EMM_PACKET *ep);
 int32_t reader_do_emm(struct s_reader *reader, EMM_PACKET *ep);
+EMM_PACKET *emm_packet_new(const EMM_PACKET *ep);
+void emm_packet_retain(EMM_PACKET *ep);
+void emm_packet_release(EMM_PACKET *ep);
 void do_emm_from_file(struct s_reader *reader);
 void emm_sort_nanos(unsigned char *dest, const unsigned char *src, int32_t len);
 
@@ -2,10 +2,267 @@
 
 #include "globals.h"
 #include "oscam-lock.h"
+#include "oscam-string.h"
 #include "oscam-time.h"
 
 extern char *LOG_LIST;
 
+#ifdef WITH_LOCKPROFILE
+/* Lock profiling: every thread accounts the locks it takes in its own table, so the profiler
+   adds no shared state to the hot path. Locks are keyed by name (all locks of one kind share an
+   entry), tables of finished threads are folded into lockprof_retired. A reset only starts a new
+   generation, each thread clears its own table when it takes its next lock. Plain pthread/calloc calls
+   are used here on purpose, the SAFE_ wrappers and cs_malloc may log and thereby take locks again. */
+#define LOCKPROF_SLOTS 64
+#define LOCKPROF_DEPTH 16
+
+struct lockprof_entry
+{
+	const char              *key;
+	struct s_lock_profile   p;
+};
+
+struct lockprof_held
+{
+	CS_MUTEX_LOCK   *l;
+	int8_t          type;
+	int64_t         since;
+};
+
+struct lockprof_thread
+{
+	struct lockprof_entry   entry[LOCKPROF_SLOTS];
+	struct lockprof_held    held[LOCKPROF_DEPTH];
+	int32_t                 depth;
+	uint32_t                generation;     // lockprof_generation the entries belong to
+	struct lockprof_thread  *next;
+};
+
+static pthread_once_t lockprof_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lockprof_key;
+static pthread_mutex_t lockprof_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct lockprof_thread *lockprof_threads;
+static struct s_lock_profile lockprof_retired[LOCKPROF_SLOTS];
+static int32_t lockprof_retired_cnt;
+static volatile uint32_t lockprof_generation;   // bumped by a reset
+
+static int64_t lockprof_now(void)
+{
+	struct timespec ts;
+	cs_gettime(&ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void lockprof_merge(struct s_lock_profile *list, int32_t *cnt, int32_t max, const struct s_lock_profile *p)
+{
+	int32_t i;
+	for(i = 0; i < *cnt && strcmp(list[i].name, p->name); i++) { ; }
+	if(i == *cnt)
+	{
+		if(*cnt >= max) { return; }
+		memset(&list[i], 0, sizeof(struct s_lock_profile));
+		cs_strncpy(list[i].name, p->name, sizeof(list[i].name));
+		(*cnt)++;
+	}
+	list[i].count += p->count;
+	list[i].contended += p->contended;
+	list[i].wait_ns += p->wait_ns;
+	list[i].hold_ns += p->hold_ns;
+	if(p->wait_max_ns > list[i].wait_max_ns) { list[i].wait_max_ns = p->wait_max_ns; }
+	if(p->hold_max_ns > list[i].hold_max_ns) { list[i].hold_max_ns = p->hold_max_ns; }
+}
+
+static void lockprof_thread_free(void *ptr)
+{
+	struct lockprof_thread *t = ptr, **pp;
+	int32_t i;
+
+	pthread_mutex_lock(&lockprof_mutex);
+	for(pp = &lockprof_threads; *pp; pp = &(*pp)->next)
+	{
+		if(*pp == t)
+		{
+			*pp = t->next;
+			break;
+		}
+	}
+	for(i = 0; i < LOCKPROF_SLOTS && t->generation == lockprof_generation; i++)
+	{
+		if(t->entry[i].key)
+			{ lockprof_merge(lockprof_retired, &lockprof_retired_cnt, LOCKPROF_SLOTS, &t->entry[i].p); }
+	}
+	pthread_mutex_unlock(&lockprof_mutex);
+	free(t);
+}
+
+static void lockprof_init(void)
+{
+	pthread_key_create(&lockprof_key, lockprof_thread_free);
+}
+
+static struct lockprof_thread *lockprof_get_thread(void)
+{
+	struct lockprof_thread *t;
+
+	pthread_once(&lockprof_once, lockprof_init);
+	if((t = pthread_getspecific(lockprof_key)))
+	{
+		if(t->generation != lockprof_generation)
+		{
+			memset(t->entry, 0, sizeof(t->entry));
+			t->generation = lockprof_generation;
+		}
+		return t;
+	}
+	if(!(t = calloc(1, sizeof(struct lockprof_thread))))
+		{ return NULL; }
+	pthread_mutex_lock(&lockprof_mutex);
+	t->generation = lockprof_generation;
+	t->next = lockprof_threads;
+	lockprof_threads = t;
+	pthread_mutex_unlock(&lockprof_mutex);
+	pthread_setspecific(lockprof_key, t);
+	return t;
+}
+
+// Lock names are mostly static strings, so the name pointer is the hash key. Dynamic names
+// (reader labels) may reuse a pointer, hence the copied name is compared as well.
+static struct s_lock_profile *lockprof_entry(struct lockprof_thread *t, const char *name)
+{
+	uint32_t i, h = (uint32_t)(((uintptr_t)name >> 3) % LOCKPROF_SLOTS);
+	struct lockprof_entry *e;
+
+	for(i = 0; i < LOCKPROF_SLOTS; i++, h = (h + 1) % LOCKPROF_SLOTS)
+	{
+		e = &t->entry[h];
+		if(!e->key)
+		{
+			e->key = name;
+			cs_strncpy(e->p.name, name, sizeof(e->p.name));
+			return &e->p;
+		}
+		if(e->key == name && !strncmp(e->p.name, name, sizeof(e->p.name) - 1))
+			{ return &e->p; }
+	}
+	return NULL;
+}
+
+static void lockprof_locked(CS_MUTEX_LOCK *l, int8_t type, int64_t start, int8_t contended)
+{
+	struct lockprof_thread *t = lockprof_get_thread();
+	struct s_lock_profile *p;
+	const char *name = l->name;
+	int64_t now = lockprof_now();
+	uint64_t wait = now > start ? (uint64_t)(now - start) : 0;
+
+	if(!t || !name) { return; }
+
+	if((p = lockprof_entry(t, name)))
+	{
+		p->count++;
+		if(contended) { p->contended++; }
+		p->wait_ns += wait;
+		if(wait > p->wait_max_ns) { p->wait_max_ns = wait; }
+	}
+	if(t->depth < LOCKPROF_DEPTH)
+	{
+		t->held[t->depth].l = l;
+		t->held[t->depth].type = type;
+		t->held[t->depth].since = now;
+		t->depth++;
+	}
+}
+
+static void lockprof_unlocked(CS_MUTEX_LOCK *l, int8_t type)
+{
+	struct lockprof_thread *t = lockprof_get_thread();
+	struct s_lock_profile *p;
+	const char *name = l->name;
+	uint64_t hold;
+	int32_t i;
+
+	if(!t) { return; }
+
+	// locks released by another thread than the one which took them are not accounted
+	for(i = t->depth - 1; i >= 0; i--)
+	{
+		if(t->held[i].l == l && t->held[i].type == type)
+			{ break; }
+	}
+	if(i < 0) { return; }
+
+	hold = (uint64_t)(lockprof_now() - t->held[i].since);
+	t->depth--;
+	memmove(&t->held[i], &t->held[i + 1], (t->depth - i) * sizeof(struct lockprof_held));
+
+	if(name && (p = lockprof_entry(t, name)))
+	{
+		p->hold_ns += hold;
+		if(hold > p->hold_max_ns) { p->hold_max_ns = hold; }
+	}
+}
+
+static int lockprof_cmp(const void *a, const void *b)
+{
+	const struct s_lock_profile *pa = a, *pb = b;
+	if(pa->wait_ns == pb->wait_ns) { return strcmp(pa->name, pb->name); }
+	return pa->wait_ns < pb->wait_ns ? 1 : -1;
+}
+
+/**
+ * collects the lock statistics of all threads, sorted by total wait time
+ **/
+int32_t cs_lock_profile_get(struct s_lock_profile *profile, int32_t max)
+{
+	struct lockprof_thread *t;
+	int32_t i, cnt = 0;
+
+	pthread_mutex_lock(&lockprof_mutex);
+	for(i = 0; i < lockprof_retired_cnt; i++)
+		{ lockprof_merge(profile, &cnt, max, &lockprof_retired[i]); }
+	// the tables of running threads are read without their owner's consent, counters may be a bit off
+	for(t = lockprof_threads; t; t = t->next)
+	{
+		// tables from before the last reset are cleared by their owner on its next lock
+		for(i = 0; i < LOCKPROF_SLOTS && t->generation == lockprof_generation; i++)
+		{
+			if(t->entry[i].key)
+				{ lockprof_merge(profile, &cnt, max, &t->entry[i].p); }
+		}
+	}
+	pthread_mutex_unlock(&lockprof_mutex);
+
+	qsort(profile, cnt, sizeof(struct s_lock_profile), lockprof_cmp);
+	return cnt;
+}
+
+void cs_lock_profile_reset(void)
+{
+	pthread_mutex_lock(&lockprof_mutex);
+	lockprof_retired_cnt = 0;
+	lockprof_generation++;
+	pthread_mutex_unlock(&lockprof_mutex);
+}
+
+void cs_lock_profile_dump(void)
+{
+	struct s_lock_profile profile[LOCKPROF_SLOTS];
+	int32_t i, cnt;
+
+	memset(profile, 0, sizeof(profile));
+	cnt = cs_lock_profile_get(profile, LOCKPROF_SLOTS);
+	cs_log("lock profile: %d locks (times in us)", cnt);
+	cs_log("%-24s %10s %10s %12s %10s %12s %10s", "lock", "count", "contended", "wait", "wait max", "hold", "hold max");
+	for(i = 0; i < cnt; i++)
+	{
+		cs_log("%-24s %10" PRIu64 " %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %10" PRIu64,
+			   profile[i].name, profile[i].count, profile[i].contended,
+			   profile[i].wait_ns / 1000, profile[i].wait_max_ns / 1000,
+			   profile[i].hold_ns / 1000, profile[i].hold_max_ns / 1000);
+	}
+}
+#endif
+
 /**
  * creates a lock
  **/
@@ -74,10 +331,16 @@ void cs_rwlock_int(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 {
 	struct timespec ts;
 	int8_t ret = 0;
+#ifdef WITH_LOCKPROFILE
+	int8_t contended = 0;
+#endif
 
 	if(!l || !l->name || l->flag)
 		{ return; }
 
+#ifdef WITH_LOCKPROFILE
+	int64_t prof_start = lockprof_now();
+#endif
 	SAFE_MUTEX_LOCK_R(&l->lock, n);
 
 	add_ms_to_timespec(&ts, l->timeout * 1000);
@@ -87,14 +350,24 @@ void cs_rwlock_int(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 		l->writelock++;
 		// if read- or writelock is busy, wait for unlock
 		if(l->writelock > 1 || l->readlock > 0)
-			{ ret = pthread_cond_timedwait(&l->writecond, &l->lock, &ts); }
+		{
+#ifdef WITH_LOCKPROFILE
+			contended = 1;
+#endif
+			ret = pthread_cond_timedwait(&l->writecond, &l->lock, &ts);
+		}
 	}
 	else
 	{
 		l->readlock++;
 		// if writelock is busy, wait for unlock
 		if(l->writelock > 0)
-			{ ret = pthread_cond_timedwait(&l->readcond, &l->lock, &ts); }
+		{
+#ifdef WITH_LOCKPROFILE
+			contended = 1;
+#endif
+			ret = pthread_cond_timedwait(&l->readcond, &l->lock, &ts);
+		}
 	}
 
 	if(ret > 0)
@@ -110,6 +383,9 @@ void cs_rwlock_int(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 	}
 
 	SAFE_MUTEX_UNLOCK_R(&l->lock, n);
+#ifdef WITH_LOCKPROFILE
+	lockprof_locked(l, type, prof_start, contended);
+#endif
 #ifdef WITH_MUTEXDEBUG
 	//cs_log_dbg(D_TRACE, "lock %s locked", l->name);
 #endif
@@ -120,10 +396,16 @@ void cs_rwlock_int_nolog(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 {
 	struct timespec ts;
 	int8_t ret = 0;
+#ifdef WITH_LOCKPROFILE
+	int8_t contended = 0;
+#endif
 
 	if(!l || !l->name || l->flag)
 		{ return; }
 
+#ifdef WITH_LOCKPROFILE
+	int64_t prof_start = lockprof_now();
+#endif
 	SAFE_MUTEX_LOCK_NOLOG_R(&l->lock, n);
 
 	add_ms_to_timespec(&ts, l->timeout * 1000);
@@ -133,14 +415,24 @@ void cs_rwlock_int_nolog(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 		l->writelock++;
 		// if read- or writelock is busy, wait for unlock
 		if(l->writelock > 1 || l->readlock > 0)
-			{ ret = pthread_cond_timedwait(&l->writecond, &l->lock, &ts); }
+		{
+#ifdef WITH_LOCKPROFILE
+			contended = 1;
+#endif
+			ret = pthread_cond_timedwait(&l->writecond, &l->lock, &ts);
+		}
 	}
 	else
 	{
 		l->readlock++;
 		// if writelock is busy, wait for unlock
 		if(l->writelock > 0)
-			{ ret = pthread_cond_timedwait(&l->readcond, &l->lock, &ts); }
+		{
+#ifdef WITH_LOCKPROFILE
+			contended = 1;
+#endif
+			ret = pthread_cond_timedwait(&l->readcond, &l->lock, &ts);
+		}
 	}
 
 	if(ret > 0)
@@ -156,6 +448,9 @@ void cs_rwlock_int_nolog(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 	}
 
 	SAFE_MUTEX_UNLOCK_NOLOG_R(&l->lock, n);
+#ifdef WITH_LOCKPROFILE
+	lockprof_locked(l, type, prof_start, contended);
+#endif
 #ifdef WITH_MUTEXDEBUG
 	//cs_log_dbg(D_TRACE, "lock %s locked", l->name);
 #endif
@@ -185,6 +480,9 @@ void cs_rwunlock_int(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 		{ SAFE_COND_BROADCAST_R(&l->readcond, n); }
 
 	SAFE_MUTEX_UNLOCK_R(&l->lock, n);
+#ifdef WITH_LOCKPROFILE
+	lockprof_unlocked(l, type);
+#endif
 
 #ifdef WITH_MUTEXDEBUG
 #ifdef WITH_DEBUG
@@ -220,6 +518,9 @@ void cs_rwunlock_int_nolog(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 		{ SAFE_COND_BROADCAST_R(&l->readcond, n); }
 
 	SAFE_MUTEX_UNLOCK_NOLOG_R(&l->lock, n);
+#ifdef WITH_LOCKPROFILE
+	lockprof_unlocked(l, type);
+#endif
 
 #ifdef WITH_MUTEXDEBUG
 #ifdef WITH_DEBUG
@@ -257,6 +558,10 @@ int8_t cs_try_rwlock_int(const char *n, CS_MUTEX_LOCK *l, int8_t type)
 	}
 
 	SAFE_MUTEX_UNLOCK_R(&l->lock, n);
+#ifdef WITH_LOCKPROFILE
+	if(!status)
+		{ lockprof_locked(l, type, lockprof_now(), 0); }
+#endif
 
 #ifdef WITH_MUTEXDEBUG
 #ifdef WITH_DEBUG
@@ -25,4 +25,20 @@ void cs_rwunlock_int_nolog(const char *n, CS_MUTEX_LOCK *l, int8_t type);
 #define cs_writelock_nolog(n, l) 	cs_rwlock_int_nolog(n, l, WRITELOCK)
 #define cs_writeunlock_nolog(n, l)	cs_rwunlock_int_nolog(n, l, WRITELOCK)
 
+// Lock profiling, compile with -DWITH_LOCKPROFILE
+struct s_lock_profile
+{
+	char        name[32];
+	uint64_t    count;          // acquisitions
+	uint64_t    contended;      // acquisitions which had to wait for another holder
+	uint64_t    wait_ns, wait_max_ns;
+	uint64_t    hold_ns, hold_max_ns;
+};
+
+#ifdef WITH_LOCKPROFILE
+int32_t cs_lock_profile_get(struct s_lock_profile *profile, int32_t max);
+void cs_lock_profile_reset(void);
+void cs_lock_profile_dump(void);
+#endif
+
 #endif
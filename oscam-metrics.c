@@ -0,0 +1,525 @@
+#define MODULE_LOG_PREFIX "metrics"
+
+#include "globals.h"
+#include "oscam-client.h"
+#include "oscam-lock.h"
+#include "oscam-metrics.h"
+#include "oscam-reader.h"
+#include "oscam-string.h"
+#include "oscam-time.h"
+
+extern uint32_t ecmcwcache_size;
+
+/* Counters and histograms are sharded per thread: every thread gets its own shard on first use
+   and only ever writes into that, so the hot paths need neither locks nor atomics. A scrape sums up
+   all shards under metrics_lock. When a thread ends, its shard is folded into metrics_retired. */
+
+static const int32_t metrics_bounds[METRICS_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+static const int32_t metrics_bounds_us[METRICS_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 500000 };
+
+static const char *metrics_counter_names[MC_COUNTERS][2] =
+{
+	{ "oscam_ecm_requests_total", "ECM requests received from clients" },
+	{ "oscam_cw_found_total", "Control words answered by a reader" },
+	{ "oscam_cw_cache_total", "Control words answered from the cache" },
+	{ "oscam_cw_notfound_total", "ECM requests answered with not found" },
+	{ "oscam_cw_timeout_total", "ECM requests answered with timeout" },
+	{ "oscam_cacheex_push_total", "Control words pushed by cacheex" },
+	{ "oscam_cacheex_hit_total", "Cache hits originating from cacheex" },
+	{ "oscam_jobs_total", "Jobs executed by the client work threads" },
+	{ "oscam_emm_requests_total", "EMMs received from clients" },
+	{ "oscam_emm_jobs_total", "EMMs queued to au readers" },
+	{ "oscam_emm_packet_copies_total", "EMM packets copied for the au reader fan-out" },
+	{ "oscam_emm_hashes_total", "EMM MD5 digests calculated" },
+	{ "oscam_emm_coalesced_total", "EMMs dropped because the same EMM was still queued for the reader" },
+	{ "oscam_emm_reassembled_total", "Shared EMMs put together from their parts" },
+	{ "oscam_emm_parts_expired_total", "EMM parts which waited too long for the rest of their EMM" },
+	{ "oscam_emm_parts_dropped_total", "EMM parts dropped as unmatched, broken or for lack of space" },
+	{ "oscam_file_records_total", "Records written by the file writer" },
+	{ "oscam_file_records_dropped_total", "Records dropped because the file writer queue was full" },
+};
+
+static const char *metrics_hist_names[MH_HISTOGRAMS][2] =
+{
+	{ "oscam_cache_hit_ms", "Time from ECM request to an answer from the cache" },
+	{ "oscam_job_wait_ms", "Time a job waited in a client job queue" },
+	{ "cache", NULL },
+	{ "dispatch", NULL },
+	{ "deliver", NULL },
+};
+
+static const char *ecm_trace_stage_names[EA_TRACE_STAGES - 1] = { "queue", "lookup", "card" };
+static const char *job_class_names[JOB_CLASSES] = { "ecm", "emm", "housekeeping" };
+
+struct metrics_shard
+{
+	uint64_t                counter[MC_COUNTERS];
+	struct s_metrics_hist   hist[MH_HISTOGRAMS];
+	struct metrics_shard    *next;
+};
+
+static pthread_key_t metrics_key;
+static pthread_mutex_t metrics_lock;
+static struct metrics_shard *metrics_shards;
+static struct metrics_shard metrics_retired;
+static int8_t metrics_initialized;
+
+static pthread_mutex_t ecm_trace_lock;
+static struct s_ecm_trace *ecm_traces;
+static int32_t ecm_trace_count, ecm_trace_alloc;
+static uint32_t ecm_trace_min;          // fastest kept trace once the list is full
+
+static void metrics_hist_merge(struct s_metrics_hist *dst, const struct s_metrics_hist *src)
+{
+	int32_t i;
+	for(i = 0; i < METRICS_BUCKETS; i++)
+		{ dst->bucket[i] += src->bucket[i]; }
+	dst->sum += src->sum;
+	dst->count += src->count;
+}
+
+static void metrics_merge(struct metrics_shard *dst, const struct metrics_shard *src)
+{
+	int32_t i;
+	for(i = 0; i < MC_COUNTERS; i++)
+		{ dst->counter[i] += src->counter[i]; }
+	for(i = 0; i < MH_HISTOGRAMS; i++)
+		{ metrics_hist_merge(&dst->hist[i], &src->hist[i]); }
+}
+
+static void metrics_shard_free(void *ptr)
+{
+	struct metrics_shard *shard = ptr, **pp;
+	// called on thread exit, the client of this thread might already be gone so don't log
+	SAFE_MUTEX_LOCK_NOLOG(&metrics_lock);
+	for(pp = &metrics_shards; *pp; pp = &(*pp)->next)
+	{
+		if(*pp == shard)
+		{
+			*pp = shard->next;
+			break;
+		}
+	}
+	metrics_merge(&metrics_retired, shard);
+	SAFE_MUTEX_UNLOCK_NOLOG(&metrics_lock);
+	free(shard);
+}
+
+static struct metrics_shard *metrics_get_shard(void)
+{
+	struct metrics_shard *shard;
+	if(!metrics_initialized)
+		{ return NULL; }
+	shard = pthread_getspecific(metrics_key);
+	if(shard)
+		{ return shard; }
+	if(!cs_malloc(&shard, sizeof(struct metrics_shard)))
+		{ return NULL; }
+	SAFE_MUTEX_LOCK(&metrics_lock);
+	shard->next = metrics_shards;
+	metrics_shards = shard;
+	SAFE_MUTEX_UNLOCK(&metrics_lock);
+	if(pthread_setspecific(metrics_key, shard))
+	{
+		metrics_shard_free(shard);
+		return NULL;
+	}
+	return shard;
+}
+
+void metrics_init(void)
+{
+	if(metrics_initialized)
+		{ return; }
+	SAFE_MUTEX_INIT(&metrics_lock, NULL);
+	SAFE_MUTEX_INIT(&ecm_trace_lock, NULL);
+	if(pthread_key_create(&metrics_key, metrics_shard_free))
+	{
+		cs_log("ERROR: can't create metrics key, metrics are disabled");
+		return;
+	}
+	metrics_initialized = 1;
+}
+
+void metrics_inc(enum metrics_counter counter)
+{
+	struct metrics_shard *shard = metrics_get_shard();
+	if(shard)
+		{ shard->counter[counter]++; }
+}
+
+static void metrics_hist_add_bounds(struct s_metrics_hist *hist, int64_t value, const int32_t *bounds)
+{
+	int32_t i;
+	if(value < 0)
+		{ value = 0; }
+	for(i = 0; i < METRICS_BUCKETS - 1 && value > bounds[i]; i++) { ; }
+	hist->bucket[i]++;
+	hist->sum += value;
+	hist->count++;
+}
+
+void metrics_hist_add(struct s_metrics_hist *hist, int64_t ms)
+{
+	metrics_hist_add_bounds(hist, ms, metrics_bounds);
+}
+
+/* The value is in ms, for the MH_TRACE_* histograms in us. */
+void metrics_observe(enum metrics_histogram hist, int64_t ms)
+{
+	struct metrics_shard *shard = metrics_get_shard();
+	if(shard)
+		{ metrics_hist_add_bounds(&shard->hist[hist], ms, hist >= MH_TRACE_CACHE ? metrics_bounds_us : metrics_bounds); }
+}
+
+struct metrics_buf
+{
+	char    *data;
+	int32_t len;
+	int32_t size;
+};
+
+static void metrics_printf(struct metrics_buf *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_printf(struct metrics_buf *out, const char *fmt, ...)
+{
+	va_list args;
+	int32_t n;
+	while(out->data)
+	{
+		va_start(args, fmt);
+		n = vsnprintf(out->data + out->len, out->size - out->len, fmt, args);
+		va_end(args);
+		if(n < 0)
+			{ return; }
+		if(out->len + n < out->size)
+		{
+			out->len += n;
+			return;
+		}
+		out->size = (out->size + n) * 2;
+		if(!cs_realloc(&out->data, out->size))
+			{ out->len = out->size = 0; }
+	}
+}
+
+static void metrics_print_hist_bounds(struct metrics_buf *out, const char *name, const char *label, const struct s_metrics_hist *hist, const int32_t *bounds)
+{
+	uint64_t cumulative = 0;
+	int32_t i;
+	for(i = 0; i < METRICS_BUCKETS - 1; i++)
+	{
+		cumulative += hist->bucket[i];
+		metrics_printf(out, "%s_bucket{%s%sle=\"%d\"} %"PRIu64"\n", name, label, label[0] ? "," : "", bounds[i], cumulative);
+	}
+	cumulative += hist->bucket[i];
+	metrics_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %"PRIu64"\n", name, label, label[0] ? "," : "", cumulative);
+	metrics_printf(out, "%s_sum%s%s%s %"PRIu64"\n", name, label[0] ? "{" : "", label, label[0] ? "}" : "", hist->sum);
+	metrics_printf(out, "%s_count%s%s%s %"PRIu64"\n", name, label[0] ? "{" : "", label, label[0] ? "}" : "", hist->count);
+}
+
+static void metrics_print_hist(struct metrics_buf *out, const char *name, const char *label, const struct s_metrics_hist *hist)
+{
+	metrics_print_hist_bounds(out, name, label, hist, metrics_bounds);
+}
+
+/* Writes name="value" with the value escaped for the exposition format. */
+static void metrics_label(char *label, int32_t size, const char *name, const char *value)
+{
+	char *p = label + snprintf(label, size, "%s=\"", name);
+	for(; *value && p < label + size - 3; value++)
+	{
+		if(*value == '"' || *value == '\\')
+			{ *p++ = '\\'; }
+		*p++ = *value;
+	}
+	*p++ = '"';
+	*p = '\0';
+}
+
+/* Returns the metrics in the Prometheus text exposition format. The result has to be freed by the caller. */
+char *metrics_render(int32_t *len)
+{
+	struct metrics_buf out = { NULL, 0, 0 };
+	struct metrics_shard total, *shard;
+	struct s_reader *rdr;
+	struct s_client *cl;
+	char label[2 * 64 + 32], stage[2 * 64 + 64];
+	int32_t i, j, protocols = 0;
+	struct
+	{
+		const char *name;
+		struct s_metrics_hist hist[EA_TRACE_STAGES - 1];
+	} protocol[16];
+
+	*len = 0;
+	if(!cs_malloc(&out.data, 4096))
+		{ return NULL; }
+	out.size = 4096;
+
+	memset(&total, 0, sizeof(total));
+	if(metrics_initialized)
+	{
+		SAFE_MUTEX_LOCK(&metrics_lock);
+		total = metrics_retired;
+		for(shard = metrics_shards; shard; shard = shard->next)
+			{ metrics_merge(&total, shard); }
+		SAFE_MUTEX_UNLOCK(&metrics_lock);
+	}
+
+	for(i = 0; i < MC_COUNTERS; i++)
+	{
+		metrics_printf(&out, "# HELP %s %s\n# TYPE %s counter\n%s %"PRIu64"\n", metrics_counter_names[i][0], metrics_counter_names[i][1],
+					   metrics_counter_names[i][0], metrics_counter_names[i][0], total.counter[i]);
+	}
+	for(i = 0; i < MH_TRACE_CACHE; i++)
+	{
+		metrics_printf(&out, "# HELP %s %s\n# TYPE %s histogram\n", metrics_hist_names[i][0], metrics_hist_names[i][1], metrics_hist_names[i][0]);
+		metrics_print_hist(&out, metrics_hist_names[i][0], "", &total.hist[i]);
+	}
+
+	metrics_printf(&out, "# HELP oscam_ecm_cache_entries Entries in the ECM/CW cache\n# TYPE oscam_ecm_cache_entries gauge\n");
+	metrics_printf(&out, "oscam_ecm_cache_entries %u\n", ecmcwcache_size);
+
+	if(cfg.ecmtrace > 0)
+	{
+		metrics_printf(&out, "# HELP oscam_ecm_stage_us Time an ECM request spent in a stage of the client thread\n# TYPE oscam_ecm_stage_us histogram\n");
+		for(i = MH_TRACE_CACHE; i < MH_HISTOGRAMS; i++)
+		{
+			metrics_label(stage, sizeof(stage), "stage", metrics_hist_names[i][0]);
+			metrics_print_hist_bounds(&out, "oscam_ecm_stage_us", stage, &total.hist[i], metrics_bounds_us);
+		}
+	}
+
+	memset(protocol, 0, sizeof(protocol));
+	metrics_printf(&out, "# HELP oscam_reader_ecm_time_ms Time a reader needed to answer an ECM\n# TYPE oscam_reader_ecm_time_ms histogram\n");
+	cs_readlock(__func__, &readerlist_lock);
+	LL_ITER itr = ll_iter_create(configured_readers);
+	while((rdr = ll_iter_next(&itr)))
+	{
+		if(!rdr->ecm_hist.count)
+			{ continue; }
+		metrics_label(label, sizeof(label), "reader", rdr->label);
+		metrics_print_hist(&out, "oscam_reader_ecm_time_ms", label, &rdr->ecm_hist);
+	}
+	metrics_printf(&out, "# HELP oscam_reader_job_wait_ms Time a reader job waited in the job queue, by scheduling class\n# TYPE oscam_reader_job_wait_ms histogram\n");
+	itr = ll_iter_create(configured_readers);
+	while((rdr = ll_iter_next(&itr)))
+	{
+		for(j = 0; j < JOB_CLASSES; j++)
+		{
+			if(!rdr->job_wait_hist[j].count)
+				{ continue; }
+			metrics_label(label, sizeof(label), "reader", rdr->label);
+			metrics_label(stage, sizeof(stage), "class", job_class_names[j]);
+			snprintf(stage + strlen(stage), sizeof(stage) - strlen(stage), ",%s", label);
+			metrics_print_hist(&out, "oscam_reader_job_wait_ms", stage, &rdr->job_wait_hist[j]);
+		}
+	}
+	if(cfg.ecmtrace > 0)
+	{
+		metrics_printf(&out, "# HELP oscam_reader_ecm_stage_us Time an ECM request spent in a stage of a reader\n# TYPE oscam_reader_ecm_stage_us histogram\n");
+		itr = ll_iter_create(configured_readers);
+		while((rdr = ll_iter_next(&itr)))
+		{
+			const char *name = reader_get_type_desc(rdr, 0);
+			for(i = 0; i < protocols && strcmp(protocol[i].name, name); i++) { ; }
+			if(i == protocols && protocols < (int32_t)(sizeof(protocol) / sizeof(protocol[0])))
+				{ protocol[protocols++].name = name; }
+			for(j = 0; j < EA_TRACE_STAGES - 1; j++)
+			{
+				if(!rdr->trace_hist[j].count)
+					{ continue; }
+				if(i < protocols)
+					{ metrics_hist_merge(&protocol[i].hist[j], &rdr->trace_hist[j]); }
+				metrics_label(label, sizeof(label), "reader", rdr->label);
+				metrics_label(stage, sizeof(stage), "stage", ecm_trace_stage_names[j]);
+				snprintf(stage + strlen(stage), sizeof(stage) - strlen(stage), ",%s", label);
+				metrics_print_hist_bounds(&out, "oscam_reader_ecm_stage_us", stage, &rdr->trace_hist[j], metrics_bounds_us);
+			}
+		}
+	}
+	cs_readunlock(__func__, &readerlist_lock);
+
+	if(cfg.ecmtrace > 0)
+	{
+		metrics_printf(&out, "# HELP oscam_protocol_ecm_stage_us Time an ECM request spent in a stage of a reader, by reader protocol\n# TYPE oscam_protocol_ecm_stage_us histogram\n");
+		for(i = 0; i < protocols; i++)
+		{
+			for(j = 0; j < EA_TRACE_STAGES - 1; j++)
+			{
+				if(!protocol[i].hist[j].count)
+					{ continue; }
+				metrics_label(label, sizeof(label), "protocol", protocol[i].name);
+				metrics_label(stage, sizeof(stage), "stage", ecm_trace_stage_names[j]);
+				snprintf(stage + strlen(stage), sizeof(stage) - strlen(stage), ",%s", label);
+				metrics_print_hist_bounds(&out, "oscam_protocol_ecm_stage_us", stage, &protocol[i].hist[j], metrics_bounds_us);
+			}
+		}
+	}
+
+	metrics_printf(&out, "# HELP oscam_reader_job_queue Jobs waiting in the job queue of a reader, by scheduling class\n# TYPE oscam_reader_job_queue gauge\n");
+	cs_readlock(__func__, &clientlist_lock);
+	for(cl = first_client; cl; cl = cl->next)
+	{
+		if(!cl->reader || (cl->typ != 'r' && cl->typ != 'p'))
+			{ continue; }
+		metrics_label(label, sizeof(label), "reader", cl->reader->label);
+		for(j = 0; j < JOB_CLASSES; j++)
+			{ metrics_printf(&out, "oscam_reader_job_queue{class=\"%s\",%s} %d\n", job_class_names[j], label, cl->job_queued[j]); }
+	}
+	cs_readunlock(__func__, &clientlist_lock);
+
+	*len = out.len;
+	return out.data;
+}
+
+/* ECM tracing: when ecmtrace is set, every request records the time it reaches each stage.
+   The client side stages go to the metrics shards, the reader side stages to the histograms
+   of the reader and the cfg.ecmtrace slowest requests are kept for the webif api. */
+
+void ecm_trace_start(ECM_REQUEST *er)
+{
+	if(cfg.ecmtrace > 0)
+		{ cs_gettime(&er->trace_start); }
+	else
+		{ memset(&er->trace_start, 0, sizeof(er->trace_start)); }
+}
+
+void ecm_trace_stamp(ECM_REQUEST *er, uint32_t *stamp)
+{
+	struct timespec now;
+	int64_t us;
+	if((!er->trace_start.tv_sec && !er->trace_start.tv_nsec) || *stamp)
+		{ return; }
+	cs_gettime(&now);
+	us = (int64_t)(now.tv_sec - er->trace_start.tv_sec) * 1000000 + (now.tv_nsec - er->trace_start.tv_nsec) / 1000;
+	*stamp = us < 1 ? 1 : (us > 0xFFFFFFFF ? 0xFFFFFFFF : us);
+}
+
+/* Called by the reader thread when its answer is written, so the histograms have a single writer. */
+void ecm_trace_reader(struct s_reader *rdr, struct s_ecm_answer *ea)
+{
+	int32_t i;
+	for(i = 0; i < EA_TRACE_STAGES - 1; i++)
+	{
+		if(ea->trace[i] && ea->trace[i + 1])
+			{ metrics_hist_add_bounds(&rdr->trace_hist[i], ea->trace[i + 1] - ea->trace[i], metrics_bounds_us); }
+	}
+}
+
+void ecm_trace_done(ECM_REQUEST *er)
+{
+	struct s_ecm_answer *ea;
+	struct s_ecm_trace *trace;
+	uint32_t *t = er->trace, total;
+	int32_t i;
+
+	if(!metrics_initialized || (!er->trace_start.tv_sec && !er->trace_start.tv_nsec))
+		{ return; }
+	ecm_trace_stamp(er, &t[ECM_TRACE_SEND]);
+
+	if(t[ECM_TRACE_CACHE])
+		{ metrics_observe(MH_TRACE_CACHE, t[ECM_TRACE_CACHE]); }
+	if(t[ECM_TRACE_CACHE] && t[ECM_TRACE_REQUEST])
+		{ metrics_observe(MH_TRACE_DISPATCH, t[ECM_TRACE_REQUEST] - t[ECM_TRACE_CACHE]); }
+	if(t[ECM_TRACE_ANSWER])
+		{ metrics_observe(MH_TRACE_DELIVER, t[ECM_TRACE_SEND] - t[ECM_TRACE_ANSWER]); }
+
+	total = t[ECM_TRACE_SEND];
+	if(cfg.ecmtrace <= 0 || (ecm_trace_count == ecm_trace_alloc && ecm_trace_alloc == cfg.ecmtrace && total <= ecm_trace_min))
+		{ return; }
+
+	SAFE_MUTEX_LOCK(&ecm_trace_lock);
+	if(ecm_trace_alloc != cfg.ecmtrace)
+	{
+		if(!cs_realloc(&ecm_traces, cfg.ecmtrace * sizeof(struct s_ecm_trace)))
+		{
+			ecm_trace_count = ecm_trace_alloc = 0;
+			SAFE_MUTEX_UNLOCK(&ecm_trace_lock);
+			return;
+		}
+		ecm_trace_alloc = cfg.ecmtrace;
+		if(ecm_trace_count > ecm_trace_alloc)
+			{ ecm_trace_count = ecm_trace_alloc; }
+	}
+	if(ecm_trace_count < ecm_trace_alloc)
+		{ trace = &ecm_traces[ecm_trace_count++]; }
+	else
+	{
+		// replace the fastest one
+		trace = &ecm_traces[0];
+		for(i = 1; i < ecm_trace_count; i++)
+		{
+			if(ecm_traces[i].trace[ECM_TRACE_SEND] < trace->trace[ECM_TRACE_SEND])
+				{ trace = &ecm_traces[i]; }
+		}
+		if(trace->trace[ECM_TRACE_SEND] >= total)
+		{
+			SAFE_MUTEX_UNLOCK(&ecm_trace_lock);
+			return;
+		}
+	}
+
+	memset(trace, 0, sizeof(struct s_ecm_trace));
+	trace->time = time(NULL);
+	cs_strncpy(trace->client, username(er->client), sizeof(trace->client));
+	trace->caid = er->caid;
+	trace->prid = er->prid;
+	trace->srvid = er->srvid;
+	trace->rc = er->rc;
+	memcpy(trace->trace, er->trace, sizeof(trace->trace));
+	for(ea = er->matching_rdr; ea; ea = ea->next)
+	{
+		if(ea->reader && ea->reader == er->selected_reader)
+		{
+			cs_strncpy(trace->reader, ea->reader->label, sizeof(trace->reader));
+			memcpy(trace->reader_trace, ea->trace, sizeof(trace->reader_trace));
+			break;
+		}
+	}
+
+	if(ecm_trace_count == ecm_trace_alloc)
+	{
+		ecm_trace_min = ecm_traces[0].trace[ECM_TRACE_SEND];
+		for(i = 1; i < ecm_trace_count; i++)
+		{
+			if(ecm_traces[i].trace[ECM_TRACE_SEND] < ecm_trace_min)
+				{ ecm_trace_min = ecm_traces[i].trace[ECM_TRACE_SEND]; }
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&ecm_trace_lock);
+}
+
+static int32_t ecm_trace_cmp(const void *a, const void *b)
+{
+	const struct s_ecm_trace *ta = a, *tb = b;
+	if(ta->trace[ECM_TRACE_SEND] == tb->trace[ECM_TRACE_SEND])
+		{ return 0; }
+	return ta->trace[ECM_TRACE_SEND] < tb->trace[ECM_TRACE_SEND] ? 1 : -1;
+}
+
+/* Copies the kept traces, slowest first. */
+int32_t ecm_trace_get(struct s_ecm_trace *traces, int32_t max)
+{
+	int32_t count;
+	if(!metrics_initialized)
+		{ return 0; }
+	SAFE_MUTEX_LOCK(&ecm_trace_lock);
+	count = ecm_trace_count < max ? ecm_trace_count : max;
+	if(count > 0)
+		{ memcpy(traces, ecm_traces, count * sizeof(struct s_ecm_trace)); }
+	SAFE_MUTEX_UNLOCK(&ecm_trace_lock);
+	if(count > 1)
+		{ qsort(traces, count, sizeof(struct s_ecm_trace), ecm_trace_cmp); }
+	return count;
+}
+
+void ecm_trace_reset(void)
+{
+	if(!metrics_initialized)
+		{ return; }
+	SAFE_MUTEX_LOCK(&ecm_trace_lock);
+	ecm_trace_count = 0;
+	ecm_trace_min = 0;
+	SAFE_MUTEX_UNLOCK(&ecm_trace_lock);
+}
@@ -0,0 +1,63 @@
+#ifndef OSCAM_METRICS_H_
+#define OSCAM_METRICS_H_
+
+enum metrics_counter
+{
+	MC_ECM_REQUEST = 0,
+	MC_CW_FOUND,
+	MC_CW_CACHE,
+	MC_CW_NOTFOUND,
+	MC_CW_TIMEOUT,
+	MC_CACHEEX_PUSH,
+	MC_CACHEEX_HIT,
+	MC_JOBS,
+	MC_EMM_REQUEST,
+	MC_EMM_JOBS,
+	MC_EMM_COPIES,
+	MC_EMM_HASHES,
+	MC_EMM_COALESCED,
+	MC_EMM_RASS_COMPLETED,
+	MC_EMM_RASS_EXPIRED,
+	MC_EMM_RASS_DROPPED,
+	MC_WRITER_RECORDS,
+	MC_WRITER_DROPPED,
+	MC_COUNTERS
+};
+
+enum metrics_histogram
+{
+	MH_CACHE_HIT = 0,
+	MH_JOB_WAIT,
+	MH_TRACE_CACHE,     // in us from here
+	MH_TRACE_DISPATCH,
+	MH_TRACE_DELIVER,
+	MH_HISTOGRAMS
+};
+
+struct s_ecm_trace
+{
+	time_t      time;
+	char        client[64];
+	char        reader[64];
+	uint16_t    caid;
+	uint32_t    prid;
+	uint16_t    srvid;
+	int8_t      rc;
+	uint32_t    trace[ECM_TRACE_STAGES];
+	uint32_t    reader_trace[EA_TRACE_STAGES];
+};
+
+void metrics_init(void);
+void metrics_inc(enum metrics_counter counter);
+void metrics_observe(enum metrics_histogram hist, int64_t ms);
+void metrics_hist_add(struct s_metrics_hist *hist, int64_t ms);
+char *metrics_render(int32_t *len);
+
+void ecm_trace_start(ECM_REQUEST *er);
+void ecm_trace_stamp(ECM_REQUEST *er, uint32_t *stamp);
+void ecm_trace_reader(struct s_reader *rdr, struct s_ecm_answer *ea);
+void ecm_trace_done(ECM_REQUEST *er);
+int32_t ecm_trace_get(struct s_ecm_trace *traces, int32_t max);
+void ecm_trace_reset(void);
+
+#endif
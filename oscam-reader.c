@@ -11,8 +11,10 @@
 #include "oscam-ecm.h"
 #include "oscam-garbage.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-net.h"
 #include "oscam-reader.h"
+#include "oscam-resolve.h"
 #include "oscam-string.h"
 #include "oscam-time.h"
 #include "oscam-work.h"
@@ -23,6 +25,7 @@ extern CS_MUTEX_LOCK system_lock;
 extern CS_MUTEX_LOCK ecmcache_lock;
 extern struct ecm_request_t *ecmcwcache;
 extern const struct s_cardsystem *cardsystems[];
+extern int32_t exit_oscam;
 
 const char *RDR_CD_TXT[] =
 {
@@ -63,29 +66,110 @@ static int32_t dvbapi_override_prio(struct s_reader *reader, ECM_REQUEST *er, in
 	return foundspace;
 }
 
-static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er, struct ecmrl rl, int32_t reader_mode)
+/* The slots in use are kept in reader->rlecm_used, so the ratelimiter only
+   looks at those. rlecm_expire is the earliest time one of them can be released,
+   before that (and unless the clock went back) the release check is skipped.
+   Client threads release slots in check mode while the reader thread assigns
+   them, so the slots, the bitmap and both times are only changed under
+   rlecm_lock. It is shared by all readers, it is only held for a few slots. */
+#define RLECM_USED(reader, h) ((reader)->rlecm_used & (1U << (h)))
+
+static pthread_mutex_t rlecm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ecm_ratelimit_free_locked(struct s_reader *reader, int32_t h)
 {
+	reader->rlecmh[h].last.time = -1;
+	reader->rlecmh[h].srvid = -1;
+	reader->rlecmh[h].kindecm = 0;
+	reader->rlecmh[h].once = 0;
+	reader->rlecm_used &= ~(1U << h);
+}
 
-	int32_t h, foundspace = -1;
-	int32_t maxecms = MAXECMRATELIMIT; // init maxecms
-	int32_t totalecms = 0; // init totalecms
-	struct timeb actualtime;
-	cs_ftime(&actualtime);
-	for(h = 0; h < MAXECMRATELIMIT; h++)    // release slots with srvid that are overtime, even if not called from reader module to maximize available slots!
+static void ecm_ratelimit_free(struct s_reader *reader, int32_t h)
+{
+	SAFE_MUTEX_LOCK(&rlecm_lock);
+	ecm_ratelimit_free_locked(reader, h);
+	SAFE_MUTEX_UNLOCK(&rlecm_lock);
+}
+
+static void ecm_ratelimit_move(struct s_reader *reader, int32_t from, int32_t to)
+{
+	SAFE_MUTEX_LOCK(&rlecm_lock);
+	reader->rlecmh[to] = reader->rlecmh[from];
+	reader->rlecm_used |= 1U << to;
+	ecm_ratelimit_free_locked(reader, from);
+	SAFE_MUTEX_UNLOCK(&rlecm_lock);
+}
+
+static void ecm_ratelimit_expire_update(struct s_reader *reader, int32_t h)
+{
+	struct timeb expire = reader->rlecmh[h].last;
+
+	add_ms_to_timeb(&expire, reader->rlecmh[h].ratelimittime + reader->rlecmh[h].srvidholdtime);
+	if(reader->rlecm_used == (1U << h) || comp_timeb(&expire, &reader->rlecm_expire) < 0)
+		{ reader->rlecm_expire = expire; }
+	if(reader->rlecm_used == (1U << h) || comp_timeb(&reader->rlecmh[h].last, &reader->rlecm_newest) > 0)
+		{ reader->rlecm_newest = reader->rlecmh[h].last; }
+}
+
+static void ecm_ratelimit_assign(struct s_reader *reader, int32_t h, struct ecmrl *rl, ECM_REQUEST *er)
+{
+	SAFE_MUTEX_LOCK(&rlecm_lock);
+	reader->rlecmh[h] = *rl; // register this srvid ratelimit params
+	cs_ftime(&reader->rlecmh[h].last); // register request time
+	memcpy(reader->rlecmh[h].ecmd5, er->ecmd5, CS_ECMSTORESIZE);// register ecmhash
+	reader->rlecmh[h].kindecm = er->ecm[0]; // register kind of ecm
+	reader->rlecm_used |= 1U << h;
+	ecm_ratelimit_expire_update(reader, h);
+	SAFE_MUTEX_UNLOCK(&rlecm_lock);
+}
+
+// release slots with srvid that are overtime
+static void ecm_ratelimit_release(struct s_reader *reader, struct timeb *actualtime)
+{
+	int32_t h;
+	uint32_t used;
+
+	SAFE_MUTEX_LOCK(&rlecm_lock);
+	if(!reader->rlecm_used || (comp_timeb(actualtime, &reader->rlecm_expire) < 0 && comp_timeb(actualtime, &reader->rlecm_newest) >= 0))
 	{
-		if(reader->rlecmh[h].last.time == -1) { continue; }
-		int64_t gone = comp_timeb(&actualtime, &reader->rlecmh[h].last);
+		SAFE_MUTEX_UNLOCK(&rlecm_lock);
+		return;
+	}
+
+	for(h = 0, used = reader->rlecm_used; used; h++, used >>= 1)
+	{
+		if(!(used & 1)) { continue; }
+		int64_t gone = comp_timeb(actualtime, &reader->rlecmh[h].last);
 		if( gone >= (reader->rlecmh[h].ratelimittime + reader->rlecmh[h].srvidholdtime) || gone < 0) // gone <0 fixup for bad systemtime on dvb receivers while changing transponders
 		{
 			cs_log_dbg(D_CLIENT, "ratelimiter srvid %04X released from slot %d/%d of reader %s (%"PRId64">=%d ratelimit ms + %d ms srvidhold!)",
 						  reader->rlecmh[h].srvid, h + 1, MAXECMRATELIMIT, reader->label, gone,
 						  reader->rlecmh[h].ratelimittime, reader->rlecmh[h].srvidholdtime);
-			reader->rlecmh[h].last.time = -1;
-			reader->rlecmh[h].srvid = -1;
-			reader->rlecmh[h].kindecm = 0;
-			reader->rlecmh[h].once = 0;
+			ecm_ratelimit_free_locked(reader, h);
 		}
-		if(reader->rlecmh[h].last.time == -1) { continue; }
+	}
+	for(h = 0, used = reader->rlecm_used; used; h++, used >>= 1)
+	{
+		if(used & 1)
+			{ ecm_ratelimit_expire_update(reader, h); }
+	}
+	SAFE_MUTEX_UNLOCK(&rlecm_lock);
+}
+
+static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er, struct ecmrl rl, int32_t reader_mode)
+{
+
+	int32_t h, foundspace = -1;
+	int32_t maxecms = MAXECMRATELIMIT; // init maxecms
+	int32_t totalecms = 0; // init totalecms
+	uint32_t used;
+	struct timeb actualtime;
+	cs_ftime(&actualtime);
+	ecm_ratelimit_release(reader, &actualtime); // even if not called from reader module to maximize available slots!
+	for(h = 0, used = reader->rlecm_used; used; h++, used >>= 1)
+	{
+		if(!(used & 1)) { continue; }
 		if(reader->rlecmh[h].ratelimitecm < maxecms) { maxecms = reader->rlecmh[h].ratelimitecm; }  // we found a more critical ratelimit srvid
 		totalecms++;
 	}
@@ -94,9 +178,9 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 
 	if(reader->cooldown[0] && reader->cooldownstate != 1) { maxecms = MAXECMRATELIMIT; }  // dont apply ratelimits if cooldown isnt in use or not in effect
 
-	for(h = 0; h < MAXECMRATELIMIT; h++)    // check if srvid is already in a slot
+	for(h = 0; h < MAXECMRATELIMIT && (reader->rlecm_used >> h); h++)    // check if srvid is already in a slot
 	{
-		if(reader->rlecmh[h].last.time == -1) { continue; }
+		if(!RLECM_USED(reader, h)) { continue; }
 		if(reader->rlecmh[h].srvid == er->srvid && reader->rlecmh[h].caid == rl.caid && reader->rlecmh[h].provid == rl.provid
 				&& (!reader->rlecmh[h].chid || (reader->rlecmh[h].chid == rl.chid)))
 		{
@@ -158,13 +242,9 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 			{
 				for(foundspace = 0; foundspace < h; foundspace++)    // check for free lower slot
 				{
-					if(reader->rlecmh[foundspace].last.time == -1)
+					if(!RLECM_USED(reader, foundspace))
 					{
-						reader->rlecmh[foundspace] = reader->rlecmh[h]; // replace ecm request info
-						reader->rlecmh[h].last.time = -1;
-						reader->rlecmh[h].srvid = -1;
-						reader->rlecmh[h].kindecm = 0;
-						reader->rlecmh[h].once = 0;
+						ecm_ratelimit_move(reader, h, foundspace); // replace ecm request info
 						if(foundspace < maxecms)
 						{
 							cs_log_dbg(D_CLIENT, "ratelimiter moved srvid %04X to slot %d/%d of reader %s", er->srvid, foundspace + 1, maxecms, reader->label);
@@ -173,7 +253,7 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 						else
 						{
 							cs_log_dbg(D_CLIENT, "ratelimiter removed srvid %04X from slot %d/%d of reader %s", er->srvid, foundspace + 1, maxecms, reader->label);
-							reader->rlecmh[foundspace].last.time = -1; // free this slot since we are over ratelimit!
+							ecm_ratelimit_free(reader, foundspace); // free this slot since we are over ratelimit!
 							return -1; // sorry, ratelimit!
 						}
 					}
@@ -185,10 +265,7 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 			}
 			else
 			{
-				reader->rlecmh[h].last.time = -1; // free this slot since we are over ratelimit!
-				reader->rlecmh[h].srvid = -1;
-				reader->rlecmh[h].kindecm = 0;
-				reader->rlecmh[h].once = 0;
+				ecm_ratelimit_free(reader, h); // free this slot since we are over ratelimit!
 				cs_log_dbg(D_CLIENT, "ratelimiter removed srvid %04X from slot %d/%d of reader %s", er->srvid, h + 1, maxecms, reader->label);
 				return -1; // sorry, ratelimit!
 			}
@@ -214,7 +291,7 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 
 	for(h = 0; h < maxecms; h++)    // check for free slot
 	{
-		if(reader->rlecmh[h].last.time == -1)
+		if(!RLECM_USED(reader, h))
 		{
 			if(reader_mode) { cs_log_dbg(D_CLIENT, "ratelimiter added srvid %04X to slot %d/%d of reader %s", er->srvid, h + 1, maxecms, reader->label); }
 			return h; // free slot found -> assign it!
@@ -232,44 +309,17 @@ static int32_t ecm_ratelimit_findspace(struct s_reader *reader, ECM_REQUEST *er,
 	return (-1); // no slot found
 }
 
+/* Releases all slots above ratelimitecm when the cooldown ratelimit phase starts.
+   The slots stay where they are: the selection sort which used to run here
+   compared each slot with itself and never moved one. */
 static void sort_ecmrl(struct s_reader *reader)
 {
-	int32_t i, j, loc;
-	struct ecmrl tmp;
-
-	for(i = 0; i < reader->ratelimitecm; i++)   // inspect all slots
-	{
-		if(reader->rlecmh[i].last.time == -1) { continue; }  // skip empty slots
-		loc = i;
-		tmp = reader->rlecmh[i]; // tmp is ecm in slot to evaluate
-
-		for(j = i + 1; j < MAXECMRATELIMIT; j++)   // inspect all slots above the slot to be inspected
-		{
-			if(reader->rlecmh[j].last.time == -1) { continue; }  // skip empty slots
-			int32_t gone = comp_timeb(&reader->rlecmh[i].last, &tmp.last);
-			if(gone > 0)   // is higher slot holding a younger ecmrequest?
-			{
-				loc = j; // found a younger one
-				tmp = reader->rlecmh[j]; // copy the ecm in younger slot
-			}
-		}
-
-		if(loc != i)   // Did we find a younger ecmrequest?
-		{
-			reader->rlecmh[loc] = reader->rlecmh[i]; // place older request in slot of younger one we found
-			reader->rlecmh[i] = tmp; // place younger request in slot of older request
-		}
-	}
+	int32_t i;
 
-	// release all slots above ratelimit ecm
+	SAFE_MUTEX_LOCK(&rlecm_lock);
 	for(i = reader->ratelimitecm; i < MAXECMRATELIMIT; i++)
-	{
-		reader->rlecmh[i].last.time = -1;
-		reader->rlecmh[i].srvid = -1;
-		reader->rlecmh[i].kindecm = 0;
-		reader->rlecmh[i].once = 0;
-	}
-
+		{ ecm_ratelimit_free_locked(reader, i); }
+	SAFE_MUTEX_UNLOCK(&rlecm_lock);
 }
 
 int32_t ecm_ratelimit_check(struct s_reader *reader, ECM_REQUEST *er, int32_t reader_mode)
@@ -326,14 +376,7 @@ int32_t ecm_ratelimit_check(struct s_reader *reader, ECM_REQUEST *er, int32_t re
 		else  //we are within ecmratelimits
 		{
 			if(reader_mode)
-			{
-				// Register new slot
-				//reader->rlecmh[foundspace].srvid=er->srvid; // register srvid
-				reader->rlecmh[foundspace] = rl; // register this srvid ratelimit params
-				cs_ftime(&reader->rlecmh[foundspace].last); // register request time
-				memcpy(reader->rlecmh[foundspace].ecmd5, er->ecmd5, CS_ECMSTORESIZE);// register ecmhash
-				reader->rlecmh[foundspace].kindecm = er->ecm[0]; // register kind of ecm
-			}
+				{ ecm_ratelimit_assign(reader, foundspace, &rl, er); } // Register new slot
 
 			return OK;
 		}
@@ -375,7 +418,7 @@ int32_t ecm_ratelimit_check(struct s_reader *reader, ECM_REQUEST *er, int32_t re
 		maxslots = 0; // maxslots is used as counter
 		for(h = 0; h < MAXECMRATELIMIT; h++)
 		{
-			if(reader->rlecmh[h].last.time == -1) { continue; }  // skip empty slots
+			if(!RLECM_USED(reader, h)) { continue; }  // skip empty slots
 			// how many active slots are registered at end of cooldown delay period
 			
 			gone = comp_timeb(&now, &reader->rlecmh[h].last);
@@ -424,14 +467,7 @@ int32_t ecm_ratelimit_check(struct s_reader *reader, ECM_REQUEST *er, int32_t re
 	else  //we are within ecmratelimits
 	{
 		if(reader_mode)
-		{
-			// Register new slot
-			//reader->rlecmh[foundspace].srvid=er->srvid; // register srvid
-			reader->rlecmh[foundspace] = rl; // register this srvid ratelimit params
-			cs_ftime(&reader->rlecmh[foundspace].last); // register request time
-			memcpy(reader->rlecmh[foundspace].ecmd5, er->ecmd5, CS_ECMSTORESIZE);// register ecmhash
-			reader->rlecmh[foundspace].kindecm = er->ecm[0]; // register kind of ecm
-		}
+			{ ecm_ratelimit_assign(reader, foundspace, &rl, er); } // Register new slot
 	}
 
 	if(reader->cooldownstate == 0 && foundspace >= reader->ratelimitecm)
@@ -450,14 +486,7 @@ int32_t ecm_ratelimit_check(struct s_reader *reader, ECM_REQUEST *er, int32_t re
 
 	// Cooldown state housekeeping is done. There is a slot available.
 	if(reader_mode)
-	{
-		// Register new slot
-		//reader->rlecmh[foundspace].srvid=er->srvid; // register srvid
-		reader->rlecmh[foundspace] = rl; // register this srvid ratelimit params
-		cs_ftime(&reader->rlecmh[foundspace].last); // register request time
-		memcpy(reader->rlecmh[foundspace].ecmd5, er->ecmd5, CS_ECMSTORESIZE);// register ecmhash
-		reader->rlecmh[foundspace].kindecm = er->ecm[0]; // register kind of ecm
-	}
+		{ ecm_ratelimit_assign(reader, foundspace, &rl, er); } // Register new slot
 
 	return OK;
 }
@@ -654,18 +683,234 @@ void cs_clear_entitlement(struct s_reader *rdr)
 }
 
 
+/* Index over the pending table (cl->ecmtask) of a network reader.
+ * Slots are found by message idx and by ecmd5 through short hash chains, free
+ * slots come from a stack and sent slots expire from a FIFO in send order.
+ * The ecmtask rc stays authoritative because the modules still change it
+ * directly, so every entry taken from the index is checked against the slot. */
+struct s_ecmtask_fifo
+{
+	int16_t     slot;
+	uint16_t    seq;
+};
+
+struct s_ecmtask_index
+{
+	int32_t     size;               // slots, cfg.max_pending at allocation
+	int32_t     mask;               // hash buckets - 1
+	int32_t     pending;            // slots sent and not answered or expired
+	int32_t     free_count;
+	int32_t     fifo_first, fifo_count, fifo_size;
+	struct s_ecmtask_fifo *fifo;
+	int16_t     *idx_head, *idx_next, *idx_bkt;
+	int16_t     *md5_head, *md5_next, *md5_bkt;
+	int16_t     *free;
+	uint16_t    *seq;               // bumped on every reuse, stale FIFO entries differ
+	uint8_t     *is_free, *live;
+};
+
+#define ECMTASK_TIMEOUT ((cfg.ctimeout + 500) / 1000 + 1)
+
+static int32_t ecmtask_md5_bucket(struct s_ecmtask_index *ix, uint16_t caid, uchar *ecmd5)
+{
+	return (caid ^ ecmd5[0] ^ (ecmd5[1] << 8) ^ (ecmd5[2] << 16) ^ ((uint32_t)ecmd5[3] << 24)) & ix->mask;
+}
+
+static void ecmtask_link(int16_t *head, int16_t *next, int16_t *bkt, int32_t slot, int32_t bucket)
+{
+	next[slot] = head[bucket];
+	head[bucket] = slot;
+	bkt[slot] = bucket;
+}
+
+static void ecmtask_unlink(int16_t *head, int16_t *next, int16_t *bkt, int32_t slot)
+{
+	int16_t *p;
+	if(bkt[slot] < 0)
+		{ return; }
+	for(p = &head[bkt[slot]]; *p >= 0; p = &next[*p])
+	{
+		if(*p == slot)
+		{
+			*p = next[slot];
+			break;
+		}
+	}
+	bkt[slot] = -1;
+}
+
+static void ecmtask_release(struct s_ecmtask_index *ix, int32_t slot)
+{
+	if(ix->live[slot])
+	{
+		ix->live[slot] = 0;
+		ix->pending--;
+	}
+	if(!ix->is_free[slot])
+	{
+		ix->is_free[slot] = 1;
+		ix->free[ix->free_count++] = slot;
+	}
+}
+
+void casc_ecmtask_reset(struct s_client *cl)
+{
+	struct s_ecmtask_index *ix = cl->ecmtask_index;
+	int32_t i;
+	if(!ix)
+		{ return; }
+	memset(ix->idx_head, 0xff, (ix->mask + 1) * sizeof(int16_t));
+	memset(ix->md5_head, 0xff, (ix->mask + 1) * sizeof(int16_t));
+	memset(ix->idx_bkt, 0xff, ix->size * sizeof(int16_t));
+	memset(ix->md5_bkt, 0xff, ix->size * sizeof(int16_t));
+	memset(ix->live, 0, ix->size);
+	for(i = 0; i < ix->size; i++)
+	{
+		ix->free[i] = ix->size - 1 - i;  // hand out slot 0 first
+		ix->is_free[i] = 1;
+	}
+	ix->free_count = ix->size;
+	ix->pending = 0;
+	ix->fifo_first = ix->fifo_count = 0;
+}
+
+int32_t casc_ecmtask_alloc(struct s_client *cl)
+{
+	struct s_ecmtask_index *ix;
+	int32_t size = cfg.max_pending, buckets = 8;
+	uchar *p;
+
+	while(buckets < size)
+		{ buckets <<= 1; }
+	if(!cs_malloc(&cl->ecmtask, size * sizeof(ECM_REQUEST)))
+		{ return 0; }
+	if(!cs_malloc(&p, sizeof(struct s_ecmtask_index) + 2 * size * sizeof(struct s_ecmtask_fifo)
+				  + (2 * buckets + 5 * size) * sizeof(int16_t) + size * sizeof(uint16_t) + 2 * size))
+	{
+		NULLFREE(cl->ecmtask);
+		return 0;
+	}
+	ix = (struct s_ecmtask_index *)p;
+	p += sizeof(struct s_ecmtask_index);
+	ix->size = size;
+	ix->mask = buckets - 1;
+	ix->fifo_size = 2 * size;
+	ix->fifo = (struct s_ecmtask_fifo *)p;  p += ix->fifo_size * sizeof(struct s_ecmtask_fifo);
+	ix->idx_head = (int16_t *)p;            p += buckets * sizeof(int16_t);
+	ix->md5_head = (int16_t *)p;            p += buckets * sizeof(int16_t);
+	ix->idx_next = (int16_t *)p;            p += size * sizeof(int16_t);
+	ix->idx_bkt = (int16_t *)p;             p += size * sizeof(int16_t);
+	ix->md5_next = (int16_t *)p;            p += size * sizeof(int16_t);
+	ix->md5_bkt = (int16_t *)p;             p += size * sizeof(int16_t);
+	ix->free = (int16_t *)p;                p += size * sizeof(int16_t);
+	ix->seq = (uint16_t *)p;                p += size * sizeof(uint16_t);
+	ix->is_free = p;                        p += size;
+	ix->live = p;
+	cl->ecmtask_index = ix;
+	casc_ecmtask_reset(cl);
+	return 1;
+}
+
+/* slot of the pending request with message idx, -1 if there is none */
+int32_t casc_get_ecmtask(struct s_client *cl, int32_t idx)
+{
+	struct s_ecmtask_index *ix = cl->ecmtask_index;
+	int32_t slot;
+	if(!ix)
+		{ return -1; }
+	for(slot = ix->idx_head[idx & ix->mask]; slot >= 0; slot = ix->idx_next[slot])
+	{
+		if(cl->ecmtask[slot].idx == idx)
+			{ return slot; }
+	}
+	return -1;
+}
+
+static void ecmtask_expire(struct s_client *cl, time_t t)
+{
+	struct s_ecmtask_index *ix = cl->ecmtask_index;
+	struct s_ecmtask_fifo *e;
+	ECM_REQUEST *ecm;
+
+	while(ix->fifo_count)
+	{
+		e = &ix->fifo[ix->fifo_first];
+		if(e->seq == ix->seq[e->slot] && ix->live[e->slot])
+		{
+			ecm = &cl->ecmtask[e->slot];
+			if(ecm->rc >= E_NOCARD)
+			{
+				if(t - (uint32_t)ecm->tps.time <= ECMTASK_TIMEOUT)
+					{ break; }
+				ecm->rc = E_FOUND;  // drop timeouts
+			}
+			ecmtask_release(ix, e->slot);
+		}
+		ix->fifo_first = (ix->fifo_first + 1) % ix->fifo_size;
+		ix->fifo_count--;
+	}
+}
+
+static void ecmtask_fifo_push(struct s_ecmtask_index *ix, int32_t slot)
+{
+	struct s_ecmtask_fifo *e;
+	int32_t i, n;
+
+	if(ix->fifo_count == ix->fifo_size)
+	{
+		// drop entries of answered slots, at most size entries are live
+		for(i = n = 0; i < ix->fifo_count; i++)
+		{
+			e = &ix->fifo[(ix->fifo_first + i) % ix->fifo_size];
+			if(e->seq == ix->seq[e->slot] && ix->live[e->slot])
+				{ ix->fifo[(ix->fifo_first + n++) % ix->fifo_size] = *e; }
+		}
+		ix->fifo_count = n;
+	}
+	e = &ix->fifo[(ix->fifo_first + ix->fifo_count++) % ix->fifo_size];
+	e->slot = slot;
+	e->seq = ix->seq[slot];
+}
+
+static int32_t ecmtask_get_free(struct s_client *cl)
+{
+	struct s_ecmtask_index *ix = cl->ecmtask_index;
+	int32_t i, slot;
+
+	if(!ix->free_count)
+	{
+		// pick up slots which the modules finished on their own
+		for(i = ix->size - 1; i >= 0; i--)
+		{
+			if(!ix->is_free[i] && cl->ecmtask[i].rc < E_NOCARD)
+				{ ecmtask_release(ix, i); }
+		}
+	}
+	while(ix->free_count)
+	{
+		slot = ix->free[--ix->free_count];
+		ix->is_free[slot] = 0;
+		if(cl->ecmtask[slot].rc < E_NOCARD)
+			{ return slot; }
+	}
+	return -1;
+}
+
 void casc_check_dcw(struct s_reader *reader, int32_t idx, int32_t rc, uchar *cw)
 {
-	int32_t i, pending = 0;
-	time_t t = time(NULL);
+	int32_t slot, next;
 	ECM_REQUEST *ecm;
 	struct s_client *cl = reader->client;
+	struct s_ecmtask_index *ix;
 
-	if(!check_client(cl)) { return; }
+	if(!check_client(cl) || !(ix = cl->ecmtask_index)) { return; }
 
-	for(i = 0; i < cfg.max_pending; i++)
+	// answer every pending request for the same ecm, they share the md5 chain
+	slot = ix->md5_bkt[idx] >= 0 ? ix->md5_head[ix->md5_bkt[idx]] : idx;
+	for(; slot >= 0; slot = next)
 	{
-		ecm = &cl->ecmtask[i];
+		next = ix->md5_bkt[idx] >= 0 ? ix->md5_next[slot] : -1;
+		ecm = &cl->ecmtask[slot];
 		if((ecm->rc >= E_NOCARD) && ecm->caid == cl->ecmtask[idx].caid && (!memcmp(ecm->ecmd5, cl->ecmtask[idx].ecmd5, CS_ECMSTORESIZE)))
 		{
 			if(rc==2)  //E_INVALID from camd35 CMD08
@@ -682,17 +927,12 @@ void casc_check_dcw(struct s_reader *reader, int32_t idx, int32_t rc, uchar *cw)
 			}
 			ecm->idx = 0;
 			ecm->rc = E_FOUND;
+			ecmtask_release(ix, slot);
 		}
-
-		if(ecm->rc >= E_NOCARD && (t - (uint32_t)ecm->tps.time > ((cfg.ctimeout + 500) / 1000) + 1))  // drop timeouts
-		{
-			ecm->rc = E_FOUND;
-		}
-
-		if(ecm->rc >= E_NOCARD)
-			{ pending++; }
 	}
-	cl->pending = pending;
+
+	ecmtask_expire(cl, time(NULL));
+	cl->pending = ix->pending;
 }
 
 int32_t hostResolve(struct s_reader *rdr)
@@ -703,7 +943,7 @@ int32_t hostResolve(struct s_reader *rdr)
 
 	IN_ADDR_T last_ip;
 	IP_ASSIGN(last_ip, cl->ip);
-	cs_resolve(rdr->device, &cl->ip, &cl->udp_sa, &cl->udp_sa_len);
+	cs_resolve_cached(rdr->device, &cl->ip, &cl->udp_sa, &cl->udp_sa_len);
 	IP_ASSIGN(SIN_GET_ADDR(cl->udp_sa), cl->ip);
 
 	if(!IP_EQUAL(cl->ip, last_ip))
@@ -943,6 +1183,7 @@ void network_tcp_connection_close(struct s_reader *reader, char *reason)
 			cl->ecmtask[i].rc = E_FOUND;
 		}
 	}
+	casc_ecmtask_reset(cl);
 	// newcamd message ids are stored as a reference in ecmtask[].idx
 	// so we need to reset them aswell
 	if(reader->typ == R_NEWCAMD)
@@ -951,50 +1192,44 @@ void network_tcp_connection_close(struct s_reader *reader, char *reason)
 
 int32_t casc_process_ecm(struct s_reader *reader, ECM_REQUEST *er)
 {
-	int32_t rc, n, i, sflag, pending = 0;
+	int32_t rc, n, i, sflag, bucket;
 	time_t t;//, tls;
 	struct s_client *cl = reader->client;
+	struct s_ecmtask_index *ix;
+	ECM_REQUEST *ecm;
 
-	if(!cl || !cl->ecmtask)
+	if(!cl || !cl->ecmtask || !(ix = cl->ecmtask_index))
 	{
 		rdr_log(reader, "WARNING: ecmtask not available");
 		return -1;
 	}
 
 	t = time((time_t *)0);
-	ECM_REQUEST *ecm;
-	for(i = 0; i < cfg.max_pending; i++)
+	ecmtask_expire(cl, t);
+
+	// ecm already pending
+	// ... this level at least
+	bucket = ecmtask_md5_bucket(ix, er->caid, er->ecmd5);
+	for(sflag = 1, i = ix->md5_head[bucket]; i >= 0; i = ix->md5_next[i])
 	{
 		ecm = &cl->ecmtask[i];
-		if((ecm->rc >= E_NOCARD) && (t - (uint32_t)ecm->tps.time > ((cfg.ctimeout + 500) / 1000) + 1))  // drop timeouts
+		if((ecm->rc >= E_NOCARD) && er->caid == ecm->caid && (!memcmp(er->ecmd5, ecm->ecmd5, CS_ECMSTORESIZE)))
 		{
-			ecm->rc = E_FOUND;
+			sflag = 0;
+			break;
 		}
 	}
+	cl->pending = ix->pending;
 
-	for(n = -1, i = 0, sflag = 1; i < cfg.max_pending; i++)
-	{
-		ecm = &cl->ecmtask[i];
-		if(n < 0 && (ecm->rc < E_NOCARD))  // free slot found
-			{ n = i; }
-
-		// ecm already pending
-		// ... this level at least
-		if((ecm->rc >= E_NOCARD) &&  er->caid == ecm->caid && (!memcmp(er->ecmd5, ecm->ecmd5, CS_ECMSTORESIZE)))
-			{ sflag = 0; }
-
-		if(ecm->rc >= E_NOCARD)
-			{ pending++; }
-	}
-	cl->pending = pending;
-
-	if(n < 0)
+	if((n = ecmtask_get_free(cl)) < 0)
 	{
 		rdr_log(reader, "WARNING: reader ecm pending table overflow !!");
 		return (-2);
 	}
 
+	ecm_payload_put(&cl->ecmtask[n].ecm);
 	memcpy(&cl->ecmtask[n], er, sizeof(ECM_REQUEST));
+	cl->ecmtask[n].ecm = ecm_payload_get(er->ecm);
 	cl->ecmtask[n].matching_rdr = NULL; //This avoids double free of matching_rdr!
 #ifdef CS_CACHEEX
 	cl->ecmtask[n].csp_lastnodes = NULL; //This avoids double free of csp_lastnodes!
@@ -1011,6 +1246,14 @@ int32_t casc_process_ecm(struct s_reader *reader, ECM_REQUEST *er)
 	}
 
 	cl->ecmtask[n].rc = E_NOCARD;
+	ix->seq[n]++;
+	ecmtask_unlink(ix->idx_head, ix->idx_next, ix->idx_bkt, n);
+	ecmtask_unlink(ix->md5_head, ix->md5_next, ix->md5_bkt, n);
+	ecmtask_link(ix->idx_head, ix->idx_next, ix->idx_bkt, n, cl->ecmtask[n].idx & ix->mask);
+	ecmtask_link(ix->md5_head, ix->md5_next, ix->md5_bkt, n, bucket);
+	ix->live[n] = 1;
+	ix->pending++;
+	ecmtask_fifo_push(ix, n);
 	cs_log_dbg(D_TRACE, "---- ecm_task %d, idx %d, sflag=%d", n, cl->ecmtask[n].idx, sflag);
 
 	cs_log_dump_dbg(D_ATR, er->ecm, er->ecmlen, "casc ecm (%s):", (reader) ? reader->label : "n/a");
@@ -1048,6 +1291,7 @@ void reader_get_ecm(struct s_reader *reader, ECM_REQUEST *er)
 	//CHECK if ecm already sent to reader
 	struct s_ecm_answer *ea_er = get_ecm_answer(reader, er);
 	if(!ea_er) { return; }
+	ecm_trace_stamp(er, &ea_er->trace[EA_TRACE_DEQUEUED]);
 
 	struct s_ecm_answer *ea = NULL, *ea_prev = NULL;
 	struct ecm_request_t *ecm;
@@ -1110,11 +1354,13 @@ void reader_get_ecm(struct s_reader *reader, ECM_REQUEST *er)
 		cl->last_srvid = er->srvid;
 		cl->last_caid = er->caid;
 		cl->last_provid = er->prid;
+		ecm_trace_stamp(er, &ea_er->trace[EA_TRACE_SENT]);
 		casc_process_ecm(reader, er);
 		cl->lastecm = time((time_t *)0);
 		return;
 	}
 
+	ecm_trace_stamp(er, &ea_er->trace[EA_TRACE_SENT]);
 	cardreader_process_ecm(reader, cl, er);  // forward request to physical reader
 }
 
@@ -1149,7 +1395,73 @@ void reader_do_idle(struct s_reader *reader)
 	}
 }
 
-int32_t reader_init(struct s_reader *reader)
+static pthread_mutex_t reader_init_mutex;
+static pthread_cond_t reader_init_cond;
+static int32_t reader_init_running;
+
+/* Wakes up cs_waitforcardinit() and readers waiting for an init slot. Called
+ * whenever a reader finished its init or a local card changed its state. */
+void reader_init_notify(void)
+{
+	SAFE_MUTEX_LOCK(&reader_init_mutex);
+	SAFE_COND_BROADCAST(&reader_init_cond);
+	SAFE_MUTEX_UNLOCK(&reader_init_mutex);
+}
+
+static int32_t reader_init_acquire(struct s_client *cl)
+{
+	struct timespec ts;
+	int32_t ok;
+
+	SAFE_MUTEX_LOCK(&reader_init_mutex);
+	while(cfg.reader_init_parallel > 0 && reader_init_running >= cfg.reader_init_parallel && !exit_oscam && !cl->kill)
+	{
+		add_ms_to_timespec(&ts, 1000);
+		SAFE_COND_TIMEDWAIT(&reader_init_cond, &reader_init_mutex, &ts);
+	}
+	ok = !exit_oscam && !cl->kill;
+	if(ok)
+		{ reader_init_running++; }
+	SAFE_MUTEX_UNLOCK(&reader_init_mutex);
+	return ok;
+}
+
+static void reader_init_release(void)
+{
+	SAFE_MUTEX_LOCK(&reader_init_mutex);
+	reader_init_running--;
+	SAFE_COND_BROADCAST(&reader_init_cond);
+	SAFE_MUTEX_UNLOCK(&reader_init_mutex);
+}
+
+static int32_t local_cards_pending(void)
+{
+	struct s_reader *rdr;
+	LL_ITER itr = ll_iter_create(configured_readers);
+	while((rdr = ll_iter_next(&itr)))
+	{
+		if(rdr->enable && !is_cascading_reader(rdr) && (rdr->card_status == CARD_NEED_INIT || rdr->card_status == UNKNOWN))
+			{ return 1; }
+	}
+	return 0;
+}
+
+/* Blocks until every enabled local card left the init states. The timed wait
+ * only covers readers which get disabled without passing reader_init_notify(). */
+void reader_wait_for_local_cards(void)
+{
+	struct timespec ts;
+
+	SAFE_MUTEX_LOCK(&reader_init_mutex);
+	while(!exit_oscam && local_cards_pending())
+	{
+		add_ms_to_timespec(&ts, 1000);
+		SAFE_COND_TIMEDWAIT(&reader_init_cond, &reader_init_mutex, &ts);
+	}
+	SAFE_MUTEX_UNLOCK(&reader_init_mutex);
+}
+
+static int32_t reader_init_int(struct s_reader *reader)
 {
 	struct s_client *client = reader->client;
 
@@ -1171,13 +1483,9 @@ int32_t reader_init(struct s_reader *reader)
 			return 0;
 		}
 
-		if(client->ecmtask)
-		{
-			add_garbage(client->ecmtask);
-			client->ecmtask = NULL;
-		}
+		free_reader_ecmtask(client);
 
-		if(!cs_malloc(&client->ecmtask, cfg.max_pending * sizeof(ECM_REQUEST)))
+		if(!casc_ecmtask_alloc(client))
 			{ return 0; }
 
 		rdr_log(reader, "proxy initialized, server %s:%d", reader->device, reader->r_port);
@@ -1196,6 +1504,19 @@ int32_t reader_init(struct s_reader *reader)
 	return 1;
 }
 
+/* Runs in the reader thread. Name resolution, connect and device open of all
+ * readers overlap, readerinitparallel limits how many of them at a time. */
+int32_t reader_init(struct s_reader *reader)
+{
+	int32_t ret;
+
+	if(!reader_init_acquire(reader->client))
+		{ return 0; }
+	ret = reader_init_int(reader);
+	reader_init_release();
+	return ret;
+}
+
 #if !defined(WITH_CARDREADER) && (defined(WITH_STAPI) || defined(WITH_STAPI5))
 /* Dummy function stub for stapi compiles without cardreader as libstapi needs it. */
 int32_t ATR_InitFromArray(ATR *atr, const unsigned char atr_buffer[ATR_MAX_SIZE], uint32_t length)
@@ -1218,6 +1539,140 @@ void cs_card_info(void)
 }
 
 
+struct s_reader_route_entry
+{
+	struct s_reader *rdr;
+	int32_t pos;            // position in first_active_reader
+};
+
+struct s_reader_route
+{
+	uint16_t caid;
+	int32_t count;
+	struct s_reader_route *next;
+	struct s_reader_route_entry *entry;
+};
+
+#define READER_ROUTE_BUCKETS 64
+
+static struct s_reader_route *reader_route[READER_ROUTE_BUCKETS];
+static uint32_t reader_route_generation = 1, reader_route_valid;
+static pthread_mutex_t reader_route_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called when the active reader list or a reader caid table changes. The
+ * routes are dropped on the next lookup. */
+void reader_route_invalidate(void)
+{
+	reader_route_generation++;
+}
+
+static struct s_reader_route *get_reader_route(uint16_t caid)
+{
+	struct s_reader_route *route, *next;
+	struct s_reader *rdr;
+	int32_t i, pos;
+
+	SAFE_MUTEX_LOCK(&reader_route_lock);
+	if(reader_route_valid != reader_route_generation)
+	{
+		// other threads may still walk old routes under readerlist_lock
+		for(i = 0; i < READER_ROUTE_BUCKETS; i++)
+		{
+			for(route = reader_route[i]; route; route = next)
+			{
+				next = route->next;
+				add_garbage(route);
+			}
+			reader_route[i] = NULL;
+		}
+		reader_route_valid = reader_route_generation;
+	}
+
+	for(route = reader_route[caid % READER_ROUTE_BUCKETS]; route && route->caid != caid; route = route->next) { ; }
+	if(!route)
+	{
+		for(i = 0, rdr = first_active_reader; rdr; rdr = rdr->next)
+		{
+			if(chk_ctab(caid, &rdr->ctab))
+				{ i++; }
+		}
+		if(cs_malloc(&route, sizeof(struct s_reader_route) + i * sizeof(struct s_reader_route_entry)))
+		{
+			route->caid = caid;
+			route->entry = (struct s_reader_route_entry *)(route + 1);
+			for(pos = 0, rdr = first_active_reader; rdr && route->count < i; rdr = rdr->next, pos++)
+			{
+				if(chk_ctab(caid, &rdr->ctab))
+				{
+					route->entry[route->count].rdr = rdr;
+					route->entry[route->count].pos = pos;
+					route->count++;
+				}
+			}
+			route->next = reader_route[caid % READER_ROUTE_BUCKETS];
+			reader_route[caid % READER_ROUTE_BUCKETS] = route;
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&reader_route_lock);
+	return route;
+}
+
+static void reader_route_add(struct s_reader_route_iter *it, uint16_t caid)
+{
+	int32_t i;
+
+	for(i = 0; i < it->num; i++)
+	{
+		if(it->route[i]->caid == caid)
+			{ return; }
+	}
+	if(!(it->route[it->num] = get_reader_route(caid)))
+		{ it->full = 1; }
+	else
+		{ it->num++; }
+}
+
+/* Candidates for er are the readers accepting its caid or ocaid (as
+ * matching_reader() requires), and for betatunnel the readers accepting
+ * btun_caid. */
+void reader_route_init(struct s_reader_route_iter *it, ECM_REQUEST *er, uint16_t btun_caid)
+{
+	memset(it, 0, sizeof(struct s_reader_route_iter));
+	reader_route_add(it, er->caid);
+	if(er->ocaid && !it->full)
+		{ reader_route_add(it, er->ocaid); }
+	if(btun_caid && !it->full)
+		{ reader_route_add(it, btun_caid); }
+}
+
+struct s_reader *reader_route_next(struct s_reader_route_iter *it)
+{
+	int32_t i, pos = -1;
+	struct s_reader *rdr = NULL;
+
+	if(it->full)
+	{
+		it->rdr = it->rdr ? it->rdr->next : first_active_reader;
+		return it->rdr;
+	}
+
+	// merge the routes by reader position, a reader in several routes is returned once
+	for(i = 0; i < it->num; i++)
+	{
+		if(it->idx[i] < it->route[i]->count && (pos < 0 || it->route[i]->entry[it->idx[i]].pos < pos))
+		{
+			pos = it->route[i]->entry[it->idx[i]].pos;
+			rdr = it->route[i]->entry[it->idx[i]].rdr;
+		}
+	}
+	for(i = 0; i < it->num; i++)
+	{
+		if(it->idx[i] < it->route[i]->count && it->route[i]->entry[it->idx[i]].pos == pos)
+			{ it->idx[i]++; }
+	}
+	return rdr;
+}
+
 /* Adds a reader to the list of active readers so that it can serve ecms. */
 static void add_reader_to_active(struct s_reader *rdr)
 {
@@ -1293,6 +1748,7 @@ static void add_reader_to_active(struct s_reader *rdr)
 		first_active_reader = rdr;
 	}
 	rdr->active = 1;
+	reader_route_invalidate();
 	cs_writeunlock(__func__, &clientlist_lock);
 	cs_writeunlock(__func__, &readerlist_lock);
 }
@@ -1314,6 +1770,7 @@ void remove_reader_from_active(struct s_reader *rdr)
 	}
 	rdr->next = NULL;
 	rdr->active = 0;
+	reader_route_invalidate();
 	cs_writeunlock(__func__, &readerlist_lock);
 }
 
@@ -1398,6 +1855,7 @@ int32_t restart_cardreader(struct s_reader *rdr, int32_t restart)
 void init_cardreader(void)
 {
 	cs_log_dbg(D_TRACE, "cardreader: Initializing");
+	cs_pthread_cond_init(__func__, &reader_init_mutex, &reader_init_cond);
 	cs_writelock(__func__, &system_lock);
 	struct s_reader *rdr;
 
@@ -1410,8 +1868,6 @@ void init_cardreader(void)
 			restart_cardreader_int(rdr, 0);
 		}
 	}
-
-	load_stat_from_file();
 	cs_writeunlock(__func__, &system_lock);
 }
 
@@ -1427,6 +1883,7 @@ void kill_all_readers(void)
 		kill_thread(cl);
 	}
 	first_active_reader = NULL;
+	reader_route_invalidate();
 }
 
 int32_t reader_slots_available(struct s_reader *reader, ECM_REQUEST *er)
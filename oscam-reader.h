@@ -19,12 +19,37 @@ void    block_connect(struct s_reader *rdr);
 int32_t is_connect_blocked(struct s_reader *rdr);
 
 void reader_do_idle(struct s_reader *reader);
+int32_t casc_ecmtask_alloc(struct s_client *cl);
+void casc_ecmtask_reset(struct s_client *cl);
+int32_t casc_get_ecmtask(struct s_client *cl, int32_t idx);
+int32_t casc_process_ecm(struct s_reader *reader, ECM_REQUEST *er);
 void casc_check_dcw(struct s_reader *reader, int32_t idx, int32_t rc, uchar *cw);
 void reader_do_card_info(struct s_reader *reader);
 int32_t reader_slots_available(struct s_reader *reader, ECM_REQUEST *er);
 
+/* Readers whose caid table accepts a caid, in first_active_reader order.
+ * reader_route_init() and reader_route_next() need readerlist_lock. */
+#define READER_ROUTE_CAIDS 3
+
+struct s_reader_route;
+
+struct s_reader_route_iter
+{
+	struct s_reader_route *route[READER_ROUTE_CAIDS];
+	int32_t idx[READER_ROUTE_CAIDS];
+	int32_t num;
+	int8_t full;            // no route available, walk first_active_reader
+	struct s_reader *rdr;
+};
+
+void reader_route_invalidate(void);
+void reader_route_init(struct s_reader_route_iter *it, ECM_REQUEST *er, uint16_t btun_caid);
+struct s_reader *reader_route_next(struct s_reader_route_iter *it);
+
 void cs_card_info(void);
 int32_t reader_init(struct s_reader *reader);
+void reader_init_notify(void);
+void reader_wait_for_local_cards(void);
 void remove_reader_from_active(struct s_reader *rdr);
 int32_t restart_cardreader(struct s_reader *rdr, int32_t restart);
 void init_cardreader(void);
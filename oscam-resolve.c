@@ -0,0 +1,304 @@
+#define MODULE_LOG_PREFIX "resolve"
+
+#include "globals.h"
+#include "oscam-net.h"
+#include "oscam-resolve.h"
+#include "oscam-string.h"
+#include "oscam-time.h"
+
+/* Shared name cache for the reader connect path. The first caller of a new name
+ * resolves it itself, so a cold start resolves all names in parallel, callers
+ * asking for the same name meanwhile wait for that lookup. Refreshes run on one
+ * resolver thread, callers only copy the cached answer. getaddrinfo() does not
+ * tell the record ttl, so answers are kept for a fixed time and refreshed ahead
+ * of it while the name is in use. */
+
+#define RESOLVE_BUCKETS         64
+#define RESOLVE_TTL             300     // s an answer is valid
+#define RESOLVE_NEGATIVE_TTL    30      // s a failed lookup is remembered
+#define RESOLVE_REFRESH_AHEAD   60      // s before expiry a used name gets refreshed
+#define RESOLVE_UNUSED          3600    // s without a caller after which a name is dropped
+#define RESOLVE_MISS_WAIT       1000    // ms a caller waits for a lookup of a new name someone else started
+#define RESOLVE_HOUSEKEEPING    10      // s between refresh/cleanup runs
+
+extern int32_t exit_oscam;
+
+struct s_resolve_entry
+{
+	char                    *hostname;
+	IN_ADDR_T               ip;
+	struct SOCKADDR         sa;
+	socklen_t               sa_len;
+	time_t                  expires;
+	time_t                  last_used;
+	int8_t                  resolved;   // ip holds an answer
+	int8_t                  has_sa;     // backend filled sa (ipv6 lookups)
+	int8_t                  failed;     // negative entry until expires
+	int8_t                  queued;     // waiting for or inside the resolver thread, or resolved by a caller
+	int16_t                 waiters;    // callers waiting for the first answer
+	struct s_resolve_entry  *next;
+	struct s_resolve_entry  *queue_next;
+};
+
+static struct s_resolve_entry *resolve_hash[RESOLVE_BUCKETS];
+static struct s_resolve_entry *resolve_queue, *resolve_queue_last;
+static pthread_mutex_t resolve_lock;
+static pthread_cond_t resolve_cond;     // resolver thread waits for work
+static pthread_cond_t resolve_done;     // callers wait for a first answer
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+static RESOLVE_FN *resolve_backend = cs_resolve;
+
+static uint32_t resolve_bucket(const char *hostname)
+{
+	uint32_t h = 5381;
+	while(*hostname)
+		{ h = h * 33 + (uint8_t)tolower((uint8_t)*hostname++); }
+	return h % RESOLVE_BUCKETS;
+}
+
+static void resolve_enqueue(struct s_resolve_entry *e)
+{
+	if(e->queued)
+		{ return; }
+	e->queued = 1;
+	e->queue_next = NULL;
+	if(resolve_queue_last)
+		{ resolve_queue_last->queue_next = e; }
+	else
+		{ resolve_queue = e; }
+	resolve_queue_last = e;
+	SAFE_COND_SIGNAL(&resolve_cond);
+}
+
+// Queues refreshes for names in use and drops names nobody asked for in a while
+static void resolve_housekeeping(time_t now)
+{
+	struct s_resolve_entry *e, **prev;
+	int32_t i;
+
+	for(i = 0; i < RESOLVE_BUCKETS; i++)
+	{
+		prev = &resolve_hash[i];
+		while((e = *prev))
+		{
+			if(!e->queued && !e->waiters && now - e->last_used > RESOLVE_UNUSED)
+			{
+				*prev = e->next;
+				NULLFREE(e->hostname);
+				NULLFREE(e);
+				continue;
+			}
+			if(now - e->last_used <= RESOLVE_UNUSED && now >= e->expires - (e->failed ? 0 : RESOLVE_REFRESH_AHEAD))
+				{ resolve_enqueue(e); }
+			prev = &e->next;
+		}
+	}
+}
+
+// Stores a lookup result, called with resolve_lock held
+static void resolve_store(struct s_resolve_entry *e, IN_ADDR_T ip, struct SOCKADDR *sa, socklen_t sa_len, time_t now)
+{
+	if(IP_ISSET(ip))
+	{
+		if(!e->resolved || !IP_EQUAL(ip, e->ip))
+			{ cs_log_dbg(D_TRACE, "%s resolved to %s", e->hostname, cs_inet_ntoa(ip)); }
+		IP_ASSIGN(e->ip, ip);
+		memcpy(&e->sa, sa, sizeof(*sa));
+		e->sa_len = sa_len;
+		e->has_sa = SIN_GET_FAMILY(e->sa) != 0;
+		e->resolved = 1;
+		e->failed = 0;
+		e->expires = now + RESOLVE_TTL;
+	}
+	else
+	{
+		e->resolved = 0;
+		e->failed = 1;
+		e->expires = now + RESOLVE_NEGATIVE_TTL;
+	}
+	e->queued = 0;
+	SAFE_COND_BROADCAST(&resolve_done);
+}
+
+static void *resolve_thread(void)
+{
+	struct s_resolve_entry *e;
+	struct timespec ts;
+	IN_ADDR_T ip;
+	struct SOCKADDR sa;
+	socklen_t sa_len;
+	time_t now, last_housekeeping = 0;
+
+	set_thread_name(__func__);
+	SAFE_MUTEX_LOCK(&resolve_lock);
+	while(!exit_oscam)
+	{
+		now = time(NULL);
+		if(now - last_housekeeping >= RESOLVE_HOUSEKEEPING)
+		{
+			resolve_housekeeping(now);
+			last_housekeeping = now;
+		}
+		if(!(e = resolve_queue))
+		{
+			add_ms_to_timespec(&ts, RESOLVE_HOUSEKEEPING * 1000);
+			SAFE_COND_TIMEDWAIT(&resolve_cond, &resolve_lock, &ts);
+			continue;
+		}
+		if(!(resolve_queue = e->queue_next))
+			{ resolve_queue_last = NULL; }
+
+		// e stays valid: only this thread frees entries and never a queued one
+		SAFE_MUTEX_UNLOCK(&resolve_lock);
+		set_null_ip(&ip);
+		memset(&sa, 0, sizeof(sa));
+		sa_len = 0;
+		resolve_backend(e->hostname, &ip, &sa, &sa_len);
+		now = time(NULL);
+		SAFE_MUTEX_LOCK(&resolve_lock);
+		resolve_store(e, ip, &sa, sa_len, now);
+	}
+	SAFE_MUTEX_UNLOCK(&resolve_lock);
+	return NULL;
+}
+
+static void resolve_init(void)
+{
+	cs_pthread_cond_init(__func__, &resolve_lock, &resolve_cond);
+	__cs_pthread_cond_init(__func__, &resolve_done);
+	start_thread("resolver", (void *) &resolve_thread, NULL, NULL, 1, 1);
+}
+
+static int32_t resolve_is_numeric(const char *hostname)
+{
+	struct in_addr in;
+#ifdef IPV6SUPPORT
+	struct in6_addr in6;
+	if(inet_pton(AF_INET6, hostname, &in6) == 1)
+		{ return 1; }
+#endif
+	return inet_pton(AF_INET, hostname, &in) == 1;
+}
+
+/* Returns the cached address of hostname, never waiting for a lookup of a known
+ * name. Expired answers are still returned while the refresh is pending. A name
+ * seen for the first time is resolved by its first caller, others wait for that
+ * lookup up to RESOLVE_MISS_WAIT ms. On failure ip is cleared and 0 is returned. */
+int32_t cs_resolve_cached(const char *hostname, IN_ADDR_T *ip, struct SOCKADDR *sa, socklen_t *sa_len)
+{
+	struct s_resolve_entry *e;
+	struct timespec ts;
+	struct SOCKADDR new_sa;
+	socklen_t new_sa_len;
+	IN_ADDR_T new_ip;
+	uint32_t bucket;
+	time_t now;
+	int32_t ok;
+
+	if(!hostname || !hostname[0])
+	{
+		set_null_ip(ip);
+		return 0;
+	}
+	if(resolve_is_numeric(hostname))
+	{
+		resolve_backend(hostname, ip, sa, sa_len);
+		return IP_ISSET(*ip);
+	}
+
+	pthread_once(&resolve_once, resolve_init);
+	now = time(NULL);
+	bucket = resolve_bucket(hostname);
+
+	SAFE_MUTEX_LOCK(&resolve_lock);
+	for(e = resolve_hash[bucket]; e; e = e->next)
+	{
+		if(!strcasecmp(e->hostname, hostname))
+			{ break; }
+	}
+	if(!e)
+	{
+		if(!cs_malloc(&e, sizeof(struct s_resolve_entry)) || !(e->hostname = cs_strdup(hostname)))
+		{
+			NULLFREE(e);
+			SAFE_MUTEX_UNLOCK(&resolve_lock);
+			set_null_ip(ip);
+			return 0;
+		}
+		e->next = resolve_hash[bucket];
+		resolve_hash[bucket] = e;
+	}
+	e->last_used = now;
+
+	if(!e->resolved && !e->failed && !e->queued)
+	{
+		// e stays valid: queued entries are never freed
+		e->queued = 1;
+		SAFE_MUTEX_UNLOCK(&resolve_lock);
+		set_null_ip(&new_ip);
+		memset(&new_sa, 0, sizeof(new_sa));
+		new_sa_len = 0;
+		resolve_backend(e->hostname, &new_ip, &new_sa, &new_sa_len);
+		now = time(NULL);
+		SAFE_MUTEX_LOCK(&resolve_lock);
+		resolve_store(e, new_ip, &new_sa, new_sa_len, now);
+	}
+	else if(!e->resolved && !e->failed)
+	{
+		add_ms_to_timespec(&ts, RESOLVE_MISS_WAIT);
+		e->waiters++;
+		while(!e->resolved && !e->failed && !exit_oscam)
+		{
+			if(pthread_cond_timedwait(&resolve_done, &resolve_lock, &ts) == ETIMEDOUT)
+				{ break; }
+		}
+		e->waiters--;
+	}
+	else if(now >= e->expires - (e->failed ? 0 : RESOLVE_REFRESH_AHEAD))
+		{ resolve_enqueue(e); }
+
+	ok = e->resolved;
+	if(ok)
+	{
+		IP_ASSIGN(*ip, e->ip);
+		if(sa && e->has_sa)
+			{ memcpy(sa, &e->sa, sizeof(e->sa)); }
+		if(sa_len && e->sa_len)
+			{ *sa_len = e->sa_len; }
+	}
+	else
+		{ set_null_ip(ip); }
+	SAFE_MUTEX_UNLOCK(&resolve_lock);
+	return ok;
+}
+
+void cs_resolve_set_backend(RESOLVE_FN *fn)
+{
+	resolve_backend = fn ? fn : cs_resolve;
+}
+
+// Drops every cached name which is not being resolved or waited for right now
+void cs_resolve_flush(void)
+{
+	struct s_resolve_entry *e, **prev;
+	int32_t i;
+
+	pthread_once(&resolve_once, resolve_init);
+	SAFE_MUTEX_LOCK(&resolve_lock);
+	for(i = 0; i < RESOLVE_BUCKETS; i++)
+	{
+		prev = &resolve_hash[i];
+		while((e = *prev))
+		{
+			if(e->queued || e->waiters)
+			{
+				prev = &e->next;
+				continue;
+			}
+			*prev = e->next;
+			NULLFREE(e->hostname);
+			NULLFREE(e);
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&resolve_lock);
+}
@@ -0,0 +1,10 @@
+#ifndef OSCAM_RESOLVE_H_
+#define OSCAM_RESOLVE_H_
+
+typedef void (RESOLVE_FN)(const char *hostname, IN_ADDR_T *ip, struct SOCKADDR *sa, socklen_t *sa_len);
+
+int32_t cs_resolve_cached(const char *hostname, IN_ADDR_T *ip, struct SOCKADDR *sa, socklen_t *sa_len);
+void cs_resolve_set_backend(RESOLVE_FN *fn);
+void cs_resolve_flush(void);
+
+#endif
@@ -1,69 +1,256 @@
 #include "globals.h"
+#include "oscam-garbage.h"
+#include "oscam-lock.h"
 #include "oscam-string.h"
 
-static void cl_set_last_providptr(struct s_client *cl, uint32_t provid, uint16_t caid)
+#define NAME_INDEX_EXACT 1
+#define NAME_INDEX_ZERO  2  // last entry also listing provid 0 (or none) for the caid
+#define NAME_INDEX_ANY   3  // last entry for the caid, whatever the provid
+
+static struct s_name_index *name_index_create(uint32_t count)
+{
+	struct s_name_index *idx;
+	uint32_t size = 16;
+
+	while(size < count * 2)
+		{ size <<= 1; }
+	if(!cs_malloc(&idx, sizeof(struct s_name_index) + size * sizeof(struct s_name_index_slot)))
+		{ return NULL; }
+	idx->mask = size - 1;
+	idx->slot = (struct s_name_index_slot *)(idx + 1);
+	return idx;
+}
+
+static uint32_t name_index_pos(struct s_name_index *idx, uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(key >> 32) & idx->mask;
+}
+
+static void name_index_set(struct s_name_index *idx, uint64_t key, void *entry, int8_t replace)
+{
+	uint32_t pos;
+
+	for(pos = name_index_pos(idx, key); idx->slot[pos].key; pos = (pos + 1) & idx->mask)
+	{
+		if(idx->slot[pos].key == key)
+		{
+			if(replace)
+				{ idx->slot[pos].entry = entry; }
+			return;
+		}
+	}
+	idx->slot[pos].key = key;
+	idx->slot[pos].entry = entry;
+	idx->count++;
+}
+
+static void *name_index_get(struct s_name_index *idx, uint64_t key)
+{
+	uint32_t pos;
+
+	for(pos = name_index_pos(idx, key); idx->slot[pos].key; pos = (pos + 1) & idx->mask)
+	{
+		if(idx->slot[pos].key == key)
+			{ return idx->slot[pos].entry; }
+	}
+	return NULL;
+}
+
+static uint64_t srvid_key(uint64_t type, uint16_t srvid, uint16_t caid, uint32_t provid)
+{
+	return (type << 56) | ((uint64_t)srvid << 40) | ((uint64_t)caid << 24) | (provid & 0xFFFFFF);
+}
+
+static uint64_t provid_key(uint64_t type, uint16_t caid, uint32_t provid)
+{
+	return (type << 56) | ((uint64_t)caid << 24) | (provid & 0xFFFFFF);
+}
+
+static uint64_t tierid_key(uint16_t tierid, uint16_t caid)
 {
+	return ((uint64_t)NAME_INDEX_EXACT << 56) | ((uint64_t)tierid << 16) | caid;
+}
+
+/* The indexes return the same entry as walking the lists: the first exact
+ * match, else the last provid zero (or any provid for provid 0) match. */
+struct s_name_index *srvid_index_create(struct s_srvid **srvid)
+{
+	struct s_name_index *idx;
+	struct s_srvid *this;
+	uint32_t count = 0;
+	int32_t i, j, k;
+
+	for(k = 0; k < 16; k++)
+	{
+		for(this = srvid[k]; this; this = this->next)
+		{
+			for(i = 0; i < this->ncaid; i++)
+				{ count += (this->caid[i].nprovid ? this->caid[i].nprovid : 1) + 2; }
+		}
+	}
+	if(!(idx = name_index_create(count)))
+		{ return NULL; }
+
+	for(k = 0; k < 16; k++)
+	{
+		for(this = srvid[k]; this; this = this->next)
+		{
+			if(!this->name)
+				{ continue; }
+			for(i = 0; i < this->ncaid; i++)
+			{
+				uint16_t caid = this->caid[i].caid;
+
+				name_index_set(idx, srvid_key(NAME_INDEX_ANY, this->srvid, caid, 0), this, 1);
+				if(this->caid[i].nprovid == 0)
+				{
+					name_index_set(idx, srvid_key(NAME_INDEX_ZERO, this->srvid, caid, 0), this, 1);
+					name_index_set(idx, srvid_key(NAME_INDEX_EXACT, this->srvid, caid, 0), this, 0);
+				}
+				for(j = 0; j < this->caid[i].nprovid; j++)
+				{
+					if(this->caid[i].provid[j] == 0)
+						{ name_index_set(idx, srvid_key(NAME_INDEX_ZERO, this->srvid, caid, 0), this, 1); }
+					name_index_set(idx, srvid_key(NAME_INDEX_EXACT, this->srvid, caid, this->caid[i].provid[j]), this, 0);
+				}
+			}
+		}
+	}
+	return idx;
+}
+
+struct s_name_index *provid_index_create(struct s_provid *provid)
+{
+	struct s_name_index *idx;
+	struct s_provid *this;
+	uint32_t count = 0;
 	int32_t i;
-	struct s_provid *this = cfg.provid;
-	struct s_provid *zero_match = NULL;
 
-	cl->last_providptr = NULL;
+	for(this = provid; this; this = this->next)
+		{ count += this->nprovid + 1; }
+	if(!(idx = name_index_create(count)))
+		{ return NULL; }
 
-	if(!caid) {
-		return;
+	for(this = provid; this; this = this->next)
+	{
+		if(this->nprovid == 0)
+			{ name_index_set(idx, provid_key(NAME_INDEX_ZERO, this->caid, 0), this, 1); }
+		for(i = 0; i < this->nprovid; i++)
+		{
+			if(this->provid[i] == 0)
+				{ name_index_set(idx, provid_key(NAME_INDEX_ZERO, this->caid, 0), this, 1); }
+			name_index_set(idx, provid_key(NAME_INDEX_EXACT, this->caid, this->provid[i]), this, 0);
+		}
+	}
+	return idx;
+}
+
+struct s_name_index *tierid_index_create(struct s_tierid *tierid)
+{
+	struct s_name_index *idx;
+	struct s_tierid *this;
+	uint32_t count = 0;
+	int32_t i;
+
+	for(this = tierid; this; this = this->next)
+		{ count += this->ncaid; }
+	if(!(idx = name_index_create(count)))
+		{ return NULL; }
+
+	for(this = tierid; this; this = this->next)
+	{
+		for(i = 0; i < this->ncaid; i++)
+			{ name_index_set(idx, tierid_key(this->tierid, this->caid[i]), this, 0); }
+	}
+	return idx;
+}
+
+/* The ratelimit index returns the first rule for (caid, provid, srvid), the
+ * other rules for the same key follow through next_same in list order. */
+struct s_name_index *ratelimit_index_create(struct s_rlimit *rlimit)
+{
+	struct s_name_index *idx;
+	struct s_rlimit *this, *first;
+	uint32_t count = 0;
+
+	for(this = rlimit; this; this = this->next)
+		{ count++; }
+	if(!(idx = name_index_create(count)))
+		{ return NULL; }
+
+	for(this = rlimit; this; this = this->next)
+	{
+		this->next_same = NULL;
+		if((first = name_index_get(idx, srvid_key(NAME_INDEX_EXACT, this->rl.srvid, this->rl.caid, this->rl.provid))))
+		{
+			while(first->next_same)
+				{ first = first->next_same; }
+			first->next_same = this;
+		}
+		else
+			{ name_index_set(idx, srvid_key(NAME_INDEX_EXACT, this->rl.srvid, this->rl.caid, this->rl.provid), this, 0); }
 	}
+	return idx;
+}
+
+struct s_rlimit *ratelimit_index_get(struct s_name_index *idx, uint16_t caid, uint32_t provid, uint16_t srvid)
+{
+	if(provid > 0xFFFFFF)
+		{ return NULL; }
+	return name_index_get(idx, srvid_key(NAME_INDEX_EXACT, srvid, caid, provid));
+}
 
-	for(; this; this = this->next)
+static struct s_provid *find_provid(uint32_t provid, uint16_t caid, int8_t zero_fallback)
+{
+	struct s_name_index *idx = cfg.provid_index;
+	struct s_provid *this, *zero_match = NULL;
+	int32_t i;
+
+	if(idx)
+	{
+		if(provid <= 0xFFFFFF && (this = name_index_get(idx, provid_key(NAME_INDEX_EXACT, caid, provid))))
+			{ return this; }
+		return zero_fallback ? name_index_get(idx, provid_key(NAME_INDEX_ZERO, caid, 0)) : NULL;
+	}
+
+	for(this = cfg.provid; this; this = this->next)
 	{
 		if(this->caid == caid)
 		{
-			if(this->nprovid == 0 )
+			if(this->nprovid == 0)
 				{ zero_match = this; }
-					
-			for(i=0; i < this->nprovid; i++)
+
+			for(i = 0; i < this->nprovid; i++)
 			{
-				if(this->provid[i] == 0 )
+				if(this->provid[i] == 0)
 					{ zero_match = this; }
-				
+
 				if(this->provid[i] == provid)
-				{
-					cl->last_providptr = this;
-					return;
-				}
+					{ return this; }
 			}
 		}
 	}
-	
-	if(zero_match != NULL)
-		{ cl->last_providptr = zero_match; }
+	return zero_fallback ? zero_match : NULL;
 }
 
-/* Gets the servicename. */
-static char *__get_servicename(struct s_client *cl, uint16_t srvid, uint32_t provid, uint16_t caid, char *buf, uint32_t buflen, bool return_unknown)
+static struct s_srvid *find_srvid(uint16_t srvid, uint32_t provid, uint16_t caid)
 {
-	int32_t i, j;
+	struct s_name_index *idx = cfg.srvid_index;
 	struct s_srvid *this, *provid_zero_match = NULL, *provid_any_match = NULL;
-	buf[0] = '\0';
-
-	if(!srvid || (srvid >> 12) >= 16)  //cfg.srvid[16]
-		{ return (buf); }
+	int32_t i, j;
 
-	if(cl && cl->last_srvidptr && cl->last_srvidptr->srvid == srvid)
-		for(i = 0; i < cl->last_srvidptr->ncaid; i++)
-			if(cl->last_srvidptr->caid[i].caid == caid 
-				&& cl->last_srvidptr_search_provid == provid
-				&& cl->last_srvidptr->name)
-			{
-				if(cl->last_providptr == NULL)
-					{ cl_set_last_providptr(cl, provid, caid); }
-				cs_strncpy(buf, cl->last_srvidptr->name, buflen);
-				return (buf);
-			}
+	if(idx)
+	{
+		if(provid <= 0xFFFFFF && (this = name_index_get(idx, srvid_key(NAME_INDEX_EXACT, srvid, caid, provid))))
+			{ return this; }
+		return name_index_get(idx, srvid_key(provid ? NAME_INDEX_ZERO : NAME_INDEX_ANY, srvid, caid, 0));
+	}
 
 	for(this = cfg.srvid[srvid >> 12]; this; this = this->next)
 		if(this->srvid == srvid)
 			for(i = 0; i < this->ncaid; i++)
-			{			
+			{
 				if(this->caid[i].caid == caid && this->name)
 				{
 					provid_any_match = this;
@@ -71,73 +258,88 @@ static char *__get_servicename(struct s_client *cl, uint16_t srvid, uint32_t pro
 					if(this->caid[i].nprovid == 0)
 					{
 						provid_zero_match = this;
-						
+
 						if(0 == provid)
-						{
-							if(cl)
-							{
-								cl_set_last_providptr(cl, provid, caid);
-								cl->last_srvidptr = this;
-								cl->last_srvidptr_search_provid = provid;
-							}
-							cs_strncpy(buf, this->name, buflen);
-							return (buf);
-						}					
+							{ return this; }
 					}
-											
+
 					for(j = 0; j < this->caid[i].nprovid; j++)
 					{
 						if(this->caid[i].provid[j] == 0)
 							{ provid_zero_match = this; }
-						
+
 						if(this->caid[i].provid[j] == provid)
-						{
-							if(cl)
-							{
-								cl_set_last_providptr(cl, provid, caid);
-								cl->last_srvidptr = this;
-								cl->last_srvidptr_search_provid = provid;
-							}
-							cs_strncpy(buf, this->name, buflen);
-							return (buf);
-						}
+							{ return this; }
 					}
 				}
 			}
 
-	if(!buf[0])
-	{
-		if(provid != 0 && provid_zero_match != NULL)
-		{
-			if(cl)
-			{ 
-				cl_set_last_providptr(cl, provid, caid);
-				cl->last_srvidptr = provid_zero_match;
-				cl->last_srvidptr_search_provid = provid;
-			}
-			cs_strncpy(buf, provid_zero_match->name, buflen);
-			return (buf);			
-		}		
-		else if(provid == 0 && provid_any_match != NULL)
-		{
-			if(cl)
-			{ 
-				cl_set_last_providptr(cl, provid, caid);
-				cl->last_srvidptr = provid_any_match;
-				cl->last_srvidptr_search_provid = provid;
+	return provid ? provid_zero_match : provid_any_match;
+}
+
+static struct s_tierid *find_tierid(uint16_t tierid, uint16_t caid)
+{
+	struct s_name_index *idx = cfg.tierid_index;
+	struct s_tierid *this;
+	int32_t i;
+
+	if(idx)
+		{ return name_index_get(idx, tierid_key(tierid, caid)); }
+
+	for(this = cfg.tierid; this; this = this->next)
+		if(this->tierid == tierid)
+			for(i = 0; i < this->ncaid; i++)
+				if(this->caid[i] == caid)
+					{ return this; }
+	return NULL;
+}
+
+static void cl_set_last_providptr(struct s_client *cl, uint32_t provid, uint16_t caid)
+{
+	cl->last_providptr = caid ? find_provid(provid, caid, 1) : NULL;
+}
+
+/* Gets the servicename. */
+static char *__get_servicename(struct s_client *cl, uint16_t srvid, uint32_t provid, uint16_t caid, char *buf, uint32_t buflen, bool return_unknown)
+{
+	int32_t i;
+	struct s_srvid *this;
+	buf[0] = '\0';
+
+	if(!srvid || (srvid >> 12) >= 16)  //cfg.srvid[16]
+		{ return (buf); }
+
+	if(cl && cl->last_srvidptr && cl->last_srvidptr->srvid == srvid)
+		for(i = 0; i < cl->last_srvidptr->ncaid; i++)
+			if(cl->last_srvidptr->caid[i].caid == caid 
+				&& cl->last_srvidptr_search_provid == provid
+				&& cl->last_srvidptr->name)
+			{
+				if(cl->last_providptr == NULL)
+					{ cl_set_last_providptr(cl, provid, caid); }
+				cs_strncpy(buf, cl->last_srvidptr->name, buflen);
+				return (buf);
 			}
-			cs_strncpy(buf, provid_any_match->name, buflen);
-			return (buf);
-		}
 
-		if(return_unknown)
-			{ snprintf(buf, buflen, "%04X@%06X:%04X unknown", caid, provid, srvid); }
+	if((this = find_srvid(srvid, provid, caid)))
+	{
 		if(cl)
-		{ 
-			cl->last_providptr = NULL;
-			cl->last_srvidptr = NULL;
+		{
+			cl_set_last_providptr(cl, provid, caid);
+			cl->last_srvidptr = this;
 			cl->last_srvidptr_search_provid = provid;
 		}
+		cs_strncpy(buf, this->name, buflen);
+		return (buf);
+	}
+
+	if(return_unknown)
+		{ snprintf(buf, buflen, "%04X@%06X:%04X unknown", caid, provid, srvid); }
+	if(cl)
+	{ 
+		cl->last_providptr = NULL;
+		cl->last_srvidptr = NULL;
+		cl->last_srvidptr_search_provid = provid;
 	}
 	return (buf);
 }
@@ -233,15 +435,11 @@ int32_t picon_servicename_remve_hd(char *buf, uint32_t UNUSED(buflen))
 /* Gets the tier name. Make sure that buf is at least 83 bytes long. */
 char *get_tiername(uint16_t tierid, uint16_t caid, char *buf)
 {
-	uint8_t found = 0;
-	int32_t i;
-	struct s_tierid *this = cfg.tierid;
+	struct s_tierid *this = find_tierid(tierid, caid);
 
-	for(buf[0] = 0; this && !found; this = this->next)
-		if(this->tierid == tierid)
-			for(i = 0; i < this->ncaid && !found; i++)
-				if(this->caid[i] == caid)
-					{ cs_strncpy(buf, this->name, 32); found = 1; }
+	buf[0] = 0;
+	if(this)
+		{ cs_strncpy(buf, this->name, 32); }
 
 	if(!tierid) { buf[0] = '\0'; }
 	return (buf);
@@ -250,15 +448,11 @@ char *get_tiername(uint16_t tierid, uint16_t caid, char *buf)
 /* Gets the tier name. Make sure that buf is at least 83 bytes long. */
 char *get_tiername_defaultid(uint16_t tierid, uint16_t caid, char *buf)
 {
-	uint8_t found = 0;
-	int32_t i;
-	struct s_tierid *this = cfg.tierid;
+	struct s_tierid *this = find_tierid(tierid, caid);
 
-	for(buf[0] = 0; this && !found; this = this->next)
-		if(this->tierid == tierid)
-			for(i = 0; i < this->ncaid && !found; i++)
-				if(this->caid[i] == caid)
-					{ cs_strncpy(buf, this->name, 32); found = 1; }
+	buf[0] = 0;
+	if(this)
+		{ cs_strncpy(buf, this->name, 32); }
 
 	if(!tierid)
 	{
@@ -271,30 +465,19 @@ char *get_tiername_defaultid(uint16_t tierid, uint16_t caid, char *buf)
 /* Gets the provider name. */
 char *get_provider(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen)
 {
-	uint8_t found = 0;
-	int32_t i;
-	struct s_provid *this = cfg.provid;
+	struct s_provid *this;
 
 	if(!caid) {
 		buf[0] = '\0';
 		return (buf);
 	}
 
-	for(buf[0] = 0; this && !found; this = this->next)
+	buf[0] = 0;
+	if((this = find_provid(provid, caid, 0)))
 	{
-		if(this->caid == caid)
-		{
-			for(i=0; i<this->nprovid && !found; i++)
-			{
-				if(this->provid[i] == provid)
-				{
-					snprintf(buf, buflen, "%s%s%s%s%s", this->prov,
-							 *this->sat && this->sat[0] ? " / " : "", this->sat,
-							 this->lang[0] ? " / " : "", this->lang);
-					found = 1;
-				}
-			}
-		}
+		snprintf(buf, buflen, "%s%s%s%s%s", this->prov,
+				 *this->sat && this->sat[0] ? " / " : "", this->sat,
+				 this->lang[0] ? " / " : "", this->lang);
 	}
 
 	if(!buf[0]) { snprintf(buf, buflen, "%04X@%06X unknown", caid, provid); }
@@ -304,42 +487,16 @@ char *get_provider(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen)
 
 char *__get_providername(uint32_t provid, uint16_t caid, char *buf, uint32_t buflen, bool return_unknown)
 {
-	uint8_t found = 0;
-	int32_t i;
-	struct s_provid *this = cfg.provid;
-	struct s_provid *zero_match = NULL;
+	struct s_provid *this;
 
 	if(!caid) {
 		buf[0] = '\0';
 		return (buf);
 	}
 
-	for(buf[0] = 0; this && !found; this = this->next)
-	{
-		if(this->caid == caid)
-		{
-			if(this->nprovid == 0 )
-				{ zero_match = this; }
-			
-			for(i=0; i<this->nprovid && !found; i++)
-			{
-				if(this->provid[i] == 0 )
-					{ zero_match = this; }
-				
-				if(this->provid[i] == provid)
-				{
-					cs_strncpy(buf, this->prov, buflen);
-					found = 1;
-				}
-			}
-		}
-	}
-	
-	if(!found && zero_match != NULL)
-	{
-		cs_strncpy(buf, zero_match->prov, buflen);
-		found = 1;		
-	}
+	buf[0] = 0;
+	if((this = find_provid(provid, caid, 1)))
+		{ cs_strncpy(buf, this->prov, buflen); }
 
 	if(!buf[0] && return_unknown) { snprintf(buf, buflen, "%04X@%06X unknown", caid, provid); }
 
@@ -375,39 +532,51 @@ const char *get_cl_lastprovidername(struct s_client *cl)
 }
 
 // Add provider description. If provider was already present, do nothing.
+// Readers can add providers at the same time and oscam.provid can be reloaded,
+// so the list is changed under config_lock. The lookups don't lock, they get a
+// completely built index swapped in, the old one goes to the garbage collector.
 void add_provider(uint16_t caid, uint32_t provid, const char *name, const char *sat, const char *lang)
 {
 	int32_t i;
-	struct s_provid **ptr;
-	
-	for(ptr = &cfg.provid; *ptr; ptr = &(*ptr)->next)
-	{
-		if((*ptr)->caid == caid)
-		{
-			for(i=0; i<(*ptr)->nprovid; i++)
-			{
-			 	if((*ptr)->provid[i] == provid)
-				{ 
-					return;
-				}
-			}
-		}
-	}
+	struct s_provid **ptr, *prov;
+	struct s_name_index *old;
 
-	struct s_provid *prov;
 	if(!cs_malloc(&prov, sizeof(struct s_provid)))
 		{ return; }
 
 	if(!cs_malloc(&prov->provid, sizeof(uint32_t)))
 		{ NULLFREE(prov); return; }
-		
+
 	prov->nprovid = 1;
 	prov->provid[0] = provid;
 	prov->caid = caid;
 	cs_strncpy(prov->prov, name, sizeof(prov->prov));
 	cs_strncpy(prov->sat, sat, sizeof(prov->sat));
 	cs_strncpy(prov->lang, lang, sizeof(prov->lang));
+
+	cs_writelock(__func__, &config_lock);
+	for(ptr = &cfg.provid; *ptr; ptr = &(*ptr)->next)
+	{
+		if((*ptr)->caid == caid)
+		{
+			for(i=0; i<(*ptr)->nprovid; i++)
+			{
+			 	if((*ptr)->provid[i] == provid)
+				{
+					cs_writeunlock(__func__, &config_lock);
+					NULLFREE(prov->provid);
+					NULLFREE(prov);
+					return;
+				}
+			}
+		}
+	}
 	*ptr = prov;
+
+	old = cfg.provid_index;
+	cfg.provid_index = provid_index_create(cfg.provid);
+	cs_writeunlock(__func__, &config_lock);
+	add_garbage(old);
 }
 
 // Get a cardsystem name based on caid
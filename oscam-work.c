@@ -6,6 +6,7 @@
 #include "oscam-ecm.h"
 #include "oscam-emm.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-net.h"
 #include "oscam-reader.h"
 #include "oscam-string.h"
@@ -18,6 +19,10 @@
 extern CS_MUTEX_LOCK system_lock;
 extern int32_t thread_pipe[2];
 
+#define JOB_EMM_SHARE       50      // % of the card time emms may take while ecms are coming in
+#define JOB_ECM_ACTIVE      10000   // ms after the last ecm job during which the emm budget applies
+#define JOB_MAX_WAIT        2000    // ms an emm or housekeeping job waits behind ecms before it goes first
+
 struct job_data
 {
 	enum actions action;
@@ -28,21 +33,150 @@ struct job_data
 	uint16_t len;
 };
 
+static void free_job_ptr(enum actions action, void *ptr)
+{
+	//special free checks
+	if(action == ACTION_ECM_ANSWER_CACHE)
+	{
+		NULLFREE(((struct s_write_from_cache *)ptr)->er_cache);
+	}
+	else if(action == ACTION_READER_EMM)
+	{
+		emm_packet_release(ptr); // shared between the au readers
+		return;
+	}
+
+	NULLFREE(ptr);
+}
+
 static void free_job_data(struct job_data *data)
 {
 	if(!data)
 		{ return; }
 	if(data->len && data->ptr)
+		{ free_job_ptr(data->action, data->ptr); }
+	NULLFREE(data);
+}
+
+static enum job_class job_get_class(enum actions action)
+{
+	switch(action)
 	{
-		//special free checks
-		if(data->action==ACTION_ECM_ANSWER_CACHE)
+	case ACTION_READER_EMM:
+		return JOB_CLASS_EMM;
+	case ACTION_READER_IDLE:
+	case ACTION_READER_CARDINFO:
+	case ACTION_READER_POLL_STATUS:
+	case ACTION_READER_CHECK_HEALTH:
+		return JOB_CLASS_HOUSEKEEPING;
+	default:
+		return JOB_CLASS_ECM; // keeps resets and inits in order with the ecms
+	}
+}
+
+/* Takes the next job from the joblist, thread_lock has to be held. Reader jobs
+   run by class: ecms in arrival order first, then emms as far as the budget
+   allows, housekeeping last. So that a steady stream of ecms can't hold them
+   back for good, an emm (within the budget) or housekeeping job which waited
+   JOB_MAX_WAIT ms goes before the ecms. Client jobs stay fifo. When only
+   deferred emms are left, wait is set to the ms until the next one may run. */
+static struct job_data *job_next(struct s_client *cl, int32_t *wait)
+{
+	struct job_data *data, *ecm = NULL, *emm = NULL, *housekeeping = NULL;
+	struct timeb now;
+	int64_t gone;
+
+	*wait = 0;
+	if(!cl->joblist || !ll_count(cl->joblist))
+		{ return NULL; }
+
+	LL_ITER itr = ll_iter_create(cl->joblist);
+	if(!cl->reader)
+		{ data = ll_iter_next_remove(&itr); }
+	else
+	{
+		// the first job of each class is the oldest one
+		while((data = ll_iter_next(&itr)))
+		{
+			enum job_class class = job_get_class(data->action);
+			if(class == JOB_CLASS_ECM && !ecm)
+				{ ecm = data; }
+			if(class == JOB_CLASS_EMM && !emm)
+				{ emm = data; }
+			if(class == JOB_CLASS_HOUSEKEEPING && !housekeeping)
+				{ housekeeping = data; }
+			if(ecm && (emm || !cl->job_queued[JOB_CLASS_EMM]) && (housekeeping || !cl->job_queued[JOB_CLASS_HOUSEKEEPING]))
+				{ break; }
+		}
+		cs_ftime(&now);
+		if(emm && comp_timeb(&cl->job_emm_next, &now) > 0)
+		{
+			*wait = comp_timeb(&cl->job_emm_next, &now);
+			emm = NULL; // over the budget
+		}
+		if(emm && housekeeping && comp_timeb(&housekeeping->time, &emm->time) < 0)
+			{ data = housekeeping; }
+		else
+			{ data = emm ? emm : housekeeping; }
+		if(ecm && data)
+		{
+			gone = comp_timeb(&now, &data->time);
+			if(gone < JOB_MAX_WAIT)
+				{ data = ecm; }
+			else
+				{ cs_log_dbg(D_TRACE, "job action %d for %s waited %"PRId64" ms, running it before the ecms", data->action, username(cl), gone); }
+		}
+		else if(ecm)
+			{ data = ecm; }
+		if(data)
 		{
-			NULLFREE(((struct s_write_from_cache *)data->ptr)->er_cache);
+			ll_remove(cl->joblist, data);
+			*wait = 0;
 		}
+	}
 
-		NULLFREE(data->ptr);
+	if(data)
+		{ cl->job_queued[job_get_class(data->action)]--; }
+	return data;
+}
+
+/* While ecms are coming in, emms may keep the card busy for JOB_EMM_SHARE % of
+   the time: after an emm which took t ms the next one waits t * (100 - share) / share ms. */
+static void job_emm_budget(struct s_client *cl, struct timeb *start)
+{
+	struct timeb now;
+	int64_t took;
+
+	cs_ftime(&now);
+	if(comp_timeb(start, &cl->job_ecm_last) > JOB_ECM_ACTIVE)
+	{
+		cl->job_emm_next = now;
+		return;
 	}
-	NULLFREE(data);
+	took = comp_timeb(&now, start);
+	cl->job_emm_next = now;
+	add_ms_to_timeb(&cl->job_emm_next, took * (100 - JOB_EMM_SHARE) / JOB_EMM_SHARE);
+}
+
+/* Emms from the same client which are already waiting for this reader are not
+   queued again, returns 1 when ep is such a duplicate. Duplicates from other
+   clients are queued, so each client gets its own emm result and statistics.
+   thread_lock has to be held. */
+static int8_t job_emm_queued(struct s_client *cl, EMM_PACKET *ep)
+{
+	struct job_data *data;
+
+	if(!cl->job_queued[JOB_CLASS_EMM])
+		{ return 0; }
+	LL_ITER itr = ll_iter_create(cl->joblist);
+	while((data = ll_iter_next(&itr)))
+	{
+		EMM_PACKET *queued = data->ptr;
+		if(data->action == ACTION_READER_EMM && queued && (queued == ep || (queued->client == ep->client
+				&& queued->emmlen == ep->emmlen && queued->type == ep->type && !memcmp(queued->emm, ep->emm, ep->emmlen))))
+			{ return 1; }
+	}
+	return 0;
 }
 
 void free_joblist(struct s_client *cl)
@@ -55,6 +189,7 @@ void free_joblist(struct s_client *cl)
 	{
 		free_job_data(data);
 	}
+	memset(cl->job_queued, 0, sizeof(cl->job_queued));
 	ll_destroy(&cl->joblist);
 	cl->account = NULL;
 	if(cl->work_job_data)  // Free job_data that was not freed by work_thread
@@ -121,7 +256,7 @@ void *work_thread(void *ptr)
 	if(!cs_malloc(&mbuf, bufsize))
 		{ return NULL; }
 	cl->work_mbuf = mbuf; // Track locally allocated data, because some callback may call cs_exit/cs_disconect_client/pthread_exit and then mbuf would be leaked
-	int32_t n = 0, rc = 0, i, idx, s;
+	int32_t n = 0, rc = 0, i, idx, s, emm_wait = 0;
 	uint8_t dcw[16];
 	int8_t restart_reader = 0;
 	while(cl->thread_active)
@@ -153,14 +288,9 @@ void *work_thread(void *ptr)
 				if(!cl->kill && cl->typ != 'r')
 					{ client_check_status(cl); } // do not call for physical readers as this might cause an endless job loop
 				SAFE_MUTEX_LOCK(&cl->thread_lock);
-				if(cl->joblist && ll_count(cl->joblist) > 0)
-				{
-					LL_ITER itr = ll_iter_create(cl->joblist);
-					data = ll_iter_next_remove(&itr);
-					if(data)
-						{ set_work_thread_name(data); }
-					//cs_log_dbg(D_TRACE, "start next job from list action=%d", data->action);
-				}
+				data = job_next(cl, &emm_wait);
+				if(data)
+					{ set_work_thread_name(data); }
 				SAFE_MUTEX_UNLOCK(&cl->thread_lock);
 			}
 
@@ -168,7 +298,8 @@ void *work_thread(void *ptr)
 			{
 				/* for serial client cl->pfd is file descriptor for serial port not socket
 				   for example: pfd=open("/dev/ttyUSB0"); */
-				if(!cl->pfd || module->listenertype == LIS_SERIAL)
+				int8_t has_fd = cl->pfd && module->listenertype != LIS_SERIAL;
+				if(!has_fd && !emm_wait)
 					{ break; }
 				pfd[0].fd = cl->pfd;
 				pfd[0].events = POLLIN | POLLPRI;
@@ -176,7 +307,8 @@ void *work_thread(void *ptr)
 				SAFE_MUTEX_LOCK(&cl->thread_lock);
 				cl->thread_active = 2;
 				SAFE_MUTEX_UNLOCK(&cl->thread_lock);
-				rc = poll(pfd, 1, 3000);
+				// add_job wakes us up for new jobs, deferred emms are picked up after emm_wait
+				rc = poll(pfd, has_fd, (emm_wait && (emm_wait < 3000 || !has_fd)) ? emm_wait : 3000);
 				SAFE_MUTEX_LOCK(&cl->thread_lock);
 				cl->thread_active = 1;
 				SAFE_MUTEX_UNLOCK(&cl->thread_lock);
@@ -230,7 +362,13 @@ void *work_thread(void *ptr)
 			}
 
 			if(data != &tmp_data)
-				{ cl->work_job_data = data; } // Track the current job_data
+			{
+				cl->work_job_data = data; // Track the current job_data
+				metrics_inc(MC_JOBS);
+				metrics_observe(MH_JOB_WAIT, gone);
+				if(reader)
+					{ metrics_hist_add(&reader->job_wait_hist[job_get_class(data->action)], gone); }
+			}
 			switch(data->action)
 			{
 			case ACTION_READER_IDLE:
@@ -258,24 +396,22 @@ void *work_thread(void *ptr)
 				if(idx < 0) { break; }  // no dcw received
 				if(!idx) { idx = cl->last_idx; }
 				reader->last_g = time(NULL); // *********************************** TO BE REPLACE BY CS_FTIME() LATER **************** // for reconnect timeout
-				for(i = 0, n = 0; i < cfg.max_pending && n == 0; i++)
+				if((i = casc_get_ecmtask(cl, idx)) >= 0)
 				{
-					if(cl->ecmtask[i].idx == idx)
-					{
-						cl->pending--;
-						casc_check_dcw(reader, i, rc, dcw);
-						n++;
-					}
+					cl->pending--;
+					casc_check_dcw(reader, i, rc, dcw);
 				}
 				break;
 			case ACTION_READER_RESET:
 				cardreader_do_reset(reader);
 				break;
 			case ACTION_READER_ECM_REQUEST:
+				cl->job_ecm_last = actualtime;
 				reader_get_ecm(reader, data->ptr);
 				break;
 			case ACTION_READER_EMM:
 				reader_do_emm(reader, data->ptr);
+				job_emm_budget(cl, &actualtime);
 				break;
 			case ACTION_READER_CARDINFO:
 				reader_do_card_info(reader);
@@ -424,14 +560,14 @@ int32_t add_job(struct s_client *cl, enum actions action, void *ptr, int32_t len
 		if(!cl)
 			{ cs_log("WARNING: add_job failed. Client killed!"); } // Ignore jobs for killed clients
 		if(len && ptr)
-			{ NULLFREE(ptr); }
+			{ free_job_ptr(action, ptr); }
 		return 0;
 	}
 
 	if(action == ACTION_CACHE_PUSH_OUT && cacheex_check_queue_length(cl))
 	{
 		if(len && ptr)
-			{ NULLFREE(ptr); }
+			{ free_job_ptr(action, ptr); }
 		return 0;
 	}
 
@@ -439,7 +575,7 @@ int32_t add_job(struct s_client *cl, enum actions action, void *ptr, int32_t len
 	if(!cs_malloc(&data, sizeof(struct job_data)))
 	{
 		if(len && ptr)
-			{ NULLFREE(ptr); }
+			{ free_job_ptr(action, ptr); }
 		return 0;
 	}
 
@@ -454,7 +590,16 @@ int32_t add_job(struct s_client *cl, enum actions action, void *ptr, int32_t len
 	{
 		if(!cl->joblist)
 			{ cl->joblist = ll_create("joblist"); }
+		if(action == ACTION_READER_EMM && ptr && job_emm_queued(cl, ptr))
+		{
+			SAFE_MUTEX_UNLOCK(&cl->thread_lock);
+			cs_log_dbg(D_TRACE, "emm already queued for %s, coalesced", username(cl));
+			metrics_inc(MC_EMM_COALESCED);
+			free_job_data(data);
+			return 1;
+		}
 		ll_append(cl->joblist, data);
+		cl->job_queued[job_get_class(action)]++;
 		if(cl->thread_active == 2)
 			{ pthread_kill(cl->thread, OSCAM_SIGNAL_WAKEUP); }
 		SAFE_MUTEX_UNLOCK(&cl->thread_lock);
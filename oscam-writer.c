@@ -0,0 +1,348 @@
+#define MODULE_LOG_PREFIX "writer"
+
+#include "globals.h"
+#include "oscam-metrics.h"
+#include "oscam-string.h"
+#include "oscam-time.h"
+#include "oscam-writer.h"
+
+/* Per-event files (saved emms, ecm.info, gbox info files) are written by one
+ * writer thread, so client and reader threads never wait for the filesystem.
+ * The thread keeps the files open and writes everything queued since its last
+ * run in one go. An appended file is only rotated to <file>-prev when the caller
+ * gives it a size limit, it is then rotated at that size and when it was not
+ * changed for WRITER_MAX_AGE. A file renamed or removed by someone else (webif
+ * emm log cleaning, logrotate) is reopened on the next run. When the queue is
+ * full, new records are dropped and counted instead of blocking. */
+
+#define WRITER_QUEUE_MAX    (1024 * 1024)       // bytes waiting for the writer before records get dropped
+#define WRITER_BATCH_MS     200                 // ms the writer lets records pile up before a run
+#define WRITER_IDLE_CLOSE   60                  // s without records after which a file is closed
+#define WRITER_MAX_AGE      (7 * 24 * 3600)     // s without changes after which a size limited file is rotated
+
+#define WRITER_APPEND       0
+#define WRITER_REPLACE      1                   // replaces the file content
+#define WRITER_REMOVE       2                   // removes the file
+
+struct s_writer_record
+{
+	struct s_writer_record  *next;
+	char                    *filename;
+	char                    *data;
+	int32_t                 len;
+	int32_t                 max_kb;     // size limit of an appended file, 0 never rotates it
+	int8_t                  mode;       // WRITER_APPEND, WRITER_REPLACE or WRITER_REMOVE
+};
+
+struct s_writer_file
+{
+	char                    *filename;
+	FILE                    *fp;
+	int32_t                 max_kb;
+	time_t                  last_used;
+	struct s_writer_file    *next;
+};
+
+static struct s_writer_record *writer_queue, *writer_queue_last;
+static int32_t writer_queued;                   // bytes in writer_queue
+static struct s_writer_file *writer_files;      // only used by the writer thread
+static pthread_mutex_t writer_lock;
+static pthread_cond_t writer_cond;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_t writer_thread_id;
+static int8_t writer_running, writer_stop;
+
+static void writer_close(struct s_writer_file *f)
+{
+	if(f->fp)
+	{
+		fclose(f->fp);
+		f->fp = NULL;
+	}
+}
+
+static void writer_rotate(struct s_writer_file *f)
+{
+	char prev[strlen(f->filename) + 6];
+
+	writer_close(f);
+	snprintf(prev, sizeof(prev), "%s-prev", f->filename);
+	if(rename(f->filename, prev))
+		{ cs_log("ERROR: Cannot rename '%s' to '%s' (errno=%d: %s)", f->filename, prev, errno, strerror(errno)); }
+}
+
+// closes open files whose path no longer leads to them, they are reopened on their next record
+static void writer_check_renamed(void)
+{
+	struct s_writer_file *f;
+	struct stat st, fst;
+
+	for(f = writer_files; f; f = f->next)
+	{
+		if(!f->fp)
+			{ continue; }
+		if(stat(f->filename, &st) || fstat(fileno(f->fp), &fst) || st.st_ino != fst.st_ino || st.st_dev != fst.st_dev)
+		{
+			cs_log_dbg(D_TRACE, "'%s' was moved away, reopening it", f->filename);
+			writer_close(f);
+		}
+	}
+}
+
+static struct s_writer_file *writer_get_file(const char *filename, int32_t max_kb, time_t now)
+{
+	struct s_writer_file *f;
+	struct stat st;
+
+	for(f = writer_files; f; f = f->next)
+	{
+		if(!strcmp(f->filename, filename))
+			{ break; }
+	}
+	if(!f)
+	{
+		if(!cs_malloc(&f, sizeof(struct s_writer_file)) || !(f->filename = cs_strdup(filename)))
+		{
+			NULLFREE(f);
+			return NULL;
+		}
+		f->next = writer_files;
+		writer_files = f;
+	}
+	f->max_kb = max_kb;
+	if(!f->fp)
+	{
+		// files are closed when idle, so an outdated file is always found here
+		if(max_kb && !stat(filename, &st) && now - st.st_mtime > WRITER_MAX_AGE)
+			{ writer_rotate(f); }
+		if(!(f->fp = fopen(filename, "a")))
+		{
+			cs_log("ERROR: Cannot open file '%s' (errno=%d: %s)", filename, errno, strerror(errno));
+			return NULL;
+		}
+	}
+	f->last_used = now;
+	return f;
+}
+
+static void writer_remove_file(struct s_writer_record *rec)
+{
+	struct s_writer_file *f;
+
+	for(f = writer_files; f; f = f->next)
+	{
+		if(!strcmp(f->filename, rec->filename))
+			{ writer_close(f); }
+	}
+	if(unlink(rec->filename) && errno != ENOENT)
+		{ cs_log("ERROR: Cannot remove file '%s' (errno=%d: %s)", rec->filename, errno, strerror(errno)); }
+}
+
+static void writer_replace_file(struct s_writer_record *rec)
+{
+	FILE *fp = fopen(rec->filename, "w");
+
+	if(!fp)
+	{
+		cs_log("ERROR: Cannot open file '%s' (errno=%d: %s)", rec->filename, errno, strerror(errno));
+		return;
+	}
+	if(rec->len && fwrite(rec->data, rec->len, 1, fp) != 1)
+		{ cs_log("ERROR: Cannot write file '%s' (errno=%d: %s)", rec->filename, errno, strerror(errno)); }
+	if(fclose(fp))
+		{ cs_log("ERROR: Cannot close file '%s' (errno=%d: %s)", rec->filename, errno, strerror(errno)); }
+}
+
+// Writes one batch, files are flushed once at the end
+static void writer_write(struct s_writer_record *records)
+{
+	struct s_writer_record *rec, *r;
+	struct s_writer_file *f;
+	time_t now = time(NULL);
+
+	writer_check_renamed();
+	for(rec = records; rec; rec = rec->next)
+	{
+		if(rec->mode == WRITER_REMOVE)
+			{ writer_remove_file(rec); }
+		else if(rec->mode == WRITER_REPLACE)
+		{
+			// only the last content of a replaced file matters, a later removal drops it too
+			for(r = rec->next; r && !(r->mode != WRITER_APPEND && !strcmp(r->filename, rec->filename)); r = r->next) { ; }
+			if(!r)
+				{ writer_replace_file(rec); }
+		}
+		else if((f = writer_get_file(rec->filename, rec->max_kb, now)))
+		{
+			if(fwrite(rec->data, rec->len, 1, f->fp) != 1)
+			{
+				cs_log("ERROR: Cannot write file '%s' (errno=%d: %s)", f->filename, errno, strerror(errno));
+				writer_close(f);
+			}
+		}
+		metrics_inc(MC_WRITER_RECORDS);
+	}
+
+	for(f = writer_files; f; f = f->next)
+	{
+		if(!f->fp)
+			{ continue; }
+		fflush(f->fp);
+		if(f->max_kb && ftell(f->fp) >= f->max_kb * 1024)
+			{ writer_rotate(f); }
+	}
+
+	while((rec = records))
+	{
+		records = rec->next;
+		NULLFREE(rec);
+	}
+}
+
+static void writer_cleanup(time_t now, int8_t all)
+{
+	struct s_writer_file *f, **prev = &writer_files;
+
+	while((f = *prev))
+	{
+		if(!all && now - f->last_used < WRITER_IDLE_CLOSE)
+		{
+			prev = &f->next;
+			continue;
+		}
+		writer_close(f);
+		*prev = f->next;
+		NULLFREE(f->filename);
+		NULLFREE(f);
+	}
+}
+
+static void *writer_thread(void)
+{
+	struct s_writer_record *records;
+	struct timespec ts;
+
+	set_thread_name(__func__);
+	SAFE_MUTEX_LOCK(&writer_lock);
+	while(writer_queue || !writer_stop)
+	{
+		if(!writer_queue)
+		{
+			add_ms_to_timespec(&ts, WRITER_IDLE_CLOSE * 1000);
+			SAFE_COND_TIMEDWAIT(&writer_cond, &writer_lock, &ts);
+			if(!writer_queue)
+			{
+				writer_cleanup(time(NULL), 0);
+				continue;
+			}
+		}
+		if(!writer_stop)
+		{
+			SAFE_MUTEX_UNLOCK(&writer_lock);
+			cs_sleepms(WRITER_BATCH_MS);
+			SAFE_MUTEX_LOCK(&writer_lock);
+		}
+		records = writer_queue;
+		writer_queue = writer_queue_last = NULL;
+		writer_queued = 0;
+		SAFE_MUTEX_UNLOCK(&writer_lock);
+
+		writer_write(records);
+		writer_cleanup(time(NULL), 0);
+
+		SAFE_MUTEX_LOCK(&writer_lock);
+	}
+	SAFE_MUTEX_UNLOCK(&writer_lock);
+	writer_cleanup(0, 1);
+	return NULL;
+}
+
+static void writer_init(void)
+{
+	cs_pthread_cond_init(__func__, &writer_lock, &writer_cond);
+	writer_running = !start_thread("file writer", (void *) &writer_thread, NULL, &writer_thread_id, 0, 1);
+}
+
+static bool writer_add(const char *filename, const char *data, int32_t len, int32_t max_kb, int8_t mode)
+{
+	struct s_writer_record *rec;
+	int32_t namelen;
+
+	if(!filename || !filename[0] || len < 0)
+		{ return false; }
+	pthread_once(&writer_once, writer_init);
+
+	namelen = strlen(filename) + 1;
+	if(!cs_malloc(&rec, sizeof(struct s_writer_record) + namelen + len))
+		{ return false; }
+	rec->filename = (char *)(rec + 1);
+	rec->data = rec->filename + namelen;
+	memcpy(rec->filename, filename, namelen);
+	memcpy(rec->data, data, len);
+	rec->len = len;
+	rec->max_kb = max_kb;
+	rec->mode = mode;
+
+	SAFE_MUTEX_LOCK(&writer_lock);
+	if(!writer_running || writer_stop || writer_queued + len > WRITER_QUEUE_MAX)
+	{
+		SAFE_MUTEX_UNLOCK(&writer_lock);
+		cs_log_dbg(D_TRACE, "writer queue full, dropping %d bytes for %s", len, filename);
+		metrics_inc(MC_WRITER_DROPPED);
+		NULLFREE(rec);
+		return false;
+	}
+	if(writer_queue_last)
+		{ writer_queue_last->next = rec; }
+	else
+		{ writer_queue = rec; }
+	writer_queue_last = rec;
+	writer_queued += len;
+	SAFE_COND_SIGNAL(&writer_cond);
+	SAFE_MUTEX_UNLOCK(&writer_lock);
+	return true;
+}
+
+// Appends to the file, it is rotated at max_kb kB (0: never). Returns false if the record was dropped
+bool writer_append(const char *filename, const char *data, int32_t len, int32_t max_kb)
+{
+	return writer_add(filename, data, len, max_kb, WRITER_APPEND);
+}
+
+void writer_replace(const char *filename, const char *data, int32_t len)
+{
+	writer_add(filename, data, len, 0, WRITER_REPLACE);
+}
+
+// Removes the file in order with the records queued before
+void writer_remove(const char *filename)
+{
+	writer_add(filename, "", 0, 0, WRITER_REMOVE);
+}
+
+void writer_buf_printf(struct s_writer_buf *buf, const char *fmt, ...)
+{
+	va_list args;
+	int32_t n;
+
+	if(buf->len >= (int32_t)sizeof(buf->data) - 1)
+		{ return; }
+	va_start(args, fmt);
+	n = vsnprintf(buf->data + buf->len, sizeof(buf->data) - buf->len, fmt, args);
+	va_end(args);
+	if(n > 0)
+		{ buf->len = MIN(buf->len + n, (int32_t)sizeof(buf->data) - 1); }
+}
+
+// Writes everything still queued and stops the writer thread
+void writer_finish(void)
+{
+	if(!writer_running)
+		{ return; }
+	SAFE_MUTEX_LOCK(&writer_lock);
+	writer_stop = 1;
+	SAFE_COND_SIGNAL(&writer_cond);
+	SAFE_MUTEX_UNLOCK(&writer_lock);
+	SAFE_THREAD_JOIN(writer_thread_id, NULL);
+	writer_running = 0;
+}
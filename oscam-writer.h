@@ -0,0 +1,19 @@
+#ifndef OSCAM_WRITER_H_
+#define OSCAM_WRITER_H_
+
+#define WRITER_BUF_SIZE 2048
+
+// Collects a record before it is handed to the writer, longer output is cut
+struct s_writer_buf
+{
+	int32_t len;
+	char    data[WRITER_BUF_SIZE];
+};
+
+bool writer_append(const char *filename, const char *data, int32_t len, int32_t max_kb);
+void writer_replace(const char *filename, const char *data, int32_t len);
+void writer_remove(const char *filename);
+void writer_buf_printf(struct s_writer_buf *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void writer_finish(void);
+
+#endif
@@ -33,11 +33,13 @@
 #include "oscam-files.h"
 #include "oscam-garbage.h"
 #include "oscam-lock.h"
+#include "oscam-metrics.h"
 #include "oscam-net.h"
 #include "oscam-reader.h"
 #include "oscam-string.h"
 #include "oscam-time.h"
 #include "oscam-work.h"
+#include "oscam-writer.h"
 #include "reader-common.h"
 #include "module-gbox.h"
 
@@ -79,6 +81,7 @@ static char *oscam_pidfile;
 static char default_pidfile[64];
 
 int32_t exit_oscam = 0;
+struct timeb startup_time;  // for the "first cw answered" startup metric
 static struct s_module modules[CS_MAX_MOD];
 
 struct s_client *first_client = NULL;  //Pointer to clients list, first client is master
@@ -476,6 +479,7 @@ static void write_versionfile(bool use_stdout)
 		write_cardreaderconf(CARDREADER_STAPI, "stapi");
 		write_cardreaderconf(CARDREADER_STAPI5, "stapi5");
 		write_cardreaderconf(CARDREADER_STINGER, "stinger");
+		write_cardreaderconf(CARDREADER_VIRTUAL, "virtual");
 	}
 	else
 	{
@@ -594,6 +598,18 @@ static void cs_dummy(void)
 	return;
 }
 
+#ifdef WITH_LOCKPROFILE
+/* The lock profile is collected under a mutex, which must not be taken in a
+   signal handler, so SIGWINCH only requests the dump and reader_check()
+   writes it on its next round. */
+static volatile sig_atomic_t lock_profile_dump_requested;
+
+static void cs_lock_profile_request(void)
+{
+	lock_profile_dump_requested = 1;
+}
+#endif
+
 /* Switch debuglevel forward one step (called when receiving SIGUSR1). */
 static void cs_debug_level(void)
 {
@@ -739,7 +755,11 @@ static void init_signal(void)
 #endif
 	set_signal_handler(SIGTERM, 3, cs_exit);
 
+#ifdef WITH_LOCKPROFILE
+	set_signal_handler(SIGWINCH, 1, cs_lock_profile_request);
+#else
 	set_signal_handler(SIGWINCH, 1, SIG_IGN);
+#endif
 	set_signal_handler(SIGPIPE , 0, cs_sigpipe);
 	set_signal_handler(SIGALRM , 0, cs_master_alarm);
 	set_signal_handler(SIGHUP  , 1, cs_reload_config);
@@ -1112,26 +1132,7 @@ static void cs_waitforcardinit(void)
 	if(cfg.waitforcards)
 	{
 		cs_log("waiting for local card init");
-		int32_t card_init_done;
-		do
-		{
-			card_init_done = 1;
-			struct s_reader *rdr;
-			LL_ITER itr = ll_iter_create(configured_readers);
-			while((rdr = ll_iter_next(&itr)))
-			{
-				if(rdr->enable && !is_cascading_reader(rdr) && (rdr->card_status == CARD_NEED_INIT || rdr->card_status == UNKNOWN))
-				{
-					card_init_done = 0;
-					break;
-				}
-			}
-
-			if(!card_init_done)
-				{ cs_sleepms(300); } // wait a little bit
-			//alarm(cfg.cmaxidle + cfg.ctimeout / 1000 + 1);
-		}
-		while(!card_init_done && !exit_oscam);
+		reader_wait_for_local_cards();
 
 		if(cfg.waitforcards_extra_delay > 0 && !exit_oscam)
 			{ cs_sleepms(cfg.waitforcards_extra_delay); }
@@ -1139,6 +1140,16 @@ static void cs_waitforcardinit(void)
 	}
 }
 
+/* Loadbalancer statistics and the emm cache are only files to parse, so they
+   are read while the readers connect and initialize. */
+static void *startup_loader(void)
+{
+	set_thread_name(__func__);
+	load_stat_from_file();
+	emm_load_cache();
+	return NULL;
+}
+
 static uint32_t resize_pfd_cllist(struct pollfd **pfd, struct s_client ***cl_list, uint32_t old_size, uint32_t new_size)
 {
 	if(old_size != new_size)
@@ -1390,6 +1401,13 @@ static void *reader_check(void)
 			}
 		}
 		cs_readunlock(__func__, &readerlist_lock);
+#ifdef WITH_LOCKPROFILE
+		if(lock_profile_dump_requested)
+		{
+			lock_profile_dump_requested = 0;
+			cs_lock_profile_dump();
+		}
+#endif
 		sleepms_on_cond(__func__, &reader_check_sleep_cond_mutex, &reader_check_sleep_cond, 1000);
 	}
 	return NULL;
@@ -1638,6 +1656,9 @@ const struct s_cardreader *cardreaders[] =
 #endif
 #ifdef CARDREADER_STINGER
 	&cardreader_stinger,
+#endif
+#ifdef CARDREADER_VIRTUAL
+	&cardreader_virtual,
 #endif
 	NULL
 };
@@ -1691,12 +1712,16 @@ int32_t main(int32_t argc, char *argv[])
 	prog_name = argv[0];
 	struct timespec start_ts;
 	cs_gettime(&start_ts); // Initialize clock_type
+	cs_ftime(&startup_time);
+	pthread_t startup_loader_thread;
+	int8_t startup_loader_started;
 
 	if(pthread_key_create(&getclient, NULL))
 	{
 		fprintf(stderr, "Could not create getclient, exiting...");
 		exit(1);
 	}
+	metrics_init();
 
 	void (*mod_def[])(struct s_module *) =
 	{
@@ -1866,10 +1891,10 @@ int32_t main(int32_t argc, char *argv[])
 	do_report_emm_support();
 
 	init_cardreader();
+	startup_loader_started = !start_thread("startup loader", (void *) &startup_loader, NULL, &startup_loader_thread, 0, 1);
 
 	cs_waitforcardinit();
 
-	emm_load_cache();
 	load_emmstat_from_file();
 
 	led_status_starting();
@@ -1907,6 +1932,8 @@ int32_t main(int32_t argc, char *argv[])
 
 	remove_versionfile();
 
+	if(startup_loader_started)
+		{ SAFE_THREAD_JOIN(startup_loader_thread, NULL); }
 	stat_finish();
 	dvbapi_stop_all_descrambling();
 	dvbapi_save_channel_cache();
@@ -1942,6 +1969,8 @@ int32_t main(int32_t argc, char *argv[])
 	// sleep a bit, so hopefully all threads are stopped when we continue
 	cs_sleepms(200);
 
+	writer_finish();
+
 	free_cache();
 	cacheex_free_hitcache();
 	webif_tpls_free();
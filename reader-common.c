@@ -227,6 +227,7 @@ void cardreader_do_reset(struct s_reader *reader)
 		do_emm_from_file(reader);
 		ICC_Async_DisplayMsg(reader, "AOK");
 	}
+	reader_init_notify();
 
 	return;
 }
@@ -272,7 +273,11 @@ int32_t cardreader_do_checkhealth(struct s_reader *reader)
 			led_status_card_ejected();
 			gbx_local_card_changed();
 		}
-		reader->card_status = NO_CARD;
+		if(reader->card_status != NO_CARD)
+		{
+			reader->card_status = NO_CARD;
+			reader_init_notify();
+		}
 	}
 	rdr_log_dbg(reader, D_READER, "%s: reader->card_status = %d, ret = %d", __func__,
 				   reader->card_status, reader->card_status == CARD_INSERTED);
@@ -401,8 +406,72 @@ bool cardreader_init(struct s_reader *reader)
 void cardreader_close(struct s_reader *reader)
 {
 	ICC_Async_Close(reader);
+	reader_rsa_mont_free(reader);
+}
+
+#if defined(READER_CONAX) || defined(READER_CRYPTOWORKS) || defined(READER_NAGRA)
+struct s_rsa_mont
+{
+	BIGNUM      *mod[RSA_MONT_CACHE];
+	BN_MONT_CTX *mont[RSA_MONT_CACHE];
+	int32_t     next;
+};
+
+static void rsa_mont_clear(struct s_rsa_mont *cache, int32_t i)
+{
+	if(cache->mod[i])
+		{ BN_free(cache->mod[i]); }
+	if(cache->mont[i])
+		{ BN_MONT_CTX_free(cache->mont[i]); }
+	cache->mod[i] = NULL;
+	cache->mont[i] = NULL;
 }
 
+/* BN_mod_exp() which keeps the Montgomery contexts of the last used moduli on the reader,
+   so the RSA of every ECM/EMM doesn't have to set them up again. Runs in the reader thread only. */
+int32_t reader_rsa_mod_exp(struct s_reader *reader, BIGNUM *r, BIGNUM *a, const BIGNUM *p, const BIGNUM *mod, BN_CTX *ctx)
+{
+	struct s_rsa_mont *cache;
+	int32_t i;
+
+	if(!BN_is_odd(mod))
+		{ return BN_mod_exp(r, a, p, mod, ctx); }
+	if(!reader->rsa_mont && !cs_malloc(&reader->rsa_mont, sizeof(struct s_rsa_mont)))
+		{ return BN_mod_exp(r, a, p, mod, ctx); }
+	cache = reader->rsa_mont;
+
+	for(i = 0; i < RSA_MONT_CACHE; i++)
+	{
+		if(cache->mod[i] && BN_cmp(cache->mod[i], mod) == 0)
+			{ return BN_mod_exp_mont(r, a, p, mod, ctx, cache->mont[i]); }
+	}
+
+	i = cache->next;
+	cache->next = (i + 1) % RSA_MONT_CACHE;
+	rsa_mont_clear(cache, i);
+	cache->mod[i] = BN_dup(mod);
+	cache->mont[i] = BN_MONT_CTX_new();
+	if(!cache->mod[i] || !cache->mont[i] || !BN_MONT_CTX_set(cache->mont[i], mod, ctx))
+	{
+		rsa_mont_clear(cache, i);
+		return BN_mod_exp(r, a, p, mod, ctx);
+	}
+	rdr_log_dbg(reader, D_READER, "rsa: cached montgomery context for %d bit modulus", BN_num_bits(mod));
+	return BN_mod_exp_mont(r, a, p, mod, ctx, cache->mont[i]);
+}
+
+void reader_rsa_mont_free(struct s_reader *reader)
+{
+	int32_t i;
+
+	if(!reader->rsa_mont)
+		{ return; }
+	for(i = 0; i < RSA_MONT_CACHE; i++)
+		{ rsa_mont_clear(reader->rsa_mont, i); }
+	NULLFREE(reader->rsa_mont);
+}
+#endif
+
 void reader_post_process(struct s_reader *reader)
 {
 	// some systems eg. nagra2/3 needs post process after receiving cw from card
@@ -40,6 +40,17 @@ int32_t card_write(struct s_reader *reader, const uchar *, const uchar *, uchar
     memset(cta_res, 0, CTA_RES_LEN); \
     uint16_t cta_lr;
 
+#if defined(READER_CONAX) || defined(READER_CRYPTOWORKS) || defined(READER_NAGRA)
+#include "cscrypt/bn.h"
+
+#define RSA_MONT_CACHE 4 // montgomery contexts kept per reader
+
+int32_t reader_rsa_mod_exp(struct s_reader *reader, BIGNUM *r, BIGNUM *a, const BIGNUM *p, const BIGNUM *mod, BN_CTX *ctx);
+void reader_rsa_mont_free(struct s_reader *reader);
+#else
+static inline void reader_rsa_mont_free(struct s_reader *UNUSED(reader)) { }
+#endif
+
 #ifdef WITH_CARDREADER
 void cardreader_init_locks(void);
 bool cardreader_init(struct s_reader *reader);
@@ -37,7 +37,7 @@ static int32_t RSA_CNX(struct s_reader *reader, unsigned char *msg, unsigned cha
 		BN_bin2bn(mod, modbytes, bn_mod);  // rsa modulus
 		BN_bin2bn(exp, expbytes, bn_exp);  // exponent
 		BN_bin2bn(msg + pre_size, modbytes, bn_data);
-		BN_mod_exp(bn_res, bn_data, bn_exp, bn_mod, ctx);
+		reader_rsa_mod_exp(reader, bn_res, bn_data, bn_exp, bn_mod, ctx);
 
 		n = BN_bn2bin(bn_res, data);
 
@@ -56,7 +56,7 @@ static int32_t RSA_CNX(struct s_reader *reader, unsigned char *msg, unsigned cha
 				memcpy(msg + size, data + (n - (modbytes - size)), modbytes - size);
 
 				BN_bin2bn(msg, modbytes, bn_data);
-				BN_mod_exp(bn_res, bn_data, bn_exp, bn_mod, ctx);
+				reader_rsa_mod_exp(reader, bn_res, bn_data, bn_exp, bn_mod, ctx);
 				n = BN_bn2bin(bn_res, data);
 				if(0x25 != data[0])
 					{ ret = -1; } /*RSA key is probably wrong*/
@@ -127,7 +127,7 @@ static int32_t cw_RSA(struct s_reader *reader, unsigned char *out, unsigned char
 	d = BN_new();
 	if(Input(d, in, n, LE))
 	{
-		if(BN_mod_exp(r, d, exp, mod, ctx))
+		if(reader_rsa_mod_exp(reader, r, d, exp, mod, ctx))
 			{ rc = Output(reader, out, n, r, LE); }
 		else
 			{ rdr_log(reader, "rsa: mod-exp failed"); }
@@ -747,122 +747,10 @@ static int32_t cryptoworks_card_info(struct s_reader *reader)
 	return OK;
 }
 
-static int32_t cryptoworks_reassemble_emm(struct s_reader *rdr, struct s_client *client, EMM_PACKET *ep)
-{
-	uchar *buffer = ep->emm;
-	int16_t *len = &ep->emmlen;
-	int16_t emm_len = 0;
-
-	// Cryptoworks
-	//   Cryptoworks EMM-S have to be assembled by the client from an EMM-SH with table
-	//   id 0x84 and a corresponding EMM-SB (body) with table id 0x86. A pseudo EMM-S
-	//   with table id 0x84 has to be build containing all nano commands from both the
-	//    original EMM-SH and EMM-SB in ascending order.
-	//
-	if(*len > 500) { return 0; }
-
-	if (!client->cw_rass && !cs_malloc(&client->cw_rass, sizeof(*client->cw_rass)))
-	{
-		cs_log("[cryptoworks] ERROR: Can't allocate EMM reassembly buffer.");
-		return 0;
-	}
-	struct emm_rass *r_emm = client->cw_rass;
-
-	switch(buffer[0])
-	{
-	case 0x82 : // emm-u
-		rdr_log_dbg(rdr, D_EMM, "unique emm (EMM-U)");
-		break;
-
-	case 0x84: // emm-sh
-		rdr_log_dbg(rdr, D_EMM, "shared emm (EMM-SH)");
-		if(!memcmp(r_emm->emm, buffer, *len))
-			{ return 0; }
-
-		if(ep->emm[11] == ep->emm[2] - 9)
-		{
-			rdr_log_dbg(rdr, D_EMM, "received assembled EMM-S");
-			return 1;
-		}
-
-		memcpy(r_emm->emm, buffer, *len);
-		r_emm->emmlen = *len;
-		rdr_log_dbg(rdr, D_EMM, "EMM-SH only in memcpy");
-		return 0;
-
-	case 0x86: // emm-sb
-		rdr_log_dbg(rdr, D_EMM, "shared emm (EMM-SB)");
-		if(!r_emm->emmlen)
-			{ return 0; }
-
-		// we keep the first 12 bytes of the 0x84 emm (EMM-SH)
-		// now we need to append the payload of the 0x86 emm (EMM-SB)
-		// starting after the header (&buffer[5])
-		// then the rest of the payload from EMM-SH
-		// so we should have :
-		// EMM-SH[0:12] + EMM-SB[5:len_EMM-SB] + EMM-SH[12:EMM-SH_len]
-		// then sort the nano in ascending order
-		// update the emm len (emmBuf[1:2])
-		//
-
-		emm_len = *len - 5 + r_emm->emmlen - 12;
-		unsigned char *tmp, *assembled;
-		if(!cs_malloc(&tmp, emm_len))
-			{ return 0; }
-		if(!cs_malloc(&assembled, emm_len + 12))
-		{
-			free(tmp);
-			return 0;
-		}
-		unsigned char *assembled_EMM;
-		if(!cs_malloc(&assembled_EMM, emm_len + 12))
-		{
-			free(assembled);
-			free(tmp);
-			return 0;
-		}
-		memcpy(tmp, &buffer[5], *len - 5);
-		memcpy(tmp + *len - 5, &r_emm->emm[12], r_emm->emmlen - 12);
-		memcpy(assembled_EMM, r_emm->emm, 12);
-		emm_sort_nanos(assembled_EMM + 12, tmp, emm_len);
-
-		assembled_EMM[1] = ((emm_len + 9) >> 8) | 0x70;
-		assembled_EMM[2] = (emm_len + 9) & 0xFF;
-
-		if(assembled_EMM[11] != emm_len)  // sanity check
-		{
-			// error in emm assembly
-			rdr_log_dbg(rdr, D_EMM, "Error assembling EMM-S");
-			free(assembled_EMM);
-			return 0;
-		}
-
-		//copy back the assembled emm in the working buffer
-		memcpy(buffer, assembled_EMM, emm_len + 12);
-		*len = emm_len + 12;
-
-		free(tmp);
-		free(assembled);
-
-		r_emm->emmlen = 0;
-
-		rdr_log_dump_dbg(rdr, D_EMM, buffer, *len, "shared emm (assembled):");
-		free(assembled_EMM);
-		break;
-
-	case 0x88: // emm-g
-	case 0x89: // emm-g
-		rdr_log_dbg(rdr, D_EMM, "global emm (EMM-G)");
-		break;
-	}
-	return 1;
-}
-
 const struct s_cardsystem reader_cryptoworks =
 {
 	.desc              = "cryptoworks",
 	.caids             = (uint16_t[]){ 0x0D, 0 },
-	.do_emm_reassembly = cryptoworks_reassemble_emm,
 	.do_emm            = cryptoworks_do_emm,
 	.do_ecm            = cryptoworks_do_ecm,
 	.card_info         = cryptoworks_card_info,
@@ -219,7 +219,7 @@ static int32_t NegotiateSessionKey_Tiger(struct s_reader *reader)
 	BN_bin2bn(reader->rsa_mod, 120, bnN);
 	BN_bin2bn(&exponent, 1, bnE);
 	BN_bin2bn(&cta_res[90], 120, bnCT);
-	BN_mod_exp(bnPT, bnCT, bnE, bnN, ctx);
+	reader_rsa_mod_exp(reader, bnPT, bnCT, bnE, bnN, ctx);
 	memset(parte_fija, 0, 120);
 	BN_bn2bin(bnPT, parte_fija + (120 - BN_num_bytes(bnPT)));
 	BN_CTX_end(ctx);
@@ -259,7 +259,7 @@ static int32_t NegotiateSessionKey_Tiger(struct s_reader *reader)
 	BN_bin2bn(d1_rsa_modulo, 88, bnN1);
 	BN_bin2bn(&exponent, 1, bnE1);
 	BN_bin2bn(cta_res + 2, 88, bnCT1);
-	BN_mod_exp(bnPT1, bnCT1, bnE1, bnN1, ctx1);
+	reader_rsa_mod_exp(reader, bnPT1, bnCT1, bnE1, bnN1, ctx1);
 	memset(parte_variable, 0, 88);
 	BN_bn2bin(bnPT1, parte_variable + (88 - BN_num_bytes(bnPT1)));
 	BN_CTX_end(ctx1);
@@ -297,7 +297,7 @@ static int32_t NegotiateSessionKey_Tiger(struct s_reader *reader)
 	BN_bin2bn(d1_rsa_modulo, 88, bnN3);
 	BN_bin2bn(&exponent, 1, bnE3);
 	BN_bin2bn(rnd, 88, bnCT3);
-	BN_mod_exp(bnPT3, bnCT3, bnE3, bnN3, ctx3);
+	reader_rsa_mod_exp(reader, bnPT3, bnCT3, bnE3, bnN3, ctx3);
 	memset(d2_data, 0, 88);
 	BN_bn2bin(bnPT3, d2_data + (88 - BN_num_bytes(bnPT3)));
 	BN_CTX_end(ctx3);
@@ -400,7 +400,7 @@ static int32_t NegotiateSessionKey(struct s_reader *reader)
 	BN_bin2bn(csystem_data->plainDT08RSA, 64, bnN);
 	BN_bin2bn(vFixed + 3, 1, bnE);
 	BN_bin2bn(cta_res + 2, 64, bnCT);
-	BN_mod_exp(bnPT, bnCT, bnE, bnN, ctx);
+	reader_rsa_mod_exp(reader, bnPT, bnCT, bnE, bnN, ctx);
 	memset(negot, 0, 64);
 	BN_bn2bin(bnPT, negot + (64 - BN_num_bytes(bnPT)));
 
@@ -425,7 +425,7 @@ static int32_t NegotiateSessionKey(struct s_reader *reader)
 
 	// prepare cmd$2b data
 	BN_bin2bn(negot, 64, bnCT);
-	BN_mod_exp(bnPT, bnCT, bnE, bnN, ctx);
+	reader_rsa_mod_exp(reader, bnPT, bnCT, bnE, bnN, ctx);
 	memset(cmd2b + 10, 0, 64);
 	BN_bn2bin(bnPT, cmd2b + 10 + (64 - BN_num_bytes(bnPT)));
 	BN_CTX_end(ctx);
@@ -500,7 +500,7 @@ static void decryptDT08(struct s_reader *reader, unsigned char *cta_res)
 	BN_bin2bn(reader->rsa_mod, 64, bn_mod);  // rsa modulus
 	BN_bin2bn(vFixed + 3, 1, bn_exp);  // exponent
 	BN_bin2bn(static_dt08 + 1, 64, bn_data);
-	BN_mod_exp(bn_res, bn_data, bn_exp, bn_mod, ctx);
+	reader_rsa_mod_exp(reader, bn_res, bn_data, bn_exp, bn_mod, ctx);
 	memset(static_dt08 + 1, 0, 64);
 	n = BN_bn2bin(bn_res, static_dt08 + 1);
 	BN_CTX_free(ctx);
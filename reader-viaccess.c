@@ -82,32 +82,6 @@ static void parse_via_date(const uchar *buf, struct via_date *vd, int32_t fend)
 //  *end_t = mktime(&tm);
 //
 //}
-struct emm_rass *find_rabuf(struct s_client *client, int32_t provid, uint8_t nano, int8_t add)
-{
-	struct emm_rass *e;
-	LL_ITER it;
-
-	if(!client->ra_buf)
-	{ 
-		client->ra_buf = ll_create("client->ra_buf");
-	}
-
-	it = ll_iter_create(client->ra_buf);
-
-	while((e = ll_iter_next(&it)) != NULL)
-	{
-		if(!add && e->provid == provid && e->emmlen != 0) { return e; }
-		if(add && e->provid == provid && e->emm[0] == nano) { return e; }
-	}
-	if(!add) return NULL;
-	
-	if(!cs_malloc(&e, sizeof(struct emm_rass)))
-		{ return NULL; }
-	e->provid = provid;
-	ll_append(client->ra_buf, e);
-	return e;
-}
-
 static void show_class(struct s_reader *reader, const char *p, uint32_t provid, const uchar *b, int32_t l)
 {
 	int32_t i, j;
@@ -2048,129 +2022,10 @@ static int32_t viaccess_card_info(struct s_reader *reader)
 	return OK;
 }
 
-static int32_t viaccess_reassemble_emm(struct s_reader *rdr, struct s_client *client, EMM_PACKET *ep)
-{
-	uint8_t *buffer = ep->emm;
-	int16_t *len = &ep->emmlen;
-	int32_t pos = 0, i;
-	int16_t k;
-	int32_t prov, provid = 0;
-	struct emm_rass *r_emm = NULL;
-	
-	// Viaccess
-	if(*len > 500) { return 0; } 
-
-	switch(buffer[0])
-	{
-		case 0x8c:
-		case 0x8d:
-			// emm-s part 1
-			provid = b2i(3, ep->emm+5); // extract provid from emm
-			provid &= 0xFFFFF0; // last digit is dont care
-			r_emm = find_rabuf(client, provid, (uint8_t) buffer[0], 1); 
-			if(!r_emm)
-			{
-				cs_log("[viaccess] ERROR: Can't allocate EMM reassembly buffer.");
-				return 0;
-			}
-			if(!memcmp(&r_emm->emm, &buffer[0], *len)) // skip same shared emm, this make sure emmlen isnt replaced. emmlen = 0 means this shared emm has been used for reassembly
-			{
-				return 0;
-			}
-			memset(&r_emm->emm[0], 0, sizeof(r_emm->emm)); // zero it!  
-			memcpy(&r_emm->emm[0], &buffer[0], *len); // put the fresh new shared emm
-			r_emm->emmlen = *len; // put the emmlen indicating that this shared emm isnt being reassembled
-			rdr_log_dump_dbg(rdr, D_EMM, r_emm->emm, r_emm->emmlen, "%s: received fresh emm-gh for provid %06X", __func__, provid);
-			return 0;
-		
-		case 0x8e:
-			// emm-s part 2
-			for(prov = 0; prov < rdr->nprov ; prov++)
-			{
-				if(!memcmp(&buffer[3], &rdr->sa[prov][0], 3))
-				{
-					//matching sa found!
-					if(is_network_reader(rdr))
-					{
-						provid = b2i(4, ep->provid); // use provid from emm since we have nothing better!
-						provid &= 0xFFFFF0; // last digit is dont care
-					}
-					else
-					{
-						provid = b2i(4, rdr->prid[prov]); // get corresponding provid from reader since there is no provid in emm payload!
-						provid &= 0xFFFFF0; // last digit is dont care
-					}
-					r_emm = find_rabuf(client, provid, 0, 0); // nano = dont care, the shared 8c or 8d not been written gets returned!
-					if(!r_emm || !r_emm->emmlen) 
-					{ 
-						continue; // match but no emm-gh found for this provider 
-					}
-					else
-					{
-						break; // stop searching-> emm-gh found!
-					}
-				}
-			}
-			if(!r_emm || !r_emm->emmlen) { return 0; } // stop -> no emm-gh found!
-			
-			//extract nanos from emm-gh and emm-s
-			uchar emmbuf[512];
-
-			rdr_log_dbg(rdr, D_EMM, "%s: start extracting nanos", __func__);
-			//extract from emm-gh
-			for(i = 3; i < r_emm->emmlen; i += r_emm->emm[i + 1] + 2)
-			{
-				//copy nano (length determined by i+1)
-				memcpy(emmbuf + pos, r_emm->emm + i, r_emm->emm[i + 1] + 2);
-				pos += r_emm->emm[i + 1] + 2;
-			}
-
-			if(buffer[2] == 0x2c)
-			{
-				//add 9E 20 nano + first 32 uint8_ts of emm content
-				memcpy(emmbuf + pos, "\x9E\x20", 2);
-				memcpy(emmbuf + pos + 2, buffer + 7, 32);
-				pos += 34;
-
-				//add F0 08 nano + 8 subsequent uint8_ts of emm content
-				memcpy(emmbuf + pos, "\xF0\x08", 2);
-				memcpy(emmbuf + pos + 2, buffer + 39, 8);
-				pos += 10;
-			}
-			else
-			{
-				//extract from variable emm-s
-				for(k = 7; k < (*len); k += buffer[k + 1] + 2)
-				{
-					//copy nano (length determined by k+1)
-					memcpy(emmbuf + pos, buffer + k, buffer[k + 1] + 2);
-					pos += buffer[k + 1] + 2;
-				}
-			}
-
-			rdr_log_dump_dbg(rdr, D_EMM, buffer, *len, "%s: %s emm-s", __func__, (buffer[2] == 0x2c) ? "fixed" : "variable");
-
-			emm_sort_nanos(buffer + 7, emmbuf, pos);
-			pos += 7;
-
-			//calculate emm length and set it on position 2
-			buffer[2] = pos - 3;
-
-			rdr_log_dump_dbg(rdr, D_EMM, r_emm->emm, r_emm->emmlen, "%s: emm-gh provid %06X", __func__, provid);
-			rdr_log_dump_dbg(rdr, D_EMM, buffer, pos, "%s: assembled emm", __func__);
-
-			*len = pos;
-			r_emm->emmlen = 0; // mark this shared 8c or 8d as being used for reassembly and send to reader!
-			break;
-	}
-	return 1;
-}
-
 const struct s_cardsystem reader_viaccess =
 {
 	.desc              = "viaccess",
 	.caids             = (uint16_t[]){ 0x05, 0 },
-	.do_emm_reassembly = viaccess_reassemble_emm,
 	.do_emm            = viaccess_do_emm,
 	.do_ecm            = viaccess_do_ecm,
 	.card_info         = viaccess_card_info,
@@ -1,14 +1,40 @@
 /*
  * OSCam self tests
  * This file contains tests for different config parsers and generators
+ * and known answer tests plus a benchmark for the bignum code in cscrypt
+ * and a check of the compiled service tables against the plain sidtab walk
+ * and a benchmark of the reader name resolver against a slow stub backend
+ * and a benchmark of the ECM ratelimiter with thousands of SIDs
+ * and a run of the local card path against the virtual card reader
+ * and the ghttp reader and its response parser against a pipelining stub server
+ * and a replay of a recorded EMM stream through the EMM reassembly
  * Build this file using `make tests`
  */
 #include "globals.h"
 
 #include "oscam-array.h"
+#include "oscam-chk.h"
+#include "oscam-config.h"
 #include "oscam-string.h"
 #include "oscam-conf-chk.h"
 #include "oscam-conf-mk.h"
+#include "oscam-ecm.h"
+#include "oscam-emm-reassembly.h"
+#include "oscam-lock.h"
+#include "oscam-net.h"
+#include "oscam-reader.h"
+#include "oscam-resolve.h"
+#include "oscam-time.h"
+#include "oscam-writer.h"
+#include "module-anticasc.h"
+#include "module-dvbapi.h"
+#include "module-dvbapi-chancache.h"
+#include "module-ghttp.h"
+#include "modules.h"
+#include "reader-common.h"
+#include "readers.h"
+#include "csctapi/cardreaders.h"
+#include "csctapi/icc_async.h"
 
 struct test_vec
 {
@@ -72,6 +98,1765 @@ static void run_parser_test(struct test_type *t)
 	t->clear_fn(t->data_c);
 }
 
+#if defined(READER_CONAX) || defined(READER_CRYPTOWORKS) || defined(READER_NAGRA)
+#include "cscrypt/bn.h"
+
+struct bn_test_vec
+{
+	const char *desc;
+	const char *m;   // Modulus
+	const char *a;   // Base
+	const char *e;   // Exponent
+	const char *r;   // Expected a^e mod m
+};
+
+// Known answers, computed with an independent implementation
+static const struct bn_test_vec bn_mod_exp_vec[] =
+{
+		{
+			.desc = "512 bit modulus",
+			.m = "A3BC4710C1F194DBB6258A843B5766388903A9C81CC919F6F344BAFB23813FA90B13A023AF11BAB1240F16A76490FD4A"
+			  "C393FD0E1CC62BE5783646BF0324AAC3",
+			.a = "1797D42FDFFF106140347639E0699E317F86AC7BC5729FCE14BB7CD907892120DD3B2DE7DE22F6CF670F849D97A983C1"
+			  "08087A442CBD9B945EFB51A50925BC1604",
+			.e = "3",
+			.r = "16FCE8A430A734F49FA44182EFA6DA3A381CFF5C77CD8C10703A151D29CDEC6C3151101937B5B8F24A2AE39F7A654515"
+			  "2E94FB5C8046611B45F056BEB4712ECD",
+		},
+		{
+			.desc = "512 bit modulus",
+			.m = "B5D856023F1EC635F482468898CB994F5D69BD8964562841548F285534B7AD5332D0BDB3576EB8E4672774F3E33E474A"
+			  "F096DBB7C52EF7610536BC6C1E3EF5DB",
+			.a = "CBD61F326A25CAC13E34300685227E5BE65B02514F2E0D4980D6B3EB4A0D3343B8F428817A0F5FA1A48C213116A9A843"
+			  "0F95BC11766A951CAD378876E6B956629F",
+			.e = "DE12A1E6BAD55E9C6EB1261FCBED9A21352E7D3037E660EACF125DE9A6B1CFA8704D5EDCDE4C8E2287FEE8ECBC2BF626"
+			  "160B7D4107C64F5C605C8AB7FD2DA724",
+			.r = "19AAF0DD6E41A781AB8FA0FDC4202CC7C4C9C521B5F78833591BAE4043A43B92B1030DB75648FCEDC54452F918B3B991"
+			  "4E81EC217898ED7D11CC5D7A273D9C40",
+		},
+		{
+			.desc = "704 bit modulus",
+			.m = "BFCFB041F9F75E1036916CE9F6194BFC50FE0E25D60F72B3A6981214A5924CE97B58D108656B23439267EE4455977CFD"
+			  "4B1A82E65604C11C436DF2EC0A9A12377B6A86B5381C6467D19E57E6A411108254A51982319DA7CB",
+			.a = "B25FEE655399F4AA30CB3C693FEBC7C729075CA9BA315AC1072C6FAC4C17F12D1B4B8A63D6ACAD0427D69B3B318BBAC7"
+			  "A5EF9B39D69FAE32AD8F54B2282D21DFA4E57C6F3C4E6A8985C5C154F7CA33737E18660554FE5669A6",
+			.e = "3",
+			.r = "51D2D8B795983CC901271932FF9279730553A9ABD8D8A1BED8769D01B9A4B648A4F1F290EE0850F26272F5EAADFC0DB2"
+			  "B31DBEC862DF3D3E14E4206DBEF63789F037E3ABCA57FB308FB8DA88ED111728E73D2F0A846C6E74",
+		},
+		{
+			.desc = "960 bit modulus",
+			.m = "9E8BB4B3A31AAEE0FBA59C96DF8416C1194F475644877AF11E37B157B6C8A03A8FCA3A120C6C679DC9F64B966726A534"
+			  "71D653FD557C8C29CCF0839A33DDA844746DC69E1D2EC63232679894E2873419FDDD0660D6D7CFE5A63A7D9B4E3A56A7"
+			  "E8FBDF2448E9A7866630276BAB692A5F187C343BF4FF7C4D",
+			.a = "9BB9A201FECC1BD851234F72397C44A78B1CAD5603DAC3DED209BF5AD4973721C1A2DFA0307D815C639CDB4E05FB40FC"
+			  "D35F55A287DC418E27472B1C088314A4F7C9D705C99C93E20F7F869A510ED64ED479C6975426E10835DAA59317FD7A0F"
+			  "C2B6A54C4D298FBAE755D088DF337BB24031B10334F5F550AD",
+			.e = "EC61BF630CCC05669D24F866DD7D1E009131D46E1FF6598621D436D10B8B206EFE3E49BD2D15C3157222BA4948533A7F"
+			  "952B0414600C77A018C64DA602DD1EF33CC8D5D159440BE47849CBCBFC2B18FFC8197FA8C3F7C36A7D608AC141378FBB"
+			  "064B08D9C47D94A8D445A261F920A6517F669B72B1633AEC",
+			.r = "4F66060D2822F4B327AA16F437C8D21FE3C586D8CB86D930804A160507953BE91905127D06FA471B4D8B6E2ABA715D00"
+			  "7BC7CF5D10BC980D8036B66D26F75C55B68CD5C2DCA2D86AEEC7AC76117E57D9464E28AA2D363F162B98EC2FBE80F9CB"
+			  "19863B9CACDEF6347B0193BF564090E82FF74455554B7059",
+		},
+		{
+			.desc = "1024 bit modulus",
+			.m = "D371DAE977868F9DD1BB9401B78DDCA94EF8740376278BA99D52257FB793B4EA31D3606486277BB33A18B59D66C210BA"
+			  "80E19391DC16BE9BB5A9CBF6863DF694836E35E9B1E73AE68EFB7134747123AF8DF33EAF2F0F2600B0769EA44C795799"
+			  "DDD34E35D21B2577F2589748317D1D9AC9F6CD1134DDA372E308FAB19D2BE271",
+			.a = "8A4E9526D4B609DDBAE3EC6D316CEE9BD7346F831E4EA45701E1E9D7C46175A1F53ED9C0BC240058353529619F6CC483"
+			  "56BB8DDA0F1E6A5FAAAB0632F4DA66CAAA0AC102422A8A41B9C5C990AF946A194A611AC26AB0AC39794AEEC4F8F15851"
+			  "7331093BDABEAE483F58CB9202C87A675685CB38A61F9C55625F1F7CBA2235FC3E",
+			.e = "10001",
+			.r = "66C1A9193730CFD9256BF19EC78CC7D96540176F651C8553081713160226A74E00EC1F257FE27114F67F095C05807E1A"
+			  "A00140C1496BB4DE7718551A00811A208082B179427DF877FE39032548E95531741A5AFB906A636E5D93E114B6DEEBE3"
+			  "65C7E830E908033C8AAE3DB1E5A6CEF2D2A308FB814734E0383EE3D93E09223F",
+		},
+		{
+			.desc = "1024 bit modulus",
+			.m = "B6E1E8063D7093D732CD3BC5B50F023B6257F1EE718EEBA9D150AB6E088BA72F66BA78A235E793B85D2778A9B3BD6F39"
+			  "D059F0216F53B97C33C09C658953033F4242F74D462A7891E53863BED3EF4B0E9D5DC3C778E6BCB708710D0B09AD2AED"
+			  "D3C4D695F072A1FBBC30311544FAA147C7614C7DEB58A78F3E24BA7D9658F20B",
+			.a = "D47949A6CECEE5B9414C11B68B276D26D97B83818C116A481808A38A666AF38B582E7B5CFCA882EB904700B663A6F0BD"
+			  "23EF77F09D73B1AA187FF620D5E3642F987AC2350BB18FD6229FFB1643E2834E893FC09D4AF8178BBD10E2E045374C10"
+			  "C2C56406521CC0B7905E45FC87F59A8DFAB2A787B84C0A0717587A0130526ECE75",
+			.e = "B53453E592F96D5BAB9BEB5318935CDFD990BB0351D9F213C4B0BA558A7A3644A1F6F08CD8B50E082477AA8A9AEE1162"
+			  "3D31AFC73BB2C67EF828FAEFC6F316E9E4CD31506748683D4EB6140194534D333EFCED9BE99E2C4DE3A92D064CEA9904"
+			  "48C4A1A9C1F2F49945C1605B6132A89346F8C570000D0413FB318B45016D8AA3",
+			.r = "843912FE4A65C4F0DC5CAEE870EDF6FA257ED58C758EC4259CD85CC922B65AA2A8C67DDFCA752ACED3C4963C21A96E55"
+			  "3C52302D7D50C8739610CD086EF4392AE7177117F875629143D42192BA160F8E3B5DDFBB888D2E18A5D973CE09081B3D"
+			  "E3C851408099627800460A339C4A2CF8139022EBDCD7A3F629664686C17AC364",
+		},
+		{
+			.desc = "1536 bit modulus",
+			.m = "BABD5C1B3F8FB01F53E944800FCA56678CA29C6ACBE86C9D1BA231A3FBB33BEA45DF761252DEBDCAE9980984AF1F4899"
+			  "694814DBF462C535D91B95FB0C5271223D486444B4B13F7FF58673593E07ECC692113053D2CFCCB90C5C37736923C548"
+			  "C46F91F438BC6B07E2F188838DE2AA4536A6C0F6AD5D37E265E3684C633C924CCA9C5F784F00D3A6427B369EDBBCE5E8"
+			  "F089882B84F2719F780EBA83AC62291F4E59DA4BF0EC1B3C7E10B2198ADD7CCAE8005BFC5F8A2CC0054704A930058FF9",
+			.a = "91EFB8C4950E90448F5BE440A9DBEA46B377184D9016FA9383FE3AA7362B33B37F3C32B0AC56C00EB6A65ADDE7BA2885"
+			  "D5FA6FDFDAD3BCFCFBADC88858E697972800DE0573AF86CE48AACA2FB17A61927FC2358CDE7AE476584591B20470A596"
+			  "8E792D1F7CCD8832077E5553EB05EDED07139FA870243119578BC8E1E670C040B5DC869E9689DAF8EC39B26A1C68AEEF"
+			  "00EF3C85870B78804ECC7E760D50084EA94F1D38810C338A16C416DF16240472ED6D775949FF8B0CE9C2A183A87DDF80"
+			  "EA",
+			.e = "DEDC84CFB58C539DDF07AD6E4E850B2E95E04E4BDEFF39A02324ECE00E4B83BE741E23E117467B0AC8E60E8741F06E8E"
+			  "8E5CC6A43D49B1F56D99B8095190C85AE8F639638439C71EBD105419F4AABF59E9146B17C96B9709BC3E005FF707CF9E"
+			  "D10C7C5422CCDEAF66C7280EC0754B2773729F17698191DABAF9EBD1E2044B8D09F179DC7238E9CAD6BECF9DDE9B950C"
+			  "AF25779C0ED9055DF1C7DC9B38123E836B01691A33C29789639EFC9B9E784B5B527F137DDEA05D8CE8E50DC86457605E",
+			.r = "5F396B18486B6A1D922741EAFD868A017FF4AC39903128397C135E1995309EA8D4FA32A65675432D8BC6AF2FCC23E2DB"
+			  "9CC8A97ED79E372B253E57FB796E886E561B1661C2A8F71CFFB49E872BE9E62B2FE419251E47F2BEB39A37E1485F5035"
+			  "EE1FA6FC53043064763993C83594F1DD3DDAF75C1087BB9BAE743EA79D6F908166D2CD8B923F1210016E4509FB509E76"
+			  "4782B9EDA991906CBB779A1C97017C7F50C1940C6F6A8C73A111A493DF90E7C347DEEBF5AD4957FB3E1911097B072A27",
+		},
+		{
+			.desc = "256 bit modulus, even",
+			.m = "D74C2C8C466037ED3A846A7C77E3B49D618E9BADA50A8AEE200AB3533237866A",
+			.a = "45C655D6D5855B30502E550DC65A2AA16BCC33BCEB493828F5A165BE57388D90",
+			.e = "70BBEC54990AA87C",
+			.r = "D26D0434CB01E97536C9EE2D49AC29A670691FE1A60BA3A7AF649A516AF9A23C",
+		},
+	{ .desc = NULL },
+};
+
+static int bn_test_mod_exp(BIGNUM *r, BIGNUM *a, BIGNUM *e, BIGNUM *m, BN_CTX *ctx, int variant)
+{
+	BN_MONT_CTX *mont;
+	int ret;
+
+	switch(variant)
+	{
+	case 0:
+		return BN_mod_exp(r, a, e, m, ctx);
+	case 1:
+		return BN_mod_exp_simple(r, a, e, m, ctx);
+	default:
+		if(!BN_is_odd(m))
+			{ return BN_mod_exp(r, a, e, m, ctx); }
+		if(!(mont = BN_MONT_CTX_new()))
+			{ return 0; }
+		ret = BN_MONT_CTX_set(mont, m, ctx) && BN_mod_exp_mont(r, a, e, m, ctx, mont);
+		BN_MONT_CTX_free(mont);
+		return ret;
+	}
+}
+
+static void run_bn_tests(void)
+{
+	static const char *variant_txt[] = { "BN_mod_exp", "BN_mod_exp_simple", "BN_mod_exp_mont" };
+	const struct bn_test_vec *vec;
+	BN_CTX *ctx = BN_CTX_new();
+	BIGNUM *m = NULL, *a = NULL, *e = NULL, *r = NULL, *res = BN_new();
+	int variant;
+
+	printf("Bignum modular exponentiation (RSA of conax, cryptoworks and nagra readers)\n");
+	for(vec = bn_mod_exp_vec; vec->desc; vec++)
+	{
+		BN_hex2bn(&m, vec->m);
+		BN_hex2bn(&a, vec->a);
+		BN_hex2bn(&e, vec->e);
+		BN_hex2bn(&r, vec->r);
+		for(variant = 0; variant < 3; variant++)
+		{
+			printf(" Testing %s, %s", vec->desc, variant_txt[variant]);
+			if(bn_test_mod_exp(res, a, e, m, ctx, variant) && BN_cmp(res, r) == 0)
+			{
+				printf(" [OK]\n");
+			} else {
+				printf("\n");
+				printf(" === ERROR ===\n");
+				printf("\n");
+			}
+		}
+		fflush(stdout);
+	}
+	BN_free(m);
+	BN_free(a);
+	BN_free(e);
+	BN_free(r);
+	BN_free(res);
+	BN_CTX_free(ctx);
+}
+
+// Compares the plain sliding window code with Montgomery using a per key context, like the readers do
+static void run_bn_benchmark(void)
+{
+	const struct bn_test_vec *vec;
+	struct timeb start, end;
+	BN_CTX *ctx = BN_CTX_new();
+	BN_MONT_CTX *mont;
+	BIGNUM *m = NULL, *a = NULL, *e = NULL, *res = BN_new();
+	int i, n = 50;
+
+	printf("Bignum modular exponentiation benchmark (%d runs)\n", n);
+	for(vec = bn_mod_exp_vec; vec->desc; vec++)
+	{
+		BN_hex2bn(&m, vec->m);
+		BN_hex2bn(&a, vec->a);
+		BN_hex2bn(&e, vec->e);
+		if(!BN_is_odd(m) || !(mont = BN_MONT_CTX_new()))
+			{ continue; }
+		BN_MONT_CTX_set(mont, m, ctx);
+
+		cs_ftimeus(&start);
+		for(i = 0; i < n; i++)
+			{ BN_mod_exp_simple(res, a, e, m, ctx); }
+		cs_ftimeus(&end);
+		printf(" %s, %d bit exponent: simple %" PRId64 " us", vec->desc, BN_num_bits(e), comp_timebus(&end, &start) / n);
+
+		cs_ftimeus(&start);
+		for(i = 0; i < n; i++)
+			{ BN_mod_exp_mont(res, a, e, m, ctx, mont); }
+		cs_ftimeus(&end);
+		printf(", montgomery %" PRId64 " us\n", comp_timebus(&end, &start) / n);
+
+		BN_MONT_CTX_free(mont);
+		fflush(stdout);
+	}
+	BN_free(m);
+	BN_free(a);
+	BN_free(e);
+	BN_free(res);
+	BN_CTX_free(ctx);
+}
+#endif
+
+extern uint32_t cfg_sidtab_generation;
+
+// The sidtab walk chk_srvid() did before the sidtabs were compiled
+static int32_t sidtab_walk(SIDTABS *sidtabs, ECM_REQUEST *er)
+{
+	int32_t nr, rc = 0;
+	SIDTAB *sidtab;
+
+	if(!sidtabs->ok)
+	{
+		if(!sidtabs->no) { return 1; }
+		rc = 1;
+	}
+	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
+		if(sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid)
+		{
+			if((sidtabs->no & ((SIDTABBITS)1 << nr)) && chk_srvid_match(er, sidtab))
+				{ return 0; }
+			if((sidtabs->ok & ((SIDTABBITS)1 << nr)) && chk_srvid_match(er, sidtab))
+				{ rc = 1; }
+		}
+	return rc;
+}
+
+static int32_t sidtab_walk_by_caid_prov(SIDTABS *sidtabs, uint16_t caid, uint32_t provid)
+{
+	int32_t nr, rc = 0;
+	SIDTAB *sidtab;
+
+	if(!sidtabs->ok)
+	{
+		if(!sidtabs->no) { return 1; }
+		rc = 1;
+	}
+	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
+		if(sidtab->num_caid | sidtab->num_provid)
+		{
+			if((sidtabs->no & ((SIDTABBITS)1 << nr)) && !sidtab->num_srvid && chk_srvid_match_by_caid_prov(caid, provid, sidtab))
+				{ return 0; }
+			if((sidtabs->ok & ((SIDTABBITS)1 << nr)) && chk_srvid_match_by_caid_prov(caid, provid, sidtab))
+				{ rc = 1; }
+		}
+	return rc;
+}
+
+static int32_t sidtab_walk_lb(SIDTABS *sidtabs, ECM_REQUEST *er)
+{
+	int32_t nr;
+	SIDTAB *sidtab;
+
+	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
+		if((sidtabs->ok & ((SIDTABBITS)1 << nr)) && chk_srvid_match(er, sidtab))
+			{ return 1; }
+	return 0;
+}
+
+static int32_t run_sidtab_compare(struct s_client *cl)
+{
+	static const uint16_t caids[] = { 0x0100, 0x0500, 0x0600 };
+	static const uint32_t prids[] = { 0, 0x043800, 0x000999 };
+	static const uint16_t srvids[] = { 0x10, 0x20, 0x30 };
+	ECM_REQUEST er;
+	int32_t c, p, v;
+
+	memset(&er, 0, sizeof(er));
+	for(c = 0; c < 3; c++)
+		for(p = 0; p < 3; p++)
+		{
+			if(chk_srvid_by_caid_prov(cl, caids[c], prids[p]) != sidtab_walk_by_caid_prov(&cl->sidtabs, caids[c], prids[p]))
+				{ return 0; }
+			for(v = 0; v < 3; v++)
+			{
+				er.caid = caids[c];
+				er.prid = prids[p];
+				er.srvid = srvids[v];
+				if(chk_srvid(cl, &er) != sidtab_walk(&cl->sidtabs, &er))
+					{ return 0; }
+				if(has_lb_srvid(cl, &er) != sidtab_walk_lb(&cl->lb_sidtabs, &er))
+					{ return 0; }
+			}
+		}
+	return 1;
+}
+
+static void run_sidtab_tests(void)
+{
+	static uint16_t caid_a[] = { 0x0500 }, caid_b[] = { 0x0100, 0x0500 };
+	static uint32_t provid_a[] = { 0x043800 };
+	static uint16_t srvid_a[] = { 0x10, 0x11 }, srvid_c[] = { 0x20 }, srvid_c2[] = { 0x20, 0x30 };
+	static const SIDTABBITS masks[][4] = // ok, no, lb ok
+	{
+		{ 1, 4, 0 },
+		{ 2 | 4, 0, 8 },
+		{ 0, 1, 1 | 8 },
+		{ 0, 2 | 8, 4 },
+		{ 8, 1 | 2, 2 },
+	};
+	SIDTAB sidtab[4];
+	SIDTAB *saved = cfg.sidtab;
+	struct s_client cl;
+	uint32_t i, ok;
+
+	memset(sidtab, 0, sizeof(sidtab));
+	cs_strncpy(sidtab[0].label, "a", sizeof(sidtab[0].label));
+	sidtab[0].num_caid = 1; sidtab[0].caid = caid_a;
+	sidtab[0].num_provid = 1; sidtab[0].provid = provid_a;
+	sidtab[0].num_srvid = 2; sidtab[0].srvid = srvid_a;
+	sidtab[1].num_caid = 2; sidtab[1].caid = caid_b;
+	sidtab[2].num_srvid = 1; sidtab[2].srvid = srvid_c;
+	sidtab[0].next = &sidtab[1];
+	sidtab[1].next = &sidtab[2];
+	sidtab[2].next = &sidtab[3];
+	cfg.sidtab = sidtab;
+	++cfg_sidtab_generation;
+
+	printf("Compiled service tables (chk_srvid)\n");
+	for(ok = 1, i = 0; i < sizeof(masks) / sizeof(masks[0]); i++)
+	{
+		memset(&cl, 0, sizeof(cl));
+		cl.sidtabs.ok = masks[i][0];
+		cl.sidtabs.no = masks[i][1];
+		cl.lb_sidtabs.ok = masks[i][2];
+		ok &= run_sidtab_compare(&cl);
+	}
+	printf(" Testing sidtab masks%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+
+	// an edited sidtab has to be picked up through the generation counter
+	sidtab[2].num_srvid = 2;
+	sidtab[2].srvid = srvid_c2;
+	++cfg_sidtab_generation;
+	for(ok = 1, i = 0; i < sizeof(masks) / sizeof(masks[0]); i++)
+	{
+		memset(&cl, 0, sizeof(cl));
+		cl.sidtabs.ok = masks[i][0];
+		cl.sidtabs.no = masks[i][1];
+		cl.lb_sidtabs.ok = masks[i][2];
+		ok &= run_sidtab_compare(&cl);
+	}
+	printf(" Testing sidtab reload%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+
+	cfg.sidtab = saved;
+	++cfg_sidtab_generation;
+}
+
+static int32_t run_name_index_compare(void)
+{
+	static const uint16_t caids[] = { 0x0100, 0x0500, 0x0600 };
+	static const uint32_t prids[] = { 0, 0x000001, 0x043800, 0x1000000 };
+	static const uint16_t ids[] = { 0x1010, 0x1020, 0x2030 };
+	struct s_name_index *srvid_index = cfg.srvid_index, *provid_index = cfg.provid_index, *tierid_index = cfg.tierid_index;
+	char a[83], b[83];
+	int32_t c, p, v, ok = 1;
+
+	for(c = 0; c < 3; c++)
+		for(p = 0; p < 4; p++)
+		{
+			for(v = 0; v < 3; v++)
+			{
+				cfg.srvid_index = NULL;
+				get_servicename_or_null(NULL, ids[v], prids[p], caids[c], a, sizeof(a));
+				cfg.srvid_index = srvid_index;
+				get_servicename_or_null(NULL, ids[v], prids[p], caids[c], b, sizeof(b));
+				ok &= !strcmp(a, b);
+			}
+			cfg.provid_index = NULL;
+			get_providername(prids[p], caids[c], a, sizeof(a));
+			cfg.provid_index = provid_index;
+			get_providername(prids[p], caids[c], b, sizeof(b));
+			ok &= !strcmp(a, b);
+			cfg.provid_index = NULL;
+			get_provider(prids[p], caids[c], a, sizeof(a));
+			cfg.provid_index = provid_index;
+			get_provider(prids[p], caids[c], b, sizeof(b));
+			ok &= !strcmp(a, b);
+			cfg.tierid_index = NULL;
+			get_tiername(ids[p % 3], caids[c], a);
+			cfg.tierid_index = tierid_index;
+			get_tiername(ids[p % 3], caids[c], b);
+			ok &= !strcmp(a, b);
+		}
+	return ok;
+}
+
+static void run_name_index_tests(void)
+{
+	static uint32_t prov_a[] = { 0x043800 }, prov_b[] = { 0, 0x000001 }, prov_c[] = { 0x043800, 0x000001 };
+	struct s_srvid_caid caid_a[] = { { 0x0500, 1, prov_a } }, caid_b[] = { { 0x0500, 2, prov_b }, { 0x0100, 0, NULL } };
+	struct s_srvid_caid caid_c[] = { { 0x0500, 2, prov_c } }, caid_d[] = { { 0x0100, 0, NULL }, { 0x0600, 1, prov_a } };
+	struct s_srvid srvid[5];
+	struct s_provid provid[4];
+	struct s_tierid tierid[3];
+	struct s_srvid *saved_srvid[16];
+	struct s_provid *saved_provid = cfg.provid;
+	struct s_tierid *saved_tierid = cfg.tierid;
+	struct s_name_index *saved_srvid_index = cfg.srvid_index, *saved_provid_index = cfg.provid_index, *saved_tierid_index = cfg.tierid_index;
+	int32_t ok;
+
+	// same service listed several times: first exact match wins, else the last provid 0 or any provid one
+	memset(srvid, 0, sizeof(srvid));
+	srvid[0].srvid = 0x1010; srvid[0].ncaid = 1; srvid[0].caid = caid_a; srvid[0].name = "a";
+	srvid[1].srvid = 0x1010; srvid[1].ncaid = 2; srvid[1].caid = caid_b; srvid[1].name = "b";
+	srvid[2].srvid = 0x1010; srvid[2].ncaid = 1; srvid[2].caid = caid_c; srvid[2].name = "c";
+	srvid[3].srvid = 0x1020; srvid[3].ncaid = 2; srvid[3].caid = caid_d; srvid[3].name = "d";
+	srvid[4].srvid = 0x1020; srvid[4].ncaid = 2; srvid[4].caid = caid_d; srvid[4].name = "e";
+	srvid[0].next = &srvid[1];
+	srvid[1].next = &srvid[2];
+	srvid[2].next = &srvid[3];
+	srvid[3].next = &srvid[4];
+
+	memset(provid, 0, sizeof(provid));
+	provid[0].caid = 0x0500; provid[0].nprovid = 1; provid[0].provid = prov_a; cs_strncpy(provid[0].prov, "pa", sizeof(provid[0].prov));
+	provid[1].caid = 0x0500; provid[1].nprovid = 2; provid[1].provid = prov_b; cs_strncpy(provid[1].prov, "pb", sizeof(provid[1].prov));
+	provid[2].caid = 0x0500; provid[2].nprovid = 2; provid[2].provid = prov_c; cs_strncpy(provid[2].prov, "pc", sizeof(provid[2].prov));
+	provid[3].caid = 0x0100; cs_strncpy(provid[3].prov, "pd", sizeof(provid[3].prov));
+	provid[0].next = &provid[1];
+	provid[1].next = &provid[2];
+	provid[2].next = &provid[3];
+
+	memset(tierid, 0, sizeof(tierid));
+	tierid[0].tierid = 0x1010; tierid[0].ncaid = 2; tierid[0].caid[0] = 0x0500; tierid[0].caid[1] = 0x0600; cs_strncpy(tierid[0].name, "ta", sizeof(tierid[0].name));
+	tierid[1].tierid = 0x1010; tierid[1].ncaid = 1; tierid[1].caid[0] = 0x0500; cs_strncpy(tierid[1].name, "tb", sizeof(tierid[1].name));
+	tierid[2].tierid = 0x1020; tierid[2].ncaid = 1; tierid[2].caid[0] = 0x0100; cs_strncpy(tierid[2].name, "tc", sizeof(tierid[2].name));
+	tierid[0].next = &tierid[1];
+	tierid[1].next = &tierid[2];
+
+	memcpy(saved_srvid, cfg.srvid, sizeof(saved_srvid));
+	memset(cfg.srvid, 0, sizeof(cfg.srvid));
+	cfg.srvid[1] = &srvid[0];
+	cfg.provid = provid;
+	cfg.tierid = tierid;
+	cfg.srvid_index = srvid_index_create(cfg.srvid);
+	cfg.provid_index = provid_index_create(cfg.provid);
+	cfg.tierid_index = tierid_index_create(cfg.tierid);
+
+	printf("Service, provider and tier name indexes\n");
+	ok = cfg.srvid_index && cfg.provid_index && cfg.tierid_index && run_name_index_compare();
+	printf(" Testing name lookups%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+
+	NULLFREE(cfg.srvid_index);
+	NULLFREE(cfg.provid_index);
+	NULLFREE(cfg.tierid_index);
+	memcpy(cfg.srvid, saved_srvid, sizeof(saved_srvid));
+	cfg.provid = saved_provid;
+	cfg.tierid = saved_tierid;
+	cfg.srvid_index = saved_srvid_index;
+	cfg.provid_index = saved_provid_index;
+	cfg.tierid_index = saved_tierid_index;
+}
+
+#define RESOLVE_BENCH_READERS  500
+#define RESOLVE_BENCH_HOSTS    20
+#define RESOLVE_BENCH_DELAY    2       // ms per stub lookup
+#define RESOLVE_SLOW_HOSTS     200     // distinct names at a cold start
+#define RESOLVE_SLOW_DELAY     30      // ms per lookup of a slow resolver
+
+static int32_t resolve_bench_hosts = RESOLVE_BENCH_HOSTS, resolve_bench_delay = RESOLVE_BENCH_DELAY;
+static int32_t resolve_bench_calls;
+static int8_t resolve_bench_cached;
+static pthread_mutex_t resolve_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t resolve_bench_serial = PTHREAD_MUTEX_INITIALIZER; // like gethostbyname_lock
+static int64_t resolve_bench_max_wait;
+static int32_t resolve_bench_errors;
+
+// Stub backend: "readerN" resolves to 10.0.0.N after a delay, everything else fails
+static void resolve_bench_backend(const char *hostname, IN_ADDR_T *ip, struct SOCKADDR *sa, socklen_t *sa_len)
+{
+	char txt[16];
+	int32_t n;
+
+	(void)sa;
+	(void)sa_len;
+	cs_sleepms(resolve_bench_delay);
+	SAFE_MUTEX_LOCK(&resolve_bench_lock);
+	resolve_bench_calls++;
+	SAFE_MUTEX_UNLOCK(&resolve_bench_lock);
+	if(sscanf(hostname, "reader%d", &n) != 1)
+		{ return; }
+	snprintf(txt, sizeof(txt), "10.0.0.%d", n);
+	cs_inet_addr(txt, ip);
+}
+
+static void *resolve_bench_reader(void *arg)
+{
+	char hostname[32], txt[16];
+	int32_t n = (intptr_t)arg % resolve_bench_hosts;
+	struct timeb start, end;
+	IN_ADDR_T ip, want;
+	int64_t wait;
+
+	snprintf(hostname, sizeof(hostname), "reader%d", n);
+	snprintf(txt, sizeof(txt), "10.0.0.%d", n);
+	cs_inet_addr(txt, &want);
+	set_null_ip(&ip);
+
+	cs_ftime(&start);
+	if(resolve_bench_cached)
+		{ cs_resolve_cached(hostname, &ip, NULL, NULL); }
+	else
+	{
+		// the old connect path, every lookup in the reader thread
+		SAFE_MUTEX_LOCK(&resolve_bench_serial);
+		resolve_bench_backend(hostname, &ip, NULL, NULL);
+		SAFE_MUTEX_UNLOCK(&resolve_bench_serial);
+	}
+	cs_ftime(&end);
+	wait = comp_timeb(&end, &start);
+
+	SAFE_MUTEX_LOCK(&resolve_bench_lock);
+	if(wait > resolve_bench_max_wait)
+		{ resolve_bench_max_wait = wait; }
+	if(!IP_EQUAL(ip, want))
+		{ resolve_bench_errors++; }
+	SAFE_MUTEX_UNLOCK(&resolve_bench_lock);
+	return NULL;
+}
+
+// All readers reconnecting at once, returns the wall time in ms
+static int64_t resolve_bench_run(int8_t cached, int32_t readers)
+{
+	pthread_t threads[RESOLVE_BENCH_READERS];
+	pthread_attr_t attr;
+	struct timeb start, end;
+	intptr_t i;
+
+	resolve_bench_cached = cached;
+	resolve_bench_max_wait = 0;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 128 * 1024);
+	cs_ftime(&start);
+	for(i = 0; i < readers; i++)
+	{
+		if(pthread_create(&threads[i], &attr, resolve_bench_reader, (void *)i))
+			{ threads[i] = 0; }
+	}
+	for(i = 0; i < readers; i++)
+	{
+		if(threads[i])
+			{ pthread_join(threads[i], NULL); }
+	}
+	cs_ftime(&end);
+	pthread_attr_destroy(&attr);
+	return comp_timeb(&end, &start);
+}
+
+static void run_resolve_benchmark(void)
+{
+	int64_t direct, direct_max, cold, cold_max, warm, warm_max, slow, slow_max;
+	int32_t cold_calls, slow_errors, calls, ok;
+	IN_ADDR_T ip;
+
+	printf("Reader name resolver, %d readers on %d hosts, %d ms per lookup\n", RESOLVE_BENCH_READERS, RESOLVE_BENCH_HOSTS, RESOLVE_BENCH_DELAY);
+	cs_resolve_set_backend(resolve_bench_backend);
+	cs_resolve_flush();
+
+	resolve_bench_errors = 0;
+	direct = resolve_bench_run(0, RESOLVE_BENCH_READERS);
+	direct_max = resolve_bench_max_wait;
+	resolve_bench_calls = 0;
+	cold = resolve_bench_run(1, RESOLVE_BENCH_READERS);
+	cold_max = resolve_bench_max_wait;
+	cold_calls = resolve_bench_calls;
+	warm = resolve_bench_run(1, RESOLVE_BENCH_READERS);
+	warm_max = resolve_bench_max_wait;
+	printf(" serialized lookups %"PRId64" ms (max wait %"PRId64" ms), cold cache %"PRId64" ms (max wait %"PRId64" ms, %d lookups), warm cache %"PRId64" ms (max wait %"PRId64" ms)\n",
+			direct, direct_max, cold, cold_max, cold_calls, warm, warm_max);
+
+	// a failing name is asked once, then answered from the negative cache
+	calls = resolve_bench_calls;
+	ok = !cs_resolve_cached("unknown.host", &ip, NULL, NULL) && !cs_resolve_cached("unknown.host", &ip, NULL, NULL);
+	ok = ok && !IP_ISSET(ip) && resolve_bench_calls == calls + 1;
+	ok = ok && !resolve_bench_errors && cold_calls == RESOLVE_BENCH_HOSTS;
+	printf(" Testing resolver cache%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+
+	// cold start with many names and a slow resolver, no first connect may go without an address
+	cs_resolve_flush();
+	resolve_bench_hosts = RESOLVE_SLOW_HOSTS;
+	resolve_bench_delay = RESOLVE_SLOW_DELAY;
+	resolve_bench_errors = 0;
+	slow = resolve_bench_run(1, RESOLVE_SLOW_HOSTS);
+	slow_max = resolve_bench_max_wait;
+	slow_errors = resolve_bench_errors;
+	resolve_bench_hosts = RESOLVE_BENCH_HOSTS;
+	resolve_bench_delay = RESOLVE_BENCH_DELAY;
+	printf(" %d new names at %d ms per lookup %"PRId64" ms (max wait %"PRId64" ms, %d without address)\n",
+			RESOLVE_SLOW_HOSTS, RESOLVE_SLOW_DELAY, slow, slow_max, slow_errors);
+	printf(" Testing resolver cold start%s\n", !slow_errors ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+
+	cs_resolve_flush();
+	cs_resolve_set_backend(NULL);
+}
+
+#define RATELIMIT_BENCH_SIDS   5000
+#define RATELIMIT_BENCH_RULES  2000
+#define RATELIMIT_BENCH_SLOTS  4
+#define RATELIMIT_BENCH_NORULE 0x4000  // first SID above the rules, these get the reader defaults
+
+// Drives distinct SIDs through one ratelimited reader: check first, assign if a slot is free
+static int32_t ratelimit_bench_run(struct s_reader *rdr, ECM_REQUEST *er, int32_t first, int32_t count)
+{
+	int32_t i, accepted = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		er->srvid = first + i;
+		if(ecm_ratelimit_check(rdr, er, 0) == OK && ecm_ratelimit_check(rdr, er, 1) == OK)
+			{ accepted++; }
+	}
+	return accepted;
+}
+
+// waits until the writer thread has written the file with the wanted content
+static int32_t writer_test_wait(const char *filename, const char *want)
+{
+	char buf[64];
+	int32_t i, n;
+	FILE *f;
+
+	for(i = 0; i < 50; i++)
+	{
+		cs_sleepms(50);
+		if(!(f = fopen(filename, "r")))
+			{ continue; }
+		n = fread(buf, 1, sizeof(buf) - 1, f);
+		fclose(f);
+		buf[n] = '\0';
+		if(!strcmp(buf, want))
+			{ return 1; }
+	}
+	return 0;
+}
+
+static void run_writer_rename_test(void)
+{
+	char dir[] = "/tmp/oscam-writer-XXXXXX", fname[64], moved[64];
+	int32_t ok;
+
+	if(!mkdtemp(dir))
+		{ return; }
+	snprintf(fname, sizeof(fname), "%s/emm.log", dir);
+	snprintf(moved, sizeof(moved), "%s/emm.log.0", dir);
+
+	// the webif moves the emm log away and writes a new one, later records must go to the new one
+	ok = writer_append(fname, "a\n", 2, 0) && writer_test_wait(fname, "a\n");
+	ok = ok && !rename(fname, moved);
+	ok = ok && writer_append(fname, "b\n", 2, 0) && writer_test_wait(fname, "b\n") && writer_test_wait(moved, "a\n");
+	ok = ok && !unlink(fname);
+	ok = ok && writer_append(fname, "c\n", 2, 0) && writer_test_wait(fname, "c\n");
+	printf(" Testing writer reopens moved files%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+
+	unlink(fname);
+	unlink(moved);
+	rmdir(dir);
+}
+
+static void run_ratelimit_benchmark(void)
+{
+	struct s_rlimit *rules, *saved_list = cfg.ratelimit_list;
+	struct s_name_index *saved_index = cfg.ratelimit_index, *idx;
+	struct s_reader *rdr;
+	struct s_client *cl;
+	struct s_auth *account;
+	ECM_REQUEST er;
+	uchar ecm[1] = { 0x80 };
+	struct ecmrl a, b;
+	struct timeb start, end;
+	int64_t walk, indexed, slots;
+	int32_t i, accepted, ok = 1;
+
+	if(!cs_malloc(&rules, RATELIMIT_BENCH_RULES * sizeof(struct s_rlimit)) || !cs_malloc(&rdr, sizeof(struct s_reader))
+			|| !cs_malloc(&cl, sizeof(struct s_client)) || !cs_malloc(&account, sizeof(struct s_auth)))
+	{
+		NULLFREE(rules);
+		NULLFREE(rdr);
+		NULLFREE(cl);
+		return;
+	}
+	// one rule per second SID, every tenth one only for chid 0x0010 followed by a catch-all for the other chids
+	for(i = 0; i < RATELIMIT_BENCH_RULES; i++)
+	{
+		rules[i].rl.caid = 0x0500;
+		rules[i].rl.srvid = 0x1000 + (i % 10 == 1 ? (i - 1) : i) * 2;
+		rules[i].rl.chid = i % 10 == 0 ? 0x0010 : 0;
+		rules[i].rl.ratelimitecm = RATELIMIT_BENCH_SLOTS;
+		rules[i].rl.ratelimittime = 10000 + i;
+		rules[i].next = i + 1 < RATELIMIT_BENCH_RULES ? &rules[i + 1] : NULL;
+	}
+	cfg.ratelimit_list = rules;
+	cfg.ratelimit_index = ratelimit_index_create(rules);
+
+	printf("ECM ratelimiter, %d SIDs through one reader with %d slots, %d rules\n", RATELIMIT_BENCH_SIDS, RATELIMIT_BENCH_SLOTS, RATELIMIT_BENCH_RULES);
+	memset(&er, 0, sizeof(er));
+	cs_strncpy(account->usr, "bench", sizeof(account->usr));
+	cl->account = account;
+	er.client = cl;
+	er.caid = 0x0500;
+	er.ecm = ecm;
+	ok = (idx = cfg.ratelimit_index) != NULL;
+	for(i = 0; ok && i < RATELIMIT_BENCH_SIDS; i++)
+	{
+		er.srvid = 0x1000 + i;
+		er.chid = i % 3 ? 0x0010 : 0x0020;
+		cfg.ratelimit_index = NULL;
+		a = get_ratelimit(&er);
+		cfg.ratelimit_index = idx;
+		b = get_ratelimit(&er);
+		ok &= !memcmp(&a, &b, sizeof(a));
+	}
+
+	cfg.ratelimit_index = NULL;
+	cs_ftimeus(&start);
+	for(i = 0; i < RATELIMIT_BENCH_SIDS; i++)
+	{
+		er.srvid = 0x1000 + i;
+		a = get_ratelimit(&er);
+	}
+	cs_ftimeus(&end);
+	walk = comp_timebus(&end, &start);
+	cfg.ratelimit_index = idx;
+	cs_ftimeus(&start);
+	for(i = 0; i < RATELIMIT_BENCH_SIDS; i++)
+	{
+		er.srvid = 0x1000 + i;
+		b = get_ratelimit(&er);
+	}
+	cs_ftimeus(&end);
+	indexed = comp_timebus(&end, &start);
+
+	// the first SIDs take the slots, everything else is rejected until they are released
+	memset(rdr, 0, sizeof(struct s_reader));
+	cs_strncpy(rdr->label, "bench", sizeof(rdr->label));
+	rdr->ratelimitecm = RATELIMIT_BENCH_SLOTS;
+	rdr->ratelimittime = 20;
+	for(i = 0; i < MAXECMRATELIMIT; i++)
+	{
+		rdr->rlecmh[i].srvid = -1;
+		rdr->rlecmh[i].last.time = -1;
+	}
+	er.chid = 0;
+	cs_ftimeus(&start);
+	accepted = ratelimit_bench_run(rdr, &er, RATELIMIT_BENCH_NORULE, RATELIMIT_BENCH_SIDS);
+	cs_ftimeus(&end);
+	slots = comp_timebus(&end, &start);
+	ok &= accepted == RATELIMIT_BENCH_SLOTS && rdr->rlecm_used == (1U << RATELIMIT_BENCH_SLOTS) - 1;
+	ok &= ratelimit_bench_run(rdr, &er, RATELIMIT_BENCH_NORULE, 1) == 1; // a SID in a slot stays accepted
+	cs_sleepms(30); // reader default slots are released after 20 ms
+	ok &= ratelimit_bench_run(rdr, &er, RATELIMIT_BENCH_NORULE + RATELIMIT_BENCH_SIDS, RATELIMIT_BENCH_SLOTS + 1) == RATELIMIT_BENCH_SLOTS;
+
+	printf(" rule lookup: list walk %"PRId64" ns, index %"PRId64" ns per ECM; slot check %"PRId64" ns per ECM\n",
+			walk * 1000 / RATELIMIT_BENCH_SIDS, indexed * 1000 / RATELIMIT_BENCH_SIDS, slots * 1000 / RATELIMIT_BENCH_SIDS);
+	printf(" Testing ratelimiter%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+
+	NULLFREE(cfg.ratelimit_index);
+	cfg.ratelimit_list = saved_list;
+	cfg.ratelimit_index = saved_index;
+	NULLFREE(rules);
+	NULLFREE(rdr);
+	NULLFREE(cl);
+	NULLFREE(account);
+}
+
+#ifdef CS_ANTICASC
+#define ACASC_REPLAY_ECMS       20000
+#define ACASC_REPLAY_INTERVALS  2000
+#define ACASC_REPLAY_START      1500000000
+#define ACASC_REPLAY_CLOCK_STEP 1500                // ECMs between two steps of the clock back
+
+static const struct
+{
+	uint16_t caid;
+	uint32_t provid;
+	uint16_t chid;
+	uint16_t sid;
+} acasc_replay_services[] =
+{
+	{ 0x0500, 0x020910, 0x0000, 0x0101 }, { 0x0500, 0x020910, 0x0000, 0x0102 }, { 0x0500, 0x043800, 0x0000, 0x0201 },
+	{ 0x0500, 0x043800, 0x0001, 0x0201 }, { 0x0500, 0x032830, 0x0000, 0x0301 }, { 0x0100, 0x00003D, 0x0000, 0x1001 },
+	{ 0x0100, 0x00003D, 0x0000, 0x1002 }, { 0x0100, 0x000065, 0x0000, 0x1101 }, { 0x0100, 0x000068, 0x0000, 0x1201 },
+	{ 0x09C4, 0x000000, 0x0000, 0x0022 }, { 0x09C4, 0x000000, 0x0000, 0x0030 }, { 0x09C4, 0x000000, 0x0003, 0x0030 },
+	{ 0x1830, 0x000000, 0x0000, 0x0011 }, { 0x1830, 0x000000, 0x0000, 0x0012 }, { 0x4A70, 0x000000, 0x0000, 0x0501 },
+	{ 0x183D, 0x000000, 0x0000, 0x0601 }, { 0x0604, 0x000000, 0x0000, 0x0701 }, { 0x0B00, 0x000000, 0x0000, 0x0801 },
+	{ 0x0B00, 0x000000, 0x0000, 0x0802 }, { 0x0D05, 0x000004, 0x0000, 0x0901 }, { 0x1702, 0x000000, 0x0000, 0x0203 },
+	{ 0x1702, 0x000000, 0x0000, 0x0204 }, { 0x0500, 0x024400, 0x0000, 0x0A01 }, { 0x0500, 0x024400, 0x0000, 0x0A02 },
+};
+
+// The zap list and stat handling as they were before they became incremental
+struct acasc_replay_ref
+{
+	struct s_zap_list   zap[ZAPLIST_SIZE];
+	int8_t              zap_count;
+	time_t              zap_count_start;
+	struct s_acasc      ac_stat;
+	int8_t              ac_deny;
+};
+
+static uint32_t acasc_replay_seed = 12345;
+
+static uint32_t acasc_replay_rand(uint32_t range)
+{
+	acasc_replay_seed = acasc_replay_seed * 1103515245 + 12345;
+	return (acasc_replay_seed >> 16) % range;
+}
+
+static void acasc_replay_ref_zap(struct acasc_replay_ref *ref, ECM_REQUEST *er, time_t zaptime)
+{
+	int8_t k, weight = get_caid_weight(er), found = 0;
+
+	for(k = 0; k < ZAPLIST_SIZE; k++)
+	{
+		if(er->caid == ref->zap[k].caid && er->prid == ref->zap[k].provid && er->chid == ref->zap[k].chid && er->srvid == ref->zap[k].sid
+				&& zaptime - weight * 2 < ref->zap[k].lasttime)
+		{
+			ref->zap[k].lasttime = zaptime;
+			if(ref->zap[k].request_stage < 10)
+				{ ref->zap[k].request_stage++; }
+			found = 1;
+			break;
+		}
+	}
+	if(found)
+		{ return; }
+	for(k = 0; k < ZAPLIST_SIZE; k++)
+	{
+		if(zaptime - 30 > ref->zap[k].lasttime)
+		{
+			ref->zap[k].caid = er->caid;
+			ref->zap[k].provid = er->prid;
+			ref->zap[k].chid = er->chid;
+			ref->zap[k].sid = er->srvid;
+			ref->zap[k].request_stage = 1;
+			ref->zap[k].lasttime = zaptime;
+			break;
+		}
+	}
+	if(ref->zap_count_start + 60 > zaptime)
+		{ ref->zap_count++; }
+	else
+	{
+		ref->zap_count_start = zaptime;
+		ref->zap_count = 0;
+		for(k = 0; k < ZAPLIST_SIZE; k++)
+			{ ref->zap_count += ref->zap[k].lasttime > zaptime - 60; }
+	}
+}
+
+static int8_t acasc_replay_ref_active(struct acasc_replay_ref *ref, time_t zaptime)
+{
+	int8_t k, count = 0;
+
+	for(k = 0; k < ZAPLIST_SIZE; k++)
+		{ count += zaptime - 30 < ref->zap[k].lasttime && ref->zap[k].request_stage == 10; }
+	return count;
+}
+
+static void acasc_replay_ref_stat(struct acasc_replay_ref *ref, uint16_t count, uint16_t limit)
+{
+	int32_t j, exceeds, idx = ref->ac_stat.idx, prev_deny = 0;
+
+	ref->ac_stat.stat[idx] = count;
+	if(count)
+	{
+		for(j = exceeds = 0; j < cfg.ac_samples; j++)
+			{ exceeds += ref->ac_stat.stat[j] > limit; }
+		prev_deny = ref->ac_deny;
+		ref->ac_deny = exceeds >= cfg.ac_denysamples;
+		if(ref->ac_deny)
+			{ ref->ac_stat.stat[idx] = 0; }
+	}
+	else if(ref->ac_deny)
+	{
+		prev_deny = 1;
+		ref->ac_deny = 0;
+	}
+	if(!ref->ac_deny && !prev_deny)
+		{ ref->ac_stat.idx = (ref->ac_stat.idx + 1) % cfg.ac_samples; }
+}
+
+/* Replays a synthetic zapping trace and a run of stat intervals through the
+   anticascading code and through the reference above, the decisions have to
+   be the same after every step. */
+static void run_anticasc_replay(void)
+{
+	struct s_client *cl, *saved_first = first_client;
+	struct s_auth *account;
+	struct acasc_replay_ref *ref;
+	ECM_REQUEST er;
+	time_t now = ACASC_REPLAY_START;
+	int32_t saved_samples = cfg.ac_samples, saved_denysamples = cfg.ac_denysamples;
+	int32_t i, k, burst, watching = 0, penalties = 0, clock_steps = 0, denies = 0, ok = 1;
+	int8_t active;
+	uint16_t count;
+
+	if(!cs_malloc(&cl, sizeof(struct s_client)) || !cs_malloc(&account, sizeof(struct s_auth)) || !cs_malloc(&ref, sizeof(struct acasc_replay_ref)))
+	{
+		NULLFREE(cl);
+		NULLFREE(account);
+		return;
+	}
+	cl->typ = 'c';
+	cl->account = account;
+	memset(&er, 0, sizeof(er));
+
+	// mostly following one channel, zapping now and then, sometimes in bursts or after a break,
+	// now and then the clock is set back like on a receiver getting its time from the stream
+	for(i = 0; ok && i < ACASC_REPLAY_ECMS; i++)
+	{
+		burst = i % 2000 < 300;
+		if(acasc_replay_rand(100) < (burst ? 60 : 8))
+			{ watching = acasc_replay_rand(sizeof(acasc_replay_services) / sizeof(acasc_replay_services[0])); }
+		if(i % ACASC_REPLAY_CLOCK_STEP == ACASC_REPLAY_CLOCK_STEP - 1)
+		{
+			now -= 5 + acasc_replay_rand(120);
+			clock_steps++;
+		}
+		else if(burst)
+			{ now += acasc_replay_rand(3); }
+		else
+			{ now += acasc_replay_rand(100) < 3 ? 20 + acasc_replay_rand(70) : acasc_replay_rand(9); }
+		er.caid = acasc_replay_services[watching].caid;
+		er.prid = acasc_replay_services[watching].provid;
+		er.chid = acasc_replay_services[watching].chid;
+		er.srvid = acasc_replay_services[watching].sid;
+
+		zaplist_insert(cl, &er, now);
+		acasc_replay_ref_zap(ref, &er, now);
+		active = zaplist_active_sids(cl, now);
+		ok &= active == acasc_replay_ref_active(ref, now) && account->acosc_user_zap_count == ref->zap_count;
+		for(k = 0; k < ZAPLIST_SIZE; k++)
+		{
+			struct s_zap_list *a = &cl->client_zaplist.entry[k], *b = &ref->zap[k];
+			ok &= a->caid == b->caid && a->provid == b->provid && a->chid == b->chid && a->sid == b->sid
+					&& a->request_stage == b->request_stage && a->lasttime == b->lasttime;
+		}
+		if(active > 2 || account->acosc_user_zap_count > 5) // a penalty resets the zap count
+		{
+			account->acosc_user_zap_count = ref->zap_count = 0;
+			penalties++;
+		}
+	}
+
+	// alternating busy and quiet periods with idle intervals, half way the sample window shrinks
+	first_client = cl;
+	cl->ac_limit = 540;
+	cfg.ac_samples = 10;
+	cfg.ac_denysamples = 8;
+	for(i = 0; ok && i < ACASC_REPLAY_INTERVALS; i++)
+	{
+		if(i == ACASC_REPLAY_INTERVALS / 2)
+		{
+			cfg.ac_samples = 6;
+			cfg.ac_denysamples = 4;
+			ref->ac_stat.idx = account->ac_stat.idx %= cfg.ac_samples;
+		}
+		count = acasc_replay_rand(100) < 10 ? 0 : (i / 40 % 2 ? 400 + acasc_replay_rand(600) : acasc_replay_rand(600));
+		cl->acasc.ac_count = count;
+		ac_do_stat();
+		acasc_replay_ref_stat(ref, count, cl->ac_limit);
+		ok &= cl->acasc.ac_deny == ref->ac_deny && account->ac_stat.idx == ref->ac_stat.idx
+				&& !memcmp(account->ac_stat.stat, ref->ac_stat.stat, sizeof(ref->ac_stat.stat));
+		denies += cl->acasc.ac_deny;
+	}
+
+	printf("Anticascading replay, %d ECMs on %d services with %d clock steps back, %d stat intervals\n", ACASC_REPLAY_ECMS,
+			(int32_t)(sizeof(acasc_replay_services) / sizeof(acasc_replay_services[0])), clock_steps, ACASC_REPLAY_INTERVALS);
+	printf(" %d ACoSC penalties, %d intervals denied\n", penalties, denies);
+	printf(" Testing anticascading replay%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+
+	first_client = saved_first;
+	cfg.ac_samples = saved_samples;
+	cfg.ac_denysamples = saved_denysamples;
+	NULLFREE(cl);
+	NULLFREE(account);
+	NULLFREE(ref);
+}
+#endif
+
+#ifdef HAVE_DVBAPI
+#define CHANCACHE_TEST_OPS      20000
+#define CHANCACHE_TEST_SRVIDS   2000
+
+extern DEMUXTYPE *demux;
+extern char cs_confdir[];
+
+struct chancache_test_entry
+{
+	uint16_t caid;
+	uint32_t prid;
+	uint16_t srvid;
+	uint16_t pid;
+	uint32_t chid;
+	int8_t   removed;
+};
+
+static uint32_t chancache_test_seed = 4711;
+
+static uint32_t chancache_test_rand(uint32_t range)
+{
+	chancache_test_seed = chancache_test_seed * 1103515245 + 12345;
+	return (chancache_test_seed >> 16) % range;
+}
+
+static int32_t chancache_test_match(struct chancache_test_entry *e, struct s_ecmpids *p)
+{
+	return !e->removed && e->srvid == demux[0].program_number && e->caid == p->CAID && e->pid == p->ECM_PID && (e->prid == p->PROVID || p->PROVID == 0);
+}
+
+// The list walk the channel cache did before it was indexed
+static int32_t chancache_test_edit(struct chancache_test_entry *model, int32_t *count, struct s_ecmpids *p, int8_t add)
+{
+	int32_t i, removed = 0;
+
+	for(i = 0; i < *count; i++)
+	{
+		if(!chancache_test_match(&model[i], p))
+			{ continue; }
+		if(add && model[i].chid == p->CHID)
+			{ return 0; }
+		model[i].removed = 1;
+		removed++;
+	}
+	if(!add)
+		{ return removed; }
+	model[*count].caid = p->CAID;
+	model[*count].prid = p->PROVID;
+	model[*count].srvid = demux[0].program_number;
+	model[*count].pid = p->ECM_PID;
+	model[*count].chid = p->CHID;
+	model[*count].removed = 0;
+	(*count)++;
+	return removed + 1;
+}
+
+static int32_t chancache_test_lookups(struct chancache_test_entry *model, int32_t count, struct s_ecmpids *p)
+{
+	struct s_channel_cache *c;
+	int32_t i, exact = -1, caid_prid = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		if(exact < 0 && chancache_test_match(&model[i], p))
+			{ exact = i; }
+		if(!model[i].removed && model[i].caid == p->CAID && (model[i].prid == p->PROVID || p->PROVID == 0))
+			{ caid_prid = 1; }
+	}
+	c = dvbapi_find_channel_cache(0, 0, 0);
+	if(exact < 0 ? c != NULL : (!c || c->chid != model[exact].chid || c->prid != model[exact].prid))
+		{ return 0; }
+	return !dvbapi_find_channel_cache(0, 0, 1) == !caid_prid;
+}
+
+static void chancache_test_pick(struct s_ecmpids *p)
+{
+	static const uint16_t caids[] = { 0x0500, 0x0100, 0x1830, 0x09C4 };
+	static const uint32_t prids[] = { 0x000000, 0x032830, 0x00006A, 0x024400 };
+
+	demux[0].program_number = 1 + chancache_test_rand(CHANCACHE_TEST_SRVIDS);
+	p->CAID = caids[chancache_test_rand(4)];
+	p->PROVID = prids[chancache_test_rand(4)];
+	p->ECM_PID = 0x1000 + chancache_test_rand(4);
+	p->CHID = chancache_test_rand(3);
+}
+
+/* Replays random channel cache edits and lookups against the list walk, then
+   saves the cache and checks the snapshot and that loading it keeps the answers. */
+static void run_chancache_test(void)
+{
+	struct chancache_test_entry *model;
+	struct s_ecmpids *p;
+	struct { uint32_t magic; uint16_t version; uint16_t record_size; uint32_t count; uint32_t reserved; } *header;
+	uint16_t *rec;
+	char saved_confdir[128], dir[] = "/tmp/oscam-chancache-XXXXXX", fname[256];
+	struct timeb start, end;
+	int32_t i, count = 0, live = 0, ok = 1;
+	int64_t lookup_time = 0;
+	uchar *snapshot = NULL;
+	FILE *f;
+	long size = 0;
+
+	if(!dvbapi_alloc_demux() || !cs_malloc(&model, CHANCACHE_TEST_OPS * sizeof(struct chancache_test_entry)))
+		{ return; }
+	p = &demux[0].ECMpids[0];
+	printf("dvbapi channel cache, %d edits on %d services\n", CHANCACHE_TEST_OPS, CHANCACHE_TEST_SRVIDS);
+	for(i = 0; ok && i < CHANCACHE_TEST_OPS; i++)
+	{
+		int8_t add = chancache_test_rand(100) < 80;
+		chancache_test_pick(p);
+		ok &= dvbapi_edit_channel_cache(0, 0, add) == chancache_test_edit(model, &count, p, add);
+
+		chancache_test_pick(p);
+		cs_ftimeus(&start);
+		dvbapi_find_channel_cache(0, 0, 0);
+		cs_ftimeus(&end);
+		lookup_time += comp_timebus(&end, &start);
+		ok &= chancache_test_lookups(model, count, p);
+	}
+	for(i = 0; i < count; i++)
+		{ live += !model[i].removed; }
+
+	cs_strncpy(saved_confdir, cs_confdir, sizeof(saved_confdir));
+	if(ok && mkdtemp(dir))
+	{
+		snprintf(cs_confdir, sizeof(saved_confdir), "%s/", dir);
+		dvbapi_save_channel_cache();
+		get_config_filename(fname, sizeof(fname), "oscam.ccache.bin");
+		if((f = fopen(fname, "r")))
+		{
+			fseek(f, 0, SEEK_END);
+			size = ftell(f);
+			rewind(f);
+			if(size > 0 && cs_malloc(&snapshot, size) && fread(snapshot, size, 1, f) != 1)
+				{ NULLFREE(snapshot); }
+			fclose(f);
+		}
+		header = (void *)snapshot;
+		ok &= header && header->count == (uint32_t)live && size == (long)(sizeof(*header) + live * header->record_size);
+		// records are caid, srvid, pid, reserved (16 bit), prid, chid (32 bit) in cache order
+		for(i = 0, rec = ok ? (uint16_t *)(header + 1) : NULL; ok && i < count; i++)
+		{
+			if(model[i].removed)
+				{ continue; }
+			ok &= rec[0] == model[i].caid && rec[1] == model[i].srvid && rec[2] == model[i].pid
+					&& ((uint32_t *)rec)[2] == model[i].prid && ((uint32_t *)rec)[3] == model[i].chid;
+			rec += header->record_size / sizeof(uint16_t);
+		}
+		// loading appends behind the live entries, so every lookup has to give the same answer
+		dvbapi_load_channel_cache();
+		for(i = 0; ok && i < 2000; i++)
+		{
+			chancache_test_pick(p);
+			ok &= chancache_test_lookups(model, count, p);
+		}
+		unlink(fname);
+		rmdir(dir);
+		cs_strncpy(cs_confdir, saved_confdir, sizeof(saved_confdir));
+	}
+	else
+		{ ok = 0; }
+
+	printf(" %d entries, exact lookup %"PRId64" ns\n", live, lookup_time * 1000 / CHANCACHE_TEST_OPS);
+	printf(" Testing channel cache%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+	NULLFREE(snapshot);
+	NULLFREE(model);
+}
+#endif
+
+#if defined(CARDREADER_VIRTUAL) && defined(READER_CONAX)
+#define VIRTUAL_TEST_ECMS 200
+
+static struct s_reader *virtual_test_open(const char *script, char *fname, ATR *atr)
+{
+	struct s_reader *rdr;
+	int fd;
+	FILE *f;
+
+	if((fd = mkstemp(fname)) < 0)
+		{ return NULL; }
+	if(!(f = fdopen(fd, "w")))
+	{
+		close(fd);
+		return NULL;
+	}
+	fputs(script, f);
+	fclose(f);
+	if(!cs_malloc(&rdr, sizeof(struct s_reader)))
+		{ return NULL; }
+	cs_strncpy(rdr->device, fname, sizeof(rdr->device));
+	rdr->crdr = &cardreader_virtual;
+	rdr->typ = cardreader_virtual.typ;
+	rdr->mhz = rdr->cardmhz = 357;
+	if(ICC_Async_Device_Init(rdr) || ICC_Async_Activate(rdr, atr, 0))
+		{ NULLFREE(rdr); }
+	return rdr;
+}
+
+// Closes and frees the reader, *rdr is NULL afterwards
+static void virtual_test_close(struct s_reader **rdr, char *fname)
+{
+	if(*rdr)
+		{ ICC_Async_Close(*rdr); }
+	NULLFREE(*rdr);
+	unlink(fname);
+}
+
+/* Runs a scripted conax card (T0) through card init and ECMs and a T1 card
+   through chained blocks on a paced line. */
+static void run_virtual_card_test(void)
+{
+	static const char conax_script[] =
+		"atr = 3B 24 00 30 42 30 30\n"
+		"baudrate = 0\n"
+		"apdu = DD 26 : 98 07\n"
+		"apdu = DD CA 00 00 07 : 20 01 40 28 02 0B 00 90 00\n"
+		"apdu = DD 82 : 98 0B\n"
+		"apdu = DD CA 00 00 0B : 74 00 23 07 00 00 11 22 33 44 55 90 00\n"
+		"apdu = DD A2 : 98 1E\n"
+		"apdu = DD CA 00 00 1E : 25 0D 00 00 00 00 00 10 11 12 13 14 15 16 17"
+		" 25 0D 00 00 01 00 00 20 21 22 23 24 25 26 27 90 00\n";
+	char script[1024], fname[] = "/tmp/oscam-virtual-XXXXXX";
+	uchar ecm[32], cmd[300], rsp[CTA_RES_LEN];
+	struct s_ecm_answer ea;
+	struct s_reader *rdr;
+	struct timeb start, end;
+	ECM_REQUEST *er;
+	ATR atr;
+	uint16_t lr;
+	int32_t i, n, ok = 1;
+	int64_t ecm_time = 0, t1_time = 0;
+
+	if(!cs_malloc(&er, sizeof(ECM_REQUEST)))
+		{ return; }
+	memset(ecm, 0x5A, sizeof(ecm));
+	ecm[0] = 0x81;
+	ecm[1] = 0x70;
+	ecm[2] = sizeof(ecm) - 3;
+	er->ecm = ecm;
+	er->ecmlen = sizeof(ecm);
+
+	rdr = virtual_test_open(conax_script, fname, &atr);
+	ok = rdr && reader_conax.card_init(rdr, &atr) == OK && rdr->caid == 0x0B00 && rdr->hexserial[5] == 0x55;
+	cs_ftimeus(&start);
+	for(i = 0; ok && i < VIRTUAL_TEST_ECMS; i++)
+	{
+		memset(&ea, 0, sizeof(ea));
+		ok = reader_conax.do_ecm(rdr, er, &ea) == OK && ea.cw[0] == 0x10 && ea.cw[7] == 0x17 && ea.cw[8] == 0x20 && ea.cw[15] == 0x27;
+	}
+	cs_ftimeus(&end);
+	ecm_time = comp_timebus(&end, &start);
+	virtual_test_close(&rdr, fname);
+
+	// 256 bytes answer plus status word, the card has to chain it
+	n = snprintf(script, sizeof(script), "atr = 3B 80 81 31 FE 45 8B\nbaudrate = 115200\nlatency = 5\napdu = * : 6A 82\napdu = 80 10 :");
+	for(i = 0; i < 256; i++)
+		{ n += snprintf(script + n, sizeof(script) - n, " %02X", i); }
+	snprintf(script + n, sizeof(script) - n, " 90 00\n");
+	cs_strncpy(fname, "/tmp/oscam-virtual-XXXXXX", sizeof(fname));
+	if(ok)
+		{ rdr = virtual_test_open(script, fname, &atr); }
+	ok = ok && rdr && rdr->protocol_type == ATR_PROTOCOL_TYPE_T1;
+	if(ok)
+	{
+		// 300 bytes command, the reader has to chain it
+		memset(cmd, 0, sizeof(cmd));
+		cmd[0] = 0x80;
+		cmd[1] = 0x10;
+		cs_ftimeus(&start);
+		ok = !ICC_Async_CardWrite(rdr, cmd, sizeof(cmd), rsp, &lr) && lr == 258 && rsp[255] == 0xFF && rsp[256] == 0x90;
+		cs_ftimeus(&end);
+		t1_time = comp_timebus(&end, &start);
+		// both directions on the wire at 12 bit per byte plus the card latency
+		ok = ok && t1_time >= (int64_t)(sizeof(cmd) + lr) * 12 * 1000000 / 115200 + 5000;
+		cmd[1] = 0x20;
+		ok = ok && !ICC_Async_CardWrite(rdr, cmd, 5, rsp, &lr) && lr == 2 && rsp[0] == 0x6A;
+	}
+	virtual_test_close(&rdr, fname);
+
+	printf("virtual card, conax T0 without line delay, T1 at 115200 bps\n");
+	printf(" %d ECMs, %"PRId64" us per ECM, chained T1 command %"PRId64" us\n", VIRTUAL_TEST_ECMS, ecm_time / VIRTUAL_TEST_ECMS, t1_time);
+	printf(" Testing virtual card%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+	NULLFREE(er);
+}
+#endif
+
+#ifdef MODULE_GHTTP
+#define GHTTP_TEST_REQUESTS  256
+#define GHTTP_TEST_WINDOW    24      // ecms the reader keeps waiting, below GHTTP_MAX_INFLIGHT
+#define GHTTP_TEST_RTT       2       // ms the stub server waits before answering a batch
+#define GHTTP_TEST_ECMLEN    20
+
+static int32_t ghttp_test_fd;       // listening socket of the stub server
+static int32_t ghttp_test_requests; // requests the stub server answered
+static int32_t ghttp_test_batch;    // most requests it had waiting at once
+
+// Cw the stub server answers for a hash, hashes divisible by 8 are not found
+static void ghttp_test_cw(uint32_t hash, uchar *cw)
+{
+	int32_t i;
+	for(i = 0; i < 16; i++)
+		{ cw[i] = hash >> (i % 4 * 8) ^ i; }
+	for(i = 0; i < 16; i += 4)
+		{ cw[i + 3] = cw[i] + cw[i + 1] + cw[i + 2]; }
+}
+
+// Cache hash of an ecm as the reader puts it into the request
+static uint32_t ghttp_test_hash(const uchar *ecm, int32_t len)
+{
+	uint32_t h = 0;
+	while(len--)
+		{ h = 31 * h + *ecm++; }
+	return h;
+}
+
+// Sends data in random pieces, the client has to put the responses together
+static void ghttp_test_write(int32_t fd, const uchar *data, int32_t len)
+{
+	int32_t n, done = 0;
+
+	while(done < len)
+	{
+		n = 1 + rand() % 40;
+		n = MIN(n, len - done);
+		if(send(fd, data + done, n, 0) != n)
+			{ return; }
+		done += n;
+	}
+}
+
+// Stub cache server, answers GET /api/c/80/<hash> with the cw of the hash
+static void *ghttp_test_server(void *UNUSED(arg))
+{
+	uchar buf[8192], out[16384], cw[16];
+	char *req, *end;
+	int32_t fd, len = 0, n, olen, i, batch, no_delay = 1;
+	uint32_t hash, count = 0;
+
+	if((fd = accept(ghttp_test_fd, NULL, NULL)) < 0)
+		{ return NULL; }
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&no_delay, sizeof(no_delay));
+	while((n = recv(fd, buf + len, sizeof(buf) - len - 1, 0)) > 0)
+	{
+		len += n;
+		buf[len] = '\0';
+		if(!strstr((char *)buf, "\r\n\r\n"))
+			{ continue; }
+		cs_sleepms(GHTTP_TEST_RTT);
+		for(olen = 0, batch = 0, req = (char *)buf; (end = strstr(req, "\r\n\r\n")); req = end + 4, batch++)
+		{
+			if(sscanf(req, "GET /api/c/80/%x", &hash) != 1)
+				{ hash = 0; }
+			ghttp_test_cw(hash, cw);
+			if(!(hash % 8))
+				{ olen += snprintf((char *)out + olen, sizeof(out) - olen, "HTTP/1.1 204 No Content\r\n\r\n"); }
+			else if(count++ % 2)
+			{
+				olen += snprintf((char *)out + olen, sizeof(out) - olen, "HTTP/1.1 200 OK\r\ntransfer-encoding: chunked\r\n\r\n5;x=1\r\n");
+				memcpy(out + olen, cw, 5);
+				olen += 5;
+				olen += snprintf((char *)out + olen, sizeof(out) - olen, "\r\nb\r\n");
+				memcpy(out + olen, cw + 5, 11);
+				olen += 11;
+				olen += snprintf((char *)out + olen, sizeof(out) - olen, "\r\n0\r\nX-Trailer: 1\r\n\r\n");
+			}
+			else
+			{
+				olen += snprintf((char *)out + olen, sizeof(out) - olen, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: 16\r\n\r\n");
+				memcpy(out + olen, cw, 16);
+				olen += 16;
+			}
+		}
+		ghttp_test_requests += batch;
+		if(batch > ghttp_test_batch)
+			{ ghttp_test_batch = batch; }
+		ghttp_test_write(fd, out, olen);
+		i = req - (char *)buf;
+		memmove(buf, buf + i, len - i);
+		len -= i;
+	}
+	close(fd);
+	return NULL;
+}
+
+/* Every fifth ecm repeats the one before with another md5, the reader attaches
+ * it to the pending request of the first. The answers are taken before the
+ * ecm handler, ea->is_pending keeps write_ecm_answer() from going further. */
+static int32_t ghttp_test_ecms(struct s_reader *rdr, ECM_REQUEST *er, struct s_ecm_answer *ea)
+{
+	int32_t i, j, id;
+
+	for(i = 0; i < GHTTP_TEST_REQUESTS; i++)
+	{
+		if(!(er[i].ecm = ecm_payload_alloc(GHTTP_TEST_ECMLEN)))
+			{ return 0; }
+		id = i % 5 == 4 ? i - 1 : i;
+		er[i].ecm[0] = 0x80;
+		er[i].ecm[1] = 0x70;
+		er[i].ecm[2] = GHTTP_TEST_ECMLEN - 3;
+		for(j = 3; j < GHTTP_TEST_ECMLEN; j++)
+			{ er[i].ecm[j] = id * 7 + j * (id >> 3 | 1); }
+		er[i].ecmlen = GHTTP_TEST_ECMLEN;
+		er[i].caid = 0x0500;
+		i2b_buf(4, i, er[i].ecmd5);
+		cs_ftime(&er[i].tps);
+		er[i].matching_rdr = &ea[i];
+		ea[i].reader = rdr;
+		ea[i].er = &er[i];
+		ea[i].is_pending = 1;
+		cs_lock_create(__func__, &ea[i].ecmanswer_lock, "ghttp_test_lock", 5000);
+	}
+	return 1;
+}
+
+/* Runs the ecms through the ghttp reader against the stub server with up to window
+ * ecms waiting. Returns the wall time in us, the average and worst latency go to avg and max. */
+static int64_t ghttp_test_run(int32_t window, int64_t *avg, int64_t *max, int32_t *errors)
+{
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	struct s_reader *rdr = NULL;
+	struct s_client *cl = NULL;
+	ECM_REQUEST *er = NULL;
+	struct s_ecm_answer *ea = NULL;
+	struct timeb start, now, sent[GHTTP_TEST_REQUESTS];
+	struct pollfd pfd;
+	pthread_t server;
+	uchar cw[16];
+	uint32_t hash;
+	int32_t i, n, rc, next = 0, done = 0;
+	int64_t t, total = 0, ret = -1;
+
+	*avg = *max = 0;
+	ghttp_test_requests = ghttp_test_batch = 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if((ghttp_test_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		{ return -1; }
+	if(bind(ghttp_test_fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(ghttp_test_fd, 1)
+			|| getsockname(ghttp_test_fd, (struct sockaddr *)&sa, &sa_len) || pthread_create(&server, NULL, ghttp_test_server, NULL))
+	{
+		close(ghttp_test_fd);
+		return -1;
+	}
+
+	if(!cs_malloc(&rdr, sizeof(struct s_reader)) || !cs_malloc(&cl, sizeof(struct s_client))
+			|| !cs_malloc(&er, GHTTP_TEST_REQUESTS * sizeof(ECM_REQUEST))
+			|| !cs_malloc(&ea, GHTTP_TEST_REQUESTS * sizeof(struct s_ecm_answer))
+			|| !ghttp_test_ecms(rdr, er, ea))
+		{ goto out; }
+	module_ghttp(&rdr->ph);
+	rdr->typ = R_GHTTP;
+	cs_strncpy(rdr->label, "ghttp-test", sizeof(rdr->label));
+	cs_strncpy(rdr->device, "127.0.0.1", sizeof(rdr->device));
+	rdr->r_port = ntohs(sa.sin_port);
+	rdr->client = cl;
+	cl->reader = rdr;
+	cl->typ = 'p';
+	if(!casc_ecmtask_alloc(cl) || rdr->ph.c_init(cl))
+		{ goto out; }
+
+	cs_ftimeus(&start);
+	while(done < GHTTP_TEST_REQUESTS)
+	{
+		while(next < GHTTP_TEST_REQUESTS && next - done < window)
+		{
+			cs_ftimeus(&sent[next]);
+			if(casc_process_ecm(rdr, &er[next++]))
+				{ (*errors)++; }
+		}
+		pfd.fd = cl->pfd;
+		pfd.events = POLLIN;
+		if(!cl->pfd || poll(&pfd, 1, 2000) <= 0 || (n = rdr->ph.recv(cl, NULL, 0)) <= 0)
+			{ break; }
+		rdr->ph.c_recv_chk(cl, NULL, &rc, NULL, n);
+
+		// the answers come in request order, a joined ecm together with the one it joined
+		for(; done < next && (ea[done].status & REQUEST_ANSWERED); done++)
+		{
+			hash = ghttp_test_hash(er[done].ecm + 3, GHTTP_TEST_ECMLEN - 3);
+			ghttp_test_cw(hash, cw);
+			if(hash % 8 ? ea[done].rc != E_FOUND || memcmp(ea[done].cw, cw, 16) : ea[done].rc != E_NOTFOUND)
+				{ (*errors)++; }
+			cs_ftimeus(&now);
+			t = comp_timebus(&now, &sent[done]);
+			total += t;
+			if(t > *max)
+				{ *max = t; }
+		}
+	}
+	cs_ftimeus(&now);
+	if(done == GHTTP_TEST_REQUESTS)
+		{ ret = comp_timebus(&now, &start); }
+	*avg = done ? total / done : 0;
+	network_tcp_connection_close(rdr, "test done");
+	rdr->ph.cleanup(cl);
+
+out:
+	// a server thread which never got its connection leaves accept() only this way
+	shutdown(ghttp_test_fd, SHUT_RDWR);
+	close(ghttp_test_fd);
+	pthread_join(server, NULL);
+	if(ret < 0)
+		{ (*errors)++; }
+	for(i = 0; er && i < GHTTP_TEST_REQUESTS; i++)
+	{
+		ecm_payload_put(&er[i].ecm);
+		if(ea && ea[i].reader)
+			{ cs_lock_destroy(__func__, &ea[i].ecmanswer_lock); }
+	}
+	if(cl)
+		{ free_reader_ecmtask(cl); }
+	NULLFREE(ea);
+	NULLFREE(er);
+	NULLFREE(cl);
+	NULLFREE(rdr);
+	return ret;
+}
+
+static void run_ghttp_test(void)
+{
+	static const char split[] = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nabcdHTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+	static const char chunked[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3;ext=1\r\nabc\r\n0A\r\n0123456789\r\n0\r\nX: y\r\n\r\n";
+	static const char broken[] = "HTTP/1.1 200 OK\r\nContent-Length: -5\r\n\r\n";
+	struct s_ghttp_resp resp;
+	uchar buf[256];
+	int64_t single, single_avg, single_max, piped, piped_avg, piped_max;
+	int32_t i, ok = 1, errors = 0, single_requests;
+	int32_t saved_pending = cfg.max_pending, saved_ctimeout = cfg.ctimeout;
+
+	// a response fed byte by byte is complete only with its last byte
+	memcpy(buf, split, sizeof(split) - 1);
+	for(i = 1; i < 42; i++)
+		{ ok = ok && ghttp_parse_response(buf, i, &resp) == 0; }
+	ok = ok && ghttp_parse_response(buf, sizeof(split) - 1, &resp) == 1 && resp.status == 200 && resp.consumed == 42;
+	ok = ok && resp.body_len == 4 && !memcmp(buf + resp.hdr_len, "abcd", 4) && !resp.close;
+	ok = ok && ghttp_parse_response(buf + 42, sizeof(split) - 43, &resp) == 1 && resp.status == 204 && !resp.body_len && resp.close;
+
+	memcpy(buf, chunked, sizeof(chunked) - 1);
+	ok = ok && ghttp_parse_response(buf, sizeof(chunked) - 2, &resp) == 0;
+	ok = ok && ghttp_parse_response(buf, sizeof(chunked) - 1, &resp) == 1 && resp.consumed == (int32_t)sizeof(chunked) - 1;
+	ok = ok && resp.body_len == 13 && !memcmp(buf + resp.hdr_len, "abc0123456789", 13);
+
+	memcpy(buf, broken, sizeof(broken) - 1);
+	ok = ok && ghttp_parse_response(buf, sizeof(broken) - 1, &resp) == -1;
+	ok = ok && ghttp_parse_response((uchar *)"SSH-2.0-OpenSSH\r\n\r\n", 19, &resp) == -1;
+	// a NUL byte in a header line ends no line early, the response is refused
+	memcpy(buf, "HTTP/1.1 200 OK\r\nX-A: \0\r\nContent-Length: 0\r\n\r\n", 46);
+	ok = ok && ghttp_parse_response(buf, 46, &resp) == -1;
+	memcpy(buf, "HTTP/1.1 200 \0K\r\n\r\n", 19);
+	ok = ok && ghttp_parse_response(buf, 19, &resp) == -1;
+
+	// the reader needs its pending table and has to take answers for a while
+	cfg.max_pending = 2 * GHTTP_TEST_WINDOW;
+	cfg.ctimeout = 10000;
+	srand(4711);
+	single = ghttp_test_run(1, &single_avg, &single_max, &errors);
+	single_requests = ghttp_test_requests;
+	piped = ghttp_test_run(GHTTP_TEST_WINDOW, &piped_avg, &piped_max, &errors);
+	cfg.max_pending = saved_pending;
+	cfg.ctimeout = saved_ctimeout;
+	// one at a time every ecm goes out on its own, in flight the repeats join their first
+	ok = ok && !errors && single > 0 && piped > 0 && piped < single;
+	ok = ok && single_requests == GHTTP_TEST_REQUESTS && ghttp_test_requests < GHTTP_TEST_REQUESTS && ghttp_test_batch > 1;
+
+	printf("ghttp reader against a stub cache, %d ecms, %d ms per round trip\n", GHTTP_TEST_REQUESTS, GHTTP_TEST_RTT);
+	printf(" one at a time %"PRId64" ecm/s (avg %"PRId64" us, max %"PRId64" us), %d waiting %"PRId64" ecm/s (avg %"PRId64" us, max %"PRId64" us)\n",
+			single > 0 ? (int64_t)GHTTP_TEST_REQUESTS * 1000000 / single : 0, single_avg, single_max,
+			GHTTP_TEST_WINDOW, piped > 0 ? (int64_t)GHTTP_TEST_REQUESTS * 1000000 / piped : 0, piped_avg, piped_max);
+	printf(" %d requests for %d ecms, up to %d pipelined\n", ghttp_test_requests, GHTTP_TEST_REQUESTS, ghttp_test_batch);
+	printf(" Testing ghttp pipeline%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+}
+#endif
+
+#if defined(READER_CRYPTOWORKS) && defined(READER_VIACCESS)
+#define RASS_TEST_ROUNDS   20000
+#define RASS_TEST_CLIENTS  80      // more than the part pool holds
+#define RASS_TEST_LATER    600     // s, the parts expired but the used ones are remembered
+
+/* A recorded stream in the layout of the saved EMM logs: caid, provid and the
+ * section. Every shared part comes twice, like the carousel sends it. */
+static const char *rass_test_stream[] =
+{
+	"0D00 000000 84700C11223344556677880C8301AA",          // cryptoworks EMM-SH
+	"0D00 000000 84700C11223344556677880C8301AA",
+	"0D00 000000 86700B000042030102030102BBCC",            // EMM-SB
+	"0D00 000000 86700B000042030102030102BBCC",            // again, the EMM-SH is used up
+	"0D00 000000 82700A112233445566A0020102",              // EMM-U
+	"0500 032410 8C700A9003032410E203010203",              // viaccess EMM-GH
+	"0500 032410 8C700A9003032410E203010203",
+	"0500 032410 8E700B112233009E02AABBF001CC",            // EMM-S
+	"0500 032410 88700B11223344A0050102030405",            // EMM-U
+	NULL
+};
+
+// EMM-GH of another provider and an EMM-S with no provid in the packet
+static const char rass_test_via_other[] = "0500 032920 8C700A9003032920E203010203";
+static const char rass_test_via_noprov[] = "0500 000000 8E700B112233009E02AABBF001CC";
+
+static const char rass_test_cw_assembled[] = "84701511223344556677880C0102BBCC42030102038301AA";
+static const char rass_test_via_assembled[] = "8E70151122330090030324109E02AABBE203010203F001CC";
+
+static int32_t rass_test_hex(const char *hex, uchar *buf, int32_t max)
+{
+	char tmp[2 * MAX_EMM_SIZE + 1];
+	int32_t i, n = 0;
+
+	for(i = 0; hex[i] && n < (int32_t)sizeof(tmp) - 1; i++)
+	{
+		if(hex[i] != ' ')
+			{ tmp[n++] = hex[i]; }
+	}
+	tmp[n] = '\0';
+	if(n / 2 > max || cs_atob(buf, tmp, n / 2) < 0)
+		{ return -1; }
+	return n / 2;
+}
+
+// Parses a line of the recorded stream into ep, returns 0 for a broken line
+static int32_t rass_test_packet(const char *line, EMM_PACKET *ep)
+{
+	uint32_t caid, provid;
+	int32_t pos = 0;
+
+	memset(ep, 0, sizeof(EMM_PACKET));
+	if(sscanf(line, "%4x %6x %n", &caid, &provid, &pos) != 2 || !pos)
+		{ return 0; }
+	i2b_buf(2, caid, ep->caid);
+	i2b_buf(4, provid, ep->provid);
+	ep->emmlen = rass_test_hex(line + pos, ep->emm, sizeof(ep->emm));
+	return ep->emmlen > 0;
+}
+
+static void run_emm_reassembly_test(void)
+{
+	EMM_PACKET *ep;
+	struct s_client *cl;
+	struct s_reader *rdr;
+	struct timeb start, end;
+	uchar want[MAX_EMM_SIZE];
+	int32_t i, j, n, ok = 1, forwarded = 0, assembled = 0, sections = 0;
+	int64_t replay;
+	time_t now = time(NULL);
+
+	if(!cs_malloc(&ep, sizeof(EMM_PACKET)) || !cs_malloc(&cl, RASS_TEST_CLIENTS * sizeof(struct s_client))
+			|| !cs_malloc(&rdr, sizeof(struct s_reader)))
+	{
+		NULLFREE(cl);
+		NULLFREE(ep);
+		return;
+	}
+
+	// one pass checks every answer of the engine
+	for(i = 0; rass_test_stream[i]; i++)
+	{
+		ok = ok && rass_test_packet(rass_test_stream[i], ep);
+		n = emm_reassemble_at(&cl[0], ep, now);
+		switch(i)
+		{
+		case 2:
+			j = rass_test_hex(rass_test_cw_assembled, want, sizeof(want));
+			ok = ok && n == 1 && ep->emmlen == j && !memcmp(ep->emm, want, j);
+			break;
+		case 7:
+			j = rass_test_hex(rass_test_via_assembled, want, sizeof(want));
+			ok = ok && n == 1 && ep->emmlen == j && !memcmp(ep->emm, want, j);
+			break;
+		case 4:
+		case 8:
+			ok = ok && n == 1;
+			break;
+		default:
+			ok = ok && n == 0;
+			break;
+		}
+	}
+
+	// the carousel repeats the used parts after the parts expired, the EMMs must not come again
+	for(i = 0; rass_test_stream[i]; i++)
+	{
+		rass_test_packet(rass_test_stream[i], ep);
+		n = emm_reassemble_at(&cl[0], ep, now + RASS_TEST_LATER);
+		ok = ok && n == (ep->emm[0] == 0x82 || ep->emm[0] == 0x88);
+	}
+
+	// without a provid the shared address of a local au reader gives the provider,
+	// the later EMM-GH of another provider is not taken
+	rdr->typ = R_MOUSE;
+	rdr->nprov = 1;
+	memcpy(rdr->sa[0], "\x11\x22\x33", 3);
+	i2b_buf(4, 0x032410, rdr->prid[0]);
+	cl[1].aureader_list = ll_create("rass_test_aureaders");
+	ll_append(cl[1].aureader_list, rdr);
+	rass_test_packet(rass_test_stream[5], ep);
+	ok = ok && !emm_reassemble_at(&cl[1], ep, now);
+	rass_test_packet(rass_test_via_other, ep);
+	ok = ok && !emm_reassemble_at(&cl[1], ep, now);
+	rass_test_packet(rass_test_via_noprov, ep);
+	j = rass_test_hex(rass_test_via_assembled, want, sizeof(want));
+	ok = ok && emm_reassemble_at(&cl[1], ep, now) == 1 && ep->emmlen == j && !memcmp(ep->emm, want, j);
+	rass_test_packet(rass_test_via_noprov, ep);
+	ok = ok && !emm_reassemble_at(&cl[1], ep, now);
+	ll_destroy(&cl[1].aureader_list);
+	emm_reassembly_client_free(&cl[1]);
+
+	// the pool is bounded, the parts of the first clients get dropped
+	emm_reassembly_client_free(&cl[0]);
+	for(i = 0; i < RASS_TEST_CLIENTS; i++)
+	{
+		rass_test_packet(rass_test_stream[0], ep);
+		emm_reassemble(&cl[i], ep);
+	}
+	rass_test_packet(rass_test_stream[2], ep);
+	ok = ok && !emm_reassemble(&cl[0], ep);
+	rass_test_packet(rass_test_stream[2], ep);
+	ok = ok && emm_reassemble(&cl[RASS_TEST_CLIENTS - 1], ep) == 1;
+	for(i = 0; i < RASS_TEST_CLIENTS; i++)
+		{ emm_reassembly_client_free(&cl[i]); }
+
+	// replay, the parts of a round differ from all before so every round assembles
+	cs_ftimeus(&start);
+	for(j = 0; j < RASS_TEST_ROUNDS; j++)
+	{
+		for(i = 0; rass_test_stream[i]; i++)
+		{
+			rass_test_packet(rass_test_stream[i], ep);
+			if(ep->emm[0] == 0x84 || ep->emm[0] == 0x8C)
+			{
+				ep->emm[ep->emmlen - 1] = j;
+				ep->emm[ep->emm[0] == 0x84 ? 3 : ep->emmlen - 2] = j >> 8;
+			}
+			n = emm_reassemble(&cl[j % 8], ep);
+			forwarded += n;
+			assembled += n && (ep->emm[0] == 0x84 || ep->emm[0] == 0x8E);
+			sections++;
+		}
+	}
+	cs_ftimeus(&end);
+	replay = comp_timebus(&end, &start);
+	for(i = 0; i < 8; i++)
+		{ emm_reassembly_client_free(&cl[i]); }
+	ok = ok && assembled == 2 * RASS_TEST_ROUNDS && forwarded == 4 * RASS_TEST_ROUNDS;
+
+	printf("EMM reassembly, cryptoworks and viaccess parts of 8 clients\n");
+	printf(" %d sections replayed in %"PRId64" us, %"PRId64" ns per section (parsing included), %d assembled\n",
+			sections, replay, replay * 1000 / (sections ? sections : 1), assembled);
+	printf(" Testing EMM reassembly%s\n", ok ? " [OK]" : "\n === ERROR ===\n");
+	fflush(stdout);
+	NULLFREE(rdr);
+	NULLFREE(cl);
+	NULLFREE(ep);
+}
+#endif
+
 void run_all_tests(void)
 {
 	ECM_WHITELIST ecm_whitelist, ecm_whitelist_c;
@@ -314,4 +2099,30 @@ void run_all_tests(void)
 		},
 	};
 	run_parser_test(&caidtab_test);
+
+	run_sidtab_tests();
+	run_name_index_tests();
+	run_resolve_benchmark();
+	run_ratelimit_benchmark();
+	run_writer_rename_test();
+#ifdef CS_ANTICASC
+	run_anticasc_replay();
+#endif
+#ifdef HAVE_DVBAPI
+	run_chancache_test();
+#endif
+#if defined(CARDREADER_VIRTUAL) && defined(READER_CONAX)
+	run_virtual_card_test();
+#endif
+#ifdef MODULE_GHTTP
+	run_ghttp_test();
+#endif
+#if defined(READER_CRYPTOWORKS) && defined(READER_VIACCESS)
+	run_emm_reassembly_test();
+#endif
+
+#if defined(READER_CONAX) || defined(READER_CRYPTOWORKS) || defined(READER_NAGRA)
+	run_bn_tests();
+	run_bn_benchmark();
+#endif
 }
@@ -0,0 +1,565 @@
+/*
+ * dvbapi_load - replays recorded dvbapi client traffic from many simulated
+ * boxes against the dvbapi network server (dvbapi listen_port) to measure how
+ * many boxes one OSCam instance can serve.
+ *
+ * The capture is the raw byte stream one box sent to OSCam (for example
+ * recorded with "socat -r capture TCP-LISTEN:... TCP:oscam:..."). Every box
+ * sends its own CLIENT_INFO and then the CA_PMT objects of the capture. The
+ * FILTER_DATA sections of the capture are kept and each interval every box
+ * sends the next recorded section matching each section filter OSCam has
+ * started for it, so ECMs keep flowing like on a real receiver.
+ *
+ * Build with "make dvbapi_load".
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define DVBAPI_PROTOCOL_VERSION   2
+
+#define DVBAPI_CA_SET_PID         0x40086f87
+#define DVBAPI_CA_SET_DESCR       0x40106f86
+#define DVBAPI_CA_SET_DESCR_MODE  0x400c6f88
+#define DVBAPI_DMX_SET_FILTER     0x403c6f2b
+#define DVBAPI_DMX_STOP           0x00006f2a
+#define DVBAPI_AOT_CA             0x9F803000
+#define DVBAPI_AOT_CA_PMT         0x9F803200
+#define DVBAPI_FILTER_DATA        0xFFFF0000
+#define DVBAPI_CLIENT_INFO        0xFFFF0001
+#define DVBAPI_SERVER_INFO        0xFFFF0002
+#define DVBAPI_ECM_INFO           0xFFFF0003
+
+#define MAX_BOX_FILTERS 64
+#define RX_BUF_SIZE     4096
+
+struct msg
+{
+	uint8_t *data;
+	int32_t len;
+};
+
+struct filter
+{
+	int8_t active;
+	uint8_t demux_id, filter_num;
+	uint16_t pid;
+	uint8_t filter[16], mask[16];
+	int32_t next;               // next section to try
+};
+
+struct box
+{
+	int32_t fd;
+	int8_t connected;
+	uint8_t rx[RX_BUF_SIZE];
+	int32_t rx_len;
+	struct filter filters[MAX_BOX_FILTERS];
+	int64_t ecm_sent;           // time the last ecm section was sent, 0 if answered
+};
+
+struct stats
+{
+	uint64_t sections, filters_set, filters_stopped, cws, ecm_info;
+	uint64_t latency_sum, latency_count, latency_max;
+};
+
+static struct msg *pmts, *sections;
+static int32_t pmt_count, section_count;
+static struct stats stat_now, stat_total;
+static volatile int32_t stop;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t b2i4(const uint8_t *b)
+{
+	return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int32_t add_msg(struct msg **list, int32_t *count, const uint8_t *data, int32_t len)
+{
+	struct msg *tmp = realloc(*list, (*count + 1) * sizeof(struct msg));
+	if(!tmp)
+		{ return 0; }
+	*list = tmp;
+	if(!(tmp[*count].data = malloc(len)))
+		{ return 0; }
+	memcpy(tmp[*count].data, data, len);
+	tmp[*count].len = len;
+	(*count)++;
+	return 1;
+}
+
+/* Splits the capture into messages the same way module-dvbapi.c does. */
+static int32_t load_capture(const char *file)
+{
+	FILE *f = fopen(file, "rb");
+	uint8_t *buf;
+	long size;
+	int32_t pos = 0, len, k, n;
+
+	if(!f)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", file, strerror(errno));
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if(size <= 0 || !(buf = malloc(size)) || fread(buf, 1, size, f) != (size_t)size)
+	{
+		fprintf(stderr, "cannot read %s\n", file);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+
+	while(pos + 4 <= size)
+	{
+		uint32_t opcode = b2i4(buf + pos);
+
+		if((opcode & 0xFFFFF000) == DVBAPI_AOT_CA)
+		{
+			uint32_t data_len = buf[pos + 3] & 0x7F;
+			n = 0;
+			if(buf[pos + 3] & 0x80)
+			{
+				n = data_len;
+				for(data_len = 0, k = 0; k < n && pos + 4 + k < size; k++)
+					{ data_len = (data_len << 8) | buf[pos + 4 + k]; }
+			}
+			len = 4 + n + data_len;
+			if((opcode & 0xFFFFFF00) == DVBAPI_AOT_CA_PMT && pos + len <= size)
+				{ add_msg(&pmts, &pmt_count, buf + pos, len); }
+		}
+		else if(opcode == DVBAPI_FILTER_DATA && pos + 9 <= size)
+		{
+			len = 9 + (((buf[pos + 7] << 8) | buf[pos + 8]) & 0x0FFF);
+			if(pos + len <= size)
+				{ add_msg(&sections, &section_count, buf + pos + 6, len - 6); }
+		}
+		else if(opcode == DVBAPI_CLIENT_INFO && pos + 7 <= size)
+		{
+			len = 7 + buf[pos + 6];
+		}
+		else
+		{
+			fprintf(stderr, "unknown opcode %08X at offset %d of %s\n", opcode, pos, file);
+			break;
+		}
+		pos += len;
+	}
+	free(buf);
+
+	printf("capture: %d CA_PMT objects, %d sections\n", pmt_count, section_count);
+	return pmt_count > 0;
+}
+
+static int32_t box_send(struct box *b, const uint8_t *data, int32_t len)
+{
+	while(len > 0)
+	{
+		ssize_t r = send(b->fd, data, len, MSG_NOSIGNAL);
+		if(r < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			struct pollfd pfd = { b->fd, POLLOUT, 0 };
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if(r <= 0)
+			{ return 0; }
+		data += r;
+		len -= r;
+	}
+	return 1;
+}
+
+static void box_close(struct box *b)
+{
+	if(b->fd >= 0)
+		{ close(b->fd); }
+	b->fd = -1;
+	b->connected = 0;
+}
+
+static int32_t box_connect(struct box *b, struct addrinfo *ai, int32_t id)
+{
+	uint8_t info[64];
+	int32_t i, one = 1, len;
+
+	memset(b, 0, sizeof(struct box));
+	if((b->fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+		{ return 0; }
+	if(connect(b->fd, ai->ai_addr, ai->ai_addrlen) < 0)
+	{
+		box_close(b);
+		return 0;
+	}
+	setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(b->fd, F_SETFL, fcntl(b->fd, F_GETFL) | O_NONBLOCK);
+	b->connected = 1;
+
+	info[0] = 0xFF;
+	info[1] = 0xFF;
+	info[2] = 0x00;
+	info[3] = 0x01;
+	info[4] = DVBAPI_PROTOCOL_VERSION >> 8;
+	info[5] = DVBAPI_PROTOCOL_VERSION & 0xFF;
+	len = snprintf((char *)info + 7, sizeof(info) - 7, "dvbapi_load box %d", id);
+	info[6] = len;
+	if(!box_send(b, info, 7 + len))
+		{ return 0; }
+
+	for(i = 0; i < pmt_count; i++)
+	{
+		if(!box_send(b, pmts[i].data, pmts[i].len))
+			{ return 0; }
+	}
+	return 1;
+}
+
+/* Section filters compare filter byte 0 with table id and the others with the
+ * bytes after the section length. */
+static int32_t filter_match(const struct filter *f, const struct msg *sec)
+{
+	int32_t k;
+	uint8_t b;
+
+	for(k = 0; k < 16; k++)
+	{
+		if(!f->mask[k])
+			{ continue; }
+		if(k == 0)
+			{ b = sec->data[0]; }
+		else if(k + 2 < sec->len)
+			{ b = sec->data[k + 2]; }
+		else
+			{ return 0; }
+		if((b ^ f->filter[k]) & f->mask[k])
+			{ return 0; }
+	}
+	return 1;
+}
+
+static void box_feed_filters(struct box *b, int64_t now)
+{
+	uint8_t pkt[6 + 4096];
+	int32_t i, k, s;
+
+	for(i = 0; i < MAX_BOX_FILTERS; i++)
+	{
+		struct filter *f = &b->filters[i];
+		if(!f->active)
+			{ continue; }
+		for(k = 0; k < section_count; k++)
+		{
+			s = (f->next + k) % section_count;
+			if(sections[s].len > 4096 || !filter_match(f, &sections[s]))
+				{ continue; }
+
+			pkt[0] = 0xFF;
+			pkt[1] = 0xFF;
+			pkt[2] = 0x00;
+			pkt[3] = 0x00;
+			pkt[4] = f->demux_id;
+			pkt[5] = f->filter_num;
+			memcpy(pkt + 6, sections[s].data, sections[s].len);
+			if(!box_send(b, pkt, 6 + sections[s].len))
+			{
+				box_close(b);
+				return;
+			}
+			stat_now.sections++;
+			if((sections[s].data[0] & 0xFE) == 0x80 && !b->ecm_sent)
+				{ b->ecm_sent = now; }
+			f->next = s + 1;
+			break;
+		}
+	}
+}
+
+static struct filter *box_find_filter(struct box *b, uint8_t demux_id, uint8_t filter_num, int8_t add)
+{
+	struct filter *free_slot = NULL;
+	int32_t i;
+
+	for(i = 0; i < MAX_BOX_FILTERS; i++)
+	{
+		struct filter *f = &b->filters[i];
+		if(f->active && f->demux_id == demux_id && f->filter_num == filter_num)
+			{ return f; }
+		if(!f->active && !free_slot)
+			{ free_slot = f; }
+	}
+	return add ? free_slot : NULL;
+}
+
+/* Returns the size of the server message at data, 0 if incomplete, -1 if unknown. */
+static int32_t server_msg_size(const uint8_t *data, int32_t len)
+{
+	int32_t pos, k;
+
+	if(len < 5)
+		{ return 0; }
+	switch(b2i4(data))
+	{
+		case DVBAPI_SERVER_INFO:
+			if(len < 7)
+				{ return 0; }
+			return 7 + data[6];
+		case DVBAPI_DMX_SET_FILTER:
+			return 5 + 60;
+		case DVBAPI_DMX_STOP:
+			return 5 + 4;
+		case DVBAPI_CA_SET_PID:
+			return 5 + 8;
+		case DVBAPI_CA_SET_DESCR:
+			return 5 + 16;
+		case DVBAPI_CA_SET_DESCR_MODE:
+			return 5 + 12;
+		case DVBAPI_ECM_INFO:
+			// sid, caid, pid, provid, ecm time, 4 strings and hops
+			pos = 5 + 14;
+			for(k = 0; k < 4; k++)
+			{
+				if(pos >= len)
+					{ return 0; }
+				pos += 1 + data[pos];
+			}
+			return pos + 1;
+		default:
+			return -1;
+	}
+}
+
+static void box_handle_msg(struct box *b, const uint8_t *data, int64_t now)
+{
+	struct filter *f;
+
+	switch(b2i4(data))
+	{
+		case DVBAPI_DMX_SET_FILTER:
+			if((f = box_find_filter(b, data[5], data[6], 1)))
+			{
+				f->active = 1;
+				f->demux_id = data[5];
+				f->filter_num = data[6];
+				f->pid = (data[7] << 8) | data[8];
+				memcpy(f->filter, data + 9, 16);
+				memcpy(f->mask, data + 25, 16);
+			}
+			stat_now.filters_set++;
+			break;
+		case DVBAPI_DMX_STOP:
+			if((f = box_find_filter(b, data[5], data[6], 0)))
+				{ f->active = 0; }
+			stat_now.filters_stopped++;
+			break;
+		case DVBAPI_CA_SET_DESCR:
+			stat_now.cws++;
+			if(b->ecm_sent)
+			{
+				uint64_t ms = now - b->ecm_sent;
+				stat_now.latency_sum += ms;
+				stat_now.latency_count++;
+				if(ms > stat_now.latency_max)
+					{ stat_now.latency_max = ms; }
+				b->ecm_sent = 0;
+			}
+			break;
+		case DVBAPI_ECM_INFO:
+			stat_now.ecm_info++;
+			break;
+	}
+}
+
+static void box_read(struct box *b, int64_t now)
+{
+	ssize_t r;
+	int32_t pos = 0, size;
+
+	r = recv(b->fd, b->rx + b->rx_len, sizeof(b->rx) - b->rx_len, 0);
+	if(r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		box_close(b);
+		return;
+	}
+	if(r < 0)
+		{ return; }
+	b->rx_len += r;
+
+	while((size = server_msg_size(b->rx + pos, b->rx_len - pos)) > 0 && pos + size <= b->rx_len)
+	{
+		box_handle_msg(b, b->rx + pos, now);
+		pos += size;
+	}
+	if(size < 0)
+	{
+		fprintf(stderr, "unknown server message %08X, closing box\n", b2i4(b->rx + pos));
+		box_close(b);
+		return;
+	}
+	memmove(b->rx, b->rx + pos, b->rx_len - pos);
+	b->rx_len -= pos;
+}
+
+static void add_stats(struct stats *to, const struct stats *from)
+{
+	to->sections += from->sections;
+	to->filters_set += from->filters_set;
+	to->filters_stopped += from->filters_stopped;
+	to->cws += from->cws;
+	to->ecm_info += from->ecm_info;
+	to->latency_sum += from->latency_sum;
+	to->latency_count += from->latency_count;
+	if(from->latency_max > to->latency_max)
+		{ to->latency_max = from->latency_max; }
+}
+
+static void print_stats(const char *prefix, const struct stats *s, int32_t connected, int32_t boxes, int32_t filters, double secs)
+{
+	printf("%s boxes %d/%d filters %d sections/s %.0f cw/s %.1f ecm latency avg %.0f ms max %llu ms\n",
+		   prefix, connected, boxes, filters, s->sections / secs, s->cws / secs,
+		   s->latency_count ? (double)s->latency_sum / s->latency_count : 0.0, (unsigned long long)s->latency_max);
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-n boxes] [-t seconds] [-i interval_ms] capture\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = "127.0.0.1", *port = "9000";
+	int32_t boxes = 10, seconds = 60, interval = 500, opt, i, k, connected, filters;
+	struct addrinfo hints, *ai;
+	struct pollfd *pfd;
+	struct box *box;
+	int64_t start, last_feed, last_stats, now;
+
+	while((opt = getopt(argc, argv, "h:p:n:t:i:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'h': host = optarg; break;
+			case 'p': port = optarg; break;
+			case 'n': boxes = atoi(optarg); break;
+			case 't': seconds = atoi(optarg); break;
+			case 'i': interval = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(optind >= argc || boxes < 1 || interval < 1)
+		{ usage(argv[0]); }
+	if(!load_capture(argv[optind]))
+		{ return 1; }
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port, &hints, &ai))
+	{
+		fprintf(stderr, "cannot resolve %s:%s\n", host, port);
+		return 1;
+	}
+
+	box = calloc(boxes, sizeof(struct box));
+	pfd = calloc(boxes, sizeof(struct pollfd));
+	if(!box || !pfd)
+		{ return 1; }
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	for(i = 0; i < boxes; i++)
+	{
+		if(!box_connect(&box[i], ai, i))
+			{ fprintf(stderr, "box %d: cannot connect to %s:%s (%s)\n", i, host, port, strerror(errno)); }
+	}
+	freeaddrinfo(ai);
+
+	start = last_feed = last_stats = now_ms();
+	while(!stop && now_ms() - start < seconds * 1000LL)
+	{
+		for(i = 0; i < boxes; i++)
+		{
+			pfd[i].fd = box[i].fd;
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+		if(poll(pfd, boxes, 50) < 0 && errno != EINTR)
+			{ break; }
+
+		now = now_ms();
+		for(i = 0; i < boxes; i++)
+		{
+			if(pfd[i].revents && box[i].connected)
+				{ box_read(&box[i], now); }
+		}
+
+		if(now - last_feed >= interval)
+		{
+			for(i = 0; i < boxes; i++)
+			{
+				if(box[i].connected)
+					{ box_feed_filters(&box[i], now); }
+			}
+			last_feed = now;
+		}
+
+		if(now - last_stats >= 1000)
+		{
+			for(i = connected = filters = 0; i < boxes; i++)
+			{
+				connected += box[i].connected;
+				for(k = 0; k < MAX_BOX_FILTERS; k++)
+					{ filters += box[i].filters[k].active; }
+			}
+			print_stats("", &stat_now, connected, boxes, filters, (now - last_stats) / 1000.0);
+			add_stats(&stat_total, &stat_now);
+			memset(&stat_now, 0, sizeof(stat_now));
+			last_stats = now;
+		}
+	}
+
+	add_stats(&stat_total, &stat_now);
+	for(i = connected = filters = 0; i < boxes; i++)
+	{
+		connected += box[i].connected;
+		for(k = 0; k < MAX_BOX_FILTERS; k++)
+			{ filters += box[i].filters[k].active; }
+		box_close(&box[i]);
+	}
+	print_stats("total:", &stat_total, connected, boxes, filters, (now_ms() - start) / 1000.0);
+	printf("total: filters set %llu stopped %llu, ecm info %llu\n", (unsigned long long)stat_total.filters_set,
+		   (unsigned long long)stat_total.filters_stopped, (unsigned long long)stat_total.ecm_info);
+
+	free(box);
+	free(pfd);
+	return 0;
+}